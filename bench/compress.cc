@@ -0,0 +1,205 @@
+/*
+ * compress.cc - Benchmark for the compressors of the tar image backend
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "image/backends/basic.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+
+bool pretty = false;
+
+/*! A small, fast generator, so that every run builds the same tree. */
+class Random {
+    std::uint64_t _state;
+public:
+    explicit Random(std::uint64_t seed) : _state{seed} {}
+    std::uint64_t next() {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return _state;
+    }
+};
+
+static const char *words[] = {
+    "the", "system", "service", "package", "config", "default", "enable",
+    "network", "interface", "option", "value", "file", "directory", "user",
+    "group", "install", "library", "version", "license", "support", "#",
+    "=", "true", "false", "/usr/lib", "/etc", "0", "1", "\n", "\n\t"
+};
+
+/*! Write +size+ bytes of text, like configuration files and manuals. */
+static void write_text(const std::string &path, std::size_t size,
+                       Random &rng) {
+    std::string data;
+    while(data.size() < size) {
+        data += words[rng.next() % (sizeof words / sizeof *words)];
+        data += ' ';
+    }
+    data.resize(size);
+    std::ofstream(path, std::ios_base::binary) << data;
+}
+
+/*! Write +size+ bytes that compress like executables: runs of data that
+ * repeats earlier parts of the file, among data that does not. */
+static void write_binary(const std::string &path, std::size_t size,
+                         Random &rng) {
+    std::string data;
+    data.reserve(size);
+    while(data.size() < size) {
+        const std::uint64_t choice = rng.next();
+        if(data.size() >= 4096 && choice % 4 != 0) {
+            const std::size_t from = choice % (data.size() - 64);
+            data.append(data, from, 64);
+        } else {
+            for(int word = 0; word < 8; word++) {
+                const std::uint64_t bits = rng.next();
+                data.append(reinterpret_cast<const char *>(&bits),
+                            sizeof bits);
+            }
+        }
+    }
+    data.resize(size);
+    std::ofstream(path, std::ios_base::binary) << data;
+}
+
+/*! Build a tree of at least +size+ bytes under +root+, shaped like a root
+ * file system: many small text files, fewer large programs and libraries,
+ * and symbolic links to the libraries.
+ * @returns The number of bytes in the files of the tree.
+ */
+static std::uint64_t generate(const std::string &root, std::uint64_t size) {
+    Random rng(0x9e3779b97f4a7c15ull);
+    error_code ec;
+    std::uint64_t written = 0;
+    for(const char *dir : {"/etc", "/usr/bin", "/usr/lib", "/usr/share/doc"}) {
+        fs::create_directories(root + dir, ec);
+    }
+
+    for(unsigned long file = 0; written < size; file++) {
+        const std::string num = std::to_string(file);
+        std::size_t length;
+        switch(file % 8) {
+        case 0:
+            length = 16384 + rng.next() % 262144;
+            write_binary(root + "/usr/bin/prog-" + num, length, rng);
+            break;
+        case 1:
+            length = 32768 + rng.next() % 524288;
+            write_binary(root + "/usr/lib/lib" + num + ".so.1", length, rng);
+            fs::create_symlink("lib" + num + ".so.1",
+                               root + "/usr/lib/lib" + num + ".so", ec);
+            break;
+        case 2:
+        case 3:
+            length = 256 + rng.next() % 4096;
+            write_text(root + "/etc/conf-" + num + ".conf", length, rng);
+            break;
+        default:
+            fs::create_directories(root + "/usr/share/doc/pkg-" + num, ec);
+            length = 1024 + rng.next() % 32768;
+            write_text(root + "/usr/share/doc/pkg-" + num + "/README",
+                       length, rng);
+            break;
+        }
+        written += length;
+    }
+    return written;
+}
+
+
+int main(int argc, char *argv[]) {
+    std::uint64_t megs = 64;
+    std::map<std::string, std::string> opts;
+    bool usage = false;
+
+    /* Options of the form key=value are passed to every backend. */
+    int arg = 1;
+    if(argc > arg && std::string(argv[arg]).find('=') == std::string::npos) {
+        megs = std::strtoull(argv[arg++], nullptr, 10);
+    }
+    for(; arg < argc; arg++) {
+        const std::string opt(argv[arg]);
+        const std::string::size_type equals = opt.find('=');
+        if(equals == std::string::npos) {
+            usage = true;
+            break;
+        }
+        opts[opt.substr(0, equals)] = opt.substr(equals + 1);
+    }
+    if(megs == 0 || usage) {
+        std::cerr << "usage: " << argv[0]
+                  << " [megabytes] [level=N] [threads=N]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    char dir[] = "/tmp/hscript-bench-compress-XXXXXX";
+    if(mkdtemp(dir) == nullptr) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    const std::string ir_dir(dir);
+    const std::uint64_t bytes = generate(ir_dir + "/target", megs * 1048576);
+    std::printf("tree: %llu bytes", static_cast<unsigned long long>(bytes));
+    for(const auto &opt : opts) {
+        std::printf(" %s=%s", opt.first.c_str(), opt.second.c_str());
+    }
+    std::printf("\n");
+
+    using namespace Horizon::Image;
+    int result = EXIT_SUCCESS;
+    for(const std::string type : {"tar", "tgz", "tbz", "txz", "tzst"}) {
+        const std::string out(ir_dir + "/image." + type);
+        std::unique_ptr<BasicBackend> backend;
+        for(const auto &candidate : BackendManager::available_backends()) {
+            if(candidate.type_code == type) {
+                backend.reset(candidate.creation_fn(ir_dir, out, opts));
+            }
+        }
+        if(!backend) {
+            std::printf("%-6s not available\n", type.c_str());
+            continue;
+        }
+
+        using namespace std::chrono;
+        const auto start = steady_clock::now();
+        const bool created = backend->prepare() == 0 &&
+                             backend->create() == 0 &&
+                             backend->finalise() == 0;
+        const double secs = duration<double>(steady_clock::now() -
+                                             start).count();
+        error_code ec;
+        const std::uintmax_t size = fs::file_size(out, ec);
+        if(!created || ec || size == 0) {
+            std::printf("%-6s failed\n", type.c_str());
+            result = EXIT_FAILURE;
+            continue;
+        }
+        std::printf("%-6s %10.3f s %10.1f MiB/s %14ju bytes %8.2f:1\n",
+                    type.c_str(), secs, bytes / secs / 1048576.0, size,
+                    static_cast<double>(bytes) / size);
+        fs::remove(out, ec);
+    }
+
+    error_code ec;
+    fs::remove_all(ir_dir, ec);
+    return result;
+}
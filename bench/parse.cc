@@ -0,0 +1,393 @@
+/*
+ * parse.cc - Benchmark for the HorizonScript parser
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include "hscript/script.hh"
+#include "hscript/script_k.hh"
+#include "hscript/script_t.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+
+bool pretty = false;
+
+/*! The number of allocations made by the benchmark. */
+static unsigned long allocs = 0;
+/*! The number of bytes allocated by the benchmark. */
+static unsigned long alloc_bytes = 0;
+
+void *operator new(std::size_t size) {
+    allocs++;
+    alloc_bytes += size;
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+/*! A typical installfile, as a fleet validation service would see it. */
+static const char *typical_script = R"(
+network true
+netaddress eth0 dhcp
+netaddress eth0 static 192.168.1.20 24 192.168.1.1
+nameserver 192.168.1.1
+nameserver 2001:db8::1
+hostname build-42.fleet.example.com
+arch x86_64
+language en_GB.UTF-8
+keymap us
+timezone America/Chicago
+version stable
+repository https://distfiles.adelielinux.org/adelie/stable/system
+repository https://distfiles.adelielinux.org/adelie/stable/user
+signingkey /etc/apk/keys/packages@adelielinux.org.pub
+pkginstall adelie-base-posix openssh easy-kernel easy-kernel-modules linux-firmware grub-efi
+pkginstall vim tmux git rsync bash-completion htop
+svcenable sshd
+svcenable chronyd default
+rootpw $6$gumtLGmHwOVIRpQR$2M9PUO24hy5mofzWWf9a.YLbzOgOlUby1g0hDj.wG67E2wrrvys59fq02PPdxBdbgkLZFtjfEx6MHZwMBamwu/
+username fleetop
+useralias fleetop Fleet Operator Account
+userpw fleetop $6$gumtLGmHwOVIRpQR$2M9PUO24hy5mofzWWf9a.YLbzOgOlUby1g0hDj.wG67E2wrrvys59fq02PPdxBdbgkLZFtjfEx6MHZwMBamwu/
+usergroups fleetop wheel,audio,video
+username builder
+usergroups builder users
+bootloader true
+diskid /dev/sda WDC WD10EZEX
+disklabel /dev/sda gpt
+partition /dev/sda 1 256M esp
+partition /dev/sda 2 1G boot
+partition /dev/sda 3 fill
+encrypt /dev/sda3
+lvm_pv /dev/mapper/crypt-sda3
+lvm_vg /dev/mapper/crypt-sda3 FleetVolumes
+lvm_lv FleetVolumes root 20G
+lvm_lv FleetVolumes home fill
+fs /dev/sda1 vfat
+fs /dev/sda2 ext4
+fs /dev/FleetVolumes/root xfs
+fs /dev/FleetVolumes/home ext4
+mount /dev/FleetVolumes/root /
+mount /dev/sda2 /boot
+mount /dev/sda1 /boot/efi
+mount /dev/FleetVolumes/home /home defaults,nodev,nosuid
+)";
+
+
+/*! Write a syntactically valid HorizonScript of at least +size+ bytes.
+ * @param out       The stream to which the script is written.
+ * @param size      The minimum size of the script, in bytes.
+ * @returns The number of lines written.
+ */
+static unsigned long generate(std::ostream &out, std::size_t size) {
+    unsigned long lines = 0, pkg = 0, entry = 0;
+    std::size_t written = 0;
+    std::ostringstream line;
+
+    auto emit = [&](const std::string &text) {
+        out << text << '\n';
+        written += text.size() + 1;
+        lines++;
+    };
+
+    emit("network false");
+    emit("hostname bench.machine");
+    emit("rootpw $6$gumtLGmHwOVIRpQR$2M9PUO24hy5mofzWWf9a.YLbzOgOlUby1g0hDj.wG67E2wrrvys59fq02PPdxBdbgkLZFtjfEx6MHZwMBamwu/");
+    emit("mount /dev/sda1 /");
+
+    while(written < size) {
+        line.str("");
+        switch(entry++ % 6) {
+        case 0:
+            line << "# Comment line " << entry << " describing the next block";
+            break;
+        case 1:
+            line << "";
+            break;
+        case 2:
+            line << "pkginstall";
+            for(int i = 0; i < 24; i++) line << " bench-pkg-" << pkg++;
+            break;
+        case 3:
+            line << "    PkgInstall\tbench-pkg-" << pkg++;
+            break;
+        case 4:
+            line << "repository https://mirror" << entry << ".example.net/"
+                 << "adelie/current/system";
+            break;
+        case 5:
+            line << "svcenable bench-svc-" << entry;
+            break;
+        }
+        emit(line.str());
+    }
+
+    return lines;
+}
+
+/*! Run +what+ +rounds+ times and return the fastest run, in seconds. */
+template<typename F>
+static double best_of(int rounds, F what) {
+    using namespace std::chrono;
+    double best = 0;
+    for(int round = 0; round < rounds; round++) {
+        auto start = steady_clock::now();
+        what();
+        double secs = duration<double>(steady_clock::now() - start).count();
+        if(round == 0 || secs < best) best = secs;
+    }
+    return best;
+}
+
+static void report(const char *name, unsigned long lines, std::size_t bytes,
+                   double secs) {
+    std::printf("%-24s %10.3f ms %14.0f lines/s %10.1f MiB/s\n", name,
+                secs * 1000, lines / secs, bytes / secs / 1048576.0);
+}
+
+
+int main(int argc, char *argv[]) {
+    std::size_t megs = 8;
+    int rounds = 5;
+
+    if(argc > 1) megs = std::strtoul(argv[1], nullptr, 10);
+    if(argc > 2) rounds = std::atoi(argv[2]);
+    if(megs == 0 || rounds <= 0) {
+        std::cerr << "usage: " << argv[0] << " [megabytes] [rounds]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    char path[] = "/tmp/hscript-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd == -1) {
+        std::perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    unsigned long lines;
+    {
+        std::ofstream out(path, std::ios_base::trunc);
+        lines = generate(out, megs * 1048576);
+    }
+    std::ifstream sizer(path, std::ios_base::ate);
+    const std::size_t bytes = static_cast<std::size_t>(sizer.tellg());
+    std::printf("script: %lu lines, %zu bytes, best of %d rounds\n", lines,
+                bytes, rounds);
+
+    unsigned long tokens = 0;
+    report("tokenise", lines, bytes, best_of(rounds, [&]() {
+        Horizon::ScriptTokeniser tokeniser;
+        Horizon::ScriptToken token;
+        bool io_error;
+        tokeniser.open(path, &io_error);
+        tokens = 0;
+        while(tokeniser.next(token)) tokens++;
+    }));
+
+    unsigned long found = 0;
+    report("tokenise + key_id", lines, bytes, best_of(rounds, [&]() {
+        Horizon::ScriptTokeniser tokeniser;
+        Horizon::ScriptToken token;
+        bool io_error;
+        tokeniser.open(path, &io_error);
+        found = 0;
+        while(tokeniser.next(token)) {
+            if(Horizon::Keys::key_id(token.key) !=
+               Horizon::Keys::KeyId::Invalid) found++;
+        }
+    }));
+
+    /* The key lookup used before the key registry, for comparison. */
+    std::map<std::string, int> key_map;
+    for(std::size_t key = 0; key < Horizon::Keys::KEY_COUNT; key++) {
+        key_map[std::string(Horizon::Keys::key_names[key])] = key;
+    }
+    report("tokenise + std::map", lines, bytes, best_of(rounds, [&]() {
+        Horizon::ScriptTokeniser tokeniser;
+        Horizon::ScriptToken token;
+        std::string key;
+        bool io_error;
+        tokeniser.open(path, &io_error);
+        found = 0;
+        while(tokeniser.next(token)) {
+            key.assign(token.key);
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            if(key_map.find(key) != key_map.end()) found++;
+        }
+    }));
+
+    /* The line reader used before the tokeniser, for comparison. */
+    unsigned long getlines = 0;
+    report("getline (512 bytes)", lines, bytes, best_of(rounds, [&]() {
+        std::ifstream stream(path);
+        char nextline[512];
+        getlines = 0;
+        while(stream.getline(nextline, sizeof(nextline))) {
+            const std::string line(nextline);
+            if(line.find_first_not_of(" \t") != std::string::npos) getlines++;
+        }
+    }));
+
+    bool loaded = true;
+    report("Script::load (path)", lines, bytes, best_of(rounds, [&]() {
+        Horizon::Script *script = Horizon::Script::load(path);
+        loaded = loaded && script != nullptr;
+        delete script;
+    }));
+
+    report("Script::load (stream)", lines, bytes, best_of(rounds, [&]() {
+        std::ifstream stream(path);
+        Horizon::Script *script = Horizon::Script::load(stream, 0, path);
+        loaded = loaded && script != nullptr;
+        delete script;
+    }));
+
+    char cache[] = "/tmp/hscript-bench-cache-XXXXXX";
+    if(mkdtemp(cache) == nullptr) {
+        std::perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    Horizon::Script::load(path, 0, cache);
+    report("Script::load (cached)", lines, bytes, best_of(rounds, [&]() {
+        Horizon::Script *script = Horizon::Script::load(path, 0, cache);
+        loaded = loaded && script != nullptr;
+        delete script;
+    }));
+
+    /* Load and discard the typical script many times, as a validation
+     * service would, and count the allocations made for each. */
+    const unsigned long loads = 2000;
+    const std::string typical(typical_script + 1);
+    unsigned long load_allocs = 0, load_bytes = 0;
+    const unsigned long typical_lines =
+            std::count(typical.begin(), typical.end(), '\n') * loads;
+    auto load_typical = [&](const std::string &cache_dir) {
+        const unsigned long before = allocs, before_bytes = alloc_bytes;
+        for(unsigned long load = 0; load < loads; load++) {
+            std::istringstream stream(typical);
+            Horizon::Script *script = Horizon::Script::load(stream, 0,
+                                                            "/dev/stdin",
+                                                            cache_dir);
+            loaded = loaded && script != nullptr;
+            delete script;
+        }
+        load_allocs = (allocs - before) / loads;
+        load_bytes = (alloc_bytes - before_bytes) / loads;
+    };
+    report("Script::load (typical)", typical_lines, typical.size() * loads,
+           best_of(rounds, [&]() { load_typical(""); }));
+    std::printf("%-24s %10lu allocs %13lu bytes per script\n",
+                "  allocations", load_allocs, load_bytes);
+    report("  (cached)", typical_lines, typical.size() * loads,
+           best_of(rounds, [&]() { load_typical(cache); }));
+    std::printf("%-24s %10lu allocs %13lu bytes per script\n",
+                "  allocations", load_allocs, load_bytes);
+
+    /* Load many small scripts which inherit the typical script, as most
+     * scripts in a fleet do, with and without sharing the inherited one. */
+    char base_path[] = "/tmp/hscript-bench-base-XXXXXX";
+    fd = mkstemp(base_path);
+    if(fd == -1) {
+        std::perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    {
+        std::ofstream out(base_path, std::ios_base::trunc);
+        out << typical;
+    }
+    auto host_script = [&](unsigned long host) {
+        return "hostname host-" + std::to_string(host) +
+               ".fleet.example.com\nnetaddress eth1 static 10.0.0." +
+               std::to_string(host % 250 + 2) + " 8 10.0.0.1\ninherit " +
+               base_path + "\n";
+    };
+    const unsigned long host_lines = 3 * loads;
+    const std::size_t host_bytes = host_script(0).size() * loads;
+    auto load_hosts = [&](Horizon::ScriptLoader *loader) {
+        const unsigned long before = allocs, before_bytes = alloc_bytes;
+        for(unsigned long load = 0; load < loads; load++) {
+            std::istringstream stream(host_script(load));
+            Horizon::Script *script =
+                    loader == nullptr ?
+                        Horizon::Script::load(stream, 0, "/dev/stdin") :
+                        loader->load(stream, "/dev/stdin");
+            loaded = loaded && script != nullptr;
+            delete script;
+        }
+        load_allocs = (allocs - before) / loads;
+        load_bytes = (alloc_bytes - before_bytes) / loads;
+    };
+    report("Script::load (inherit)", host_lines, host_bytes,
+           best_of(rounds, [&]() { load_hosts(nullptr); }));
+    std::printf("%-24s %10lu allocs %13lu bytes per script\n",
+                "  allocations", load_allocs, load_bytes);
+    Horizon::ScriptLoader loader;
+    report("  (ScriptLoader)", host_lines, host_bytes,
+           best_of(rounds, [&]() { load_hosts(&loader); }));
+    std::printf("%-24s %10lu allocs %13lu bytes per script\n",
+                "  allocations", load_allocs, load_bytes);
+
+    /* Log many warnings, as a script with many problems would. */
+    const unsigned long warnings = 100000;
+    std::ofstream null_stream("/dev/null");
+    auto log_warnings = [&](OutputSink &sink) {
+        OutputScope scope(sink);
+        for(unsigned long warning = 0; warning < warnings; warning++) {
+            output_warning(Horizon::ScriptLocation(path, warning),
+                           "svcenable: service already enabled", "sshd");
+        }
+        sink.flush();
+    };
+    TextSink text_sink(null_stream, nullptr);
+    report("warnings (text)", warnings, 0,
+           best_of(rounds, [&]() { log_warnings(text_sink); }));
+    TextSink buffered_sink(null_stream, nullptr, true);
+    report("warnings (buffered)", warnings, 0,
+           best_of(rounds, [&]() { log_warnings(buffered_sink); }));
+    JSONSink json_sink(null_stream, true);
+    report("warnings (JSON)", warnings, 0,
+           best_of(rounds, [&]() { log_warnings(json_sink); }));
+    CollectorSink collector;
+    report("warnings (collector)", warnings, 0,
+           best_of(rounds, [&]() {
+               collector.clear();
+               log_warnings(collector);
+           }));
+
+    unlink(base_path);
+    unlink(path);
+    fs::remove_all(cache);
+    if(!loaded || tokens == 0) {
+        std::cerr << "benchmark script failed to load" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -9,17 +9,45 @@
  * SPDX-License-Identifier: AGPL-3.0-only
  */
 
+#include <boost/program_options.hpp>
 #include <unistd.h>
 #include "hscript/script.hh"
 #include "util/output.hh"
+#include "util/profile.hh"
 
 bool pretty = false;
 
-int main(void) {
-    const Horizon::Script *my_script;
+int main(int argc, char *argv[]) {
+    Horizon::Script *my_script;
     Horizon::ScriptOptions opts;
     int result_code = EXIT_SUCCESS;
+    std::string profile_path, pkg_cache;
+    std::uint64_t pkg_cache_size{};
+    bool needs_help{}, resume{};
     using Horizon::ScriptOptionFlags;
+    using namespace boost::program_options;
+
+    options_description cli("Allowed options");
+    cli.add_options()
+        ("help,h", bool_switch(&needs_help), "Display this message.")
+        ("package-cache", value<std::string>(&pkg_cache), "Cache downloaded packages in this directory, and reuse them in later installations.")
+        ("package-cache-size", value<std::uint64_t>(&pkg_cache_size)->default_value(0), "Evict the least recently used packages once the cache exceeds this many MiB.  0 means no limit.")
+        ("profile", value<std::string>(&profile_path), "Write a timing profile of the installation to this file, in Chrome trace format.")
+        ("resume", bool_switch(&resume), "Resume an interrupted installation, skipping the steps it completed.");
+    try {
+        variables_map args;
+        store(command_line_parser(argc, argv).options(cli).run(), args);
+        notify(args);
+    } catch(const boost::program_options::error& cli_err) {
+        std::cerr << cli_err.what() << std::endl;
+        needs_help = true;
+        result_code = EXIT_FAILURE;
+    }
+
+    if(needs_help) {
+        std::cout << cli << std::endl;
+        return result_code;
+    }
 
     /* Default to pretty if we are using a TTY, unless -n specified. */
     if(isatty(1) && isatty(2)) {
@@ -29,6 +57,7 @@ int main(void) {
     opts.set(ScriptOptionFlags::InstallEnvironment);
     opts.set(ScriptOptionFlags::UseNetwork);
     opts.set(ScriptOptionFlags::StrictMode);
+    if(resume) opts.set(ScriptOptionFlags::Resume);
 
     std::cout << "HorizonScript Executor version " << VERSTR;
 #ifdef NON_LIBRE_FIRMWARE
@@ -43,11 +72,15 @@ int main(void) {
               << std::endl << "AGPL 3.0 license, unless otherwise noted.";
     std::cout << std::endl << std::endl;
 
+    ProfileSession profile(profile_path);
     my_script = Horizon::Script::load("/etc/horizon/installfile", opts);
     if(my_script == nullptr) {
         std::cout << "Could not load the HorizonScript." << std::endl;
         return EXIT_FAILURE;
     }
+    if(!pkg_cache.empty()) {
+        my_script->setPackageCache(pkg_cache, pkg_cache_size << 20);
+    }
 
     if(!my_script->execute()) {
         output_error("internal", "Script failed.  Stop.", "");
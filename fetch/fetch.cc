@@ -23,7 +23,6 @@
 #include "util/output.hh"
 
 static const char *IFILE_PATH = "/etc/horizon/installfile";
-static const int SCRIPT_LINE_MAX = 512;
 
 bool pretty = true;
 
@@ -52,18 +51,19 @@ int process_local(const std::string &path) {
                      path + " could not be opened for reading");
         return EXIT_FAILURE;
     }
-    char buffer[SCRIPT_LINE_MAX];
 
-    while(input.getline(buffer, SCRIPT_LINE_MAX)) {
-        output << buffer << std::endl;
+    /* The script is copied verbatim; there is no limit on line length. */
+    if(input.peek() != std::ifstream::traits_type::eof()) {
+        output << input.rdbuf();
     }
 
-    if(input.fail() && !input.eof()) {
-        output_error("process_local", "line too long while reading " + path);
+    if(input.bad()) {
+        output_error("process_local", "I/O error reading " + path);
         return EXIT_FAILURE;
     }
-    if(input.bad() && !input.eof()) {
-        output_error("process_local", "I/O error reading " + path);
+    if(!output.flush()) {
+        output_error("process_local", "I/O error writing " +
+                     std::string(IFILE_PATH));
         return EXIT_FAILURE;
     }
 
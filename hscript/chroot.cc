@@ -0,0 +1,400 @@
+/*
+ * chroot.cc - Implementation of the persistent in-target command agent
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>          /* strerror */
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* O_CLOEXEC, O_NONBLOCK */
+#   include <poll.h>           /* poll */
+#   include <signal.h>         /* kill, SIG* */
+#   include <spawn.h>          /* posix_spawnp */
+#   include <sys/resource.h>   /* struct rusage */
+#   include <sys/socket.h>     /* socketpair, send, recv */
+#   include <sys/wait.h>       /* wait4, waitpid, W* */
+#   include <unistd.h>         /* chroot, fork, pipe2, _exit */
+#endif /* HAS_INSTALL_ENV */
+#include "chroot.hh"
+#include "util.hh"
+#include "util/output.hh"
+#include "util/profile.hh"
+
+extern "C" char **environ;
+
+using namespace Horizon;
+
+/*! How long a command has to exit after SIGTERM before it is sent SIGKILL,
+ * as for the ProcessSupervisor. */
+#define AGENT_KILL_GRACE std::chrono::seconds(10)
+/*! How often the agent checks whether a command has exited. */
+#define AGENT_POLL_MS 100
+/*! The longest line that is held before it is sent anyway. */
+#define AGENT_MAX_LINE 65536
+
+#ifdef HAS_INSTALL_ENV
+/* Each request is the number of arguments, whether to capture output, the
+ * deadline in seconds, and each argument as a length and its bytes.  While
+ * the command runs, each line it writes is sent back as a line kind and the
+ * line, unless output is captured.  The reply is how the command ended, the
+ * exit status, signal, errno or deadline, the resources it used, and the
+ * length and bytes of any captured output.  The agent is a fork of the
+ * caller, so the structures are sent as they are. */
+enum ReplyKind : int32_t {
+    Exited = 0,
+    Signalled = 1,
+    SpawnFailed = 2,
+    TimedOut = 3,
+    OutputLine = 4,
+    ErrorLine = 5
+};
+
+/*! Send all of +len+ bytes at +data+ over +fd+. */
+static bool send_all(int fd, const void *data, std::size_t len) {
+    const char *ptr = static_cast<const char *>(data);
+    while(len > 0) {
+        const ssize_t ret = send(fd, ptr, len, MSG_NOSIGNAL);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        ptr += ret;
+        len -= static_cast<std::size_t>(ret);
+    }
+    return true;
+}
+
+/*! Receive exactly +len+ bytes into +data+ from +fd+. */
+static bool recv_all(int fd, void *data, std::size_t len) {
+    char *ptr = static_cast<char *>(data);
+    while(len > 0) {
+        const ssize_t ret = recv(fd, ptr, len, 0);
+        if(ret == 0) return false;
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        ptr += ret;
+        len -= static_cast<std::size_t>(ret);
+    }
+    return true;
+}
+
+/*! Send +str+ over +fd+, preceded by its length. */
+static bool send_string(int fd, const std::string &str) {
+    const uint32_t len = static_cast<uint32_t>(str.size());
+    return send_all(fd, &len, sizeof len) &&
+            send_all(fd, str.data(), str.size());
+}
+
+/*! Receive a string sent by send_string from +fd+. */
+static bool recv_string(int fd, std::string &str) {
+    uint32_t len;
+    if(!recv_all(fd, &len, sizeof len)) return false;
+    str.resize(len);
+    return len == 0 || recv_all(fd, &str[0], len);
+}
+
+/*! Pass on the full lines read from a command to +fd+ in +pending+: to
+ * +output+, if it is captured, or over +sock+ as +kind+. */
+static void agent_lines(int sock, std::string &pending, bool capture,
+                        int32_t kind, std::string &output, bool all) {
+    std::string::size_type start = 0, end;
+    while((end = pending.find('\n', start)) != std::string::npos) {
+        const std::string line(pending, start, end - start);
+        if(capture) {
+            output += line + "\n";
+        } else {
+            send_all(sock, &kind, sizeof kind);
+            send_string(sock, line);
+        }
+        start = end + 1;
+    }
+    pending.erase(0, start);
+    if(!pending.empty() && (all || pending.size() >= AGENT_MAX_LINE)) {
+        if(capture) {
+            output += pending;
+        } else {
+            send_all(sock, &kind, sizeof kind);
+            send_string(sock, pending);
+        }
+        pending.clear();
+    }
+}
+
+/*! Run one command for the agent, sending each line it writes over +sock+
+ * and ending it after +deadline+ seconds, if not zero; then fill in the
+ * reply fields. */
+static void agent_spawn(int sock, const std::vector<std::string> &args,
+                        bool capture, uint32_t deadline, int32_t &kind,
+                        int32_t &value, struct rusage &usage,
+                        std::string &output) {
+    typedef std::chrono::steady_clock Clock;
+    std::vector<char *> argv;
+    for(const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    if(pipe2(out, O_CLOEXEC) != 0 || pipe2(err, O_CLOEXEC) != 0) {
+        kind = SpawnFailed;
+        value = errno;
+        for(int fd : {out[0], out[1]}) if(fd != -1) close(fd);
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+    pid_t child;
+    const int ret = posix_spawnp(&child, argv[0], &actions, nullptr,
+                                 argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    close(err[1]);
+    if(ret != 0) {
+        close(out[0]);
+        close(err[0]);
+        kind = SpawnFailed;
+        value = ret;
+        return;
+    }
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+
+    /* The command has exited once it is collected, even if a daemon it
+     * started still holds its pipes; what is left in them is sent then. */
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    const int32_t kinds[2] = {OutputLine, ErrorLine};
+    std::string pending[2];
+    Clock::time_point signal_at = deadline > 0 ?
+                Clock::now() + std::chrono::seconds(deadline) :
+                Clock::time_point::max();
+    int signals = 0, status = 0, wait_error = 0;
+    bool exited = false;
+    while(!exited) {
+        poll(fds, 2, AGENT_POLL_MS);
+        const pid_t done = wait4(child, &status, WNOHANG, &usage);
+        if(done == -1 && errno != EINTR) wait_error = errno;
+        exited = done == child || wait_error != 0;
+        for(std::size_t index = 0; index < 2; index++) {
+            if(fds[index].fd == -1) continue;
+            char buf[4096];
+            ssize_t len;
+            while((len = read(fds[index].fd, buf, sizeof buf)) > 0) {
+                pending[index].append(buf, static_cast<std::size_t>(len));
+            }
+            const bool eof = len == 0 || (len < 0 && errno != EAGAIN &&
+                                          errno != EINTR);
+            agent_lines(sock, pending[index], capture, kinds[index], output,
+                        eof || exited);
+            if(eof || exited) {
+                close(fds[index].fd);
+                fds[index].fd = -1;
+            }
+        }
+        if(!exited && Clock::now() >= signal_at) {
+            kill(child, signals == 0 ? SIGTERM : SIGKILL);
+            signal_at = signals == 0 ? Clock::now() + AGENT_KILL_GRACE :
+                                       Clock::time_point::max();
+            signals++;
+        }
+    }
+
+    if(wait_error != 0) {
+        kind = SpawnFailed;
+        value = wait_error;
+    } else if(signals > 0) {
+        kind = TimedOut;
+        value = static_cast<int32_t>(deadline);
+    } else if(WIFEXITED(status)) {
+        kind = Exited;
+        value = WEXITSTATUS(status);
+    } else {
+        kind = Signalled;
+        value = WTERMSIG(status);
+    }
+}
+
+/*! The agent itself: serve requests from +sock+ until it is closed. */
+[[noreturn]] static void agent_main(int sock, const std::string &root) {
+    int32_t ready = 0;
+    if(chroot(root.c_str()) != 0 || chdir("/") != 0) ready = errno;
+    if(!send_all(sock, &ready, sizeof ready) || ready != 0) _exit(1);
+
+    while(true) {
+        uint32_t argc, deadline;
+        uint8_t capture;
+        if(!recv_all(sock, &argc, sizeof argc) ||
+           !recv_all(sock, &capture, sizeof capture) ||
+           !recv_all(sock, &deadline, sizeof deadline)) _exit(0);
+
+        std::vector<std::string> args(argc);
+        for(auto &arg : args) if(!recv_string(sock, arg)) _exit(0);
+
+        int32_t kind = SpawnFailed, value = EINVAL;
+        struct rusage usage = {};
+        std::string output;
+        if(argc > 0) {
+            agent_spawn(sock, args, capture != 0, deadline, kind, value,
+                        usage, output);
+        }
+
+        if(!send_all(sock, &kind, sizeof kind) ||
+           !send_all(sock, &value, sizeof value) ||
+           !send_all(sock, &usage, sizeof usage) ||
+           !send_string(sock, output)) _exit(0);
+    }
+}
+#endif /* HAS_INSTALL_ENV */
+
+ChrootAgent::ChrootAgent(const std::string &root) : _root(root), _sock(-1),
+    _pid(-1), _failed(false) {}
+
+ChrootAgent::~ChrootAgent() {
+    stop();
+}
+
+bool ChrootAgent::start() {
+#ifdef HAS_INSTALL_ENV
+    int socks[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) != 0) {
+        output_warning("chroot", "cannot start command agent",
+                       strerror(errno));
+        return false;
+    }
+
+    const pid_t pid = fork();
+    if(pid == -1) {
+        output_warning("chroot", "cannot start command agent",
+                       strerror(errno));
+        close(socks[0]);
+        close(socks[1]);
+        return false;
+    }
+    if(pid == 0) {
+        close(socks[0]);
+        agent_main(socks[1], _root);
+    }
+
+    close(socks[1]);
+    _sock = socks[0];
+    _pid = pid;
+
+    int32_t ready = -1;
+    if(!recv_all(_sock, &ready, sizeof ready) || ready != 0) {
+        output_warning("chroot", "cannot start command agent",
+                       ready > 0 ? strerror(ready) : "agent exited");
+        stop();
+        return false;
+    }
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+void ChrootAgent::stop() {
+#ifdef HAS_INSTALL_ENV
+    if(_sock != -1) {
+        /* The agent exits when it reads the end of the stream. */
+        close(_sock);
+        _sock = -1;
+    }
+    if(_pid != -1) {
+        while(waitpid(_pid, nullptr, 0) == -1 && errno == EINTR);
+        _pid = -1;
+    }
+#endif /* HAS_INSTALL_ENV */
+}
+
+int ChrootAgent::run(const std::vector<std::string> &args,
+                     std::string *output, std::chrono::seconds deadline) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if(args.empty()) return -1;
+
+    if(_sock == -1 && !_failed) _failed = !start();
+    if(_failed) {
+        /* Captured output is not available through chroot(8). */
+        std::vector<std::string> chroot_args{_root};
+        chroot_args.insert(chroot_args.end(), args.begin(), args.end());
+        return run_command("chroot", chroot_args, deadline);
+    }
+
+#ifdef HAS_INSTALL_ENV
+    const std::string &cmd = args.front();
+    ProfileSpan span("process", cmd);
+    if(span.active()) {
+        std::string line("chroot " + _root);
+        for(const auto &arg : args) line += " " + arg;
+        span.set_detail(line);
+    }
+
+    const uint32_t argc = static_cast<uint32_t>(args.size());
+    const uint8_t capture = (output != nullptr);
+    const uint32_t seconds = static_cast<uint32_t>(deadline.count());
+    bool ok = send_all(_sock, &argc, sizeof argc) &&
+            send_all(_sock, &capture, sizeof capture) &&
+            send_all(_sock, &seconds, sizeof seconds);
+    for(const auto &arg : args) ok = ok && send_string(_sock, arg);
+
+    /* Lines are logged as the ProcessSupervisor logs those of a command. */
+    const std::string where = !output_location.empty() ? output_location :
+                                                         cmd;
+    int32_t kind, value;
+    struct rusage usage;
+    std::string captured;
+    while((ok = ok && recv_all(_sock, &kind, sizeof kind)) &&
+          (kind == OutputLine || kind == ErrorLine)) {
+        std::string line;
+        ok = recv_string(_sock, line);
+        if(!line.empty() && line.back() == '\r') line.pop_back();
+        if(ok) {
+            output_log(kind == ErrorLine ? "stderr" : "stdout", "0", where,
+                       line);
+        }
+    }
+    ok = ok && recv_all(_sock, &value, sizeof value) &&
+            recv_all(_sock, &usage, sizeof usage) &&
+            recv_string(_sock, captured);
+    if(!ok) {
+        output_error(cmd, "lost connection to command agent");
+        stop();
+        _failed = true;
+        return -1;
+    }
+    if(output != nullptr) *output = std::move(captured);
+    if(kind != SpawnFailed) span.set_child_usage(usage);
+
+    switch(kind) {
+    case SpawnFailed:
+        output_error(cmd, "cannot fork", strerror(value));
+        return -1;
+    case Signalled:
+        output_error(cmd, "received fatal signal " + std::to_string(value));
+        return -1;
+    case TimedOut:
+        output_error(cmd, "did not finish within " + std::to_string(value) +
+                     " seconds, and was stopped");
+        return -1;
+    default:
+        if(value != 0) {
+            output_error(cmd, "exited abnormally with status " +
+                         std::to_string(value));
+        }
+        return value;
+    }
+#else
+    return -1;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
@@ -0,0 +1,80 @@
+/*
+ * chroot.hh - Definition of the persistent in-target command agent
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_CHROOT_HH_
+#define HSCRIPT_CHROOT_HH_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Horizon {
+
+/*! Runs commands inside a target system.
+ *
+ * Instead of running chroot(8) for every command, the agent forks once,
+ * enters the target with chroot(2), and then spawns each command it is
+ * sent over a socket.  Each line a command writes is sent back and logged
+ * as the ProcessSupervisor logs the lines of other commands, unless it is
+ * captured, and a command that passes its deadline is ended.  Only the
+ * commands themselves are started inside the target, which matters when
+ * each start-up runs under an emulator.
+ *
+ * If the agent cannot be started, commands are run through chroot(8) as
+ * before.  The agent should be started while no other thread is likely to
+ * be forking or holding a lock, since it is forked from the caller.
+ */
+class ChrootAgent {
+public:
+    /*! Create an agent for the system rooted at +root+.
+     * The agent is started when the first command is run. */
+    explicit ChrootAgent(const std::string &root);
+    /*! Stop the agent, if it is running. */
+    ~ChrootAgent();
+    ChrootAgent(const ChrootAgent &) = delete;
+    ChrootAgent &operator=(const ChrootAgent &) = delete;
+
+    /*! Run a command inside the target.
+     * @param args      The command to run and its arguments.
+     * @param output    If not nullptr, receives the standard output and
+     *                  error of the command instead of the log.
+     * @param deadline  If not zero, how long the command may run before it
+     *                  is stopped.
+     * @returns The exit status of the command, or -1 if it could not be run,
+     * was killed by a signal, or was stopped, like run_command.
+     */
+    int run(const std::vector<std::string> &args,
+            std::string *output = nullptr,
+            std::chrono::seconds deadline = std::chrono::seconds::zero());
+
+    /*! Stop the agent.  The target is no longer in use once this returns. */
+    void stop();
+private:
+    /*! Start the agent process. */
+    bool start();
+
+    /*! The root directory of the target. */
+    const std::string _root;
+    /*! The socket connected to the agent, or -1. */
+    int _sock;
+    /*! The process ID of the agent, or -1. */
+    int _pid;
+    /*! Whether starting the agent failed, so chroot(8) is used instead. */
+    bool _failed;
+    /*! Serialises the commands sent to the agent. */
+    std::mutex _lock;
+};
+
+}
+
+#endif /* !HSCRIPT_CHROOT_HH_ */
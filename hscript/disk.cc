@@ -13,7 +13,6 @@
 #include <algorithm>
 #include <assert.h>         /* assert */
 #include <cstring>          /* strerror */
-#include <fstream>
 #include <set>
 #include <string>
 #ifdef HAS_INSTALL_ENV
@@ -21,6 +20,7 @@
 #   include <blkid/blkid.h>    /* blkid_get_tag_value */
 #   include "util/filesystem.hh"
 #   include <libudev.h>        /* udev_* */
+#   include <mutex>
 #   include <parted/parted.h>  /* ped_* */
 #   include <sys/mount.h>      /* mount */
 #   include <sys/stat.h>       /* stat */
@@ -28,12 +28,20 @@
 #   include <unistd.h>         /* access */
 #endif /* HAS_INSTALL_ENV */
 #include "disk.hh"
+#include "inventory.hh"
+#include "script_c.hh"
+#include "targetfiles.hh"
 #include "util.hh"
 #include "util/output.hh"
 
 using namespace Horizon::Keys;
 
 #ifdef HAS_INSTALL_ENV
+/*! Guards libparted, which keeps its list of devices and its exception
+ * state in globals.  Every call into it, including writing a table to its
+ * device, is made with this held. */
+static std::mutex parted_lock;
+
 /*! Determine if _block is a valid block device.
  * @param key       The key associated with this test.
  * @param pos       The location where the key exists.
@@ -43,6 +51,13 @@ using namespace Horizon::Keys;
  */
 bool is_block_device(const std::string &key, const Horizon::ScriptLocation &pos,
                      const std::string &_block) {
+    /* Everything in the inventory is a block device. */
+    const Horizon::BlockInventory *inventory =
+            Horizon::BlockInventory::current();
+    if(inventory != nullptr && inventory->find(_block) != nullptr) {
+        return true;
+    }
+
     struct stat blk_stat;
     const char *block_c = _block.c_str();
     if(access(block_c, F_OK) != 0 || stat(block_c, &blk_stat) != 0) {
@@ -59,7 +74,7 @@ bool is_block_device(const std::string &key, const Horizon::ScriptLocation &pos,
 #endif /* HAS_INSTALL_ENV */
 
 
-Key *DiskId::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *DiskId::parseFromData(std::string_view data, const ScriptLocation &pos,
                            int *errors, int *, const Script *script) {
     std::string block, ident;
     std::string::size_type block_end = data.find_first_of(' ');
@@ -72,7 +87,19 @@ Key *DiskId::parseFromData(const std::string &data, const ScriptLocation &pos,
 
     block = data.substr(0, block_end);
     ident = data.substr(block_end + 1);
-    return new DiskId(script, pos, block, ident);
+    return new(script) DiskId(script, pos, block, ident);
+}
+
+Key *DiskId::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                          const Script *script) {
+    const std::string_view block = in.get_string();
+    const std::string_view ident = in.get_string();
+    return new(script) DiskId(script, pos, block, ident);
+}
+
+void DiskId::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_string(this->_ident);
 }
 
 bool DiskId::validate() const {
@@ -81,7 +108,7 @@ bool DiskId::validate() const {
     if(script->options().test(InstallEnvironment)) {
         /* Unlike 'mount', 'diskid' *does* require that the block device exist
          * before installation begins.  This test is always valid. */
-        return is_block_device("diskid", where(), _block);
+        return is_block_device("diskid", where(), device());
     }
 #endif /* HAS_INSTALL_ENV */
 
@@ -91,8 +118,8 @@ bool DiskId::validate() const {
 bool DiskId::execute() const {
     bool match = false;
 
-    output_info(pos, "diskid: Checking " + _block +
-                " for identification string " + _ident);
+    output_info(pos, "diskid: Checking " + device() +
+                " for identification string " + ident());
 
     if(!script->options().test(InstallEnvironment)) return true;
 
@@ -103,7 +130,7 @@ bool DiskId::execute() const {
     struct stat blk_stat;
     const char *block_c = _block.c_str();
     if(stat(block_c, &blk_stat) != 0) {
-        output_error(pos, "diskid: error opening device " + _block,
+        output_error(pos, "diskid: error opening device " + this->device(),
                      strerror(errno));
         return false;
     }
@@ -146,7 +173,7 @@ bool DiskId::execute() const {
 }
 
 
-Key *DiskLabel::parseFromData(const std::string &data,
+Key *DiskLabel::parseFromData(std::string_view data,
                               const ScriptLocation &pos, int *errors, int *,
                               const Script *script) {
     std::string block, label;
@@ -178,7 +205,19 @@ Key *DiskLabel::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new DiskLabel(script, pos, block, type);
+    return new(script) DiskLabel(script, pos, block, type);
+}
+
+Key *DiskLabel::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                             const Script *script) {
+    const std::string_view block = in.get_string();
+    const LabelType type = static_cast<LabelType>(in.get_number());
+    return new(script) DiskLabel(script, pos, block, type);
+}
+
+void DiskLabel::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_number(this->_type);
 }
 
 bool DiskLabel::validate() const {
@@ -186,7 +225,7 @@ bool DiskLabel::validate() const {
     /* REQ: Runner.Validate.disklabel.Block */
     if(script->options().test(InstallEnvironment)) {
         /* disklabels are created before any others, so we can check now */
-        return is_block_device("disklabel", where(), _block);
+        return is_block_device("disklabel", where(), device());
     }
 #endif /* HAS_INSTALL_ENV */
 
@@ -217,6 +256,7 @@ bool DiskLabel::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
+    std::lock_guard<std::mutex> guard(parted_lock);
     PedDevice *pdevice = ped_device_get(this->device().c_str());
     PedDiskType *label = ped_disk_type_get(type_str.c_str());
     int res;
@@ -232,13 +272,14 @@ bool DiskLabel::execute() const {
     PedDisk *disk = ped_disk_new_fresh(pdevice, label);
     if(disk == nullptr) {
         output_error(pos, "disklabel: internal error creating new " +
-                     type_str + " disklabel on " + _block);
+                     type_str + " disklabel on " + device());
         return false;
     }
 
     res = ped_disk_commit(disk);
+    ped_disk_destroy(disk);
     if(res != 1) {
-        output_error(pos, "disklabel: error creating disklabel on " + _block);
+        output_error(pos, "disklabel: error creating disklabel on " + device());
     }
     return (res == 1);
 #else
@@ -247,7 +288,7 @@ bool DiskLabel::execute() const {
 }
 
 
-Key *Encrypt::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Encrypt::parseFromData(std::string_view data, const ScriptLocation &pos,
                             int *errors, int *, const Script *script) {
     std::string::size_type sep = data.find(' ');
     std::string dev, pass;
@@ -265,7 +306,19 @@ Key *Encrypt::parseFromData(const std::string &data, const ScriptLocation &pos,
         return nullptr;
     }
 
-    return new Encrypt(script, pos, dev, pass);
+    return new(script) Encrypt(script, pos, dev, pass);
+}
+
+Key *Encrypt::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                           const Script *script) {
+    const std::string_view block = in.get_string();
+    const std::string_view pw = in.get_string();
+    return new(script) Encrypt(script, pos, block, pw);
+}
+
+void Encrypt::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_string(this->_pw);
 }
 
 bool Encrypt::validate() const {
@@ -283,10 +336,11 @@ bool Encrypt::execute() const {
  * @param   in_size     (in) The string to parse.
  * @param   out_size    (out) Where to which to write the size in bytes or %.
  * @param   type        (out) The type of size determined.
+ * @param   warnings    (out) If not nullptr, ++ on each warning.
  * @returns true if the string was parseable, false otherwise.
  */
 bool parse_size_string(const std::string &in_size, uint64_t *out_size,
-                       SizeType *type) {
+                       SizeType *type, int *warnings) {
     std::string size(in_size), numbers, suffix;
     std::string::size_type suffix_pos;
     uint64_t multiplicand = 0;
@@ -328,6 +382,7 @@ bool parse_size_string(const std::string &in_size, uint64_t *out_size,
     }
 
     if(suffix_pos == std::string::npos) {
+        if(warnings) *warnings += 1;
         output_warning("partition", "size has no suffix; assuming bytes");
         return true;
     }
@@ -383,7 +438,7 @@ bool parse_size_string(const std::string &in_size, uint64_t *out_size,
 }
 
 
-Key *Partition::parseFromData(const std::string &data,
+Key *Partition::parseFromData(std::string_view data,
                               const ScriptLocation &pos, int *errors, int *,
                               const Script *script) {
     std::string block, pno, size_str, typecode;
@@ -429,11 +484,14 @@ Key *Partition::parseFromData(const std::string &data,
         size_str = data.substr(last_pos + 1, next_pos - last_pos - 1);
         typecode = data.substr(next_pos + 1);
     }
-    if(!parse_size_string(size_str, &size, &size_type)) {
+    int size_warnings = 0;
+    if(!parse_size_string(size_str, &size, &size_type, &size_warnings)) {
         if(errors) *errors += 1;
         output_error(pos, "partition: invalid size", size_str);
         return nullptr;
     }
+    /* The warning for a size without a suffix is not counted. */
+    if(size_warnings > 0) no_cache(script);
 
     if(!typecode.empty()) {
         std::transform(typecode.cbegin(), typecode.cend(), typecode.begin(),
@@ -454,7 +512,27 @@ Key *Partition::parseFromData(const std::string &data,
         }
     }
 
-    return new Partition(script, pos, block, part_no, size_type, size, type);
+    return new(script) Partition(script, pos, block, part_no, size_type, size,
+                                 type);
+}
+
+Key *Partition::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                             const Script *script) {
+    const std::string_view block = in.get_string();
+    const int partno = static_cast<int>(in.get_number());
+    const SizeType size_type = static_cast<SizeType>(in.get_number());
+    const uint64_t size = in.get_number();
+    const PartitionType type = static_cast<PartitionType>(in.get_number());
+    return new(script) Partition(script, pos, block, partno, size_type, size,
+                                 type);
+}
+
+void Partition::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_number(this->_partno);
+    out.put_number(this->_size_type);
+    out.put_number(this->_size);
+    out.put_number(this->_type);
 }
 
 bool Partition::validate() const {
@@ -468,109 +546,128 @@ bool Partition::validate() const {
 }
 
 bool Partition::execute() const {
-    output_info(pos, "partition: creating partition #" +
-                std::to_string(_partno) + " on " + _block);
+    return execute_all({this});
+}
 
-    if(script->options().test(Simulate)) {
-        output_error(pos, "partition: Not supported in Simulation mode");
-        return true;
+bool Partition::execute_all(const std::vector<const Partition *> &parts) {
+    if(parts.empty()) return true;
+    const Partition *first = parts.front();
+
+    for(const auto &part : parts) {
+        output_info(part->pos, "partition: creating partition #" +
+                    std::to_string(part->partno()) + " on " + part->device());
+        if(first->script->options().test(Simulate)) {
+            output_error(part->pos,
+                         "partition: Not supported in Simulation mode");
+        }
     }
+    if(first->script->options().test(Simulate)) return true;
 
 #ifdef HAS_INSTALL_ENV
-    PedDevice *dev = ped_device_get(this->device().c_str());
+    /* Other disks' file systems and volumes may be created meanwhile. */
+    std::lock_guard<std::mutex> guard(parted_lock);
+    PedDevice *dev = ped_device_get(first->device().c_str());
     if(dev == nullptr) {
-        output_error(pos, "partition: error opening device " + this->device());
+        output_error(first->pos, "partition: error opening device " +
+                     first->device());
         return false;
     }
 
     PedDisk *disk = ped_disk_new(dev);
     if(disk == nullptr) {
-        output_error(pos, "partition: error reading device " + this->device());
+        output_error(first->pos, "partition: error reading device " +
+                     first->device());
         return false;
     }
 
-    int last = ped_disk_get_last_partition_num(disk);
-
-    /* no partitions = 0 partitions */
-    if(last == -1) last = 0;
+    /* Each partition is added to the table in memory, so that the next
+     * starts where the previous one ended. */
+    for(const auto &part : parts) {
+        const ScriptLocation &pos = part->pos;
+        int last = ped_disk_get_last_partition_num(disk);
 
-    if(last != (this->partno() - 1)) {
-        output_error(pos, "partition: consistency error on " + this->device(),
-                     "Partition #" + std::to_string(this->partno()) +
-                     " has been requested, but the disk has " +
-                     std::to_string(last) + " partitions");
-        ped_disk_destroy(disk);
-        return false;
-    }
+        /* no partitions = 0 partitions */
+        if(last == -1) last = 0;
 
-    PedPartition *before, *me;
-    PedSector start = 0;
-    PedSector size = 0;
-    if(last > 0) {
-        before = ped_disk_get_partition(disk, last);
-        if(before == nullptr) {
-            output_error(pos, "partition: error reading partition table on " +
-                         this->device());
+        if(last != (part->partno() - 1)) {
+            output_error(pos, "partition: consistency error on " +
+                         part->device(), "Partition #" +
+                         std::to_string(part->partno()) +
+                         " has been requested, but the disk has " +
+                         std::to_string(last) + " partitions");
             ped_disk_destroy(disk);
             return false;
         }
-        start = before->geom.end + 1;
-    }
-    /* Ensure the first MiB is free for various firmware and boot software
-     * that use it. */
-    if(start < 2048) start = 2048;
 
-    switch(this->size_type()) {
-    case SizeType::Bytes:
-        size = static_cast<int64_t>(this->size()) / dev->sector_size;
-        break;
-    case SizeType::Percent:
-        size = dev->length * (this->size() / 100.0);
-        break;
-    case SizeType::Fill:
-        size = dev->length - start;
-        break;
-    }
+        PedPartition *before, *me;
+        PedSector start = 0;
+        PedSector size = 0;
+        if(last > 0) {
+            before = ped_disk_get_partition(disk, last);
+            if(before == nullptr) {
+                output_error(pos, "partition: error reading partition table "
+                             "on " + part->device());
+                ped_disk_destroy(disk);
+                return false;
+            }
+            start = before->geom.end + 1;
+        }
+        /* Ensure the first MiB is free for various firmware and boot software
+         * that use it. */
+        if(start < 2048) start = 2048;
+
+        switch(part->size_type()) {
+        case SizeType::Bytes:
+            size = static_cast<int64_t>(part->size()) / dev->sector_size;
+            break;
+        case SizeType::Percent:
+            size = dev->length * (part->size() / 100.0);
+            break;
+        case SizeType::Fill:
+            size = dev->length - start;
+            break;
+        }
 
-    me = ped_partition_new(disk, PED_PARTITION_NORMAL, nullptr,
-                           start, start + size);
-    if(me == nullptr) {
-        output_error(pos, "partition: error creating partition on " +
-                     this->device());
-        ped_disk_destroy(disk);
-        return false;
-    }
+        me = ped_partition_new(disk, PED_PARTITION_NORMAL, nullptr,
+                               start, start + size);
+        if(me == nullptr) {
+            output_error(pos, "partition: error creating partition on " +
+                         part->device());
+            ped_disk_destroy(disk);
+            return false;
+        }
 
-    switch(_type) {
-    case Boot:
-        ped_partition_set_flag(me, PED_PARTITION_BOOT, 1);
-        break;
-    case ESP:
-        ped_partition_set_flag(me, PED_PARTITION_ESP, 1);
-        break;
-    case BIOS:
-        ped_partition_set_flag(me, PED_PARTITION_BIOS_GRUB, 1);
-        break;
-    case PReP:
-        ped_partition_set_flag(me, PED_PARTITION_PREP, 1);
-        break;
-    case None:
-        /* we good */
-        break;
-    }
+        switch(part->type()) {
+        case Boot:
+            ped_partition_set_flag(me, PED_PARTITION_BOOT, 1);
+            break;
+        case ESP:
+            ped_partition_set_flag(me, PED_PARTITION_ESP, 1);
+            break;
+        case BIOS:
+            ped_partition_set_flag(me, PED_PARTITION_BIOS_GRUB, 1);
+            break;
+        case PReP:
+            ped_partition_set_flag(me, PED_PARTITION_PREP, 1);
+            break;
+        case None:
+            /* we good */
+            break;
+        }
 
-    int res = ped_disk_add_partition(disk, me, ped_constraint_any(dev));
-    if(res == 0) {
-        output_error(pos, "partition: error adding partition to " +
-                     this->device());
-        ped_disk_destroy(disk);
-        return false;
+        int res = ped_disk_add_partition(disk, me, ped_constraint_any(dev));
+        if(res == 0) {
+            output_error(pos, "partition: error adding partition to " +
+                         part->device());
+            ped_disk_destroy(disk);
+            return false;
+        }
     }
 
-    res = ped_disk_commit(disk);
+    const int res = ped_disk_commit(disk);
     if(res != 1) {
-        output_error(pos, "partition: error flushing changes to " +
-                     this->device());
+        output_error(parts.back()->pos, "partition: error flushing changes "
+                     "to " + first->device());
         ped_disk_destroy(disk);
         return false;
     }
@@ -586,7 +683,7 @@ const static std::set<std::string> valid_fses = {
 };
 
 
-Key *Filesystem::parseFromData(const std::string &data,
+Key *Filesystem::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors, int *,
                                const Script *script) {
     if(std::count(data.begin(), data.end(), ' ') != 1) {
@@ -634,7 +731,19 @@ Key *Filesystem::parseFromData(const std::string &data,
         type = XFS;
     }
 
-    return new Filesystem(script, pos, device, type);
+    return new(script) Filesystem(script, pos, device, type);
+}
+
+Key *Filesystem::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    const std::string_view block = in.get_string();
+    const FilesystemType type = static_cast<FilesystemType>(in.get_number());
+    return new(script) Filesystem(script, pos, block, type);
+}
+
+void Filesystem::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_number(this->_type);
 }
 
 bool Filesystem::validate() const {
@@ -646,7 +755,7 @@ bool Filesystem::execute() const {
     std::string cmd;
     std::vector<std::string> args;
 
-    output_info(pos, "fs: creating new filesystem on " + _block);
+    output_info(pos, "fs: creating new filesystem on " + device());
 
     switch(_type) {
     case Ext2:
@@ -681,7 +790,7 @@ bool Filesystem::execute() const {
         args.push_back("-F");
     }
 
-    args.push_back(_block);
+    args.push_back(device());
 
     if(script->options().test(Simulate)) {
         std::cout << cmd;
@@ -702,7 +811,7 @@ bool Filesystem::execute() const {
 }
 
 
-Key *Mount::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Mount::parseFromData(std::string_view data, const ScriptLocation &pos,
                           int *errors, int *, const Script *script) {
     std::string dev, where, opt;
     std::string::size_type where_pos, opt_pos;
@@ -742,7 +851,21 @@ Key *Mount::parseFromData(const std::string &data, const ScriptLocation &pos,
 
     if(any_failure) return nullptr;
 
-    return new Mount(script, pos, dev, where, opt);
+    return new(script) Mount(script, pos, dev, where, opt);
+}
+
+Key *Mount::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                         const Script *script) {
+    const std::string_view block = in.get_string();
+    const std::string_view mountpoint = in.get_string();
+    const std::string_view opts = in.get_string();
+    return new(script) Mount(script, pos, block, mountpoint, opts);
+}
+
+void Mount::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_block);
+    out.put_string(this->_mountpoint);
+    out.put_string(this->_opts);
 }
 
 bool Mount::validate() const {
@@ -848,13 +971,8 @@ bool Mount::execute() const {
                                "target /etc", ec.message());
             }
         }
-        std::ofstream fstab_f(script->targetDirectory() + "/etc/fstab",
-                              std::ios::app);
-        if(!fstab_f) {
-            output_error(pos, "mount: failure opening /etc/fstab for writing");
-            return false;
-        }
-        fstab_f << this->device() << "\t" << this->mountpoint() << "\t"
+        files(script)->append("/etc/fstab")
+                << this->device() << "\t" << this->mountpoint() << "\t"
                 << fstype << "\t" << fstab_opts << "\t0\t" << pass
                 << std::endl;
     }
@@ -20,20 +20,23 @@ namespace Keys {
 
 class DiskId : public Key {
 private:
-    const std::string _block;
-    const std::string _ident;
+    const std::pmr::string _block;
+    const std::pmr::string _ident;
 
     DiskId(const Script *_s, const ScriptLocation &_p,
-           const std::string &my_block, const std::string &my_i) :
-        Key(_s, _p), _block(my_block), _ident(my_i) {}
+           std::string_view my_block, std::string_view my_i) :
+        Key(_s, _p), _block(my_block, alloc()), _ident(my_i, alloc()) {}
 public:
     /*! Retrieve the block device that this key identifies. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retrieve the identification for the block device. */
-    const std::string ident() const { return this->_ident; }
+    const std::string ident() const { return std::string(this->_ident); }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
@@ -50,20 +53,23 @@ public:
         GPT
     };
 private:
-    const std::string _block;
+    const std::pmr::string _block;
     const LabelType _type;
 
-    DiskLabel(const Script *_s, const ScriptLocation &_p, const std::string &_b,
+    DiskLabel(const Script *_s, const ScriptLocation &_p, std::string_view _b,
               const LabelType &_t) :
-        Key(_s, _p), _block(_b), _type(_t) {}
+        Key(_s, _p), _block(_b, alloc()), _type(_t) {}
 public:
     /*! Retrieve the block device that this key identifies. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retrieve the type of disklabel for the block device. */
     LabelType type() const { return this->_type; }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
@@ -94,20 +100,20 @@ public:
         PReP
     };
 private:
-    const std::string _block;
+    const std::pmr::string _block;
     const int _partno;
     const SizeType _size_type;
     const uint64_t _size;
     const PartitionType _type;
 
     Partition(const Script *_sc, const ScriptLocation &_pos,
-              const std::string &_b, const int _p, const SizeType _st,
+              std::string_view _b, const int _p, const SizeType _st,
               const uint64_t _s, const PartitionType _pt) :
-        Key(_sc, _pos), _block(_b), _partno(_p), _size_type(_st), _size(_s),
-        _type(_pt) {}
+        Key(_sc, _pos), _block(_b, alloc()), _partno(_p), _size_type(_st),
+        _size(_s), _type(_pt) {}
 public:
     /*! Retrieve the block device that this key identifies. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retrieve the partition number that this key identifies. */
     int partno() const { return this->_partno; }
     /*! Retrieve the type of size that this partition uses. */
@@ -117,27 +123,41 @@ public:
     /*! Retrieve the Type Code of this partition, if any. */
     PartitionType type() const { return this->_type; }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
+
+    /*! Create every partition in +parts+, writing the partition table once.
+     * @param parts     The partitions to create, which must all be on the
+     *                  same device and sorted by partition number.
+     * @returns true if every partition was created, false otherwise.
+     */
+    static bool execute_all(const std::vector<const Partition *> &parts);
 };
 
 class Encrypt : public Key {
 private:
-    const std::string _block;
-    const std::string _pw;
+    const std::pmr::string _block;
+    const std::pmr::string _pw;
 
-    Encrypt(const Script *_s, const ScriptLocation &_pos, const std::string &_b,
-            const std::string &_p) : Key(_s, _pos), _block(_b), _pw(_p) {}
+    Encrypt(const Script *_s, const ScriptLocation &_pos, std::string_view _b,
+            std::string_view _p) : Key(_s, _pos), _block(_b, alloc()),
+        _pw(_p, alloc()) {}
 public:
     /*! Retrieve the block device that this key encrypts. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retrieve the passphrase used to encrypt the block device. */
-    const std::string passphrase() const { return this->_pw; }
+    const std::string passphrase() const { return std::string(this->_pw); }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
@@ -145,29 +165,34 @@ public:
 class LVMPhysical : public StringKey {
 private:
     LVMPhysical(const Script *_s, const ScriptLocation &_p,
-                const std::string &_d) : StringKey(_s, _p, _d) {}
+                std::string_view _d) : StringKey(_s, _p, _d) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class LVMGroup : public Key {
 private:
-    const std::string _pv;
-    const std::string _vgname;
+    const std::pmr::string _pv;
+    const std::pmr::string _vgname;
 
     LVMGroup(const Script *_s, const ScriptLocation &_pos,
-             const std::string &_p, const std::string &_v) :
-        Key(_s, _pos), _pv(_p), _vgname(_v) {}
+             std::string_view _p, std::string_view _v) :
+        Key(_s, _pos), _pv(_p, alloc()), _vgname(_v, alloc()) {}
 public:
     /*! Retrieve the physical volume where this volume group will reside. */
-    const std::string pv() const { return this->_pv; }
+    const std::string pv() const { return std::string(this->_pv); }
     /*! Retrieve the name of this volume group. */
-    const std::string name() const { return this->_vgname; }
+    const std::string name() const { return std::string(this->_vgname); }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     /*! Determine if the PV passed is a real one. */
     bool test_pv() const;
@@ -176,27 +201,31 @@ public:
 
 class LVMVolume : public Key {
 private:
-    const std::string _vg;
-    const std::string _lvname;
+    const std::pmr::string _vg;
+    const std::pmr::string _lvname;
     const SizeType _size_type;
     const uint64_t _size;
 
     LVMVolume(const Script *_sc, const ScriptLocation &_pos,
-              const std::string &_v, const std::string &_n, SizeType _t,
+              std::string_view _v, std::string_view _n, SizeType _t,
               uint64_t _s) :
-        Key(_sc, _pos), _vg(_v), _lvname(_n), _size_type(_t), _size(_s) {}
+        Key(_sc, _pos), _vg(_v, alloc()), _lvname(_n, alloc()),
+        _size_type(_t), _size(_s) {}
 public:
     /*! Retrieve the volume group to which this volume belongs. */
-    const std::string vg() const { return this->_vg; }
+    const std::string vg() const { return std::string(this->_vg); }
     /*! Retrieve the name of this volume. */
-    const std::string name() const { return this->_lvname; }
+    const std::string name() const { return std::string(this->_lvname); }
     /*! Retrieve the type of size that this volume uses. */
     SizeType size_type() const { return this->_size_type; }
     /*! Retrieve the size of this volume. */
     uint64_t size() const { return this->_size; }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
@@ -213,45 +242,53 @@ public:
         XFS
     };
 private:
-    const std::string _block;
+    const std::pmr::string _block;
     FilesystemType _type;
 
     Filesystem(const Script *_s, const ScriptLocation &_pos,
-               const std::string &_b, FilesystemType _t) :
-        Key(_s, _pos), _block(_b), _type(_t) {}
+               std::string_view _b, FilesystemType _t) :
+        Key(_s, _pos), _block(_b, alloc()), _type(_t) {}
 public:
     /*! Retrieve the block device on which to create the filesystem. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retreive the type of filesystem to create. */
     FilesystemType fstype() const { return this->_type; }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
 
 class Mount : public Key {
 private:
-    const std::string _block;
-    const std::string _mountpoint;
-    const std::string _opts;
+    const std::pmr::string _block;
+    const std::pmr::string _mountpoint;
+    const std::pmr::string _opts;
 
     Mount(const Script *_s, const ScriptLocation &_pos,
-          const std::string &my_block, const std::string &my_mountpoint,
-          const std::string &my_opts = "") :
-        Key(_s, _pos), _block(my_block), _mountpoint(my_mountpoint),
-        _opts(my_opts) {}
+          std::string_view my_block, std::string_view my_mountpoint,
+          std::string_view my_opts = "") :
+        Key(_s, _pos), _block(my_block, alloc()),
+        _mountpoint(my_mountpoint, alloc()), _opts(my_opts, alloc()) {}
 public:
     /*! Retrieve the block device to which this mount pertains. */
-    const std::string device() const { return this->_block; }
+    const std::string device() const { return std::string(this->_block); }
     /*! Retrieve the mountpoint for this mount. */
-    const std::string mountpoint() const { return this->_mountpoint; }
+    const std::string mountpoint() const {
+        return std::string(this->_mountpoint);
+    }
     /*! Retrieve the mount options for this mount, if any. */
-    const std::string options() const { return this->_opts; }
+    const std::string options() const { return std::string(this->_opts); }
 
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
     bool validate() const override;
     bool execute() const override;
 };
@@ -18,14 +18,16 @@
 #   include "util/filesystem.hh"
 #endif /* HAS_INSTALL_ENV */
 #include "disk.hh"
+#include "inventory.hh"
+#include "script_c.hh"
 #include "util.hh"
 #include "util/output.hh"
 
 using namespace Horizon::Keys;
 
-bool parse_size_string(const std::string &, uint64_t *, SizeType *);
+bool parse_size_string(const std::string &, uint64_t *, SizeType *, int *);
 
-Key *LVMPhysical::parseFromData(const std::string &data,
+Key *LVMPhysical::parseFromData(std::string_view data,
                                 const ScriptLocation &pos, int *errors, int *,
                                 const Script *script) {
     if(data.size() < 6 || data.substr(0, 5) != "/dev/") {
@@ -34,11 +36,16 @@ Key *LVMPhysical::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new LVMPhysical(script, pos, data);
+    return new(script) LVMPhysical(script, pos, data);
+}
+
+Key *LVMPhysical::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                               const Script *script) {
+    return new(script) LVMPhysical(script, pos, in.get_string());
 }
 
 bool LVMPhysical::execute() const {
-    output_info(pos, "lvm_pv: creating physical volume on " + _value);
+    output_info(pos, "lvm_pv: creating physical volume on " + value());
 
     if(script->options().test(Simulate)) {
         std::cout << "pvcreate --force " << _value << std::endl;
@@ -52,8 +59,8 @@ bool LVMPhysical::execute() const {
         return true;
     }
 
-    if(run_command("pvcreate", {"--force", _value}) != 0) {
-        output_error(pos, "lvm_pv: failed to create physical volume", _value);
+    if(run_command("pvcreate", {"--force", value()}) != 0) {
+        output_error(pos, "lvm_pv: failed to create physical volume", value());
         return false;
     }
 #endif /* HAS_INSTALL_ENV */
@@ -114,7 +121,7 @@ bool is_valid_lvm_lv_name(const std::string &name) {
 }
 
 
-Key *LVMGroup::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *LVMGroup::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
     std::string::size_type space = data.find_first_of(' ');
     if(space == std::string::npos || data.size() == space + 1) {
@@ -139,7 +146,19 @@ Key *LVMGroup::parseFromData(const std::string &data, const ScriptLocation &pos,
         return nullptr;
     }
 
-    return new LVMGroup(script, pos, pv, name);
+    return new(script) LVMGroup(script, pos, pv, name);
+}
+
+Key *LVMGroup::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    const std::string_view pv = in.get_string();
+    const std::string_view vg = in.get_string();
+    return new(script) LVMGroup(script, pos, pv, vg);
+}
+
+void LVMGroup::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_pv);
+    out.put_string(this->_vgname);
 }
 
 bool LVMGroup::validate() const {
@@ -150,6 +169,13 @@ bool LVMGroup::validate() const {
 /* LCOV_EXCL_START */
 bool LVMGroup::test_pv() const {
 #ifdef HAS_INSTALL_ENV
+    std::string type;
+    Horizon::BlockInventory *inventory = Horizon::BlockInventory::current();
+    if(inventory != nullptr && inventory->type(this->pv(), type)) {
+        /* an empty type is inconclusive, as below */
+        return type.empty() || type == "LVM2_member";
+    }
+
     const char *fstype = blkid_get_tag_value(nullptr, "TYPE",
                                              this->pv().c_str());
     if(fstype == nullptr) {
@@ -208,7 +234,7 @@ bool does_vg_exist_on_pv(const std::string &vg, const std::string &pv,
 #endif /* HAS_INSTALL_ENV */
 
 bool LVMGroup::execute() const {
-    output_info(pos, "lvm_vg: creating volume group " + _vgname + " on " + _pv);
+    output_info(pos, "lvm_vg: creating volume group " + name() + " on " + pv());
 
     if(script->options().test(Simulate)) {
         std::cout << "vgcreate " << _vgname << " " << _pv << std::endl;
@@ -218,15 +244,15 @@ bool LVMGroup::execute() const {
 #ifdef HAS_INSTALL_ENV
     /* REQ: Runner.Execute.lvm_vg.Duplicate */
     if(fs::exists("/dev/" + _vgname)) {
-        return does_vg_exist_on_pv(_vgname, _pv, pos, true);
+        return does_vg_exist_on_pv(name(), pv(), pos, true);
     }
 
-    if(run_command("vgcreate", {_vgname, _pv}) != 0) {
-        if(does_vg_exist_on_pv(_vgname, _pv, pos, true)) {
+    if(run_command("vgcreate", {name(), pv()}) != 0) {
+        if(does_vg_exist_on_pv(name(), pv(), pos, true)) {
             return true;
         }
 
-        output_error(pos, "lvm_vg: failed to create volume group " + _vgname);
+        output_error(pos, "lvm_vg: failed to create volume group " + name());
         return false;
     }
 #endif /* HAS_INSTALL_ENV */
@@ -234,7 +260,7 @@ bool LVMGroup::execute() const {
 }
 
 
-Key *LVMVolume::parseFromData(const std::string &data,
+Key *LVMVolume::parseFromData(std::string_view data,
                               const ScriptLocation &pos, int *errors, int *,
                               const Script *script) {
     std::string vg, name, size_str;
@@ -269,13 +295,32 @@ Key *LVMVolume::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    if(!parse_size_string(size_str, &size, &size_type)) {
+    int size_warnings = 0;
+    if(!parse_size_string(size_str, &size, &size_type, &size_warnings)) {
         if(errors) *errors += 1;
         output_error(pos, "lvm_lv: invalid size", size_str);
         return nullptr;
     }
+    /* The warning for a size without a suffix is not counted. */
+    if(size_warnings > 0) no_cache(script);
+
+    return new(script) LVMVolume(script, pos, vg, name, size_type, size);
+}
+
+Key *LVMVolume::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                             const Script *script) {
+    const std::string_view vg = in.get_string();
+    const std::string_view name = in.get_string();
+    const SizeType size_type = static_cast<SizeType>(in.get_number());
+    const uint64_t size = in.get_number();
+    return new(script) LVMVolume(script, pos, vg, name, size_type, size);
+}
 
-    return new LVMVolume(script, pos, vg, name, size_type, size);
+void LVMVolume::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_vg);
+    out.put_string(this->_lvname);
+    out.put_number(this->_size_type);
+    out.put_number(this->_size);
 }
 
 bool LVMVolume::validate() const {
@@ -283,7 +328,7 @@ bool LVMVolume::validate() const {
 }
 
 bool LVMVolume::execute() const {
-    output_info(pos, "lvm_lv: creating volume " + _lvname + " on " + _vg);
+    output_info(pos, "lvm_lv: creating volume " + name() + " on " + vg());
     std::string param, size;
 
     switch(_size_type) {
@@ -308,8 +353,8 @@ bool LVMVolume::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    if(run_command("lvcreate", {param, size, "-n", _lvname, _vg}) != 0) {
-        output_error(pos, "lvm_lv: failed to create logical volume " + _lvname);
+    if(run_command("lvcreate", {param, size, "-n", name(), vg()}) != 0) {
+        output_error(pos, "lvm_lv: failed to create logical volume " + name());
         return false;
     }
 #endif /* HAS_INSTALL_ENV */
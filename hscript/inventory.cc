@@ -0,0 +1,146 @@
+/*
+ * inventory.cc - Implementation of the block device inventory
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstdlib>          /* free */
+#include <sstream>
+#ifdef HAS_INSTALL_ENV
+#   include <blkid/blkid.h>    /* blkid_* */
+#   include <libudev.h>        /* udev_* */
+#endif /* HAS_INSTALL_ENV */
+#include "inventory.hh"
+#include "util/filesystem.hh"
+
+using namespace Horizon;
+
+BlockInventory::BlockInventory() : _blkid(nullptr) {}
+
+BlockInventory::~BlockInventory() {
+#ifdef HAS_INSTALL_ENV
+    if(_blkid != nullptr) blkid_put_cache(static_cast<blkid_cache>(_blkid));
+#endif /* HAS_INSTALL_ENV */
+}
+
+/*! The snapshot in use on this thread. */
+static thread_local BlockInventory *current_inventory = nullptr;
+
+BlockInventory *BlockInventory::current() {
+    return current_inventory;
+}
+
+BlockInventory::Scope::Scope(BlockInventory *inventory)
+        : _previous(current_inventory) {
+    current_inventory = inventory;
+}
+
+BlockInventory::Scope::~Scope() {
+    current_inventory = _previous;
+}
+
+bool BlockInventory::exists(const std::string &path) {
+    const BlockInventory *inventory = current();
+    if(inventory != nullptr && inventory->find(path) != nullptr) return true;
+
+    error_code ec;
+    return fs::exists(path, ec);
+}
+
+std::unique_ptr<BlockInventory> BlockInventory::scan() {
+#ifdef HAS_INSTALL_ENV
+    struct udev *udev = udev_new();
+    if(!udev) return nullptr;
+
+    struct udev_enumerate *blocks = udev_enumerate_new(udev);
+    if(!blocks) {
+        udev_unref(udev);
+        return nullptr;
+    }
+
+    std::unique_ptr<BlockInventory> inventory(new BlockInventory);
+    struct udev_list_entry *entry;
+    udev_enumerate_add_match_subsystem(blocks, "block");
+    udev_enumerate_scan_devices(blocks);
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(blocks)) {
+        const char *syspath = udev_list_entry_get_name(entry);
+        struct udev_device *dev = udev_device_new_from_syspath(udev, syspath);
+        if(!dev) continue;
+
+        const char *node = udev_device_get_devnode(dev);
+        if(node == nullptr) {
+            udev_device_unref(dev);
+            continue;
+        }
+
+        Device device;
+        const char *value;
+        device.node = node;
+        device.typed = false;
+        if((value = udev_device_get_property_value(dev, "ID_FS_TYPE"))) {
+            device.type = value;
+            device.typed = true;
+        }
+        if((value = udev_device_get_property_value(dev, "DM_VG_NAME"))) {
+            if(*value != '\0') inventory->_vgs.insert(value);
+        }
+
+        const std::size_t index = inventory->_devices.size();
+        inventory->_paths.emplace(device.node, index);
+        /* DEVLINKS holds every link to the node, separated by spaces. */
+        if((value = udev_device_get_property_value(dev, "DEVLINKS"))) {
+            std::istringstream links(value);
+            std::string link;
+            while(links >> link) inventory->_paths.emplace(link, index);
+        }
+        inventory->_devices.push_back(std::move(device));
+        udev_device_unref(dev);
+    }
+
+    udev_enumerate_unref(blocks);
+    udev_unref(udev);
+    return inventory;
+#else
+    return nullptr;
+#endif /* HAS_INSTALL_ENV */
+}
+
+const BlockInventory::Device *BlockInventory::find(const std::string &path)
+        const {
+    const auto found = _paths.find(path);
+    if(found == _paths.end()) return nullptr;
+    return &_devices[found->second];
+}
+
+bool BlockInventory::type(const std::string &path, std::string &type) {
+    const auto found = _paths.find(path);
+    if(found == _paths.end()) return false;
+
+    Device &device = _devices[found->second];
+#ifdef HAS_INSTALL_ENV
+    if(!device.typed) {
+        /* udev has not probed this device; ask blkid once, and remember. */
+        blkid_cache cache = static_cast<blkid_cache>(_blkid);
+        if(cache == nullptr && blkid_get_cache(&cache, nullptr) == 0) {
+            _blkid = cache;
+        }
+        if(cache != nullptr) {
+            char *value = blkid_get_tag_value(cache, "TYPE",
+                                              device.node.c_str());
+            if(value != nullptr) {
+                device.type = value;
+                free(value);
+            }
+        }
+        device.typed = true;
+    }
+#endif /* HAS_INSTALL_ENV */
+    type = device.type;
+    return true;
+}
@@ -0,0 +1,106 @@
+/*
+ * inventory.hh - Definition of the block device inventory
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_INVENTORY_HH_
+#define HSCRIPT_INVENTORY_HH_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Horizon {
+
+/*! A snapshot of the block devices present on the system.
+ * The snapshot is taken with a single udev enumeration, and answers the
+ * existence and type checks made while validating a script, so that each
+ * key does not need to probe the system itself.  Paths that are not in the
+ * snapshot may still exist, so callers should fall back to probing them.
+ */
+class BlockInventory {
+public:
+    /*! A block device in the snapshot. */
+    struct Device {
+        /*! The device node, such as /dev/sda1. */
+        std::string node;
+        /*! The type of the file system or other signature on the device, as
+         * reported by udev; empty if udev does not know it. */
+        std::string type;
+        /*! Whether +type+ has been determined. */
+        bool typed;
+    };
+
+    BlockInventory();
+    ~BlockInventory();
+    BlockInventory(const BlockInventory &) = delete;
+    BlockInventory &operator=(const BlockInventory &) = delete;
+
+    /*! Take a snapshot of the block devices present on the system.
+     * @returns The snapshot, or nullptr if udev is not available.
+     */
+    static std::unique_ptr<BlockInventory> scan();
+
+    /*! Retrieve the snapshot in use on the calling thread.
+     * @returns The snapshot, or nullptr if none is in use.
+     */
+    static BlockInventory *current();
+
+    /*! Uses a snapshot on the calling thread for the lifetime of the
+     * Scope, so that Keys validated meanwhile may consult it. */
+    class Scope {
+        BlockInventory *_previous;
+    public:
+        explicit Scope(BlockInventory *inventory);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    /*! Determine if +path+ exists, consulting the snapshot in use on the
+     * calling thread before probing the file system.
+     */
+    static bool exists(const std::string &path);
+
+    /*! Find the device at +path+, which may be a device node or any of the
+     * links udev has created for it.
+     * @returns The device, or nullptr if it is not in the snapshot.
+     */
+    const Device *find(const std::string &path) const;
+
+    /*! Retrieve the type of the signature on the device at +path+.
+     * Devices whose type udev did not record are probed with blkid, using a
+     * single blkid cache for the entire snapshot.
+     * @param path      The path to the device.
+     * @param type      Output variable: the type, or empty if there is none.
+     * @returns true if +path+ is in the snapshot, false otherwise.
+     */
+    bool type(const std::string &path, std::string &type);
+
+    /*! Determine if the LVM volume group +vg+ has any active volumes. */
+    bool has_vg(const std::string &vg) const {
+        return this->_vgs.find(vg) != this->_vgs.end();
+    }
+private:
+    /*! The devices in the snapshot. */
+    std::vector<Device> _devices;
+    /*! The index in +_devices+ of each device node and link. */
+    std::map<std::string, std::size_t, std::less<>> _paths;
+    /*! The volume groups with active volumes. */
+    std::set<std::string, std::less<>> _vgs;
+    /*! The blkid cache, once it has been needed. */
+    void *_blkid;
+};
+
+}
+
+#endif /* !HSCRIPT_INVENTORY_HH_ */
@@ -0,0 +1,145 @@
+/*
+ * journal.cc - Implementation of the execution journal
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cerrno>
+#include <cstdio>           /* snprintf */
+#include <cstring>          /* strerror */
+#include <fstream>
+#include <sstream>
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* open */
+#   include <unistd.h>         /* close, fsync, unlink, write */
+#endif /* HAS_INSTALL_ENV */
+#include "journal.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+using namespace Horizon;
+
+/*! The first line of a journal, naming its format. */
+#define JOURNAL_MAGIC "horizon-journal 1"
+
+Journal::Journal(const std::string &root) :
+    _path(root + "/var/lib/horizon/journal") {}
+
+bool Journal::load() {
+    std::ifstream in(_path);
+    std::string line;
+    if(!in || !std::getline(in, line)) return false;
+    if(line != JOURNAL_MAGIC) {
+        output_warning("journal", "journal is in an unknown format", _path);
+        return false;
+    }
+
+    _steps.clear();
+    while(std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string step;
+        std::uint64_t digest;
+        if(!(fields >> step >> std::hex >> digest)) {
+            output_warning("journal", "journal is damaged", _path);
+            _steps.clear();
+            return false;
+        }
+        _steps[step] = digest;
+    }
+    return true;
+}
+
+bool Journal::completed(const std::string &step, std::uint64_t digest) const {
+    const auto it = _steps.find(step);
+    return it != _steps.end() && it->second == digest;
+}
+
+bool Journal::record(const std::string &step, std::uint64_t digest) {
+#ifdef HAS_INSTALL_ENV
+    _steps[step] = digest;
+
+    std::string data(JOURNAL_MAGIC "\n");
+    for(const auto &entry : _steps) {
+        char hex[17];
+        snprintf(hex, sizeof hex, "%016llx",
+                 static_cast<unsigned long long>(entry.second));
+        data += entry.first + " " + hex + "\n";
+    }
+
+    error_code ec;
+    const fs::path dir = fs::path(_path).parent_path();
+    fs::create_directories(dir, ec);
+
+    /* The new journal replaces the old one only once it is on disk, and the
+     * directory is flushed so that the rename is too. */
+    const std::string temp(_path + "+");
+    const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                        O_NOFOLLOW | O_CLOEXEC, 0644);
+    bool ok = (fd != -1);
+    for(std::size_t done = 0; ok && done < data.size();) {
+        const ssize_t ret = ::write(fd, data.data() + done,
+                                    data.size() - done);
+        if(ret < 0) {
+            if(errno != EINTR) ok = false;
+        } else {
+            done += static_cast<std::size_t>(ret);
+        }
+    }
+    ok = ok && fsync(fd) == 0;
+    const int saved_errno = errno;
+    if(fd != -1 && close(fd) != 0) ok = false;
+    if(!ok || ::rename(temp.c_str(), _path.c_str()) != 0) {
+        output_error("journal", "cannot record step " + step,
+                     strerror(ok ? errno : saved_errno));
+        unlink(temp.c_str());
+        return false;
+    }
+
+    const int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd == -1 || fsync(dir_fd) != 0) {
+        output_error("journal", "cannot record step " + step,
+                     strerror(errno));
+        if(dir_fd != -1) close(dir_fd);
+        return false;
+    }
+    close(dir_fd);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+void Journal::remove() {
+#ifdef HAS_INSTALL_ENV
+    _steps.clear();
+    error_code ec;
+    fs::remove(_path, ec);
+    /* The directory is only removed if nothing else was put there. */
+    fs::remove(fs::path(_path).parent_path(), ec);
+#endif /* HAS_INSTALL_ENV */
+}
+
+std::set<std::string> Journal::installed_packages(const std::string &root) {
+    std::set<std::string> names;
+    std::ifstream db(root + "/lib/apk/db/installed");
+    std::string line;
+    while(std::getline(db, line)) {
+        if(line.compare(0, 2, "P:") == 0) {
+            names.insert(line.substr(2));
+        } else if(line.compare(0, 2, "p:") == 0) {
+            /* Each thing a package provides may have a version. */
+            std::istringstream provides(line.substr(2));
+            std::string name;
+            while(provides >> name) {
+                names.insert(name.substr(0, name.find('=')));
+            }
+        }
+    }
+    return names;
+}
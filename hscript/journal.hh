@@ -0,0 +1,101 @@
+/*
+ * journal.hh - Definition of the execution journal
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_JOURNAL_HH_
+#define HSCRIPT_JOURNAL_HH_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include "key.hh"
+#include "script_c.hh"
+
+namespace Horizon {
+
+/*! Computes the digest of the inputs of an execution step: the data of
+ * each Key the step executes, as saved to the parse cache.  The locations
+ * of the Keys are not part of it, so editing other parts of a script does
+ * not change the digest of a step.
+ */
+class JournalDigest {
+private:
+    CacheWriter _data;
+public:
+    /*! Add a label, such as the name of a group of Keys. */
+    void add(std::string_view label) { _data.put_string(label); }
+    /*! Add a Key, which may be nullptr if it was not specified. */
+    void add(const Keys::Key *key) {
+        _data.put_number(key != nullptr);
+        if(key != nullptr) key->saveToCache(_data);
+    }
+    /*! Add every Key in +keys+. */
+    template<typename T>
+    void add_all(const T &keys) {
+        _data.put_number(keys.size());
+        for(const auto &key : keys) add(key);
+    }
+    /*! Add a set (or other container) of strings. */
+    template<typename T>
+    void add_strings(const T &strings) { _data.put_strings(strings); }
+
+    /*! Retrieve the digest of everything added. */
+    std::uint64_t value() const { return cache_hash(_data.data()); }
+};
+
+/*! Records the execution steps that have completed on a target.
+ *
+ * The journal is kept in /var/lib/horizon/journal on the target itself, so
+ * that it is only found again once the target is mounted as it was.  Each
+ * step is recorded with the digest of its inputs once its effects are on
+ * disk, by replacing the journal with a copy that is flushed first.  A
+ * resumed execution skips a step only if the journal records it with the
+ * same digest.  The journal is removed once execution succeeds.
+ */
+class Journal {
+public:
+    /*! Create a journal for the system rooted at +root+. */
+    explicit Journal(const std::string &root);
+
+    /*! Read the journal of the target.
+     * @returns true if a journal was read, false if there is none or it is
+     * unreadable.
+     */
+    bool load();
+
+    /*! Determine if +step+ completed with inputs having +digest+. */
+    bool completed(const std::string &step, std::uint64_t digest) const;
+
+    /*! Record that +step+ completed with inputs having +digest+.
+     * @returns true if the record is on disk, false otherwise.
+     */
+    bool record(const std::string &step, std::uint64_t digest);
+
+    /*! Remove the journal from the target, and its directory if that is
+     * then empty. */
+    void remove();
+
+    /*! Retrieve the names of the packages installed on the system rooted at
+     * +root+, and of those that they provide, from its APK database. */
+    static std::set<std::string> installed_packages(const std::string &root);
+private:
+    /*! The path of the journal on the host. */
+    const std::string _path;
+    /*! The digest of each completed step, by name. */
+    std::map<std::string, std::uint64_t> _steps;
+};
+
+}
+
+#endif /* !HSCRIPT_JOURNAL_HH_ */
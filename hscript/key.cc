@@ -12,13 +12,42 @@
 
 #include <algorithm>
 #include "key.hh"
+#include "script_c.hh"
+#include "script_i.hh"
 #include "util/output.hh"
 
 
+Horizon::Keys::Key::Key(const Script *_s, const ScriptLocation &_p) :
+    script{_s}, pos{_s->internal->intern(_p.name), _p.line, _p.inherited} {}
+
 Horizon::Keys::Key::~Key() {
 }
 
-bool Horizon::Keys::BooleanKey::parse(const std::string &what,
+std::pmr::memory_resource *Horizon::Keys::Key::arena(const Script *s) {
+    return &s->internal->arena;
+}
+
+void Horizon::Keys::Key::no_cache(const Script *s) {
+    s->internal->cacheable = false;
+}
+
+Horizon::UserDatabase *Horizon::Keys::Key::users(const Script *s) {
+    return s->internal->users.get();
+}
+
+Horizon::TargetFiles *Horizon::Keys::Key::files(const Script *s) {
+    return s->internal->files.get();
+}
+
+Horizon::NetConfig *Horizon::Keys::Key::network_config(const Script *s) {
+    return &s->internal->network_config;
+}
+
+Horizon::ChrootAgent *Horizon::Keys::Key::chroot_agent(const Script *s) {
+    return s->internal->agent.get();
+}
+
+bool Horizon::Keys::BooleanKey::parse(std::string_view what,
                                       const ScriptLocation &where,
                                       const std::string &key, bool *out) {
     std::string lower(what.size(), 0);
@@ -30,7 +59,7 @@ bool Horizon::Keys::BooleanKey::parse(const std::string &what,
         *out = false;
     } else {
         output_error(where, key + ": expected 'true' or 'false'",
-                     "'" + what + "' is not a valid Boolean value");
+                     "'" + std::string(what) + "' is not a valid Boolean value");
         return false;
     }
     return true;
@@ -41,7 +70,15 @@ bool Horizon::Keys::BooleanKey::validate() const {
     return true;
 }
 
+void Horizon::Keys::BooleanKey::saveToCache(CacheWriter &out) const {
+    out.put_number(this->value);
+}
+
 bool Horizon::Keys::StringKey::validate() const {
     /* Key will fail init if it is not valid, so this is always a no-op. */
     return true;
 }
+
+void Horizon::Keys::StringKey::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_value);
+}
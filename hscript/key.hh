@@ -13,26 +13,97 @@
 #ifndef __HSCRIPT_KEY_HH_
 #define __HSCRIPT_KEY_HH_
 
+#include <cstddef>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include "script.hh"
 
 namespace Horizon {
+
+class CacheReader;
+class ChrootAgent;
+class CacheWriter;
+class NetConfig;
+class TargetFiles;
+class UserDatabase;
+
 namespace Keys {
 
+/*! Defines the location of a Key within a script.
+ * This is a ScriptLocation whose name is owned by the Script that owns the
+ * Key, so that Keys from the same file share a single copy of the name.
+ */
+struct KeyLocation {
+    /*! The filename of the script. */
+    std::string_view name;
+    /*! The line number of the current location. */
+    int line;
+    /*! Whether this script is inherited or the original script. */
+    bool inherited;
+
+    operator ScriptLocation() const {
+        return ScriptLocation(std::string(name), line, inherited);
+    }
+};
+
 /*! Base Key class, used by all Keys.
  * A Getter method is not provided in this base Key class, because each Key may
  * return a different type of data.  For example, `network` may return `bool`.
+ *
+ * Keys are allocated from the arena of the Script that owns them, using
+ * `new(script) T(...)`, and are all released at once when the Script is
+ * destroyed.  Destructors of Keys are not run, so any memory held by a Key
+ * must come from the arena as well; use alloc() to construct members.
  */
 class Key {
 protected:
     /*! The script that owns this Key. */
     const Script *script;
     /*! The line number where this Key appeared. */
-    const ScriptLocation pos;
-    Key(const Script *_s, const ScriptLocation &_p) : script{_s}, pos{_p} {}
+    const KeyLocation pos;
+    Key(const Script *_s, const ScriptLocation &_p);
+
+    /*! Retrieve the arena of the specified Script. */
+    static std::pmr::memory_resource *arena(const Script *s);
+    /*! Prevent the specified Script from being saved to the parse cache.
+     * This must be called by parseFromData if it outputs a diagnostic that
+     * is not counted as an error or warning, since loading the Script from
+     * the cache would not output it again.
+     */
+    static void no_cache(const Script *s);
+    /*! Retrieve the user database of the target of the specified Script.
+     * This is only open while the account Keys are executing. */
+    static UserDatabase *users(const Script *s);
+    /*! Retrieve the writer for files on the target of the specified Script.
+     * This is only open while the Script is executing. */
+    static TargetFiles *files(const Script *s);
+    /*! Retrieve the network configuration being built for the specified
+     * Script by the network Keys. */
+    static NetConfig *network_config(const Script *s);
+    /*! Retrieve the agent that runs commands inside the target of the
+     * specified Script.  This is only open while the bootloader is being
+     * configured. */
+    static ChrootAgent *chroot_agent(const Script *s);
+    /*! Retrieve an allocator for memory owned by this Key. */
+    std::pmr::polymorphic_allocator<char> alloc() const {
+        return arena(this->script);
+    }
 public:
     virtual ~Key();
 
+    /*! Allocate a Key from the arena of the specified Script. */
+    static void *operator new(std::size_t size, const Script *s) {
+        return arena(s)->allocate(size, alignof(std::max_align_t));
+    }
+    /*! Called only if a Key constructor throws; the arena keeps the memory. */
+    static void operator delete(void *, const Script *) {}
+    /*! Keys are released with the Script that owns them. */
+    static void operator delete(void *) {}
+
+    /*! Shared Keys are copied by the Script that shares them. */
+    friend struct Script::ScriptPrivate;
+
     /*! Create the Key object with the specified data as the entire value.
      * @param data      The value associated with the key.
      * @param pos       The location where the key occurs.
@@ -42,15 +113,32 @@ public:
      */
 #define UNUSED __attribute__((unused))
     /* LCOV_EXCL_START */
-    static Key *parseFromData(const std::string &data UNUSED,
+    static Key *parseFromData(std::string_view data UNUSED,
                               const ScriptLocation &pos UNUSED,
                               int *errors UNUSED, int *warnings UNUSED,
                               const Script *s UNUSED) {
         return nullptr;
     }
+    /*! Create the Key object from an entry of the parse cache.
+     * @param in        The reader for the entry.
+     * @param pos       The location where the key occurs.
+     * @returns nullptr if the entry is unreadable, otherwise a pointer to a
+     *          Key equal to the one saved by saveToCache.
+     */
+    static Key *loadFromCache(CacheReader &in UNUSED,
+                              const ScriptLocation &pos UNUSED,
+                              const Script *s UNUSED) {
+        return nullptr;
+    }
     /* LCOV_EXCL_STOP */
 #undef UNUSED
 
+    /*! Save the data associated with the Key to an entry of the parse cache.
+     * Keys are saved after they are parsed, so only data that parseFromData
+     * accepted will ever be saved.
+     */
+    virtual void saveToCache(CacheWriter &out) const = 0;
+
     /*! Determines if the data associated with the Key is valid. */
     virtual bool validate() const = 0;
 
@@ -82,7 +170,7 @@ protected:
      * @param out       Output variable: will contain the value.
      * @returns true if value is parsed successfully, false otherwise.
      */
-    static bool parse(const std::string &what, const ScriptLocation &where,
+    static bool parse(std::string_view what, const ScriptLocation &where,
                       const std::string &key, bool *out);
 public:
     /*! Determines if the Key is set or not.
@@ -92,24 +180,27 @@ public:
 
     /*! Key will fail to init if valid is invalid. */
     bool validate() const override;
+    void saveToCache(CacheWriter &out) const override;
 };
 
 
 /*! Base Key class that parses and handles single string values. */
 class StringKey : public Key {
 protected:
-    const std::string _value;
+    const std::pmr::string _value;
     StringKey(const Script *_s, const ScriptLocation &_p,
-              const std::string &my_str) : Key{_s, _p}, _value{my_str} {}
+              std::string_view my_str) : Key{_s, _p},
+        _value{my_str, alloc()} {}
 
 public:
     /*! Retrieve the value of this key. */
-    const std::string value() const { return this->_value; }
+    const std::string value() const { return std::string(this->_value); }
 
     /*! By default, key will be considered valid since it parsed.
      * This method should be overridden when further consideration is needed.
      */
     bool validate() const override;
+    void saveToCache(CacheWriter &out) const override;
 };
 
 }
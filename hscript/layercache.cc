@@ -0,0 +1,136 @@
+/*
+ * layercache.cc - Implementation of the package layer cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstdio>           /* snprintf, rename */
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* utimensat */
+#   include <sys/stat.h>       /* UTIME_NOW, lstat */
+#   include <unistd.h>         /* getpid */
+#endif /* HAS_INSTALL_ENV */
+#include "layercache.hh"
+#include "util.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+#include "util/profile.hh"
+
+using namespace Horizon;
+
+#ifdef HAS_INSTALL_ENV
+/*! Add each file under +dir+ in +root+ that is on device +dev+ to +out+. */
+static void list_files(const std::string &root, const std::string &dir,
+                       dev_t dev, std::set<std::string> &out) {
+    error_code ec;
+    for(fs::directory_iterator it(root + dir, ec), end;
+        !ec && it != end; it.increment(ec)) {
+        const std::string path(dir + "/" + it->path().filename().string());
+        struct stat st;
+        if(lstat((root + path).c_str(), &st) != 0) continue;
+        if(!S_ISDIR(st.st_mode)) {
+            out.insert(path);
+        } else if(st.st_dev == dev) {
+            list_files(root, path, dev, out);
+        }
+    }
+}
+#endif /* HAS_INSTALL_ENV */
+
+/*! Name the layer with digest +key+ in the cache at +dir+. */
+static std::string layer_path(const std::string &dir, std::uint64_t key) {
+    char hex[17];
+    snprintf(hex, sizeof hex, "%016llx", static_cast<unsigned long long>(key));
+    return dir + "/" + hex;
+}
+
+LayerCache::LayerCache(const std::string &dir, std::uint64_t key)
+    : _dir(dir), _path(layer_path(dir, key)) {}
+
+bool LayerCache::open() {
+#ifdef HAS_INSTALL_ENV
+    error_code ec;
+    fs::create_directories(_dir, ec);
+    if(ec) {
+        output_warning("layercache", "cannot create layer cache " + _dir,
+                       ec.message());
+        return false;
+    }
+    output_info("layercache", "using layer cache " + _dir);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+bool LayerCache::exists() const {
+    error_code ec;
+    return fs::is_directory(_path, ec);
+}
+
+bool LayerCache::restore(const std::string &root) const {
+#ifdef HAS_INSTALL_ENV
+    ProfileSpan span("layercache", "restore");
+    output_info("layercache", "restoring installed packages from layer",
+                _path);
+    if(run_command("cp", {"-a", "--reflink=auto", _path + "/.", root}) != 0) {
+        output_error("layercache", "cannot restore layer", _path);
+        return false;
+    }
+
+    /* The time a layer was last used shows which are no longer needed. */
+    const struct timespec now[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+    utimensat(AT_FDCWD, _path.c_str(), now, 0);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+std::set<std::string> LayerCache::files(const std::string &root) {
+    std::set<std::string> found;
+#ifdef HAS_INSTALL_ENV
+    struct stat st;
+    if(stat(root.c_str(), &st) == 0) list_files(root, "", st.st_dev, found);
+#endif /* HAS_INSTALL_ENV */
+    return found;
+}
+
+bool LayerCache::save(const std::string &root,
+                      const std::set<std::string> &exclude) const {
+#ifdef HAS_INSTALL_ENV
+    ProfileSpan span("layercache", "save");
+    error_code ec;
+    const std::string temp(_path + ".new-" + std::to_string(getpid()));
+    fs::remove_all(temp, ec);
+
+    output_info("layercache", "saving installed packages as layer", _path);
+    if(run_command("cp", {"-a", "-x", "--reflink=auto", root + "/.",
+                          temp}) != 0) {
+        output_warning("layercache", "cannot save layer", _path);
+        fs::remove_all(temp, ec);
+        return false;
+    }
+    for(const auto &path : exclude) {
+        fs::remove(temp + path, ec);
+    }
+
+    /* Another build may have saved the same layer in the meantime. */
+    if(::rename(temp.c_str(), _path.c_str()) != 0) {
+        fs::remove_all(temp, ec);
+        if(!exists()) {
+            output_warning("layercache", "cannot save layer", _path);
+            return false;
+        }
+    }
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
@@ -0,0 +1,82 @@
+/*
+ * layercache.hh - Definition of the package layer cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_LAYERCACHE_HH_
+#define HSCRIPT_LAYERCACHE_HH_
+
+#include <cstdint>
+#include <set>
+#include <string>
+
+namespace Horizon {
+
+/*! A directory on the host holding snapshots of image targets as they were
+ * once their packages were installed, shared by every image build that
+ * uses it.
+ *
+ * Each snapshot, or layer, is named by the digest of everything that
+ * decides which packages are installed: the architecture, repositories,
+ * signing keys, and packages.  A build with the same digest copies the layer
+ * to its target instead of installing packages, and only configures the
+ * system.  Layers are copied with reflinks where the file system of the
+ * cache supports them, so that restoring one takes almost no time or space.
+ * A layer is written under a temporary name and renamed into place once it
+ * is complete, so that a build never restores part of one.
+ *
+ * Layers are never removed.  Packages published after a layer was written
+ * are not in it, so a restored layer must be upgraded.
+ */
+class LayerCache {
+public:
+    /*! Create a cache in +dir+, for the layer with digest +key+. */
+    LayerCache(const std::string &dir, std::uint64_t key);
+
+    /*! Create the cache directory if needed.
+     * @returns true if the cache may be used, false otherwise.
+     */
+    bool open();
+
+    /*! Determine if the layer is in the cache. */
+    bool exists() const;
+
+    /*! Copy the layer to the system rooted at +root+.
+     * @returns true if the layer was copied, false otherwise.
+     */
+    bool restore(const std::string &root) const;
+
+    /*! List every file in the system rooted at +root+, relative to it, as
+     * given to save.  Directories and file systems mounted inside +root+
+     * are left out.  Listing the files there before packages are installed
+     * keeps those written by anything else out of the layer.
+     */
+    static std::set<std::string> files(const std::string &root);
+
+    /*! Write the system rooted at +root+ to the cache as the layer.  File
+     * systems mounted inside +root+ are left out, as is each file in
+     * +exclude+, given relative to +root+.
+     * @returns true if the layer was written, false otherwise.
+     */
+    bool save(const std::string &root,
+              const std::set<std::string> &exclude) const;
+
+    /*! Retrieve the directory holding the layer. */
+    const std::string &path() const { return _path; }
+private:
+    /*! The directory holding the cache. */
+    const std::string _dir;
+    /*! The directory holding the layer. */
+    const std::string _path;
+};
+
+}
+
+#endif /* !HSCRIPT_LAYERCACHE_HH_ */
@@ -11,7 +11,7 @@
  */
 
 #include <assert.h>
-#include <fstream>
+#include <memory>
 #include <regex>
 #include <set>
 #include <sstream>
@@ -20,22 +20,30 @@
 #   include "util/filesystem.hh"
 #endif /* HAS_INSTALL_ENV */
 #include <unistd.h>         /* access - used by tz code even in RT env */
+#include "chroot.hh"
 #include "meta.hh"
+#include "targetfiles.hh"
+#include "script_c.hh"
 #include "util.hh"
 #include "util/output.hh"
 
 using namespace Horizon::Keys;
 
-Key *Hostname::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Hostname::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
     std::string valid_chars("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.");
     if(data.find_first_not_of(valid_chars) != std::string::npos) {
         if(errors) *errors += 1;
         output_error(pos, "hostname: expected machine or DNS name",
-                     "'" + data + "' is not a valid hostname");
+                     "'" + std::string(data) + "' is not a valid hostname");
         return nullptr;
     }
-    return new Hostname(script, pos, data);
+    return new(script) Hostname(script, pos, data);
+}
+
+Key *Hostname::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    return new(script) Hostname(script, pos, in.get_string());
 }
 
 bool Hostname::validate() const {
@@ -118,13 +126,7 @@ bool Hostname::execute() const {
             output_error(pos, "hostname: could not create /etc", ec.message());
             return false;
         }
-        std::ofstream hostname_f(script->targetDirectory() + "/etc/hostname",
-                                 std::ios_base::trunc);
-        if(!hostname_f) {
-            output_error(pos, "hostname: could not open /etc/hostname");
-            return false;
-        }
-        hostname_f << actual;
+        files(script)->replace("/etc/hostname") << actual;
     }
 #endif /* HAS_INSTALL_ENV */
 
@@ -151,14 +153,8 @@ bool Hostname::execute() const {
                                  "directory", ec.message());
                 }
             }
-            std::ofstream net_conf_f(script->targetDirectory() +
-                                     "/etc/conf.d/net", std::ios_base::app);
-            if(!net_conf_f) {
-                output_error(pos, "hostname: could not open /etc/conf.d/net "
-                             "for writing");
-                return false;
-            }
-            net_conf_f << "dns_domain_lo=\"" << domain << "\"" << std::endl;
+            files(script)->append("/etc/conf.d/net")
+                    << "dns_domain_lo=\"" << domain << "\"" << std::endl;
         }
 #endif /* HAS_INSTALL_ENV */
     }
@@ -167,7 +163,7 @@ bool Hostname::execute() const {
 }
 
 
-static std::set<std::string> valid_arches = {
+static std::set<std::string, std::less<>> valid_arches = {
     "aarch64", "aarch64_be", "alpha", "armel", "armhf", "armv7",
     "m68k", "mips", "mips64", "mipsel", "mips64el",
     "pmmx", "ppc", "ppc64",
@@ -177,22 +173,29 @@ static std::set<std::string> valid_arches = {
 };
 
 
-Key *Arch::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Arch::parseFromData(std::string_view data, const ScriptLocation &pos,
                          int *errors, int *warnings, const Script *script) {
     if(data.find_first_not_of("abcdefghijklmnopqrstuvwyxz1234567890_") !=
             std::string::npos) {
         if(errors) *errors += 1;
         output_error(pos, "arch: expected CPU architecture name",
-                     "'" + data + "' is not a valid CPU architecture name");
+                     "'" + std::string(data) +
+                     "' is not a valid CPU architecture name");
         return nullptr;
     }
 
     if(valid_arches.find(data) == valid_arches.end()) {
         if(warnings) *warnings += 1;
-        output_warning(pos, "arch: unknown CPU architecture '" + data + "'");
+        output_warning(pos, "arch: unknown CPU architecture '" +
+                       std::string(data) + "'");
     }
 
-    return new Arch(script, pos, data);
+    return new(script) Arch(script, pos, data);
+}
+
+Key *Arch::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                        const Script *script) {
+    return new(script) Arch(script, pos, in.get_string());
 }
 
 bool Arch::execute() const {
@@ -206,45 +209,56 @@ bool Arch::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    std::ofstream arch_f(script->targetDirectory() + "/etc/apk/arch",
-                         std::ios_base::trunc);
-    if(!arch_f) {
-        output_error(pos, "arch: could not write target CPU architecture");
-        return false;
-    }
-
-    arch_f << this->value() << std::endl;
+    files(script)->replace("/etc/apk/arch") << this->value() << std::endl;
 #endif  /* HAS_INSTALL_ENV */
     return true;  /* LCOV_EXCL_LINE */
 }
 
 
-static std::regex valid_pkg("[0-9A-Za-z+_.-]*((>?<|[<>]?=|[~>])[0-9A-Za-z-_.]+)?");
+static const std::regex valid_pkg("[0-9A-Za-z+_.-]*((>?<|[<>]?=|[~>])[0-9A-Za-z-_.]+)?");
 
 
-Key *PkgInstall::parseFromData(const std::string &data,
+Key *PkgInstall::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors,
                                int *warnings, const Script *script) {
-    std::string next_pkg;
-    std::istringstream stream(data);
-    std::set<std::string> all_pkgs;
-
-    while(stream >> next_pkg) {
-        if(!std::regex_match(next_pkg, valid_pkg)) {
+    const std::string_view delim(" \t\n\v\f\r");
+    std::string_view::size_type start = 0, end;
+    std::pmr::set<std::pmr::string> all_pkgs(arena(script));
+
+    while((start = data.find_first_not_of(delim, start)) !=
+          std::string_view::npos) {
+        end = data.find_first_of(delim, start);
+        const std::string_view next_pkg(data.substr(start, end - start));
+        start = end;
+        if(!std::regex_match(next_pkg.begin(), next_pkg.end(), valid_pkg)) {
             if(errors) *errors += 1;
             output_error(pos, "pkginstall: expected package name",
-                         "'" + next_pkg + "' is not a valid package or atom");
+                         "'" + std::string(next_pkg) +
+                         "' is not a valid package or atom");
             return nullptr;
         }
-        if(all_pkgs.find(next_pkg) != all_pkgs.end()) {
+        if(!all_pkgs.emplace(next_pkg).second) {
             if(warnings) *warnings += 1;
-            output_warning(pos, "pkginstall: package '" + next_pkg +
+            output_warning(pos, "pkginstall: package '" +
+                           std::string(next_pkg) +
                            "' is already in the target package set");
-            continue;
         }
-        all_pkgs.insert(next_pkg);
     }
-    return new PkgInstall(script, pos, all_pkgs);
+    return new(script) PkgInstall(script, pos, std::move(all_pkgs));
+}
+
+Key *PkgInstall::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    std::pmr::set<std::pmr::string> all_pkgs(arena(script));
+    for(std::uint64_t count = in.get_number(); count > 0 && !in.failed();
+        count--) {
+        all_pkgs.emplace(in.get_string());
+    }
+    return new(script) PkgInstall(script, pos, std::move(all_pkgs));
+}
+
+void PkgInstall::saveToCache(CacheWriter &out) const {
+    out.put_strings(this->_pkgs);
 }
 
 
@@ -270,7 +284,7 @@ bool PkgInstall::execute() const {
  * >>> langs = [lang[2] for lang in iter(x) if lang != '']
  * >>> print('"' + '", "'.join(langs) + '", "C."')
  */
-const std::set<std::string> valid_langs = {
+const std::set<std::string, std::less<>> valid_langs = {
     "aa", "ab", "af", "ak", "sq", "am", "ar", "an", "hy", "as", "av", "ae",
     "ay", "az", "ba", "bm", "eu", "be", "bn", "bh", "bi", "bs", "br", "bg",
     "my", "ca", "ch", "ce", "zh", "cu", "cv", "kw", "co", "cr", "cs", "da",
@@ -290,7 +304,7 @@ const std::set<std::string> valid_langs = {
 };
 
 
-Key *Language::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Language::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
     if(data.length() < 2 ||
        valid_langs.find(data.substr(0, 2)) == valid_langs.end()) {
@@ -321,11 +335,16 @@ Key *Language::parseFromData(const std::string &data, const ScriptLocation &pos,
         }
     }
 
-    return new Language(script, pos, data);
+    return new(script) Language(script, pos, data);
+}
+
+Key *Language::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    return new(script) Language(script, pos, in.get_string());
 }
 
 bool Language::execute() const {
-    output_info(pos, "language: setting default system language to " + _value);
+    output_info(pos, "language: setting default system language to " + value());
 
     if(script->options().test(Simulate)) {
         std::cout << "printf '#!/bin/sh\\" << "nexport LANG=\"%s\"\\" << "n' "
@@ -337,24 +356,9 @@ bool Language::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    std::string lang_path = script->targetDirectory() +
-            "/etc/profile.d/00-language.sh";
-    std::ofstream lang_f(lang_path, std::ios_base::trunc);
-    error_code ec;
-    if(!lang_f) {
-        output_error(pos, "language: could not open profile for writing");
-        return false;
-    }
-    lang_f << "#!/bin/sh" << std::endl << "export LANG=\""
-           << this->value() << "\"" << std::endl;
-    lang_f.close();
-
-    fs::permissions(lang_path, rwxr_xr_x, ec);
-    if(ec) {
-        output_error(pos, "language: could not set profile script "
-                     "executable", ec.message());
-        return false;
-    }
+    files(script)->replace("/etc/profile.d/00-language.sh", 0755)
+            << "#!/bin/sh" << std::endl << "export LANG=\""
+            << this->value() << "\"" << std::endl;
 #endif /* HAS_INSTALL_ENV */
     return true;  /* LCOV_EXCL_LINE */
 }
@@ -362,7 +366,7 @@ bool Language::execute() const {
 
 #include "util/keymaps.hh"
 
-Key *Keymap::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Keymap::parseFromData(std::string_view data, const ScriptLocation &pos,
                            int *errors, int *, const Script *script) {
     if(valid_keymaps.find(data) == valid_keymaps.end()) {
         if(errors) *errors += 1;
@@ -370,7 +374,12 @@ Key *Keymap::parseFromData(const std::string &data, const ScriptLocation &pos,
         return nullptr;
     }
 
-    return new Keymap(script, pos, data);
+    return new(script) Keymap(script, pos, data);
+}
+
+Key *Keymap::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                          const Script *script) {
+    return new(script) Keymap(script, pos, in.get_string());
 }
 
 bool Keymap::validate() const {
@@ -385,7 +394,7 @@ dumpkeys_charset=\"\"\n\
 fix_euro=\"NO\""
                            );
 
-    output_info(pos, "keymap: setting system keyboard map to " + _value);
+    output_info(pos, "keymap: setting system keyboard map to " + value());
 
     if(script->options().test(Simulate)) {
         std::cout << "cat >" << script->targetDirectory()
@@ -396,20 +405,13 @@ fix_euro=\"NO\""
     }
 
 #ifdef HAS_INSTALL_ENV
-    std::ofstream keyconf(script->targetDirectory() + "/etc/conf.d/keymaps",
-                          std::ios_base::trunc);
-    if(!keyconf) {
-        output_error(pos, "keymap: cannot write target keyboard configuration");
-        return false;
-    }
-
-    keyconf << conf;
+    files(script)->replace("/etc/conf.d/keymaps") << conf;
 #endif /* HAS_INSTALL_ENV */
     return true;  /* LCOV_EXCL_LINE */
 }
 
 
-Key *Firmware::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Firmware::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
     bool value;
     if(!BooleanKey::parse(data, pos, "firmware", &value)) {
@@ -419,6 +421,7 @@ Key *Firmware::parseFromData(const std::string &data, const ScriptLocation &pos,
 
     if(value) {
 #ifdef NON_LIBRE_FIRMWARE
+        no_cache(script);
         output_warning(pos, "firmware: You have requested non-libre firmware.  "
                        "This may cause security issues, system instability, "
                        "and many other issues.  You should not enable this "
@@ -431,7 +434,12 @@ Key *Firmware::parseFromData(const std::string &data, const ScriptLocation &pos,
         return nullptr;
 #endif
     }
-    return new Firmware(script, pos, value);
+    return new(script) Firmware(script, pos, value);
+}
+
+Key *Firmware::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    return new(script) Firmware(script, pos, in.get_number() != 0);
 }
 
 /* LCOV_EXCL_START */
@@ -442,7 +450,7 @@ bool Firmware::execute() const {
 /* LCOV_EXCL_STOP */
 
 
-Key *Timezone::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Timezone::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *warnings, const Script *script) {
     if(data.find_first_of(" .\\") != std::string::npos || data[0] == '/') {
         if(errors) *errors += 1;
@@ -457,15 +465,21 @@ Key *Timezone::parseFromData(const std::string &data, const ScriptLocation &pos,
                        "zoneinfo data is missing or inaccessible");
         /* LCOV_EXCL_STOP */
     } else {
-        std::string zi_path = "/usr/share/zoneinfo/" + data;
+        std::string zi_path = "/usr/share/zoneinfo/" + std::string(data);
         if(access(zi_path.c_str(), F_OK) != 0) {
             if(errors) *errors += 1;
-            output_error(pos, "timezone: unknown timezone '" + data + "'");
+            output_error(pos, "timezone: unknown timezone '" +
+                         std::string(data) + "'");
             return nullptr;
         }
     }
 
-    return new Timezone(script, pos, data);
+    return new(script) Timezone(script, pos, data);
+}
+
+Key *Timezone::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    return new(script) Timezone(script, pos, in.get_string());
 }
 
 bool Timezone::execute() const {
@@ -516,7 +530,7 @@ bool Timezone::execute() const {
 }
 
 
-Key *Repository::parseFromData(const std::string &data,
+Key *Repository::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors, int *,
                                const Script *script) {
     if(data.empty() || (data[0] != '/' && data.compare(0, 4, "http"))) {
@@ -524,7 +538,12 @@ Key *Repository::parseFromData(const std::string &data,
         output_error(pos, "repository: must be absolute path or HTTP(S) URL");
         return nullptr;
     }
-    return new Repository(script, pos, data);
+    return new(script) Repository(script, pos, data);
+}
+
+Key *Repository::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    return new(script) Repository(script, pos, in.get_string());
 }
 
 bool Repository::validate() const {
@@ -544,15 +563,8 @@ bool Repository::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    std::ofstream repo_f(script->targetDirectory() + "/etc/apk/repositories",
-                         std::ios_base::app);
-    if(!repo_f) {
-        output_error(pos, "repository: could not open /etc/apk/repositories "
-                     "for writing");
-        return false;
-    }
-
-    repo_f << this->value() << std::endl;
+    files(script)->append("/etc/apk/repositories")
+            << this->value() << std::endl;
 
     return true;
 #else
@@ -561,7 +573,7 @@ bool Repository::execute() const {
 }
 
 
-Key *SigningKey::parseFromData(const std::string &data,
+Key *SigningKey::parseFromData(std::string_view data,
                                const ScriptLocation &pos,
                                int *errors, int *, const Script *script) {
     if(data.empty() || (data[0] != '/' && data.compare(0, 8, "https://"))) {
@@ -570,7 +582,12 @@ Key *SigningKey::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new SigningKey(script, pos, data);
+    return new(script) SigningKey(script, pos, data);
+}
+
+Key *SigningKey::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    return new(script) SigningKey(script, pos, in.get_string());
 }
 
 bool SigningKey::validate() const {
@@ -615,13 +632,13 @@ bool SigningKey::execute() const {
             return false;
         }
     } else {
-        return download_file(_value, target);
+        return download_file(value(), target);
     }
 #endif /* HAS_INSTALL_ENV */
     return true;  /* LCOV_EXCL_LINE */
 }
 
-Key *SvcEnable::parseFromData(const std::string &data,
+Key *SvcEnable::parseFromData(std::string_view data,
                               const ScriptLocation &pos, int *errors, int *,
                               const Script *script) {
     const static std::string valid_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz1234567890.-_";
@@ -637,11 +654,24 @@ Key *SvcEnable::parseFromData(const std::string &data,
 
     if(svc.find_first_not_of(valid_chars) != std::string::npos) {
         if(errors) *errors += 1;
-        output_error(pos, "svcenable: invalid service name", data);
+        output_error(pos, "svcenable: invalid service name",
+                     std::string(data));
         return nullptr;
     }
 
-    return new SvcEnable(script, pos, svc, runlevel);
+    return new(script) SvcEnable(script, pos, svc, runlevel);
+}
+
+Key *SvcEnable::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                             const Script *script) {
+    const std::string_view svc = in.get_string();
+    const std::string_view runlevel = in.get_string();
+    return new(script) SvcEnable(script, pos, svc, runlevel);
+}
+
+void SvcEnable::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_svc);
+    out.put_string(this->_runlevel);
 }
 
 /* LCOV_EXCL_START */
@@ -652,9 +682,9 @@ bool SvcEnable::validate() const {
 
 bool SvcEnable::execute() const {
     const std::string target = script->targetDirectory() +
-                               "/etc/runlevels/" + _runlevel + "/" + _svc;
-    const std::string initd = "/etc/init.d/" + _svc;
-    output_info(pos, "svcenable: enabling service " + _svc);
+                               "/etc/runlevels/" + runlevel() + "/" + service();
+    const std::string initd = "/etc/init.d/" + service();
+    output_info(pos, "svcenable: enabling service " + service());
 
     if(script->options().test(Simulate)) {
         std::cout << "ln -s " << initd << " " << target << std::endl;
@@ -664,12 +694,12 @@ bool SvcEnable::execute() const {
 #ifdef HAS_INSTALL_ENV
     error_code ec;
     if(!fs::exists(script->targetDirectory() + initd, ec)) {
-        output_warning(pos, "svcenable: missing service", _svc);
+        output_warning(pos, "svcenable: missing service", service());
     }
 
     fs::create_symlink(initd, target, ec);
     if(ec && ec.value() != EEXIST) {
-        output_error(pos, "svcenable: could not enable service " + _svc,
+        output_error(pos, "svcenable: could not enable service " + service(),
                      ec.message());
         return false;
     }
@@ -677,18 +707,23 @@ bool SvcEnable::execute() const {
     return true;  /* LCOV_EXCL_LINE */
 }
 
-Key *Version::parseFromData(const std::string &data,
+Key *Version::parseFromData(std::string_view data,
                             const ScriptLocation &pos, int *errors, int *,
                             const Script *script) {
     const static std::string valid_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz1234567890.-_";
 
     if(data.find_first_not_of(valid_chars) != std::string::npos) {
         if(errors) *errors += 1;
-        output_error(pos, "version: invalid version", data);
+        output_error(pos, "version: invalid version", std::string(data));
         return nullptr;
     }
 
-    return new Version(script, pos, data);
+    return new(script) Version(script, pos, data);
+}
+
+Key *Version::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                           const Script *script) {
+    return new(script) Version(script, pos, in.get_string());
 }
 
 /* LCOV_EXCL_START */
@@ -734,7 +769,7 @@ const std::string my_arch(const Horizon::Script *script) {
     }
 }
 
-Key *Bootloader::parseFromData(const std::string &data,
+Key *Bootloader::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors, int *,
                                const Script *script) {
     const std::string arch = my_arch(script);
@@ -749,7 +784,8 @@ Key *Bootloader::parseFromData(const std::string &data,
 
         if(boot.find_first_of(" ") != std::string::npos) {
             if(errors) *errors += 1;
-            output_error(pos, "bootloader: invalid bootloader", data);
+            output_error(pos, "bootloader: invalid bootloader",
+                         std::string(data));
             return nullptr;
         }
     }
@@ -772,7 +808,19 @@ Key *Bootloader::parseFromData(const std::string &data,
         }
     }
 
-    return new Bootloader(script, pos, device, boot);
+    return new(script) Bootloader(script, pos, device, boot);
+}
+
+Key *Bootloader::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    const std::string_view device = in.get_string();
+    const std::string_view bootloader = in.get_string();
+    return new(script) Bootloader(script, pos, device, bootloader);
+}
+
+void Bootloader::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_device);
+    out.put_string(this->_bootloader);
 }
 
 bool Bootloader::validate() const {
@@ -822,27 +870,33 @@ bool Bootloader::validate() const {
     return valid_selection;
 }
 
+const std::string Bootloader::package() const {
+    /* Every GRUB platform is packaged under the name of its bootloader. */
+    const std::string method = bootloader();
+    if(method.compare(0, 5, "grub-") == 0) return method;
+    return "";
+}
+
 bool Bootloader::execute() const {
-    const std::string arch = my_arch(script);
-    std::string method = _bootloader;
+    /* The package was installed with the rest of the package set. */
+    std::string method = bootloader();
+#ifdef HAS_INSTALL_ENV
+    /* Every command runs through one agent inside the target. */
+    std::unique_ptr<ChrootAgent> own_agent;
+    ChrootAgent *agent = chroot_agent(script);
+    if(agent == nullptr) {
+        own_agent = std::make_unique<ChrootAgent>(script->targetDirectory());
+        agent = own_agent.get();
+    }
+#endif  /* HAS_INSTALL_ENV */
 
     if(method == "grub-efi") {
         if(script->options().test(Simulate)) {
-            std::cout << "apk --root " << script->targetDirectory()
-                      << " --keys-dir etc/apk/keys add grub-efi"
-                      << std::endl
-                      << "chroot " << script->targetDirectory()
+            std::cout << "chroot " << script->targetDirectory()
                       << " grub-install " << _device << std::endl;
             goto updateboot;
         }
 #ifdef HAS_INSTALL_ENV
-        if(run_command("/sbin/apk",
-                       {"--root", script->targetDirectory(), "--keys-dir",
-                        "etc/apk/keys", "add", "grub-efi"}) != 0) {
-            output_error(pos, "bootloader: couldn't add package");
-            return false;
-        }
-
         /* remount EFI vars r/w */
         const auto efipath{script->targetDirectory() +
                            "/sys/firmware/efi/efivars"};
@@ -853,9 +907,7 @@ bool Bootloader::execute() const {
             return false;
         }
 
-        if(run_command("chroot",
-                       {script->targetDirectory(), "grub-install", _device})
-                != 0) {
+        if(agent->run({"grub-install", device()}) != 0) {
             output_error(pos, "bootloader: failed to install GRUB");
             return false;
         }
@@ -867,23 +919,12 @@ bool Bootloader::execute() const {
     }
     else if(method == "grub-bios") {
         if(script->options().test(Simulate)) {
-            std::cout << "apk --root " << script->targetDirectory()
-                      << " --keys-dir etc/apk/keys add grub-bios"
-                      << std::endl
-                      << "chroot " << script->targetDirectory()
+            std::cout << "chroot " << script->targetDirectory()
                       << " grub-install " << _device << std::endl;
             goto updateboot;
         }
 #ifdef HAS_INSTALL_ENV
-        if(run_command("/sbin/apk",
-                       {"--root", script->targetDirectory(), "--keys-dir",
-                        "etc/apk/keys", "add", "grub-bios"}) != 0) {
-            output_error(pos, "bootloader: couldn't add package");
-            return false;
-        }
-        if(run_command("chroot",
-                       {script->targetDirectory(), "grub-install", _device})
-                != 0) {
+        if(agent->run({"grub-install", device()}) != 0) {
             output_error(pos, "bootloader: failed to install GRUB");
             return false;
         }
@@ -898,25 +939,14 @@ bool Bootloader::execute() const {
     /* LCOV_EXCL_STOP */
     else if(method == "grub-ieee1275") {
         if(script->options().test(Simulate)) {
-            std::cout << "apk --root " << script->targetDirectory()
-                      << " --keys-dir etc/apk/keys add grub-ieee1275"
-                      << std::endl
-                      << "chroot " << script->targetDirectory()
+            std::cout << "chroot " << script->targetDirectory()
                       << " grub-install --macppc-directory=/boot/grub "
                       << _device << std::endl;
             goto updateboot;
         }
 #ifdef HAS_INSTALL_ENV
-        if(run_command("/sbin/apk",
-                       {"--root", script->targetDirectory(), "--keys-dir",
-                        "etc/apk/keys", "add", "grub-ieee1275"}) != 0) {
-            output_error(pos, "bootloader: couldn't add package");
-            return false;
-        }
-        if(run_command("chroot",
-                       {script->targetDirectory(), "grub-install",
-                        "--macppc-directory=/boot/grub", _device})
-                != 0) {
+        if(agent->run({"grub-install", "--macppc-directory=/boot/grub",
+                       device()}) != 0) {
             output_error(pos, "bootloader: failed to install GRUB");
             return false;
         }
@@ -934,8 +964,7 @@ updateboot:
     }
 #ifdef HAS_INSTALL_ENV
     else {
-        run_command("chroot",
-                    {script->targetDirectory(), "/usr/sbin/update-boot"});
+        agent->run({"/usr/sbin/update-boot"});
     }
 #endif  /* HAS_INSTALL_ENV */
     return true;
@@ -23,34 +23,41 @@ namespace Keys {
 class Hostname : public StringKey {
 private:
     Hostname(const Script *_s, const ScriptLocation &_pos,
-             const std::string my_name) : StringKey(_s, _pos, my_name) {}
+             std::string_view my_name) : StringKey(_s, _pos, my_name) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool validate() const override;
     bool execute() const override;
 };
 
 class Arch : public StringKey {
 private:
-    Arch(const Script *_s, const ScriptLocation &_p, const std::string &arch) :
+    Arch(const Script *_s, const ScriptLocation &_p, std::string_view arch) :
         StringKey(_s, _p, arch) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class PkgInstall : public Key {
 private:
-    const std::set<std::string> _pkgs;
+    const std::pmr::set<std::pmr::string> _pkgs;
     PkgInstall(const Script *_s, const ScriptLocation &_pos,
-               const std::set<std::string> my_pkgs) : Key(_s, _pos),
-        _pkgs(my_pkgs) {}
+               std::pmr::set<std::pmr::string> &&my_pkgs) : Key(_s, _pos),
+        _pkgs(std::move(my_pkgs), alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
-    const std::set<std::string> packages() const { return _pkgs; }
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
+    const std::pmr::set<std::pmr::string> &packages() const { return _pkgs; }
     bool validate() const override;
     bool execute() const override;
 };
@@ -58,20 +65,24 @@ public:
 class Language : public StringKey {
 private:
     Language(const Script *_s, const ScriptLocation &_pos,
-             const std::string &my_lang) : StringKey(_s, _pos, my_lang) {}
+             std::string_view my_lang) : StringKey(_s, _pos, my_lang) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class Keymap : public StringKey {
 private:
     Keymap(const Script *_s, const ScriptLocation &_pos,
-           const std::string &keymap) : StringKey(_s, _pos, keymap) {}
+           std::string_view keymap) : StringKey(_s, _pos, keymap) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool validate() const override;
     bool execute() const override;
 };
@@ -81,28 +92,34 @@ private:
     Firmware(const Script *_s, const ScriptLocation &_pos, bool _value) :
         BooleanKey(_s, _pos, _value) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class Timezone : public StringKey {
 private:
     Timezone(const Script *_s, const ScriptLocation &_pos,
-             const std::string &my_zone) : StringKey(_s, _pos, my_zone) {}
+             std::string_view my_zone) : StringKey(_s, _pos, my_zone) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class Repository : public StringKey {
 private:
     Repository(const Script *_s, const ScriptLocation &_pos,
-               const std::string &my_url) : StringKey(_s, _pos, my_url) {}
+               std::string_view my_url) : StringKey(_s, _pos, my_url) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool validate() const override;
     bool execute() const override;
 };
@@ -110,56 +127,71 @@ public:
 class SigningKey : public StringKey {
 private:
     SigningKey(const Script *_s, const ScriptLocation &_pos,
-               const std::string &_path) : StringKey(_s, _pos, _path) {}
+               std::string_view _path) : StringKey(_s, _pos, _path) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool validate() const override;
     bool execute() const override;
 };
 
 class SvcEnable : public Key {
 private:
-    const std::string _svc;
-    const std::string _runlevel;
+    const std::pmr::string _svc;
+    const std::pmr::string _runlevel;
 
     SvcEnable(const Script *_s, const ScriptLocation &_pos,
-              const std::string &_sv, const std::string &_r) : Key(_s, _pos),
-        _svc(_sv), _runlevel(_r) {}
+              std::string_view _sv, std::string_view _r) : Key(_s, _pos),
+        _svc(_sv, alloc()), _runlevel(_r, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
-    const std::string service() const { return this->_svc; }
-    const std::string runlevel() const { return this->_runlevel; }
+    const std::string service() const { return std::string(this->_svc); }
+    const std::string runlevel() const { return std::string(this->_runlevel); }
     bool validate() const override;
     bool execute() const override;
 };
 
 class Version : public StringKey {
 private:
-    Version(const Script *_s, const ScriptLocation &_p, const std::string &_v) :
+    Version(const Script *_s, const ScriptLocation &_p, std::string_view _v) :
         StringKey(_s, _p, _v) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class Bootloader : public Key {
 private:
-    const std::string _device;
-    const std::string _bootloader;
+    const std::pmr::string _device;
+    const std::pmr::string _bootloader;
 
     Bootloader(const Script *_s, const ScriptLocation &_p,
-               const std::string &_d, const std::string &_b) : Key(_s, _p),
-        _device(_d), _bootloader(_b) {}
+               std::string_view _d, std::string_view _b) : Key(_s, _p),
+        _device(_d, alloc()), _bootloader(_b, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int *, int *, const Script *);
-
-    const std::string device() const { return this->_device; }
-    const std::string bootloader() const { return this->_bootloader; }
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
+
+    const std::string device() const { return std::string(this->_device); }
+    const std::string bootloader() const {
+        return std::string(this->_bootloader);
+    }
+    /*! Retrieve the package that provides the bootloader, or an empty
+     * string if no package is needed. */
+    const std::string package() const;
     bool validate() const override;
     bool execute() const override;
 };
@@ -0,0 +1,78 @@
+/*
+ * netconf.cc - Implementation of the in-memory network configuration
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include "netconf.hh"
+
+using namespace Horizon;
+using Horizon::Keys::NetConfigType;
+
+/*! Retrieve the stream for +name+ in +streams+, emptying it if +replace+. */
+static std::ostream &stream_for(std::map<std::string,
+                                         std::ostringstream> &streams,
+                                const std::string &name, bool replace) {
+    std::ostringstream &stream = streams[name];
+    if(replace) {
+        stream.str("");
+        stream.clear();
+    }
+    return stream;
+}
+
+std::ostream &NetConfig::variable(const std::string &name) {
+    return stream_for(_variables, name, false);
+}
+
+std::ostream &NetConfig::set_variable(const std::string &name) {
+    return stream_for(_variables, name, true);
+}
+
+std::ostream &NetConfig::interface(const std::string &iface) {
+    return stream_for(_interfaces, iface, false);
+}
+
+std::ostream &NetConfig::set_interface(const std::string &iface) {
+    return stream_for(_interfaces, iface, true);
+}
+
+std::string NetConfig::render(NetConfigType::ConfigSystem system) const {
+    std::ostringstream conf;
+
+    switch(system) {
+    case NetConfigType::Netifrc:
+        for(const auto &var : _variables) {
+            conf << var.first << "=\"" << var.second.str() << "\""
+                 << std::endl;
+        }
+        break;
+    case NetConfigType::ENI:
+        conf << "auto lo" << std::endl
+             << "iface lo inet loopback" << std::endl << std::endl;
+        for(const auto &iface : _interfaces) {
+            conf << "auto " << iface.first << std::endl
+                 << iface.second.str() << std::endl;
+        }
+        break;
+    }
+
+    return conf.str();
+}
+
+std::string NetConfig::render_wireless() const {
+    std::ostringstream conf;
+    conf << "# Enable the control interface for wpa_cli and wpa_gui"
+         << std::endl
+         << "ctrl_interface=/var/run/wpa_supplicant" << std::endl
+         << "ctrl_interface_group=wheel" << std::endl
+         << "update_config=1" << std::endl
+         << _wireless.str();
+    return conf.str();
+}
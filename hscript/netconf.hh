@@ -0,0 +1,66 @@
+/*
+ * netconf.hh - Definition of the in-memory network configuration
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_NETCONF_HH_
+#define HSCRIPT_NETCONF_HH_
+
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "network.hh"
+
+namespace Horizon {
+
+/*! The network configuration of a target, built up by the network Keys as
+ * they execute, and rendered once for the configuration system in use.
+ *
+ * Netifrc configuration is a set of variables, such as config_eth0;
+ * /etc/network/interfaces configuration is a stanza for each interface.
+ * Wireless networks are rendered as a wpa_supplicant configuration.
+ */
+class NetConfig {
+public:
+    /*! Retrieve a stream appending to the netifrc variable +name+. */
+    std::ostream &variable(const std::string &name);
+    /*! Retrieve a stream replacing the netifrc variable +name+. */
+    std::ostream &set_variable(const std::string &name);
+
+    /*! Retrieve a stream appending to the ENI stanza of +iface+. */
+    std::ostream &interface(const std::string &iface);
+    /*! Retrieve a stream replacing the ENI stanza of +iface+. */
+    std::ostream &set_interface(const std::string &iface);
+
+    /*! Retrieve a stream appending to the wpa_supplicant networks. */
+    std::ostream &wireless() { return _wireless; }
+
+    /*! Allocate the number of the next PPP link, such as 0 for ppp0. */
+    unsigned int add_ppp_link() { return _ppp_links++; }
+
+    /*! Render the configuration file of +system+. */
+    std::string render(Keys::NetConfigType::ConfigSystem system) const;
+    /*! Render the wpa_supplicant configuration file. */
+    std::string render_wireless() const;
+private:
+    /*! The netifrc variables, by name. */
+    std::map<std::string, std::ostringstream> _variables;
+    /*! The ENI stanzas, by interface. */
+    std::map<std::string, std::ostringstream> _interfaces;
+    /*! The wpa_supplicant network blocks. */
+    std::ostringstream _wireless;
+    /*! The number of PPP links configured. */
+    unsigned int _ppp_links = 0;
+};
+
+}
+
+#endif /* !HSCRIPT_NETCONF_HH_ */
@@ -13,7 +13,7 @@
 #include <algorithm>
 #include <arpa/inet.h>          /* inet_pton */
 #include <cstring>              /* memcpy */
-#include <fstream>              /* ofstream for Net write */
+#include <fstream>              /* ofstream for PPP peers */
 #include <set>                  /* for PPPoE valid param keys */
 #ifdef HAS_INSTALL_ENV
 #   include <linux/wireless.h>     /* struct iwreq */
@@ -26,20 +26,29 @@
 #   define IFNAMSIZ 16
 #endif
 #include "network.hh"
+#include "netconf.hh"
+#include "script_c.hh"
+#include "targetfiles.hh"
 #include "util/net.hh"
 #include "util/output.hh"
 
 using namespace Horizon::Keys;
+using Horizon::NetConfig;
 
 
-Key *Network::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Network::parseFromData(std::string_view data, const ScriptLocation &pos,
                             int *errors, int *, const Script *script) {
     bool value;
     if(!BooleanKey::parse(data, pos, "network", &value)) {
         if(errors) *errors += 1;
         return nullptr;
     }
-    return new Network(script, pos, value);
+    return new(script) Network(script, pos, value);
+}
+
+Key *Network::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                           const Script *script) {
+    return new(script) Network(script, pos, in.get_number() != 0);
 }
 
 bool Network::execute() const {
@@ -48,10 +57,10 @@ bool Network::execute() const {
 }
 
 
-Key *NetConfigType::parseFromData(const std::string &data,
+Key *NetConfigType::parseFromData(std::string_view data,
                                   const ScriptLocation &pos,
                                   int *errors, int *, const Script *script) {
-    std::string type = data;
+    std::string type(data);
     ConfigSystem system;
 
     std::transform(type.cbegin(), type.cend(), type.begin(), ::tolower);
@@ -67,7 +76,17 @@ Key *NetConfigType::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new NetConfigType(script, pos, system);
+    return new(script) NetConfigType(script, pos, system);
+}
+
+Key *NetConfigType::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                                 const Script *script) {
+    const ConfigSystem type = static_cast<ConfigSystem>(in.get_number());
+    return new(script) NetConfigType(script, pos, type);
+}
+
+void NetConfigType::saveToCache(CacheWriter &out) const {
+    out.put_number(this->_sys);
 }
 
 /* LCOV_EXCL_START */
@@ -83,7 +102,7 @@ bool NetConfigType::execute() const {
 /* LCOV_EXCL_STOP */
 
 
-Key *NetAddress::parseFromData(const std::string &data,
+Key *NetAddress::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors, int *,
                                const Script *script) {
     long elements = std::count(data.cbegin(), data.cend(), ' ') + 1;
@@ -123,8 +142,8 @@ Key *NetAddress::parseFromData(const std::string &data,
                          "accept further elements");
             return nullptr;
         }
-        return new NetAddress(script, pos, iface, AddressType::DHCP, "", 0,
-                              "");
+        return new(script) NetAddress(script, pos, iface, AddressType::DHCP,
+                                      "", 0, "");
     } else if(!type.compare("slaac")) {
         if(elements > 2) {
             if(errors) *errors += 1;
@@ -132,8 +151,8 @@ Key *NetAddress::parseFromData(const std::string &data,
                          "accept further elements");
             return nullptr;
         }
-        return new NetAddress(script, pos, iface, AddressType::SLAAC, "", 0,
-                              "");
+        return new(script) NetAddress(script, pos, iface, AddressType::SLAAC,
+                                      "", 0, "");
     } else if(type.compare("static")) {
         if(errors) *errors += 1;
         output_error(pos, "netaddress: invalid address type '" + type + "'",
@@ -199,8 +218,9 @@ Key *NetAddress::parseFromData(const std::string &data,
             return nullptr;
         }
 
-        return new NetAddress(script, pos, iface, AddressType::Static, addr,
-                              static_cast<uint8_t>(real_prefix), gw);
+        return new(script) NetAddress(script, pos, iface, AddressType::Static,
+                                      addr, static_cast<uint8_t>(real_prefix),
+                                      gw);
     } else if(addr.find('.') != std::string::npos) {
         /* IPv4 */
         if(::inet_pton(AF_INET, addr.c_str(), &addr_buf) != 1) {
@@ -239,8 +259,9 @@ Key *NetAddress::parseFromData(const std::string &data,
             return nullptr;
         }
 
-        return new NetAddress(script, pos, iface, AddressType::Static, addr,
-                              static_cast<uint8_t>(real_prefix), gw);
+        return new(script) NetAddress(script, pos, iface, AddressType::Static,
+                                      addr, static_cast<uint8_t>(real_prefix),
+                                      gw);
     } else {
         /* IPvBad */
         if(errors) *errors += 1;
@@ -250,6 +271,25 @@ Key *NetAddress::parseFromData(const std::string &data,
     }
 }
 
+Key *NetAddress::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    const std::string_view iface = in.get_string();
+    const AddressType type = static_cast<AddressType>(in.get_number());
+    const std::string_view address = in.get_string();
+    const uint8_t prefix = static_cast<uint8_t>(in.get_number());
+    const std::string_view gateway = in.get_string();
+    return new(script) NetAddress(script, pos, iface, type, address, prefix,
+                                  gateway);
+}
+
+void NetAddress::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_iface);
+    out.put_number(this->_type);
+    out.put_string(this->_address);
+    out.put_number(this->_prefix);
+    out.put_string(this->_gw);
+}
+
 bool NetAddress::validate() const {
     if(!script->options().test(InstallEnvironment)) {
         return true;
@@ -268,7 +308,8 @@ bool NetAddress::validate() const {
     errno = 0;
     if(ioctl(my_sock, SIOCGIFFLAGS, &request) == -1) {
         if(errno == ENODEV) {
-            output_warning(pos, "netaddress: interface does not exist", _iface);
+            output_warning(pos, "netaddress: interface does not exist",
+                           iface());
             return true;
         }
         output_error(pos, "netaddress: trouble communicating with interface",
@@ -279,14 +320,8 @@ bool NetAddress::validate() const {
     return true;  /* LCOV_EXCL_LINE */
 }
 
-bool execute_address_netifrc(const NetAddress *addr) {
-    std::ofstream config("/tmp/horizon/netifrc/config_" + addr->iface(),
-                         std::ios_base::app);
-    if(!config) {
-        output_error(addr->where(), "netaddress: couldn't write network "
-                     "configuration for " + addr->iface());
-        return false;
-    }
+bool execute_address_netifrc(const NetAddress *addr, NetConfig &net) {
+    std::ostream &config = net.variable("config_" + addr->iface());
 
     switch(addr->type()) {
     case NetAddress::DHCP:
@@ -302,27 +337,15 @@ bool execute_address_netifrc(const NetAddress *addr) {
     }
 
     if(!addr->gateway().empty()) {
-        std::ofstream route("/tmp/horizon/netifrc/routes_" + addr->iface(),
-                            std::ios_base::app);
-        if(!route) {
-            output_error(addr->where(), "netaddress: couldn't write route "
-                         "configuration for " + addr->iface());
-            return false;
-        }
-        route << "default via " << addr->gateway() << std::endl;
+        net.variable("routes_" + addr->iface())
+                << "default via " << addr->gateway() << std::endl;
     }
 
     return true;
 }
 
-bool execute_address_eni(const NetAddress *addr) {
-    std::ofstream config("/tmp/horizon/eni/" + addr->iface(),
-                         std::ios_base::app);
-    if(!config) {
-        output_error(addr->where(), "netaddress: couldn't write network "
-                     "configuration for " + addr->iface());
-        return false;
-    }
+bool execute_address_eni(const NetAddress *addr, NetConfig &net) {
+    std::ostream &config = net.interface(addr->iface());
 
     switch(addr->type()) {
     case NetAddress::DHCP:
@@ -369,19 +392,19 @@ NetConfigType::ConfigSystem current_system(const Horizon::Script *script) {
 }
 
 bool NetAddress::execute() const {
-    output_info(pos, "netaddress: adding configuration for " + _iface);
+    output_info(pos, "netaddress: adding configuration for " + iface());
 
     switch(current_system(script)) {
     case NetConfigType::Netifrc:
     default:
-        return execute_address_netifrc(this);
+        return execute_address_netifrc(this, *network_config(script));
     case NetConfigType::ENI:
-        return execute_address_eni(this);
+        return execute_address_eni(this, *network_config(script));
     }
 }
 
 
-Key *PPPoE::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *PPPoE::parseFromData(std::string_view data, const ScriptLocation &pos,
                           int *errors, int *, const Script *script) {
     std::string::size_type spos, next;
     std::map<std::string, std::string> params;
@@ -424,7 +447,28 @@ Key *PPPoE::parseFromData(const std::string &data, const ScriptLocation &pos,
         spos = next;
     }
 
-    return new PPPoE(script, pos, iface, params);
+    return new(script) PPPoE(script, pos, iface, params);
+}
+
+Key *PPPoE::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                         const Script *script) {
+    const std::string_view iface = in.get_string();
+    std::map<std::string, std::string> params;
+    for(std::uint64_t count = in.get_number(); count > 0 && !in.failed();
+        count--) {
+        const std::string_view param = in.get_string();
+        params[std::string(param)] = in.get_string();
+    }
+    return new(script) PPPoE(script, pos, iface, params);
+}
+
+void PPPoE::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_iface);
+    out.put_number(this->_params.size());
+    for(const auto &param : this->_params) {
+        out.put_string(param.first);
+        out.put_string(param.second);
+    }
 }
 
 bool PPPoE::validate() const {
@@ -443,54 +487,25 @@ bool PPPoE::validate() const {
     return valid;
 }
 
-static int ppp_link_count = 0;
-
-bool execute_pppoe_netifrc(const PPPoE &link) {
+bool execute_pppoe_netifrc(const PPPoE &link, NetConfig &net) {
     const auto &params = link.params();
-    const std::string &linkiface{"ppp" + std::to_string(ppp_link_count)};
-
-#define ENSURE_FILE(file) \
-    if(!file) {\
-        output_error(link.where(), "pppoe: couldn't write network "\
-                     "configuration for " + linkiface);\
-        return false;\
-    }
-
-    std::ofstream ethconfig("/tmp/horizon/netifrc/config_" + link.iface(),
-                            std::ios_base::trunc);
-    ENSURE_FILE(ethconfig);
-    ethconfig << "null";
-
-    std::ofstream rcconfig("/tmp/horizon/netifrc/rc_net_" + linkiface + "_need");
-    ENSURE_FILE(rcconfig);
-    rcconfig << link.iface();
+    const std::string &linkiface{"ppp" + std::to_string(net.add_ppp_link())};
 
-    std::ofstream config("/tmp/horizon/netifrc/config_" + linkiface);
-    ENSURE_FILE(config);
-    config << "ppp";
-
-    std::ofstream linkconfig("/tmp/horizon/netifrc/link_" + linkiface);
-    ENSURE_FILE(linkconfig);
-    linkconfig << link.iface();
-
-    std::ofstream plugconfig("/tmp/horizon/netifrc/plugins_" + linkiface);
-    ENSURE_FILE(plugconfig);
-    plugconfig << "pppoe";
+    net.set_variable("config_" + link.iface()) << "null";
+    net.set_variable("rc_net_" + linkiface + "_need") << link.iface();
+    net.set_variable("config_" + linkiface) << "ppp";
+    net.set_variable("link_" + linkiface) << link.iface();
+    net.set_variable("plugins_" + linkiface) << "pppoe";
 
     if(params.find("username") != params.end()) {
-        std::ofstream userconfig("/tmp/horizon/netifrc/username_" + linkiface);
-        ENSURE_FILE(userconfig);
-        userconfig << params.at("username");
+        net.set_variable("username_" + linkiface) << params.at("username");
     }
 
     if(params.find("password") != params.end()) {
-        std::ofstream pwconfig("/tmp/horizon/netifrc/password_" + linkiface);
-        ENSURE_FILE(pwconfig);
-        pwconfig << params.at("password");
+        net.set_variable("password_" + linkiface) << params.at("password");
     }
 
-    std::ofstream pppconfig("/tmp/horizon/netifrc/pppd_" + linkiface);
-    ENSURE_FILE(pppconfig);
+    std::ostream &pppconfig = net.set_variable("pppd_" + linkiface);
     pppconfig << "noauth" << std::endl
               << "defaultroute" << std::endl;
 
@@ -508,18 +523,18 @@ bool execute_pppoe_netifrc(const PPPoE &link) {
         pppconfig << "mtu " << params.at("mtu") << std::endl;
     }
 
-    ppp_link_count++;
     return true;
 }
 
-bool execute_pppoe_eni(const PPPoE &link, const Horizon::Script *script) {
+bool execute_pppoe_eni(const PPPoE &link, const Horizon::Script *script,
+                       NetConfig &net) {
 #ifndef HAS_INSTALL_ENV
     output_error(link.where(), "pppoe: ENI cannot be simulated");
     return false;
 #else
     const auto &params = link.params();
     const std::string &pppdir{script->targetDirectory() + "/etc/ppp"};
-    const std::string &linkiface{"ppp" + std::to_string(ppp_link_count)};
+    const std::string &linkiface{"ppp" + std::to_string(net.add_ppp_link())};
     error_code ec;
 
     fs::create_directories(pppdir + "/peers", ec);
@@ -529,16 +544,10 @@ bool execute_pppoe_eni(const PPPoE &link, const Horizon::Script *script) {
         return false;
     }
 
-    std::ofstream config("/tmp/horizon/eni/" + link.iface(),
-                         std::ios_base::trunc);
-    if(!config) {
-        output_error(link.where(), "pppoe: couldn't write network "
-                     "configuration for " + link.iface());
-        return false;
-    }
-    config << "iface " << linkiface << " inet ppp" << std::endl
-           << "pre-up /sbin/ifconfig " << link.iface() << " up" << std::endl
-           << "provider " << linkiface;
+    net.set_interface(link.iface())
+            << "iface " << linkiface << " inet ppp" << std::endl
+            << "pre-up /sbin/ifconfig " << link.iface() << " up" << std::endl
+            << "provider " << linkiface;
 
     std::ofstream pppconf(pppdir + "/peers/" + linkiface);
     if(!pppconf) {
@@ -575,25 +584,24 @@ bool execute_pppoe_eni(const PPPoE &link, const Horizon::Script *script) {
                 << std::endl;
     }
 
-    ppp_link_count++;
     return true;
 #endif
 }
 
 bool PPPoE::execute() const {
-    output_info(pos, "pppoe: adding configuration for " + _iface);
+    output_info(pos, "pppoe: adding configuration for " + iface());
 
     switch(current_system(script)) {
     case NetConfigType::Netifrc:
     default:
-        return execute_pppoe_netifrc(*this);
+        return execute_pppoe_netifrc(*this, *network_config(script));
     case NetConfigType::ENI:
-        return execute_pppoe_eni(*this, script);
+        return execute_pppoe_eni(*this, script, *network_config(script));
     }
 }
 
 
-Key *Nameserver::parseFromData(const std::string &data,
+Key *Nameserver::parseFromData(std::string_view data,
                                const ScriptLocation &pos, int *errors, int *,
                                const Script *script) {
     char addr_buf[16];
@@ -609,26 +617,32 @@ Key *Nameserver::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    if(data.find(':') != std::string::npos) {
+    const std::string ip(data);
+    if(ip.find(':') != std::string::npos) {
         /* IPv6 */
-        if(::inet_pton(AF_INET6, data.c_str(), &addr_buf) != 1) {
+        if(::inet_pton(AF_INET6, ip.c_str(), &addr_buf) != 1) {
             if(errors) *errors += 1;
-            output_error(pos, "nameserver: '" + data + "' is not a valid IPv6 "
+            output_error(pos, "nameserver: '" + ip + "' is not a valid IPv6 "
                          "address", "hint: a ':' was found, so an IPv6 "
                          "address was expected");
             return nullptr;
         }
     } else {
         /* IPv4 */
-        if(::inet_pton(AF_INET, data.c_str(), &addr_buf) != 1) {
+        if(::inet_pton(AF_INET, ip.c_str(), &addr_buf) != 1) {
             if(errors) *errors += 1;
-            output_error(pos, "nameserver: '" + data + "' is not a valid IPv4 "
+            output_error(pos, "nameserver: '" + ip + "' is not a valid IPv4 "
                          "address");
             return nullptr;
         }
     }
 
-    return new Nameserver(script, pos, data);
+    return new(script) Nameserver(script, pos, ip);
+}
+
+Key *Nameserver::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    return new(script) Nameserver(script, pos, in.get_string());
 }
 
 bool Nameserver::execute() const {
@@ -640,19 +654,14 @@ bool Nameserver::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    std::ofstream resolvconf(script->targetDirectory() + "/etc/resolv.conf",
-                             std::ios_base::app);
-    if(!resolvconf) {
-        output_error(pos, "nameserver: couldn't write configuration to target");
-        return false;
-    }
-    resolvconf << "nameserver " << _value << std::endl;
+    files(script)->append("/etc/resolv.conf")
+            << "nameserver " << _value << std::endl;
 #endif /* HAS_INSTALL_ENV */
     return true;  /* LCOV_EXCL_LINE */
 }
 
 
-Key *NetSSID::parseFromData(const std::string &data, const ScriptLocation &p,
+Key *NetSSID::parseFromData(std::string_view data, const ScriptLocation &p,
                             int *errors, int *, const Script *script) {
     std::string iface, ssid, secstr, passphrase;
     SecurityType type;
@@ -726,7 +735,23 @@ Key *NetSSID::parseFromData(const std::string &data, const ScriptLocation &p,
         }
         passphrase = data.substr(pos + 1);
     }
-    return new NetSSID(script, p, iface, ssid, type, passphrase);
+    return new(script) NetSSID(script, p, iface, ssid, type, passphrase);
+}
+
+Key *NetSSID::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                           const Script *script) {
+    const std::string_view iface = in.get_string();
+    const std::string_view ssid = in.get_string();
+    const SecurityType type = static_cast<SecurityType>(in.get_number());
+    const std::string_view passphrase = in.get_string();
+    return new(script) NetSSID(script, pos, iface, ssid, type, passphrase);
+}
+
+void NetSSID::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_iface);
+    out.put_string(this->_ssid);
+    out.put_number(this->_sec);
+    out.put_string(this->_pw);
 }
 
 bool NetSSID::validate() const {
@@ -768,15 +793,9 @@ bool NetSSID::validate() const {
 }
 
 bool NetSSID::execute() const {
-    output_info(pos, "netssid: configuring SSID " + _ssid);
-
-    std::ofstream conf("/tmp/horizon/wpa_supplicant.conf",
-                       std::ios_base::app);
-    if(!conf) {
-        output_error(pos, "netssid: failed to write configuration");
-        return false;
-    }
+    output_info(pos, "netssid: configuring SSID " + ssid());
 
+    std::ostream &conf = network_config(script)->wireless();
     conf << std::endl;
     conf << "network={" << std::endl;
     conf << "\tssid=\"" << this->ssid() << "\"" << std::endl;
@@ -786,5 +805,5 @@ bool NetSSID::execute() const {
     conf << "\tpriority=5" << std::endl;
     conf << "}" << std::endl;
 
-    return !conf.fail();
+    return true;
 }
@@ -26,8 +26,10 @@ private:
     Network(const Script *_s, const ScriptLocation &_p, bool _value) :
         BooleanKey(_s, _p, _value) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &pos,
+    static Key *parseFromData(std::string_view, const ScriptLocation &pos,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
@@ -43,8 +45,11 @@ private:
     NetConfigType(const Script *_sc, const ScriptLocation &_p,
                   const ConfigSystem _s) : Key(_sc, _p), _sys(_s) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the desired network configuration system. */
     ConfigSystem type() const { return this->_sys; }
@@ -65,31 +70,34 @@ public:
         Static
     };
 private:
-    const std::string _iface;
+    const std::pmr::string _iface;
     const AddressType _type;
-    const std::string _address;
+    const std::pmr::string _address;
     const uint8_t _prefix;
-    const std::string _gw;
+    const std::pmr::string _gw;
 
-    NetAddress(const Script *sc, const ScriptLocation &p, const std::string &_i,
-               const AddressType &_t, const std::string &_a, const uint8_t _p,
-               const std::string &_g) : Key(sc, p), _iface(_i), _type(_t),
-        _address(_a), _prefix(_p), _gw(_g)
+    NetAddress(const Script *sc, const ScriptLocation &p, std::string_view _i,
+               const AddressType &_t, std::string_view _a, const uint8_t _p,
+               std::string_view _g) : Key(sc, p), _iface(_i, alloc()),
+        _type(_t), _address(_a, alloc()), _prefix(_p), _gw(_g, alloc())
     {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the interface to which this 'netaddress' key is associated. */
-    const std::string iface() const { return this->_iface; }
+    const std::string iface() const { return std::string(this->_iface); }
     /*! Retrieve the address type of this 'netadress' key. */
     AddressType type() const { return this->_type; }
     /*! Retrieve the static address, if any. */
-    const std::string address() const { return this->_address; }
+    const std::string address() const { return std::string(this->_address); }
     /*! Retreive the prefix length for the static address. */
     uint8_t prefix() const { return this->_prefix; }
     /*! Retrieve the gateway, if any. */
-    const std::string gateway() const { return this->_gw; }
+    const std::string gateway() const { return std::string(this->_gw); }
 
     bool validate() const override;
     bool execute() const override;
@@ -97,21 +105,25 @@ public:
 
 class PPPoE : public Key {
 private:
-    const std::string _iface;
-    const std::map<std::string, std::string> _params;
+    const std::pmr::string _iface;
+    const std::pmr::map<std::pmr::string, std::pmr::string> _params;
 
-    PPPoE(const Script *_sc, const ScriptLocation &_pos, const std::string &_i,
+    PPPoE(const Script *_sc, const ScriptLocation &_pos, std::string_view _i,
           const std::map<std::string, std::string> &_p) : Key(_sc, _pos),
-        _iface(_i), _params(_p) {}
+        _iface(_i, alloc()), _params(_p.begin(), _p.end(), alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the interface to which this PPPoE link is associated. */
-    const std::string iface() const { return this->_iface; }
+    const std::string iface() const { return std::string(this->_iface); }
     /*! Retrieve the parameters for this PPPoE link. */
     const std::map<std::string, std::string> params() const {
-        return this->_params;
+        return std::map<std::string, std::string>(this->_params.begin(),
+                                                  this->_params.end());
     }
 
     bool validate() const override;
@@ -121,10 +133,12 @@ public:
 class Nameserver : public StringKey {
 private:
     Nameserver(const Script *_s, const ScriptLocation &_pos,
-               const std::string &ns) : StringKey(_s, _pos, ns) {}
+               std::string_view ns) : StringKey(_s, _pos, ns) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &_pos,
+    static Key *parseFromData(std::string_view, const ScriptLocation &_pos,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
@@ -137,28 +151,32 @@ public:
         WPA
     };
 private:
-    const std::string _iface;
-    const std::string _ssid;
+    const std::pmr::string _iface;
+    const std::pmr::string _ssid;
     const SecurityType _sec;
-    const std::string _pw;
+    const std::pmr::string _pw;
 
-    NetSSID(const Script *_sc, const ScriptLocation &p, const std::string &_if,
-            const std::string &_s, SecurityType _t, const std::string &_p) :
-        Key(_sc, p), _iface(_if), _ssid(_s), _sec(_t), _pw(_p) {}
+    NetSSID(const Script *_sc, const ScriptLocation &p, std::string_view _if,
+            std::string_view _s, SecurityType _t, std::string_view _p) :
+        Key(_sc, p), _iface(_if, alloc()), _ssid(_s, alloc()), _sec(_t),
+        _pw(_p, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the interface to which this 'netssid' key is associated. */
-    const std::string iface() const { return this->_iface; }
+    const std::string iface() const { return std::string(this->_iface); }
     /*! Retrieve the named SSID for this 'netssid' key. */
-    const std::string ssid() const { return this->_ssid; }
+    const std::string ssid() const { return std::string(this->_ssid); }
     /*! Retrieve the security type of this 'netssid' key. */
     SecurityType type() const { return this->_sec; }
     /*! Retrieve the passphrase for this 'netssid' key.
      * @note Only valid if type() is not None.
      */
-    const std::string passphrase() const { return this->_pw; }
+    const std::string passphrase() const { return std::string(this->_pw); }
 
     bool validate() const override;
     bool execute() const override;
@@ -0,0 +1,173 @@
+/*
+ * pkgcache.cc - Implementation of the persistent APK package cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <algorithm>
+#include <cstring>          /* strerror */
+#include <fstream>
+#include <set>
+#include <vector>
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* open, utimensat */
+#   include <sys/file.h>       /* flock */
+#   include <sys/stat.h>       /* stat, UTIME_NOW */
+#   include <unistd.h>         /* close, unlink */
+#endif /* HAS_INSTALL_ENV */
+#include "pkgcache.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+using namespace Horizon;
+
+/*! The name of the lock file in the cache directory. */
+static const char *const lock_name = ".horizon-lock";
+
+PackageCache::PackageCache(const std::string &dir, std::uint64_t limit)
+    : _dir(dir), _limit(limit), _lock(-1) {}
+
+PackageCache::~PackageCache() {
+#ifdef HAS_INSTALL_ENV
+    if(_lock != -1) close(_lock);
+#endif /* HAS_INSTALL_ENV */
+}
+
+bool PackageCache::open() {
+#ifdef HAS_INSTALL_ENV
+    error_code ec;
+    fs::create_directories(_dir, ec);
+    if(ec) {
+        output_warning("pkgcache", "cannot create package cache " + _dir,
+                       ec.message());
+        return false;
+    }
+
+    /* The cache is brought within its limit before it is used, even if it
+     * is never free once packages are installed, since the builds sharing
+     * it may always overlap. */
+    const std::string path(_dir + "/" + lock_name);
+    _lock = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    const int mode = (_limit == 0) ? LOCK_SH : LOCK_EX;
+    if(_lock != -1 && mode == LOCK_EX && flock(_lock, mode | LOCK_NB) != 0 &&
+       errno == EWOULDBLOCK) {
+        output_info("pkgcache", "waiting for other builds to finish with "
+                    "package cache " + _dir);
+    }
+    if(_lock == -1 || flock(_lock, mode) != 0) {
+        output_warning("pkgcache", "cannot lock package cache " + _dir,
+                       strerror(errno));
+        return false;
+    }
+    if(mode == LOCK_EX) {
+        trim();
+        flock(_lock, LOCK_SH);
+    }
+
+    output_info("pkgcache", "using package cache " + _dir);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+void PackageCache::touch(const std::string &root) const {
+#ifdef HAS_INSTALL_ENV
+    /* APK names cached packages name-version.checksum.apk. */
+    std::set<std::string> installed;
+    std::ifstream db(root + "/lib/apk/db/installed");
+    std::string line, name;
+    while(std::getline(db, line)) {
+        if(line.compare(0, 2, "P:") == 0) {
+            name = line.substr(2);
+        } else if(line.compare(0, 2, "V:") == 0) {
+            installed.insert(name + "-" + line.substr(2));
+        }
+    }
+
+    error_code ec;
+    const struct timespec now[2] = {{0, UTIME_NOW}, {0, UTIME_NOW}};
+    for(fs::directory_iterator entry(_dir, ec), end;
+        !ec && entry != end; entry.increment(ec)) {
+        const std::string file(entry->path().filename().string());
+        if(file.size() < 5 || file.compare(file.size() - 4, 4, ".apk") != 0) {
+            continue;
+        }
+        const std::string::size_type sum = file.rfind('.', file.size() - 5);
+        if(sum != std::string::npos && installed.count(file.substr(0, sum))) {
+            utimensat(AT_FDCWD, entry->path().c_str(), now, 0);
+        }
+    }
+#endif /* HAS_INSTALL_ENV */
+}
+
+void PackageCache::evict() {
+#ifdef HAS_INSTALL_ENV
+    if(_limit == 0 || _lock == -1) return;
+
+    /* Upgrade to an exclusive lock, so that no one else is installing a
+     * package that is about to be evicted.  If the cache is in use, it is
+     * trimmed when it is next opened instead. */
+    if(flock(_lock, LOCK_EX | LOCK_NB) != 0) {
+        /* A failed conversion may have dropped the shared lock. */
+        flock(_lock, LOCK_SH);
+        output_info("pkgcache", "package cache in use; not evicting");
+        return;
+    }
+
+    trim();
+    flock(_lock, LOCK_SH);
+#endif /* HAS_INSTALL_ENV */
+}
+
+void PackageCache::trim() {
+#ifdef HAS_INSTALL_ENV
+    struct CachedFile {
+        std::string path;
+        std::uint64_t size;
+        struct timespec used;
+    };
+    std::vector<CachedFile> files;
+    std::uint64_t total = 0;
+    error_code ec;
+    for(fs::directory_iterator entry(_dir, ec), end;
+        !ec && entry != end; entry.increment(ec)) {
+        const std::string path(entry->path().string());
+        struct stat st;
+        if(entry->path().filename() == lock_name ||
+           stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        files.push_back({path, static_cast<std::uint64_t>(st.st_size),
+                         st.st_mtim});
+        total += static_cast<std::uint64_t>(st.st_size);
+    }
+
+    std::sort(files.begin(), files.end(),
+              [](const CachedFile &a, const CachedFile &b) {
+        if(a.used.tv_sec != b.used.tv_sec) {
+            return a.used.tv_sec < b.used.tv_sec;
+        }
+        return a.used.tv_nsec < b.used.tv_nsec;
+    });
+
+    std::size_t evicted = 0;
+    for(const auto &file : files) {
+        if(total <= _limit) break;
+        if(unlink(file.path.c_str()) == 0) {
+            total -= file.size;
+            evicted++;
+        }
+    }
+    if(evicted > 0) {
+        output_info("pkgcache", "evicted " + std::to_string(evicted) +
+                    " file(s) from package cache");
+    }
+#endif /* HAS_INSTALL_ENV */
+}
@@ -0,0 +1,75 @@
+/*
+ * pkgcache.hh - Definition of the persistent APK package cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_PKGCACHE_HH_
+#define HSCRIPT_PKGCACHE_HH_
+
+#include <cstdint>
+#include <string>
+
+namespace Horizon {
+
+/*! A directory on the host holding packages downloaded by APK, shared by
+ * every installation and image build that uses it.
+ *
+ * Each user holds a shared lock on the cache while it installs packages.
+ * Packages are evicted, least recently used first, when the cache grows
+ * past its size limit; this only happens while no one else is using the
+ * cache, so a package is never removed while it is being installed.  A
+ * cache with a limit is trimmed each time it is opened, waiting for its
+ * other users if needed, so that it never grows without bound.
+ */
+class PackageCache {
+public:
+    /*! Create a cache in +dir+.
+     * @param dir       The directory holding the cache.
+     * @param limit     The most bytes to keep in the cache, or 0 for no
+     *                  limit.
+     */
+    PackageCache(const std::string &dir, std::uint64_t limit);
+    /*! Release the lock on the cache. */
+    ~PackageCache();
+    PackageCache(const PackageCache &) = delete;
+    PackageCache &operator=(const PackageCache &) = delete;
+
+    /*! Create the cache directory if needed, evict packages until it is
+     * within its size limit, and lock it for use.
+     * @returns true if the cache may be used, false otherwise.
+     */
+    bool open();
+
+    /*! Mark the packages installed to +root+ as recently used. */
+    void touch(const std::string &root) const;
+
+    /*! Evict the least recently used packages until the cache is within its
+     * size limit.  Nothing is evicted if the cache is in use elsewhere.
+     */
+    void evict();
+
+    /*! Retrieve the directory holding the cache. */
+    const std::string &dir() const { return _dir; }
+private:
+    /*! Evict the least recently used packages until the cache is within
+     * its size limit.  The exclusive lock must be held. */
+    void trim();
+
+    /*! The directory holding the cache. */
+    const std::string _dir;
+    /*! The most bytes to keep in the cache, or 0 for no limit. */
+    const std::uint64_t _limit;
+    /*! The file descriptor of the lock file, or -1. */
+    int _lock;
+};
+
+}
+
+#endif /* !HSCRIPT_PKGCACHE_HH_ */
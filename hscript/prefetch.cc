@@ -0,0 +1,159 @@
+/*
+ * prefetch.cc - Implementation of the APK package prefetcher
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstdlib>          /* mkdtemp */
+#include <cstring>          /* strerror */
+#include <fstream>
+#include <utility>
+#include "prefetch.hh"
+#include "util.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+using namespace Horizon;
+
+APKPrefetch::APKPrefetch(const std::string &cache)
+    : _cache(cache), _success(false) {}
+
+APKPrefetch::~APKPrefetch() {
+    /* A script that fails early does not wait for the download. */
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _cancelled = true;
+        if(_child != 0) ProcessSupervisor::instance().cancel(_child);
+    }
+    if(_thread.joinable()) _thread.join();
+    if(!_dir.empty()) {
+        error_code ec;
+        fs::remove_all(_dir, ec);
+    }
+}
+
+void APKPrefetch::start(Request request) {
+    char staging[] = "/tmp/horizon-apk.XXXXXX";
+    if(mkdtemp(staging) == nullptr) {
+        output_warning("prefetch", "cannot create staging directory",
+                       strerror(errno));
+        return;
+    }
+    _dir = staging;
+    if(_cache.empty()) _cache = _dir + "/cache";
+
+    OutputSink &sink = output_sink();
+    _thread = std::thread([this, &sink, request = std::move(request)]() {
+        OutputScope scope(sink);
+        _success = run(request);
+    });
+}
+
+bool APKPrefetch::wait() {
+    if(_thread.joinable()) _thread.join();
+    return _success;
+}
+
+int APKPrefetch::run_apk(const std::vector<std::string> &args) {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if(_cancelled) return -1;
+    }
+    const int status = run_command("/sbin/apk", args,
+                                   std::chrono::seconds::zero(),
+                                   [this](ProcessSupervisor::Handle child) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _child = child;
+        if(_cancelled) ProcessSupervisor::instance().cancel(child);
+    });
+    std::lock_guard<std::mutex> guard(_lock);
+    _child = 0;
+    return status;
+}
+
+bool APKPrefetch::run(const Request &request) {
+#ifdef HAS_INSTALL_ENV
+    const std::string root(_dir + "/root");
+    const std::string etc_apk(root + "/etc/apk");
+    const std::string keys_dir(etc_apk + "/keys/");
+    error_code ec;
+
+    output_info("prefetch", "downloading " +
+                std::to_string(request.packages.size()) +
+                " package(s) to " + cache_dir());
+
+    fs::create_directories(keys_dir, ec);
+    if(!ec) fs::create_directories(cache_dir(), ec);
+    if(ec) {
+        output_warning("prefetch", "cannot create staging directory",
+                       ec.message());
+        return false;
+    }
+
+    std::ofstream repo_f(etc_apk + "/repositories", std::ios_base::trunc);
+    for(const auto &repo : request.repositories) repo_f << repo << std::endl;
+    if(!repo_f) {
+        output_warning("prefetch", "cannot write staging repositories");
+        return false;
+    }
+    repo_f.close();
+
+    for(const auto &key : request.keys) {
+        const std::string target(keys_dir + key.substr(key.find_last_of('/') +
+                                                       1));
+        if(key[0] == '/') {
+            fs::copy_file(key, target, fs_overwrite, ec);
+            if(ec) {
+                output_warning("prefetch", "cannot copy signing key " + key,
+                               ec.message());
+                return false;
+            }
+        } else if(!download_file(key, target)) {
+            return false;
+        }
+    }
+
+    if(!request.arch.empty()) {
+        std::ofstream arch_f(etc_apk + "/arch", std::ios_base::trunc);
+        arch_f << request.arch << std::endl;
+        if(!arch_f) {
+            output_warning("prefetch", "cannot write staging architecture");
+            return false;
+        }
+    }
+
+    if(run_apk({"--root", root, "--initdb", "--keys-dir", "etc/apk/keys",
+                "add"}) != 0) {
+        output_warning("prefetch", "cannot initialise staging database");
+        return false;
+    }
+
+    /* The world of the staging root is the package set of the target, so
+     * that 'cache download' fetches it and every dependency. */
+    std::ofstream world_f(etc_apk + "/world", std::ios_base::trunc);
+    for(const auto &pkg : request.packages) world_f << pkg << std::endl;
+    if(!world_f) {
+        output_warning("prefetch", "cannot write staging package set");
+        return false;
+    }
+    world_f.close();
+
+    if(run_apk({"--root", root, "--keys-dir", "etc/apk/keys", "--cache-dir",
+                cache_dir(), "--update-cache", "cache", "download"}) != 0) {
+        output_warning("prefetch", "packages will be downloaded during "
+                       "installation instead");
+        return false;
+    }
+
+    output_info("prefetch", "packages downloaded");
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
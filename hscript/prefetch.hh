@@ -0,0 +1,97 @@
+/*
+ * prefetch.hh - Definition of the APK package prefetcher
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_PREFETCH_HH_
+#define HSCRIPT_PREFETCH_HH_
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "supervisor.hh"
+
+namespace Horizon {
+
+/*! Downloads the packages of a script while the rest of it executes.
+ * The repositories, signing keys, and architecture of the script are set
+ * up in a staging root, and `apk cache download` resolves the package set
+ * and downloads it into a cache directory.  The packages can then be
+ * installed to the target from that cache.
+ *
+ * Prefetching is only an optimisation: if it fails, packages are simply
+ * downloaded when they are installed.
+ *
+ * Each prefetch stages its files in a directory of its own, which is
+ * removed when the prefetcher is destroyed.
+ */
+class APKPrefetch {
+public:
+    /*! What to prefetch. */
+    struct Request {
+        /*! The repositories to download from. */
+        std::vector<std::string> repositories;
+        /*! The signing keys to trust; absolute paths or HTTPS URLs. */
+        std::vector<std::string> keys;
+        /*! The CPU architecture of the target, or empty for the host's. */
+        std::string arch;
+        /*! The packages to install. */
+        std::vector<std::string> packages;
+    };
+
+    /*! Create a prefetcher.
+     * @param cache     The directory to download packages to, or empty to
+     *                  use a directory in the staging directory.
+     */
+    explicit APKPrefetch(const std::string &cache = "");
+    /*! Cancel the prefetch, if it is running, and remove the staging
+     * directory. */
+    ~APKPrefetch();
+    APKPrefetch(const APKPrefetch &) = delete;
+    APKPrefetch &operator=(const APKPrefetch &) = delete;
+
+    /*! Start downloading the packages of +request+ in the background.
+     * Messages are written to the output sink of the calling thread.
+     */
+    void start(Request request);
+
+    /*! Wait for the prefetch to finish.
+     * @returns true if every package was downloaded, false otherwise.
+     */
+    bool wait();
+
+    /*! Retrieve the cache directory that holds the downloaded packages. */
+    const std::string &cache_dir() const { return _cache; }
+private:
+    /*! Set up the staging root and download the packages. */
+    bool run(const Request &request);
+    /*! Run APK with +args+, unless the prefetch has been cancelled. */
+    int run_apk(const std::vector<std::string> &args);
+
+    /*! The directory in which files are staged, once created. */
+    std::string _dir;
+    /*! The directory to which packages are downloaded. */
+    std::string _cache;
+    /*! The thread doing the prefetch. */
+    std::thread _thread;
+    /*! Whether the prefetch succeeded. */
+    bool _success;
+    /*! Protects the members below. */
+    std::mutex _lock;
+    /*! The APK process running, or 0. */
+    ProcessSupervisor::Handle _child = 0;
+    /*! Set once the prefetcher is being destroyed. */
+    bool _cancelled = false;
+};
+
+}
+
+#endif /* !HSCRIPT_PREFETCH_HH_ */
@@ -12,177 +12,220 @@
 
 #include <algorithm>
 #include "util/filesystem.hh"
-#include <fstream>
 #include <iostream>
-#include <map>
+#include <mutex>
 #include <set>
-#include <sstream>
 
 #include "script.hh"
+#include "script_c.hh"
 #include "script_i.hh"
 #include "script_l.hh"
+#include "script_t.hh"
 #include "disk.hh"
 #include "meta.hh"
 #include "network.hh"
 #include "user.hh"
 
 #include "util/output.hh"
+#include "util/profile.hh"
 
-#define SCRIPT_LINE_MAX 512
+using namespace Horizon::Keys;
 
 
-typedef Horizon::Keys::Key *(*key_parse_fn)(const std::string &,
-                                            const Horizon::ScriptLocation &,
-                                            int*, int*, const Horizon::Script*);
+namespace Horizon {
 
-using namespace Horizon::Keys;
+/* The handlers for each Kind of key in HSCRIPT_KEYS; see script_k.hh. */
+#define KEY_HANDLER_One(Class, member, store) \
+    {&Class::parseFromData, &Class::loadFromCache, &ScriptPrivate::store,\
+     &ScriptPrivate::get_one<Class, &ScriptPrivate::member>, nullptr}
+#define KEY_HANDLER_List(Class, member, store) \
+    {&Class::parseFromData, &Class::loadFromCache, &ScriptPrivate::store,\
+     nullptr,\
+     &ScriptPrivate::get_all<Class, &ScriptPrivate::member>}
+#define KEY_HANDLER_Vector(Class, member, store) \
+    {&Class::parseFromData, &Class::loadFromCache,\
+     &ScriptPrivate::store<Class, &ScriptPrivate::member>, nullptr,\
+     &ScriptPrivate::get_all<Class, &ScriptPrivate::member>}
+#define KEY_HANDLER_Opaque(Class, member, store) \
+    {&Class::parseFromData, &Class::loadFromCache, &ScriptPrivate::store,\
+     nullptr, &ScriptPrivate::get_opaque}
+
+const Script::ScriptPrivate::KeyHandler Script::ScriptPrivate::handlers[] = {
+#define X(id, name, Class, Kind, member, store) \
+    KEY_HANDLER_##Kind(Class, member, store),
+    HSCRIPT_KEYS(X)
+#undef X
+    /* 'inherit' is handled by the parser. */
+    {nullptr, nullptr, nullptr, nullptr, nullptr}
+};
 
-const std::map<std::string, key_parse_fn> valid_keys = {
-    {"network", &Network::parseFromData},
-    {"hostname", &Hostname::parseFromData},
-    {"pkginstall", &PkgInstall::parseFromData},
-    {"rootpw", &RootPassphrase::parseFromData},
-
-    {"arch", &Arch::parseFromData},
-    {"language", &Language::parseFromData},
-    {"keymap", &Keymap::parseFromData},
-    {"firmware", &Firmware::parseFromData},
-    {"timezone", &Timezone::parseFromData},
-    {"repository", &Repository::parseFromData},
-    {"signingkey", &SigningKey::parseFromData},
-    {"svcenable", &SvcEnable::parseFromData},
-    {"version", &Version::parseFromData},
-    {"bootloader", &Bootloader::parseFromData},
-
-    {"netconfigtype", &NetConfigType::parseFromData},
-    {"netaddress", &NetAddress::parseFromData},
-    {"nameserver", &Nameserver::parseFromData},
-    {"netssid", &NetSSID::parseFromData},
-    {"pppoe", &PPPoE::parseFromData},
-
-    {"username", &Username::parseFromData},
-    {"useralias", &UserAlias::parseFromData},
-    {"userpw", &UserPassphrase::parseFromData},
-    {"usericon", &UserIcon::parseFromData},
-    {"usergroups", &UserGroups::parseFromData},
-
-    {"diskid", &DiskId::parseFromData},
-    {"disklabel", &DiskLabel::parseFromData},
-    {"partition", &Partition::parseFromData},
-    {"lvm_pv", &LVMPhysical::parseFromData},
-    {"lvm_vg", &LVMGroup::parseFromData},
-    {"lvm_lv", &LVMVolume::parseFromData},
-    {"encrypt", &Encrypt::parseFromData},
-    {"fs", &Filesystem::parseFromData},
-    {"mount", &Mount::parseFromData}
+#undef KEY_HANDLER_Opaque
+#undef KEY_HANDLER_Vector
+#undef KEY_HANDLER_List
+#undef KEY_HANDLER_One
+
+
+/*! The inherited scripts parsed by a ScriptLoader. */
+struct ScriptLoader::LoaderPrivate {
+    /*! Options to use for parsing, validation, and execution. */
+    ScriptOptions opts;
+    /*! The directory of the parse cache, or empty. */
+    std::string cache;
+    /*! The inherited scripts, by absolute path. */
+    std::map<std::string, std::shared_ptr<InheritedScript>> scripts;
+    /*! Guards +scripts+. */
+    std::mutex lock;
+
+    std::shared_ptr<const InheritedScript> inherit(const std::string &name);
+    std::shared_ptr<InheritedScript> parse(const std::string &name);
 };
 
+/*! Retrieve the inherited script at +name+, parsing it if it has not been
+ * parsed yet or has changed since.
+ * @returns The script, or nullptr if it cannot be shared.
+ */
+std::shared_ptr<const InheritedScript>
+ScriptLoader::LoaderPrivate::inherit(const std::string &name) {
+    struct stat st;
+    if(stat(name.c_str(), &st) != 0) return nullptr;
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = scripts.find(name);
+    if(found == scripts.end() ||
+       found->second->st.st_dev != st.st_dev ||
+       found->second->st.st_ino != st.st_ino ||
+       found->second->st.st_size != st.st_size ||
+       found->second->st.st_mtim.tv_sec != st.st_mtim.tv_sec ||
+       found->second->st.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+        std::shared_ptr<InheritedScript> parsed = parse(name);
+        if(parsed == nullptr) {
+            if(found != scripts.end()) scripts.erase(found);
+            return nullptr;
+        }
+        parsed->st = st;
+        found = scripts.insert_or_assign(name, parsed).first;
+    }
 
-namespace Horizon {
+    if(!found->second->shareable) return nullptr;
+    return found->second;
+}
 
-bool Script::ScriptPrivate::store_key(const std::string &key_name, Key *obj,
-                                      const ScriptLocation &pos, int *errors,
-                                      int *warnings, const ScriptOptions &opts) {
-    if(key_name == "network") {
-        return store_network(obj, pos, errors, warnings, opts);
-    } else if(key_name == "netconfigtype") {
-        return store_netconfig(obj, pos, errors, warnings, opts);
-    } else if(key_name == "netaddress") {
-        std::unique_ptr<NetAddress> addr(dynamic_cast<NetAddress *>(obj));
-        this->addresses.push_back(std::move(addr));
-        return true;
-    } else if(key_name == "nameserver") {
-        std::unique_ptr<Nameserver> ns(dynamic_cast<Nameserver *>(obj));
-        this->nses.push_back(std::move(ns));
-        return true;
-    } else if(key_name == "netssid") {
-        std::unique_ptr<NetSSID> ssid(dynamic_cast<NetSSID *>(obj));
-        this->ssids.push_back(std::move(ssid));
-        return true;
-    } else if(key_name == "pppoe") {
-        return store_pppoe(obj, pos, errors, warnings, opts);
-    } else if(key_name == "hostname") {
-        return store_hostname(obj, pos, errors, warnings, opts);
-    } else if(key_name == "pkginstall") {
-        return store_pkginstall(obj, pos, errors, warnings, opts);
-    } else if(key_name == "arch") {
-        return store_arch(obj, pos, errors, warnings, opts);
-    } else if(key_name == "rootpw") {
-        return store_rootpw(obj, pos, errors, warnings, opts);
-    } else if(key_name == "language") {
-        return store_lang(obj, pos, errors, warnings, opts);
-    } else if(key_name == "keymap") {
-        return store_keymap(obj, pos, errors, warnings, opts);
-    } else if(key_name == "firmware") {
-        return store_firmware(obj, pos, errors, warnings, opts);
-    } else if(key_name == "timezone") {
-        return store_timezone(obj, pos, errors, warnings, opts);
-    } else if(key_name == "repository") {
-        std::unique_ptr<Repository> repo(dynamic_cast<Repository *>(obj));
-        this->repos.push_back(std::move(repo));
-        return true;
-    } else if(key_name == "signingkey") {
-        std::unique_ptr<SigningKey> key(dynamic_cast<SigningKey *>(obj));
-        this->repo_keys.push_back(std::move(key));
-        return true;
-    } else if(key_name == "svcenable") {
-        return store_svcenable(obj, pos, errors, warnings, opts);
-    } else if(key_name == "version") {
-        return store_version(obj, pos, errors, warnings, opts);
-    } else if(key_name == "bootloader") {
-        return store_bootloader(obj, pos, errors, warnings, opts);
-    } else if(key_name == "username") {
-        return store_username(obj, pos, errors, warnings, opts);
-    } else if(key_name == "useralias") {
-        return store_useralias(obj, pos, errors, warnings, opts);
-    } else if(key_name == "userpw") {
-        return store_userpw(obj, pos, errors, warnings, opts);
-    } else if(key_name == "usericon") {
-        return store_usericon(obj, pos, errors, warnings, opts);
-    } else if(key_name == "usergroups") {
-        return store_usergroups(obj, pos, errors, warnings, opts);
-    } else if(key_name == "diskid") {
-        std::unique_ptr<DiskId> diskid(dynamic_cast<DiskId *>(obj));
-        this->diskids.push_back(std::move(diskid));
-        return true;
-    } else if(key_name == "disklabel") {
-        std::unique_ptr<DiskLabel> l(dynamic_cast<DiskLabel *>(obj));
-        this->disklabels.push_back(std::move(l));
-        return true;
-    } else if(key_name == "partition") {
-        std::unique_ptr<Partition> p(dynamic_cast<Partition *>(obj));
-        this->partitions.push_back(std::move(p));
-        return true;
-    } else if(key_name == "lvm_pv") {
-        std::unique_ptr<LVMPhysical> pv(dynamic_cast<LVMPhysical *>(obj));
-        this->lvm_pvs.push_back(std::move(pv));
-        return true;
-    } else if(key_name == "lvm_vg") {
-        std::unique_ptr<LVMGroup> vg(dynamic_cast<LVMGroup *>(obj));
-        this->lvm_vgs.push_back(std::move(vg));
-        return true;
-    } else if(key_name == "lvm_lv") {
-        std::unique_ptr<LVMVolume> lv(dynamic_cast<LVMVolume *>(obj));
-        this->lvm_lvs.push_back(std::move(lv));
-        return true;
-    } else if(key_name == "encrypt") {
-        std::unique_ptr<Encrypt> e(dynamic_cast<Encrypt *>(obj));
-        this->luks.push_back(std::move(e));
-        return true;
-    } else if(key_name == "fs") {
-        std::unique_ptr<Filesystem> fs(dynamic_cast<Filesystem *>(obj));
-        this->fses.push_back(std::move(fs));
-        return true;
-    } else if(key_name == "mount") {
-        std::unique_ptr<Mount> mount(dynamic_cast<Mount *>(obj));
-        this->mounts.push_back(std::move(mount));
-        return true;
-    } else {
-        return false;  /* LCOV_EXCL_LINE - only here for error prevention */
+/*! Parse the keys of the inherited script at +name+.
+ * Diagnostics are discarded; a script that has any is not shareable, and is
+ * parsed again by each Script that inherits it.
+ */
+std::shared_ptr<InheritedScript>
+ScriptLoader::LoaderPrivate::parse(const std::string &name) {
+    ScriptTokeniser tokens;
+    bool io_error;
+    if(!tokens.open(name, &io_error) || io_error) return nullptr;
+
+    auto script = std::make_shared<InheritedScript>();
+    script->owner.reset(new Script);
+    script->owner->opts = opts;
+    script->file = {name, tokens.data().size(), cache_hash(tokens.data())};
+
+    CollectorSink discard;
+    OutputScope scope(discard);
+    int errors = 0, warnings = 0;
+    ScriptToken token;
+    while(errors == 0 && warnings == 0 && tokens.next(token)) {
+        const KeyId key = key_id(token.key);
+        if(token.value.empty() || key == KeyId::Invalid) {
+            errors++;
+        } else if(key == KeyId::Inherit) {
+            script->inherit = token.value;
+            script->inherit_line = token.line;
+            break;
+        } else if(key == KeyId::Bootloader) {
+            /* The default bootloader depends on the inheriting script's
+             * architecture. */
+            script->keys.push_back({key, token.line, nullptr,
+                                    std::string(token.value)});
+        } else {
+            const ScriptLocation pos(name, token.line, true);
+            Key *obj = Script::ScriptPrivate::handlers[
+                    static_cast<std::size_t>(key)].parse(
+                        token.value, pos, &errors, &warnings,
+                        script->owner.get());
+            if(obj == nullptr) errors++;
+            script->keys.push_back({key, token.line, obj, ""});
+        }
     }
+    script->shareable = errors == 0 && warnings == 0 &&
+                        script->owner->internal->cacheable;
+    if(!script->shareable) {
+        script->owner.reset();
+        script->keys.clear();
+    }
+    return script;
 }
 
 
+ScriptLoader::ScriptLoader(const ScriptOptions &opts,
+                           const std::string &cache) {
+    internal = new LoaderPrivate;
+    internal->opts = opts;
+    internal->cache = cache;
+}
+
+ScriptLoader::~ScriptLoader() {
+    delete internal;
+}
+
+Script *ScriptLoader::load(const std::string &path) {
+    ScriptTokeniser tokens;
+    bool io_error;
+    if(!tokens.open(path, &io_error)) {
+        output_error(path, "Cannot open installfile", "");
+        return nullptr;
+    }
+
+    return Script::parse(tokens, io_error, internal->opts, path,
+                         internal->cache, this);
+}
+
+Script *ScriptLoader::load(std::istream &sstream, const std::string &name) {
+    ScriptTokeniser tokens;
+    bool io_error = !tokens.read(sstream);
+
+    return Script::parse(tokens, io_error, internal->opts, name,
+                         internal->cache, this);
+}
+
+
+/* How to copy each Kind of key in HSCRIPT_KEYS; see script_k.hh. */
+#define KEY_UNSHARE_One(id, member) own(KeyId::id, member, self);
+#define KEY_UNSHARE_List(id, member) \
+    for(auto &obj : member) own(KeyId::id, obj, self);
+#define KEY_UNSHARE_Vector(id, member) KEY_UNSHARE_List(id, member)
+/* Packages are copied when stored; accounts are copied below. */
+#define KEY_UNSHARE_Opaque(id, member)
+
+void Script::ScriptPrivate::unshare(const Script *self) {
+    if(bases.empty()) return;
+
+#define X(id, name, Class, Kind, member, store) KEY_UNSHARE_##Kind(id, member)
+    HSCRIPT_KEYS(X)
+#undef X
+    for(auto &account : accounts) {
+        UserDetail &detail = account.second;
+        own(KeyId::Username, detail.name, self);
+        own(KeyId::UserAlias, detail.alias, self);
+        own(KeyId::UserPassphrase, detail.passphrase, self);
+        own(KeyId::UserIcon, detail.icon, self);
+        for(auto &group : detail.groups) own(KeyId::UserGroups, group, self);
+    }
+
+    bases.clear();
+}
+
+#undef KEY_UNSHARE_Opaque
+#undef KEY_UNSHARE_Vector
+#undef KEY_UNSHARE_List
+#undef KEY_UNSHARE_One
+
+
 Script::Script() {
     internal = new ScriptPrivate;
     internal->target = "/target";
@@ -192,19 +235,35 @@ Script::~Script() {
     delete internal;
 }
 
-Script *Script::load(const std::string &path, const ScriptOptions &opts) {
-    std::ifstream file(path);
-    if(!file) {
+Script *Script::load(const std::string &path, const ScriptOptions &opts,
+                     const std::string &cache) {
+    ProfileSpan span("script", "load");
+    span.set_detail(path);
+    ScriptTokeniser tokens;
+    bool io_error;
+    if(!tokens.open(path, &io_error)) {
         output_error(path, "Cannot open installfile", "");
         return nullptr;
     }
 
-    return Script::load(file, opts, path);
+    return Script::parse(tokens, io_error, opts, path, cache, nullptr);
 }
 
 
 Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
-                     const std::string &name) {
+                     const std::string &name, const std::string &cache) {
+    ProfileSpan span("script", "load");
+    span.set_detail(name);
+    ScriptTokeniser tokens;
+    bool io_error = !tokens.read(sstream);
+
+    return Script::parse(tokens, io_error, opts, name, cache, nullptr);
+}
+
+
+Script *Script::parse(ScriptTokeniser &tokens, bool io_error,
+                      const ScriptOptions &opts, const std::string &name,
+                      const std::string &cache, ScriptLoader *loader) {
 #define PARSER_ERROR(err_str) \
     errors++;\
     output_error(pos, err_str, "");\
@@ -218,12 +277,10 @@ Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
 
     using namespace Horizon::Keys;
 
-    Script *the_script = new Script;
-    the_script->opts = opts;
+    static_assert(sizeof(ScriptPrivate::handlers) ==
+                  sizeof(ScriptPrivate::handlers[0]) * KEY_COUNT,
+                  "every key must have a handler");
 
-    int lineno = 0;
-    char nextline[SCRIPT_LINE_MAX];
-    const std::string delim(" \t");
     int errors = 0, warnings = 0;
     std::string curr_name;
     if(name == "/dev/stdin") {
@@ -231,41 +288,83 @@ Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
     } else {
         curr_name = fs::canonical(fs::path(name));
     }
-    std::set<std::string> seen = {curr_name};
-    bool inherit = false;
-    std::istream *my_stream = &sstream;
 
-    while(my_stream->getline(nextline, sizeof(nextline))) {
-        lineno++;
-        if(nextline[0] == '#') {
-            /* This is a comment line; ignore it. */
-            continue;
+    /* The files read and the Keys stored, to save to the parse cache. */
+    std::vector<CacheFile> cache_files;
+    std::vector<std::pair<KeyId, const Key *>> cache_keys;
+    if(!cache.empty() && !io_error) {
+        Script *cached = ScriptPrivate::load_cache(cache, curr_name,
+                                                   tokens.data(), opts);
+        if(cached != nullptr) {
+            output_log("parser", "0", curr_name,
+                       "0 error(s), 0 warning(s) (cached).", "");
+            return cached;
         }
+        cache_files.push_back({curr_name, tokens.data().size(),
+                               cache_hash(tokens.data())});
+    }
 
-        const ScriptLocation pos(curr_name, lineno, inherit);
-        const std::string line(nextline);
-        std::string key;
-        std::string::size_type start, key_end, value_begin;
-        start = line.find_first_not_of(delim);
-        if(start == std::string::npos) {
-            /* This is a blank line; ignore it. */
+    Script *the_script = new Script;
+    the_script->opts = opts;
+    std::set<std::string> seen = {curr_name};
+    bool inherit = false;
+    /* The tokeniser for an inherited script, which replaces +tokens+. */
+    std::unique_ptr<ScriptTokeniser> inherited;
+    ScriptTokeniser *my_tokens = &tokens;
+    ScriptToken token;
+    /* The script shared by +loader+ that replaces +tokens+, and the index of
+     * its next key. */
+    const InheritedScript *shared = nullptr;
+    std::size_t shared_key = 0;
+
+    if(io_error) {
+        output_error(curr_name, "I/O error while reading installfile", "");
+        errors++;
+    }
+
+    while(true) {
+        if(shared != nullptr && shared_key < shared->keys.size()) {
+            const InheritedScript::Event &event = shared->keys[shared_key++];
+            const ScriptLocation pos(curr_name, event.line, true);
+            Key *key_obj = event.obj;
+            if(key_obj == nullptr) {
+                key_obj = ScriptPrivate::handlers[
+                        static_cast<std::size_t>(event.key)].parse(
+                            event.value, pos, &errors, &warnings, the_script);
+                if(!key_obj) {
+                    PARSER_ERROR("value for key '" +
+                                 std::string(key_name(event.key)) +
+                                 "' was invalid")
+                    continue;
+                }
+            }
+            if(!the_script->internal->store_key(event.key, key_obj, pos,
+                                                &errors, &warnings, opts)) {
+                PARSER_ERROR("stopping due to prior errors")
+                continue;
+            }
+            if(!cache_files.empty()) cache_keys.push_back({event.key,
+                                                           key_obj});
             continue;
+        } else if(shared != nullptr) {
+            if(shared->inherit.empty()) break;
+            token = {shared->inherit_line, key_name(KeyId::Inherit),
+                     shared->inherit};
+            shared = nullptr;
+        } else if(!my_tokens->next(token)) {
+            break;
         }
+        const ScriptLocation pos(curr_name, token.line, inherit);
 
-        key_end = line.find_first_of(delim, start);
-        value_begin = line.find_first_not_of(delim, key_end);
-        key = line.substr(start, (key_end - start));
-        if(key_end == std::string::npos || value_begin == std::string::npos) {
+        if(token.value.empty()) {
             /* Key without value */
-            PARSER_ERROR("key '" + key + "' has no value")
+            PARSER_ERROR("key '" + std::string(token.key) + "' has no value")
             continue;
         }
 
-        /* Normalise key to lower-case */
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-
-        if(key == "inherit") {
-            std::string next_name{line.substr(value_begin)};
+        const KeyId key = key_id(token.key);
+        if(key == KeyId::Inherit) {
+            std::string next_name{token.value};
             if(fs::path(next_name).is_relative()) {
                 fs::path better_path = fs::absolute(curr_name);
                 better_path.remove_filename();
@@ -279,32 +378,56 @@ Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
             }
             seen.insert(next_name);
 
-            if(!fs::exists(next_name)) {
+            std::shared_ptr<const InheritedScript> base;
+            if(loader != nullptr) base = loader->internal->inherit(next_name);
+            if(base != nullptr) {
+                curr_name = next_name;
+                inherit = true;
+                shared = base.get();
+                shared_key = 0;
+                the_script->internal->bases.push_back(base);
+                if(!cache_files.empty()) cache_files.push_back(base->file);
+                continue;
+            }
+
+            bool next_error;
+            std::unique_ptr<ScriptTokeniser> next{new ScriptTokeniser};
+            if(!fs::exists(next_name) || !next->open(next_name, &next_error)) {
                 PARSER_ERROR("attempt to inherit from non-existent file")
                 break;
             } else {
-                if(my_stream != &sstream) delete my_stream;
                 curr_name = next_name;
                 inherit = true;
-                my_stream = new std::ifstream(curr_name);
+                inherited = std::move(next);
+                my_tokens = inherited.get();
+                if(next_error) {
+                    PARSER_ERROR("I/O error while reading installfile")
+                }
+                if(!cache_files.empty()) {
+                    cache_files.push_back({curr_name, my_tokens->data().size(),
+                                           cache_hash(my_tokens->data())});
+                }
             }
             continue;
         }
 
-        if(valid_keys.find(key) == valid_keys.end()) {
-            /* Invalid key */
+        if(key == KeyId::Invalid) {
+            /* Invalid key; normalise it to lower-case for display */
+            std::string name(token.key);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
             if(opts.test(StrictMode)) {
-                PARSER_ERROR("key '" + key + "' is not defined")
+                PARSER_ERROR("key '" + name + "' is not defined")
             } else {
-                PARSER_WARNING("key '" + key + "' is not defined")
+                PARSER_WARNING("key '" + name + "' is not defined")
             }
             continue;
         }
 
-        Key *key_obj = valid_keys.at(key)(line.substr(value_begin), pos,
-                                          &errors, &warnings, the_script);
+        Key *key_obj = ScriptPrivate::handlers[static_cast<std::size_t>(key)]
+                .parse(token.value, pos, &errors, &warnings, the_script);
         if(!key_obj) {
-            PARSER_ERROR("value for key '" + key + "' was invalid")
+            PARSER_ERROR("value for key '" + std::string(key_name(key)) +
+                         "' was invalid")
             continue;
         }
 
@@ -313,20 +436,7 @@ Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
             PARSER_ERROR("stopping due to prior errors")
             continue;
         }
-    }
-
-    if(my_stream->fail() && !my_stream->eof()) {
-        output_error(curr_name + ":" + std::to_string(lineno + 1),
-                     "line exceeds maximum length",
-                     "Maximum line length is " +
-                     std::to_string(SCRIPT_LINE_MAX));
-        errors++;
-    }
-
-    if(my_stream->bad() && !my_stream->eof()) {
-        output_error(curr_name + ":" + std::to_string(lineno),
-                     "I/O error while reading installfile", "");
-        errors++;
+        if(!cache_files.empty()) cache_keys.push_back({key, key_obj});
     }
 
     /* Ensure all required keys are present. */
@@ -358,12 +468,15 @@ Script *Script::load(std::istream &sstream, const ScriptOptions &opts,
                std::to_string(errors) + " error(s), " +
                std::to_string(warnings) + " warning(s).", "");
 
-    if(my_stream != &sstream) delete my_stream;
-
     if(errors > 0) {
         delete the_script;
         return nullptr;
     } else {
+        /* Warnings are not saved, so only a script without any is cached. */
+        if(!cache_files.empty() && warnings == 0 &&
+           the_script->internal->cacheable) {
+            ScriptPrivate::save_cache(cache, cache_files, cache_keys, opts);
+        }
         return the_script;
     }
 
@@ -377,80 +490,43 @@ const std::string Script::targetDirectory() const {
 }
 
 void Script::setTargetDirectory(const std::string &dir) {
+    /* Shared Keys would still use the target directory of their owner. */
+    this->internal->unshare(this);
     this->internal->target = dir;
 }
 
-const Keys::Key *Script::getOneValue(std::string name) const {
-    if(name == "network") {
-        return this->internal->network.get();
-    } else if(name == "netconfigtype") {
-        return this->internal->netconfig.get();
-    } else if(name == "hostname") {
-        return this->internal->hostname.get();
-    } else if(name == "arch") {
-        return this->internal->arch.get();
-    } else if(name == "rootpw") {
-        return this->internal->rootpw.get();
-    } else if(name == "language") {
-        return this->internal->lang.get();
-    } else if(name == "keymap") {
-        return this->internal->keymap.get();
-    } else if(name == "version") {
-        return this->internal->version.get();
-    } else if(name == "bootloader") {
-        return this->internal->boot.get();
-    } else if(name == "firmware") {
-#ifdef NON_LIBRE_FIRMWARE
-        return this->internal->firmware.get();
-#else  /* !NON_LIBRE_FIRMWARE */
-        return nullptr;
-#endif  /* NON_LIBRE_FIRMWARE */
-    } else if(name == "timezone") {
-        return this->internal->tzone.get();
+void Script::setDiskJobs(unsigned int jobs) {
+    this->internal->disk_jobs = jobs;
+}
+
+void Script::setPackageCache(const std::string &dir, std::uint64_t limit) {
+    this->internal->pkg_cache = dir;
+    this->internal->pkg_cache_limit = limit;
+}
+
+void Script::setLayerCache(const std::string &dir) {
+    this->internal->layer_cache = dir;
+}
+
+const Keys::Key *Script::getOneValue(std::string_view name) const {
+    const KeyId key = key_id(name);
+    if(key != KeyId::Invalid) {
+        auto one = ScriptPrivate::handlers[static_cast<std::size_t>(key)].one;
+        if(one != nullptr) return (this->internal->*one)();
     }
 
     assert("Unknown key given to getOneValue." == nullptr);
     return nullptr;
 }
 
-const std::vector<Keys::Key *> Script::getValues(std::string name) const {
+const std::vector<Keys::Key *> Script::getValues(std::string_view name) const {
     std::vector<Keys::Key *> values;
 
-    if(name == "netaddress") {
-        for(auto &addr : this->internal->addresses) values.push_back(addr.get());
-    } else if(name == "nameserver") {
-        for(auto &ns : this->internal->nses) values.push_back(ns.get());
-    } else if(name == "netssid") {
-        for(auto &ssid : this->internal->ssids) values.push_back(ssid.get());
-    } else if(name == "pkginstall") {
-        /* XXX */
-    } else if(name == "repository") {
-        for(auto &repo : this->internal->repos) values.push_back(repo.get());
-    } else if(name == "signing_key") {
-        for(auto &key : this->internal->repo_keys) values.push_back(key.get());
-    } else if(name == "svcenable") {
-        for(auto &svc : this->internal->svcs_enable) values.push_back(svc.get());
-    } else if(name == "username" || name == "useralias" || name == "userpw" ||
-              name == "usericon" || name == "usergroups") {
-        /* XXX */
-    } else if(name == "diskid") {
-        for(auto &id : this->internal->diskids) values.push_back(id.get());
-    } else if(name == "disklabel") {
-        for(auto &label : this->internal->disklabels) values.push_back(label.get());
-    } else if(name == "partition") {
-        for(auto &part : this->internal->partitions) values.push_back(part.get());
-    } else if(name == "lvm_pv") {
-        for(auto &pv : this->internal->lvm_pvs) values.push_back(pv.get());
-    } else if(name == "lvm_vg") {
-        for(auto &vg : this->internal->lvm_vgs) values.push_back(vg.get());
-    } else if(name == "lvm_lv") {
-        for(auto &lv : this->internal->lvm_lvs) values.push_back(lv.get());
-    } else if(name == "encrypt") {
-        /* XXX */
-    } else if(name == "fs") {
-        for(auto &fs : this->internal->fses) values.push_back(fs.get());
-    } else if(name == "mount") {
-        for(auto &mnt : this->internal->mounts) values.push_back(mnt.get());
+    const KeyId key = key_id(name);
+    if(key != KeyId::Invalid &&
+       ScriptPrivate::handlers[static_cast<std::size_t>(key)].all != nullptr) {
+        auto all = ScriptPrivate::handlers[static_cast<std::size_t>(key)].all;
+        (this->internal->*all)(values);
     } else {
         assert("Unknown key given to getValues." == nullptr);
     }
@@ -13,7 +13,9 @@
 #ifndef __HSCRIPT_SCRIPT_HH_
 #define __HSCRIPT_SCRIPT_HH_
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <bitset>
@@ -28,6 +30,9 @@ class Key;
 
 }
 
+class ScriptLoader;
+class ScriptTokeniser;
+
 /**** Script option flags ****/
 
 enum ScriptOptionFlags {
@@ -45,6 +50,9 @@ enum ScriptOptionFlags {
     Simulate,
     /*! Installing to an image; don't mount anything */
     ImageOnly,
+    /*! Resume an interrupted execution, skipping the steps that its
+     * journal records as complete */
+    Resume,
     /*! Count of flags */
     NumFlags
 };
@@ -53,7 +61,10 @@ enum ScriptOptionFlags {
 typedef std::bitset<ScriptOptionFlags::NumFlags> ScriptOptions;
 
 
-/*! Defines the Script class, which represents a HorizonScript. */
+/*! Defines the Script class, which represents a HorizonScript.
+ * Different Scripts may be loaded, validated, and executed by different
+ * threads at once, but each Script may only be used by one thread at a time.
+ */
 class Script {
 private:
     /*! Initialise the Script class. */
@@ -66,19 +77,25 @@ public:
     /*! Load a HorizonScript from the specified path.
      * @param path      The path to load from.
      * @param options   Options to use for parsing, validation, and execution.
+     * @param cache     The directory of the parse cache, or empty to parse
+     *                  the script without a cache.
      * @return true if the Script could be loaded; false otherwise.
      */
     static Script *load(const std::string &path,
-                        const ScriptOptions &options = 0);
+                        const ScriptOptions &options = 0,
+                        const std::string &cache = "");
     /*! Load a HorizonScript from the specified stream.
      * @param stream    The stream to load from.
      * @param options   Options to use for parsing, validation, and execution.
      * @param name      The name of the stream to use in diagnostic messages.
+     * @param cache     The directory of the parse cache, or empty to parse
+     *                  the script without a cache.
      * @return true if the Script could be loaded; false otherwise.
      */
     static Script *load(std::istream &stream,
                         const ScriptOptions &options = 0,
-                        const std::string &name = "installfile");
+                        const std::string &name = "installfile",
+                        const std::string &cache = "");
 
     /*! Determines if the HorizonScript is valid. */
     bool validate() const;
@@ -92,26 +109,111 @@ public:
     /*! Set the current target directory. */
     void setTargetDirectory(const std::string &dir);
 
+    /*! Set the most disk Keys that execute() may run at once.
+     * Disk Keys that do not depend on each other, such as file systems on
+     * different disks, are run at the same time.  The default, 0, uses one
+     * job per processor.  Simulations always run one Key at a time.
+     */
+    void setDiskJobs(unsigned int jobs);
+
+    /*! Set a directory on the host in which execute() caches packages.
+     * The cache is kept between installations, and may be shared by many
+     * at once.  Once installation is done, the least recently used packages
+     * are evicted until the cache holds at most +limit+ bytes.
+     * @param dir       The cache directory, or empty for no cache.
+     * @param limit     The size limit of the cache, or 0 for no limit.
+     */
+    void setPackageCache(const std::string &dir, std::uint64_t limit = 0);
+
+    /*! Set a directory on the host in which execute() caches the target of
+     * an image once its packages are installed.  A later image with the
+     * same architecture, repositories, signing keys, and packages starts
+     * from the cached target, and only configures it.  This has no effect
+     * unless the ImageOnly option is set.
+     * @param dir       The cache directory, or empty for no cache.
+     */
+    void setLayerCache(const std::string &dir);
+
     /*! Retrieve the value of a specified key in this HorizonScript.
      * @param name      The name of the key to retrieve.
      * @return The key object, if one exists.  nullptr if the key has not been
      *         specified.
      */
-    const Keys::Key *getOneValue(std::string name) const;
+    const Keys::Key *getOneValue(std::string_view name) const;
 
     /*! Retrieve all values for a specified key in this HorizonScript.
      * @param name      The name of the key to retrieve.
      * @return A std::vector of the key objects.  The vector may be empty if
      *         no values exist for the specified key.
      */
-    const std::vector<Keys::Key *> getValues(std::string name) const;
+    const std::vector<Keys::Key *> getValues(std::string_view name) const;
 
     /*! Retrieve the options set for this HorizonScript object. */
     ScriptOptions options() const;
 private:
+    /*! Parse a HorizonScript from the specified tokeniser.
+     * @param tokens    The tokeniser holding the script.
+     * @param io_error  Whether an I/O error occurred reading the script.
+     * @param options   Options to use for parsing, validation, and execution.
+     * @param name      The name of the script to use in diagnostic messages.
+     * @param cache     The directory of the parse cache, or empty.
+     * @param loader    The loader sharing inherited scripts, or nullptr.
+     * @return The Script if it could be parsed; nullptr otherwise.
+     */
+    static Script *parse(ScriptTokeniser &tokens, bool io_error,
+                         const ScriptOptions &options,
+                         const std::string &name, const std::string &cache,
+                         ScriptLoader *loader);
+
     struct ScriptPrivate;
     /*! Internal data. */
     ScriptPrivate *internal;
+
+    /*! Keys are allocated from the Script's arena. */
+    friend class Keys::Key;
+    friend class ScriptLoader;
+};
+
+
+/*! Loads many HorizonScripts that inherit the same scripts.
+ * Each script that is inherited is parsed only once by a ScriptLoader, and
+ * its Keys are shared by every Script loaded that inherits it.  A Script
+ * makes its own copy of the shared Keys before executing, or when its target
+ * directory is changed.
+ *
+ * Scripts loaded by a ScriptLoader may outlive it.  A ScriptLoader may be
+ * used by many threads at once.
+ */
+class ScriptLoader {
+public:
+    /*! Create a ScriptLoader.
+     * @param options   Options to use for parsing, validation, and execution.
+     * @param cache     The directory of the parse cache, or empty to parse
+     *                  the scripts without a cache.
+     */
+    explicit ScriptLoader(const ScriptOptions &options = 0,
+                          const std::string &cache = "");
+    ~ScriptLoader();
+    ScriptLoader(const ScriptLoader &) = delete;
+    ScriptLoader &operator=(const ScriptLoader &) = delete;
+
+    /*! Load a HorizonScript from the specified path.
+     * @param path      The path to load from.
+     * @return The Script if it could be loaded; nullptr otherwise.
+     */
+    Script *load(const std::string &path);
+    /*! Load a HorizonScript from the specified stream.
+     * @param stream    The stream to load from.
+     * @param name      The name of the stream to use in diagnostic messages.
+     * @return The Script if it could be loaded; nullptr otherwise.
+     */
+    Script *load(std::istream &stream, const std::string &name = "installfile");
+private:
+    struct LoaderPrivate;
+    /*! Internal data. */
+    LoaderPrivate *internal;
+
+    friend class Script;
 };
 
 }
@@ -0,0 +1,241 @@
+/*
+ * script_c.cc - Implementation of the HorizonScript parse cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unistd.h>
+#include "util/filesystem.hh"
+
+#include "script.hh"
+#include "script_c.hh"
+#include "script_i.hh"
+#include "script_t.hh"
+
+namespace Horizon {
+
+/*! Identifies the library that saved an entry.  An entry saved by any other
+ * version or configuration of the library is never used. */
+static const std::string_view cache_build = "hscript " VERSTR " cache "
+#define CACHE_STR(x) #x
+#define CACHE_XSTR(x) CACHE_STR(x)
+        CACHE_XSTR(SCRIPT_CACHE_FORMAT)
+#undef CACHE_XSTR
+#undef CACHE_STR
+#ifdef NON_LIBRE_FIRMWARE
+        " firmware"
+#endif
+        ;
+
+/*! The size of the checksum at the end of each entry. */
+#define CACHE_SUM_SIZE sizeof(std::uint64_t)
+
+std::uint64_t cache_hash(std::string_view data, std::uint64_t hash) {
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void CacheWriter::put_number(std::uint64_t number) {
+    do {
+        unsigned char byte = number & 0x7F;
+        number >>= 7;
+        if(number != 0) byte |= 0x80;
+        _data.push_back(static_cast<char>(byte));
+    } while(number != 0);
+}
+
+void CacheWriter::put_string(std::string_view str) {
+    put_number(str.size());
+    _data.append(str);
+}
+
+std::uint64_t CacheReader::get_number() {
+    std::uint64_t number = 0;
+    for(unsigned int shift = 0; shift < 64; shift += 7) {
+        if(_pos == _end) break;
+        const unsigned char byte = static_cast<unsigned char>(*_pos++);
+        number |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0) return number;
+    }
+    _failed = true;
+    return 0;
+}
+
+std::string_view CacheReader::get_string() {
+    const std::uint64_t size = get_number();
+    if(_failed || size > static_cast<std::uint64_t>(_end - _pos)) {
+        _failed = true;
+        return std::string_view();
+    }
+    const std::string_view str(_pos, size);
+    _pos += size;
+    return str;
+}
+
+
+/*! Determine the path of the entry for a script.
+ * Entries are named for the script's location, contents, and options; the
+ * files it inherits are checked when the entry is loaded.
+ */
+static std::string cache_entry(const std::string &cache,
+                               const CacheFile &script,
+                               const ScriptOptions &opts) {
+    /* Relative inherits from <stdin> depend on the working directory. */
+    std::uint64_t key = cache_hash(fs::absolute(script.name).string());
+    key = cache_hash(opts.to_string(), key);
+    key = cache_hash(std::to_string(script.size) + "/" +
+                     std::to_string(script.hash), key);
+
+    char entry[24];
+    std::snprintf(entry, sizeof(entry), "%016llx.hsc",
+                  static_cast<unsigned long long>(key));
+    return (fs::path(cache) / entry).string();
+}
+
+
+Script *Script::ScriptPrivate::load_cache(const std::string &cache,
+                                          const std::string &name,
+                                          std::string_view data,
+                                          const ScriptOptions &opts) {
+    const CacheFile script{name, data.size(), cache_hash(data)};
+    std::ifstream file(cache_entry(cache, script, opts), std::ios::binary);
+    if(!file) return nullptr;
+    const std::string entry{std::istreambuf_iterator<char>(file),
+                            std::istreambuf_iterator<char>()};
+    if(file.bad() || entry.size() < CACHE_SUM_SIZE) return nullptr;
+
+    const std::string_view body(entry.data(), entry.size() - CACHE_SUM_SIZE);
+    std::uint64_t sum;
+    std::memcpy(&sum, entry.data() + body.size(), CACHE_SUM_SIZE);
+    if(sum != cache_hash(body)) return nullptr;
+
+    CacheReader in(body);
+    if(in.get_string() != cache_build) return nullptr;
+    if(in.get_string() != opts.to_string()) return nullptr;
+
+    /* Ensure the script, and everything it inherits, is unchanged. */
+    std::vector<std::string> names;
+    for(std::uint64_t count = in.get_number(); count > 0 && !in.failed();
+        count--) {
+        CacheFile saved;
+        saved.name = in.get_string();
+        saved.size = in.get_number();
+        saved.hash = in.get_number();
+        if(in.failed()) return nullptr;
+
+        if(names.empty()) {
+            if(saved.name != script.name || saved.size != script.size ||
+               saved.hash != script.hash) {
+                return nullptr;
+            }
+        } else {
+            ScriptTokeniser inherited;
+            bool io_error;
+            if(!inherited.open(saved.name, &io_error) || io_error ||
+               saved.size != inherited.data().size() ||
+               saved.hash != cache_hash(inherited.data())) {
+                return nullptr;
+            }
+        }
+        names.push_back(saved.name);
+    }
+    if(in.failed() || names.empty()) return nullptr;
+
+    Script *the_script = new Script;
+    the_script->opts = opts;
+    int errors = 0, warnings = 0;
+
+    for(std::uint64_t count = in.get_number(); count > 0 && !in.failed();
+        count--) {
+        const std::uint64_t key = in.get_number();
+        const std::uint64_t file = in.get_number();
+        const int line = static_cast<int>(in.get_number());
+        const bool inherit = in.get_number() != 0;
+        if(in.failed() || key >= KEY_COUNT || file >= names.size()) {
+            errors++;
+            break;
+        }
+
+        const ScriptLocation pos(names[file], line, inherit);
+        Key *obj = handlers[key].load(in, pos, the_script);
+        if(obj == nullptr || in.failed() ||
+           !the_script->internal->store_key(static_cast<KeyId>(key), obj, pos,
+                                            &errors, &warnings, opts)) {
+            errors++;
+            break;
+        }
+    }
+
+    if(in.failed() || !in.at_end() || errors > 0 || warnings > 0) {
+        delete the_script;
+        return nullptr;
+    }
+    return the_script;
+}
+
+
+void Script::ScriptPrivate::save_cache(const std::string &cache,
+                                       const std::vector<CacheFile> &files,
+                                       const std::vector<std::pair<KeyId,
+                                       const Key *>> &keys,
+                                       const ScriptOptions &opts) {
+    CacheWriter out;
+    out.put_string(cache_build);
+    out.put_string(opts.to_string());
+
+    out.put_number(files.size());
+    for(const auto &file : files) {
+        out.put_string(file.name);
+        out.put_number(file.size);
+        out.put_number(file.hash);
+    }
+
+    out.put_number(keys.size());
+    for(const auto &key : keys) {
+        const ScriptLocation pos = key.second->where();
+        std::size_t file = 0;
+        while(file < files.size() - 1 && files[file].name != pos.name) file++;
+        out.put_number(static_cast<std::size_t>(key.first));
+        out.put_number(file);
+        out.put_number(static_cast<std::uint64_t>(pos.line));
+        out.put_number(pos.inherited);
+        key.second->saveToCache(out);
+    }
+
+    const std::uint64_t sum = cache_hash(out.data());
+
+    /* Write to a temporary file first, so that a concurrent load never sees
+     * a partial entry. */
+    error_code ec;
+    fs::create_directories(cache, ec);
+    const std::string entry = cache_entry(cache, files[0], opts);
+    std::string temp = entry + ".XXXXXX";
+    int fd = mkstemp(&temp[0]);
+    if(fd == -1) return;
+
+    const std::string &data = out.data();
+    bool written = write(fd, data.data(), data.size()) ==
+                   static_cast<ssize_t>(data.size()) &&
+                   write(fd, &sum, CACHE_SUM_SIZE) ==
+                   static_cast<ssize_t>(CACHE_SUM_SIZE);
+    if(close(fd) != 0) written = false;
+
+    if(!written || std::rename(temp.c_str(), entry.c_str()) != 0) {
+        unlink(temp.c_str());
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+/*
+ * script_c.hh - Definition of the HorizonScript parse cache
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_SCRIPT_CACHE_HH_
+#define HSCRIPT_SCRIPT_CACHE_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Horizon {
+
+/*! The version of the parse cache format.
+ * This must be increased whenever the data saved by any Key changes. */
+#define SCRIPT_CACHE_FORMAT 1
+
+/*! Hash data for the parse cache (FNV-1a, 64-bit).
+ * @param data      The data to hash.
+ * @param hash      The hash of any data preceding +data+.
+ * @returns The hash of +data+.
+ */
+std::uint64_t cache_hash(std::string_view data,
+                         std::uint64_t hash = 14695981039346656037ull);
+
+/*! Describes a file read while parsing a script. */
+struct CacheFile {
+    /*! The name of the file, as used in diagnostic messages. */
+    std::string name;
+    /*! The size of the file. */
+    std::uint64_t size;
+    /*! The hash of the contents of the file. */
+    std::uint64_t hash;
+};
+
+/*! Serialises Keys into an entry of the parse cache.
+ * Numbers are written as LEB128, and strings are prefixed by their length.
+ */
+class CacheWriter {
+private:
+    std::string _data;
+public:
+    /*! Append an unsigned number. */
+    void put_number(std::uint64_t number);
+    /*! Append a string. */
+    void put_string(std::string_view str);
+    /*! Append a set (or other container) of strings. */
+    template<typename T>
+    void put_strings(const T &strings) {
+        put_number(strings.size());
+        for(const auto &str : strings) put_string(str);
+    }
+
+    /*! Retrieve the data written so far. */
+    const std::string &data() const { return this->_data; }
+};
+
+/*! Reads Keys from an entry of the parse cache.
+ * Reading past the end of the entry, or reading a malformed value, returns
+ * an empty value and marks the reader as failed.
+ */
+class CacheReader {
+private:
+    const char *_pos;
+    const char *_end;
+    bool _failed;
+public:
+    explicit CacheReader(std::string_view data) : _pos{data.data()},
+        _end{data.data() + data.size()}, _failed{false} {}
+
+    /*! Read an unsigned number. */
+    std::uint64_t get_number();
+    /*! Read a string.
+     * The string points into the entry, and must be copied to be kept. */
+    std::string_view get_string();
+
+    /*! Determines if any read has failed. */
+    bool failed() const { return this->_failed; }
+    /*! Determines if the entire entry has been read. */
+    bool at_end() const { return this->_pos == this->_end; }
+};
+
+}
+
+#endif /* !HSCRIPT_SCRIPT_CACHE_HH_ */
@@ -0,0 +1,405 @@
+/*
+ * script_d.cc - Implementation of the disk phase of Script::execute
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+#ifdef HAS_INSTALL_ENV
+#   include <sys/stat.h>
+#   include <sys/sysmacros.h>
+#   include "util/filesystem.hh"
+#endif /* HAS_INSTALL_ENV */
+
+#include "script.hh"
+#include "script_i.hh"
+
+#include "util/output.hh"
+
+using namespace Horizon::Keys;
+
+namespace Horizon {
+
+namespace {
+
+/*! Keys which may not execute at the same time as another of their kind. */
+enum DiskLock {
+    /*! The Key may run alongside any other. */
+    NoLock,
+    /*! The Key runs LVM tools, which change shared metadata. */
+    LVMLock,
+    DiskLockCount
+};
+
+/*! A single disk Key to execute, and its place in the graph. */
+struct DiskNode {
+    /*! Executes the Key or Keys of this node. */
+    std::function<bool()> execute;
+    /*! The name of the phase, for error messages. */
+    const char *phase;
+    /*! The kind of lock this Key holds while executing. */
+    DiskLock lock;
+    /*! The line of the script on which the Key appears. */
+    int line;
+    /*! The Keys which may not execute until this one has. */
+    std::vector<std::size_t> dependents;
+    /*! The Keys this one waits for. */
+    std::vector<std::size_t> dependencies;
+    /*! The number of Keys this one is still waiting for. */
+    std::size_t waiting = 0;
+};
+
+/*! The dependency graph of the disk Keys of a script.
+ * Nodes are added in the order they would run one at a time, and each Key
+ * depends only on Keys added before it, so that order is always valid.
+ */
+class DiskGraph {
+public:
+    std::vector<DiskNode> nodes;
+
+    /*! Add a node which runs +execute+ for the Key on +line+, returning
+     * its index. */
+    std::size_t add(std::function<bool()> execute, const char *phase,
+                    DiskLock lock, int line) {
+        nodes.push_back({std::move(execute), phase, lock, line, {}, {}, 0});
+        return nodes.size() - 1;
+    }
+
+    /*! Add a node for +key+ on +line+, returning its index. */
+    std::size_t add(const Key *key, const char *phase, DiskLock lock,
+                    int line) {
+        return add([key, phase]() { return execute_key(key, phase); },
+                   phase, lock, line);
+    }
+
+    /*! Make +node+ wait for +on+. */
+    void depend(std::size_t node, std::size_t on) {
+        if(node == on) return;
+        auto &after = nodes[on].dependents;
+        if(std::find(after.begin(), after.end(), node) != after.end()) return;
+        after.push_back(node);
+        nodes[node].dependencies.push_back(on);
+        nodes[node].waiting++;
+    }
+
+    /*! Make +node+ wait for every node in +on+. */
+    void depend(std::size_t node, const std::vector<std::size_t> &on) {
+        for(std::size_t other : on) depend(node, other);
+    }
+};
+
+/*! Find the whole disk holding the block device at +path+.
+ * A partition that does not exist yet, such as one a partition Key is about
+ * to create, is found through the disk its name refers to.
+ * @returns The device number of the disk, or 0 if it cannot be found, or
+ * if the device is built on other devices, as device-mapper devices are.
+ */
+dev_t whole_disk(const std::string &path) {
+#ifdef HAS_INSTALL_ENV
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) {
+        /* sda1, nvme0n1p1, and by-id/...-part1 name partitions of disks. */
+        std::string::size_type end = path.find_last_not_of("0123456789");
+        if(end == std::string::npos || end + 1 == path.size()) return 0;
+        std::string disk = path.substr(0, end + 1);
+        if(disk.size() > 5 && disk.compare(disk.size() - 5, 5, "-part") == 0) {
+            disk.resize(disk.size() - 5);
+        } else if(disk.size() > 2 && disk.back() == 'p' &&
+                  isdigit(static_cast<unsigned char>(disk[disk.size() - 2]))) {
+            disk.pop_back();
+        } else if(isdigit(static_cast<unsigned char>(disk.back()))) {
+            return 0;
+        }
+        if(stat(disk.c_str(), &st) != 0) return 0;
+    }
+    if(!S_ISBLK(st.st_mode)) return 0;
+
+    char sys[64];
+    snprintf(sys, sizeof sys, "/sys/dev/block/%u:%u", major(st.st_rdev),
+             minor(st.st_rdev));
+    error_code ec;
+    const fs::path device = fs::canonical(sys, ec);
+    if(ec) return 0;
+    if(!fs::is_empty(device / "slaves", ec) && !ec) return 0;
+    if(!fs::exists(device / "partition", ec)) return st.st_rdev;
+
+    std::ifstream dev(device.parent_path() / "dev");
+    unsigned int maj, min;
+    char colon;
+    if(!(dev >> maj >> colon >> min) || colon != ':') return 0;
+    return makedev(maj, min);
+#else
+    return 0;
+#endif /* HAS_INSTALL_ENV */
+}
+
+/*! The disk Keys that touch each whole disk.
+ *
+ * Each device path is resolved to the whole disk holding it, so that the
+ * aliases of a disk, such as its /dev/disk/by-id link, are one disk.  A Key
+ * whose device cannot be resolved, usually because an earlier Key creates
+ * it, may touch any disk: it waits for every Key before it, and every Key
+ * after it waits for it.
+ */
+class DiskUsers {
+public:
+    /*! Make +node+ wait for the earlier Keys that may touch the disk
+     * holding +path+, and record that it touches that disk. */
+    void use(DiskGraph &graph, std::size_t node, const std::string &path) {
+        const dev_t disk = whole_disk(path);
+        if(disk == 0) {
+            graph.depend(node, _all);
+            _unresolved.push_back(node);
+        } else {
+            graph.depend(node, _disks[disk]);
+            graph.depend(node, _unresolved);
+            _disks[disk].push_back(node);
+        }
+        _all.push_back(node);
+    }
+
+    /*! Make +node+ wait for the earlier Keys whose disk is unknown, for a
+     * Key that only touches devices created by other Keys it waits for. */
+    void use_created(DiskGraph &graph, std::size_t node) {
+        graph.depend(node, _unresolved);
+        _all.push_back(node);
+    }
+private:
+    /*! The Keys that touch each disk, by device number. */
+    std::map<dev_t, std::vector<std::size_t>> _disks;
+    /*! The Keys whose disk is unknown. */
+    std::vector<std::size_t> _unresolved;
+    /*! Every Key added so far. */
+    std::vector<std::size_t> _all;
+};
+
+/*! Retrieve the device-mapper name of logical volume +lv+ in +vg+. */
+std::string mapper_name(const std::string &vg, const std::string &lv) {
+    std::string name;
+    for(const std::string &part : {vg, lv}) {
+        if(!name.empty()) name += "-";
+        for(char c : part) {
+            if(c == '-') name += "-";
+            name += c;
+        }
+    }
+    return "/dev/mapper/" + name;
+}
+
+/*! Run the graph on +jobs+ threads.
+ * Keys are started in the order they were added whenever they are ready.
+ * After a failure no further Keys are started, but running Keys finish.
+ * If +describe+ is set, the Keys each one waits for are printed before it.
+ * @returns true if every Key executed successfully.
+ */
+bool run_graph(DiskGraph &graph, unsigned int jobs, bool describe) {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::set<std::size_t> ready;
+    bool held[DiskLockCount] = {};
+    std::size_t remaining = graph.nodes.size();
+    bool failed = false;
+
+    for(std::size_t index = 0; index < graph.nodes.size(); index++) {
+        if(graph.nodes[index].waiting == 0) ready.insert(index);
+    }
+
+    /* Workers write to the same sink as the thread that started them. */
+    OutputSink &sink = output_sink();
+
+    auto work = [&]() {
+        OutputScope scope(sink);
+        std::unique_lock<std::mutex> guard(lock);
+        while(true) {
+            std::set<std::size_t>::iterator next;
+            changed.wait(guard, [&]() {
+                if(failed || remaining == 0) return true;
+                next = std::find_if(ready.begin(), ready.end(),
+                                    [&](std::size_t index) {
+                    const DiskLock kind = graph.nodes[index].lock;
+                    return kind == NoLock || !held[kind];
+                });
+                return next != ready.end();
+            });
+            if(failed || remaining == 0) return;
+
+            const std::size_t index = *next;
+            DiskNode &node = graph.nodes[index];
+            ready.erase(next);
+            held[node.lock] = node.lock != NoLock;
+
+            if(describe) {
+                /* Simulations show what each Key would wait for. */
+                std::cout << "# disk: " << node.phase << " on line "
+                          << node.line << " waits for ";
+                std::vector<int> lines;
+                for(std::size_t on : node.dependencies) {
+                    lines.push_back(graph.nodes[on].line);
+                }
+                std::sort(lines.begin(), lines.end());
+                if(lines.empty()) std::cout << "no other key";
+                for(std::size_t at = 0; at < lines.size(); at++) {
+                    if(at == 0) {
+                        std::cout << (lines.size() == 1 ? "line " : "lines ");
+                    } else {
+                        std::cout << ", ";
+                    }
+                    std::cout << lines[at];
+                }
+                std::cout << std::endl;
+            }
+
+            guard.unlock();
+            const bool success = node.execute();
+            guard.lock();
+
+            held[node.lock] = false;
+            remaining--;
+            if(!success) {
+                output_error(node.phase, "The HorizonScript failed to execute",
+                             "Check the log file for more details.");
+                failed = true;
+            } else {
+                for(std::size_t after : node.dependents) {
+                    if(--graph.nodes[after].waiting == 0) ready.insert(after);
+                }
+            }
+            changed.notify_all();
+        }
+    };
+
+    if(jobs <= 1) {
+        /* Run on this thread, in exactly the order the Keys were added. */
+        work();
+    } else {
+        std::vector<std::thread> workers;
+        for(unsigned int job = 0; job < jobs; job++) {
+            workers.emplace_back(work);
+        }
+        for(auto &worker : workers) worker.join();
+    }
+
+    return !failed;
+}
+
+}
+
+bool Script::ScriptPrivate::execute_disks(unsigned int jobs,
+                                          bool describe) {
+    DiskGraph graph;
+    DiskUsers disks;
+    std::map<std::string, std::vector<std::size_t>> pv_nodes, vg_nodes,
+            lv_nodes, vg_lvs;
+
+    /* REQ: Runner.Execute.diskid */
+    for(auto &diskid : diskids) {
+        const std::size_t node = graph.add(diskid, "diskid", NoLock,
+                                           diskid->pos.line);
+        disks.use(graph, node, diskid->device());
+    }
+
+    /* REQ: Runner.Execute.disklabel */
+    for(auto &label : disklabels) {
+        const std::size_t node = graph.add(label, "disklabel", NoLock,
+                                           label->pos.line);
+        disks.use(graph, node, label->device());
+    }
+
+    /* REQ: Runner.Execute.partition */
+    /* Ensure partitions are created in on-disk order.  Each device name is
+     * only copied once, and partition numbers are compared as numbers. */
+    std::vector<std::pair<std::string, const Partition *>> parts;
+    parts.reserve(partitions.size());
+    for(auto &part : partitions) parts.emplace_back(part->device(), part);
+    std::sort(parts.begin(), parts.end(), [](const auto &e1, const auto &e2) {
+        if(e1.first != e2.first) return e1.first < e2.first;
+        return e1.second->partno() < e2.second->partno();
+    });
+    /* Every partition on a device is written to its table at once. */
+    for(auto part = parts.begin(); part != parts.end();) {
+        auto end = std::find_if(part, parts.end(), [&](const auto &next) {
+            return next.first != part->first;
+        });
+        std::vector<const Partition *> group;
+        for(auto it = part; it != end; ++it) group.push_back(it->second);
+        const Key *first = group.front();
+        const std::size_t node = graph.add([group]() {
+            return Partition::execute_all(group);
+        }, "partition", NoLock, first->pos.line);
+        disks.use(graph, node, part->first);
+        part = end;
+    }
+
+    /* encrypt PVs */
+
+    /* REQ: Runner.Execute.lvm_pv */
+    for(auto &pv : lvm_pvs) {
+        const std::size_t node = graph.add(pv, "lvm_pv", LVMLock,
+                                           pv->pos.line);
+        disks.use(graph, node, pv->value());
+        pv_nodes[pv->value()].push_back(node);
+    }
+
+    /* REQ: Runner.Execute.lvm_vg */
+    for(auto &vg : lvm_vgs) {
+        const std::size_t node = graph.add(vg, "lvm_vg", LVMLock,
+                                           vg->pos.line);
+        disks.use(graph, node, vg->pv());
+        graph.depend(node, pv_nodes[vg->pv()]);
+        vg_nodes[vg->name()].push_back(node);
+    }
+
+    /* REQ: Runner.Execute.lvm_lv */
+    for(auto &lv : lvm_lvs) {
+        const std::size_t node = graph.add(lv, "lvm_lv", LVMLock,
+                                           lv->pos.line);
+        /* Volumes are created in order, since the last may fill the group. */
+        disks.use_created(graph, node);
+        graph.depend(node, vg_nodes[lv->vg()]);
+        graph.depend(node, vg_lvs[lv->vg()]);
+        vg_lvs[lv->vg()].push_back(node);
+        lv_nodes["/dev/" + lv->vg() + "/" + lv->name()].push_back(node);
+        lv_nodes[mapper_name(lv->vg(), lv->name())].push_back(node);
+    }
+
+    /* encrypt */
+
+    /* REQ: Runner.Execute.fs */
+    for(auto &fs : fses) {
+        const std::string device = fs->device();
+        const std::size_t node = graph.add(fs, "fs", NoLock, fs->pos.line);
+        /* A volume named as this script creates it is on the disks of its
+         * group; any other name may be an alias of any device. */
+        const auto lv = lv_nodes.find(device);
+        if(lv != lv_nodes.end()) {
+            disks.use_created(graph, node);
+            graph.depend(node, lv->second);
+        } else {
+            disks.use(graph, node, device);
+            graph.depend(node, pv_nodes[device]);
+        }
+    }
+
+    return run_graph(graph, jobs, describe);
+}
+
+}
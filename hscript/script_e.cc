@@ -11,27 +11,38 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
 #ifdef HAS_INSTALL_ENV
 #   include <parted/parted.h>
 #   include <sys/mount.h>
+#   include <sys/stat.h>
 #endif /* HAS_INSTALL_ENV */
 
 #include "script.hh"
 #include "script_i.hh"
 
+#include "journal.hh"
+#include "layercache.hh"
+#include "pkgcache.hh"
+#include "prefetch.hh"
 #include "util.hh"
 #include "util/filesystem.hh"
 
+/*! How long bringing up the network of a live install may take, so that a
+ * DHCP client that never gets a lease cannot stall the installation. */
+#define NETWORK_START_DEADLINE std::chrono::seconds(300)
+
 namespace Horizon {
 
-static bool icon_dir_created = false;
+static std::atomic<bool> icon_dir_created{false};
 
 void maybe_create_icon_dir(ScriptOptions opts, const std::string &target) {
-    if(icon_dir_created) return;
-    icon_dir_created = true;
+    if(icon_dir_created.exchange(true)) return;
 
     const std::string icon_dir(target + "/var/lib/AccountsService/icons");
 
@@ -55,6 +66,79 @@ void maybe_create_icon_dir(ScriptOptions opts, const std::string &target) {
 #endif  /* HAS_INSTALL_ENV */
 }
 
+std::set<std::string> Script::ScriptPrivate::plan_packages() const {
+    std::set<std::string> plan(packages.begin(), packages.end());
+
+#ifdef NON_LIBRE_FIRMWARE
+    /* REQ: Runner.Execute.firmware */
+    if(firmware && firmware->test()) plan.insert("linux-firmware");
+#endif
+
+    if(boot) {
+        const std::string loader = boot->package();
+        if(!loader.empty()) plan.insert(loader);
+    }
+
+    return plan;
+}
+
+std::uint64_t Script::ScriptPrivate::step_digest(
+        const std::string &step) const {
+    JournalDigest digest;
+    digest.add(step);
+    if(step == "disk") {
+        digest.add_all(diskids);
+        digest.add_all(disklabels);
+        digest.add_all(partitions);
+        digest.add_all(lvm_pvs);
+        digest.add_all(lvm_vgs);
+        digest.add_all(lvm_lvs);
+        digest.add_all(luks);
+        digest.add_all(fses);
+        digest.add_all(mounts);
+    } else if(step == "pkgdb") {
+        digest.add_all(repos);
+        digest.add_all(repo_keys);
+        digest.add(arch);
+        digest.add_strings(plan_packages());
+    } else if(step == "post-metadata") {
+        digest.add_all(addresses);
+        digest.add(rootpw);
+        digest.add(lang);
+        digest.add(keymap);
+        for(const auto &acct : accounts) {
+            digest.add(acct.second.name);
+            digest.add(acct.second.alias);
+            digest.add(acct.second.passphrase);
+            digest.add(acct.second.icon);
+            digest.add_all(acct.second.groups);
+        }
+        digest.add(tzone);
+        digest.add_all(svcs_enable);
+    }
+    return digest.value();
+}
+
+#ifdef HAS_INSTALL_ENV
+/*! Determine if every package in +packages+ is installed on +target+. */
+static bool packages_installed(const std::set<std::string> &packages,
+                               const std::string &target) {
+    const std::set<std::string> installed =
+            Journal::installed_packages(target);
+    for(const auto &pkg : packages) {
+        /* Conflicts are not installed, and versions are not checked. */
+        if(pkg.empty() || pkg[0] == '!') continue;
+        const std::string name(pkg.substr(0, pkg.find_first_of("<>=~@")));
+        if(installed.find(name) == installed.end()) {
+            output_warning("journal", "package " + name + " is not installed",
+                           "packages will be installed again");
+            return false;
+        }
+    }
+    return true;
+}
+#endif  /* HAS_INSTALL_ENV */
+
 bool Script::execute() const {
     bool success;
     error_code ec;
@@ -63,16 +147,11 @@ bool Script::execute() const {
     std::set<std::string> ifaces;
     const std::string targ_etc(targetDirectory() + "/etc");
 
-    /* assume create_directory will give us the error if removal fails */
-    if(fs::exists("/tmp/horizon", ec)) {
-        fs::remove_all("/tmp/horizon", ec);
-    }
+    /* Keys consult the Script that owns them while executing. */
+    internal->unshare(this);
 
-    if(!fs::create_directory("/tmp/horizon", ec)) {
-        output_error("internal", "could not create temporary directory",
-                     ec.message());
-        return false;
-    }
+    /* Network Keys build their configuration from scratch. */
+    internal->network_config = NetConfig();
 
     /* REQ: Runner.Execute.Verify */
     output_step_start("validate");
@@ -89,77 +168,133 @@ bool Script::execute() const {
     output_error(phase, "The HorizonScript failed to execute",\
                  "Check the log file for more details.")
 #define EXECUTE_OR_FAIL(phase, obj) \
-    if(!obj->execute()) {\
+    if(!execute_key(obj, phase)) {\
         EXECUTE_FAILURE(phase);\
         return false;\
     }
 
-    /**************** DISK SETUP ****************/
-    output_step_start("disk");
-    if(!opts.test(ImageOnly)) {
-#ifdef HAS_INSTALL_ENV
-        if(opts.test(InstallEnvironment)) ped_device_probe_all();
-#endif /* HAS_INSTALL_ENV */
-        /* REQ: Runner.Execute.diskid */
-        for(auto &diskid : internal->diskids) {
-            EXECUTE_OR_FAIL("diskid", diskid)
-        }
-
-        /* REQ: Runner.Execute.disklabel */
-        for(auto &label : internal->disklabels) {
-            EXECUTE_OR_FAIL("disklabel", label)
-        }
-
-        /* REQ: Runner.Execute.partition */
-        /* Ensure partitions are created in on-disk order. */
-        std::sort(internal->partitions.begin(), internal->partitions.end(),
-                  [](std::unique_ptr<Partition> const &e1,
-                     std::unique_ptr<Partition> const &e2) {
-            return (e1->device() + "p" + std::to_string(e1->partno())) <
-                   (e2->device() + "p" + std::to_string(e2->partno()));
-        });
-        for(auto &part : internal->partitions) {
-            EXECUTE_OR_FAIL("partition", part)
-        }
-
-        /* encrypt PVs */
-
-        /* REQ: Runner.Execute.lvm_pv */
-        for(auto &pv : internal->lvm_pvs) {
-            EXECUTE_OR_FAIL("lvm_pv", pv)
-        }
+    /* Packages are downloaded while the disks are being prepared.  If the
+     * script fails, returning cancels the download. */
+    /* REQ: Runner.Execute.pkginstall */
+    const std::set<std::string> packages = internal->plan_packages();
+
+    std::unique_ptr<PackageCache> pkg_cache;
+    if(!internal->pkg_cache.empty() && !opts.test(Simulate)) {
+        pkg_cache.reset(new PackageCache(internal->pkg_cache,
+                                         internal->pkg_cache_limit));
+        /* Without the cache, packages are still downloaded as usual. */
+        if(!pkg_cache->open()) pkg_cache.reset();
+    }
 
-        /* REQ: Runner.Execute.lvm_vg */
-        for(auto &vg : internal->lvm_vgs) {
-            EXECUTE_OR_FAIL("lvm_vg", vg)
-        }
+    /* An image whose packages were installed before starts from the target
+     * as it was then, so none of them are downloaded. */
+    std::unique_ptr<LayerCache> layers;
+    bool layered = false;
+#ifdef HAS_INSTALL_ENV
+    if(opts.test(ImageOnly) && !opts.test(Simulate) &&
+       !internal->layer_cache.empty()) {
+        layers.reset(new LayerCache(internal->layer_cache,
+                                    internal->step_digest("pkgdb")));
+        if(!layers->open()) layers.reset();
+        else layered = layers->exists();
+    }
+#endif  /* HAS_INSTALL_ENV */
 
-        /* REQ: Runner.Execute.lvm_lv */
-        for(auto &lv : internal->lvm_lvs) {
-            EXECUTE_OR_FAIL("lvm_lv", lv)
-        }
+    /* Each step whose effects are on the disks of the target is recorded
+     * in a journal there, so that an interrupted installation can be
+     * resumed.  Images are built from scratch every time. */
+    Journal journal(targetDirectory());
+    const bool journalled = !opts.test(Simulate) && !opts.test(ImageOnly);
+    bool resume = false;
+#ifdef HAS_INSTALL_ENV
+    resume = journalled && opts.test(Resume);
+#endif  /* HAS_INSTALL_ENV */
 
-        /* encrypt */
+    /* The journal cannot be read until the disks are mounted, so a resumed
+     * installation downloads packages only if it installs them again. */
+    APKPrefetch prefetch(pkg_cache ? pkg_cache->dir() : "");
+    if(opts.test(InstallEnvironment) && !opts.test(Simulate) && !layered &&
+       !resume) {
+        APKPrefetch::Request request;
+        for(auto &repo : internal->repos) {
+            request.repositories.push_back(repo->value());
+        }
+        for(auto &key : internal->repo_keys) {
+            request.keys.push_back(key->value());
+        }
+        if(internal->arch) request.arch = internal->arch->value();
+        request.packages.assign(packages.begin(), packages.end());
+        prefetch.start(std::move(request));
+    }
 
-        /* REQ: Runner.Execute.fs */
-        for(auto &fs : internal->fses) {
-            EXECUTE_OR_FAIL("fs", fs)
-        }
+    /* Files written to the target are committed together, once everything
+     * that needs them on disk is about to run. */
+#ifdef HAS_INSTALL_ENV
+    if(!opts.test(Simulate)) {
+        internal->files = std::make_unique<TargetFiles>(targetDirectory());
     }
+#endif  /* HAS_INSTALL_ENV */
+
+    /**************** DISK SETUP ****************/
+    output_step_start("disk");
 
     /* REQ: Runner.Execute.mount */
     /* Sort by mountpoint.
      * This ensures that any subdirectory mounts come after their parent. */
     std::sort(internal->mounts.begin(), internal->mounts.end(),
-              [](std::unique_ptr<Mount> const &e1,
-                 std::unique_ptr<Mount> const &e2) {
+              [](const Mount *e1, const Mount *e2) {
         return e1->mountpoint() < e2->mountpoint();
     });
-    for(auto &mount : internal->mounts) {
-        EXECUTE_OR_FAIL("mount", mount)
+
+    if(!resume) {
+        if(!opts.test(ImageOnly)) {
+#ifdef HAS_INSTALL_ENV
+            if(opts.test(InstallEnvironment)) ped_device_probe_all();
+#endif /* HAS_INSTALL_ENV */
+            /* REQ: Runner.Execute.diskid */
+            /* Simulations must print their commands in order. */
+            unsigned int jobs = internal->disk_jobs;
+            if(jobs == 0) jobs = std::thread::hardware_concurrency();
+            if(opts.test(Simulate)) jobs = 1;
+            if(!internal->execute_disks(jobs, opts.test(Simulate))) {
+                return false;
+            }
+        }
+
+        for(auto &mount : internal->mounts) {
+            EXECUTE_OR_FAIL("mount", mount)
+        }
     }
 #ifdef HAS_INSTALL_ENV
-    if(opts.test(InstallEnvironment)) ped_device_free_all();
+    else {
+        /* The disks are never prepared again.  Only the file systems that
+         * are no longer mounted are mounted, and the fstab of the target
+         * already lists them. */
+        for(auto &mount : internal->mounts) {
+            if(is_mountpoint(targetDirectory() + mount->mountpoint())) {
+                continue;
+            }
+            EXECUTE_OR_FAIL("mount", mount)
+        }
+        internal->files = std::make_unique<TargetFiles>(targetDirectory());
+
+        if(!journal.load()) {
+            output_error("journal", "cannot resume execution",
+                         "no journal was found on the target");
+            EXECUTE_FAILURE("disk");
+            return false;
+        }
+        if(!journal.completed("disk", internal->step_digest("disk"))) {
+            output_error("journal", "cannot resume execution",
+                         "the disks were not prepared as this script "
+                         "describes");
+            EXECUTE_FAILURE("disk");
+            return false;
+        }
+        output_info("journal", "resuming execution; the disks are prepared");
+    }
+
+    if(opts.test(InstallEnvironment) && !resume) ped_device_free_all();
 
     if(!opts.test(Simulate)) {
         const std::string devpath = targetDirectory() + "/dev";
@@ -169,7 +304,8 @@ bool Script::execute() const {
         if(!fs::exists(devpath, ec)) {
             fs::create_directory(devpath, ec);
         }
-        if(mount("/dev", devpath.c_str(), nullptr, MS_BIND | MS_REC,
+        if(!(resume && is_mountpoint(devpath)) &&
+           mount("/dev", devpath.c_str(), nullptr, MS_BIND | MS_REC,
                  nullptr) != 0) {
             output_warning("internal", "could not bind-mount /dev; "
                            "bootloader configuration may fail");
@@ -178,24 +314,46 @@ bool Script::execute() const {
         if(!fs::exists(procpath, ec)) {
             fs::create_directory(procpath, ec);
         }
-        if(mount("none", procpath.c_str(), "proc", 0, nullptr) != 0) {
+        if(!(resume && is_mountpoint(procpath)) &&
+           mount("none", procpath.c_str(), "proc", 0, nullptr) != 0) {
             output_warning("internal", "target procfs could not be mounted");
         }
 
         if(!fs::exists(syspath, ec)) {
             fs::create_directory(syspath, ec);
         }
-        if(mount("/sys", syspath.c_str(), nullptr, MS_BIND | MS_REC,
+        if(!(resume && is_mountpoint(syspath)) &&
+           mount("/sys", syspath.c_str(), nullptr, MS_BIND | MS_REC,
                  nullptr) != 0) {
             output_warning("internal", "target sysfs could not be mounted");
         }
     }
+
+    /* The fstab is on disk before the disks are recorded as prepared. */
+    if(journalled && !resume) {
+        if(!internal->files->commit() ||
+           !journal.record("disk", internal->step_digest("disk"))) {
+            EXECUTE_FAILURE("disk");
+            return false;
+        }
+    }
 #endif /* HAS_INSTALL_ENV */
     output_step_end("disk");
 
     /**************** PRE PACKAGE METADATA ****************/
     output_step_start("pre-metadata");
 
+#ifdef HAS_INSTALL_ENV
+    /* Steps before pkgdb are always executed again.  The files their Keys
+     * append to are written again from the start. */
+    if(resume) {
+        for(const char *path : {"/etc/apk/repositories", "/etc/conf.d/net",
+                                "/etc/resolv.conf"}) {
+            internal->files->discard(path);
+        }
+    }
+#endif  /* HAS_INSTALL_ENV */
+
     /* REQ: Runner.Execute.hostname */
     EXECUTE_OR_FAIL("hostname", internal->hostname)
 
@@ -218,13 +376,6 @@ bool Script::execute() const {
     for(auto &repo : internal->repos) {
         EXECUTE_OR_FAIL("repository", repo)
     }
-
-#ifdef NON_LIBRE_FIRMWARE
-    /* REQ: Runner.Execute.firmware */
-    if(internal->firmware && internal->firmware->test()) {
-        internal->packages.insert("linux-firmware");
-    }
-#endif
     output_step_end("pre-metadata");
 
     /**************** NETWORK ****************/
@@ -235,82 +386,46 @@ bool Script::execute() const {
     }
 
     if(!this->internal->ssids.empty()) {
-        std::ofstream wpao("/tmp/horizon/wpa_supplicant.conf",
-                          std::ios_base::trunc);
-        if(wpao) {
-            wpao << "# Enable the control interface for wpa_cli and wpa_gui"
-                << std::endl
-                << "ctrl_interface=/var/run/wpa_supplicant" << std::endl
-                << "ctrl_interface_group=wheel" << std::endl
-                << "update_config=1" << std::endl;
-            wpao.close();
-        } else {
-            output_error("internal",
-                         "cannot write wireless networking configuration");
-        }
-
         for(auto &ssid : internal->ssids) {
-            if(!ssid->execute()) {
+            if(!execute_key(ssid, "ssid")) {
                 EXECUTE_FAILURE("ssid");
                 /* "Soft" error.  Not fatal. */
             }
         }
 
+        const std::string wpa_conf(internal->network_config.render_wireless());
         if(opts.test(Simulate)) {
-            std::ifstream wpai("/tmp/horizon/wpa_supplicant.conf");
-            if(wpai) {
-                std::cout << "cat >" << targetDirectory()
-                          << "/etc/wpa_supplicant/wpa_supplicant.conf "
-                          << "<<- WPA_EOF" << std::endl
-                          << wpai.rdbuf() << std::endl
-                          << "WPA_EOF" << std::endl;
-            } else {
-                output_error("internal",
-                             "cannot read wireless networking configuration");
-            }
+            std::cout << "cat >" << targetDirectory()
+                      << "/etc/wpa_supplicant/wpa_supplicant.conf "
+                      << "<<- WPA_EOF" << std::endl
+                      << wpa_conf << std::endl
+                      << "WPA_EOF" << std::endl;
         }
 #ifdef HAS_INSTALL_ENV
         else {
-            const std::string wpa_dir(targ_etc + "/wpa_supplicant");
-            if(!fs::exists(wpa_dir, ec)) {
-                fs::create_directory(wpa_dir, ec);
-            }
-            fs::copy_file("/tmp/horizon/wpa_supplicant.conf",
-                          wpa_dir + "/wpa_supplicant.conf",
-                          fs_overwrite, ec);
-            if(ec) {
-                output_error("internal", "cannot save wireless networking "
-                             "configuration to target", ec.message());
-            }
+            internal->files->replace("/etc/wpa_supplicant/wpa_supplicant.conf")
+                    << wpa_conf;
         }
 #endif /* HAS_INSTALL_ENV */
     }
 
     bool dhcp = false;
     if(!internal->addresses.empty() || !internal->pppoes.empty()) {
-        fs::path conf_dir, targ_netconf_dir, targ_netconf_file;
+        fs::path targ_netconf_dir, targ_netconf_file;
         switch(netconfsys) {
         case NetConfigType::Netifrc:
-            conf_dir = fs::path("/tmp/horizon/netifrc");
             netconf_file = "/etc/conf.d/net";
             targ_netconf_dir = fs::path(targ_etc + "/conf.d");
             break;
         case NetConfigType::ENI:
-            conf_dir = fs::path("/tmp/horizon/eni");
             netconf_file = "/etc/network/interfaces";
             targ_netconf_dir = fs::path(targ_etc + "/network");
             break;
         }
         targ_netconf_file = fs::path(targetDirectory() + netconf_file);
 
-        if(!fs::exists(conf_dir) &&
-           !fs::create_directory(conf_dir, ec)) {
-            output_error("internal", "cannot create temporary directory",
-                         ec.message());
-        }
-
         for(auto &addr : internal->addresses) {
-            if(!addr->execute()) {
+            if(!execute_key(addr, "netaddress")) {
                 EXECUTE_FAILURE("netaddress");
                 /* "Soft" error.  Not fatal. */
             } else {
@@ -326,44 +441,12 @@ bool Script::execute() const {
             ifaces.insert("ppp" + std::to_string(pppcnt++));
         }
 
-        std::ostringstream conf;
-
-        if(netconfsys == NetConfigType::ENI) {
-            conf << "auto lo" << std::endl
-                 << "iface lo inet loopback" << std::endl << std::endl;
-        }
-
-        for(auto &&varfile : fs::directory_iterator(conf_dir)) {
-            std::ifstream contents(varfile.path().string());
-            if(!contents) {
-                output_error("internal", "cannot read network "
-                             "configuration");
-                EXECUTE_FAILURE("net-internal");
-                continue;
-            }
-
-            switch(netconfsys) {
-            case NetConfigType::Netifrc: {
-                const std::string variable(varfile.path().filename().string());
-                conf << variable << "=\"";
-                if(contents.rdbuf()->in_avail()) conf << contents.rdbuf();
-                conf << "\"" << std::endl;
-                break;
-            }
-            case NetConfigType::ENI: {
-                const std::string iface(varfile.path().filename().string());
-                conf << "auto " << iface << std::endl;
-                if(contents.rdbuf()->in_avail()) conf << contents.rdbuf();
-                conf << std::endl;
-                break;
-            }
-            }
-        }
+        const std::string conf(internal->network_config.render(netconfsys));
 
         if(opts.test(Simulate)) {
             std::cout << "mkdir -p " << targ_netconf_dir << std::endl;
             std::cout << "cat >>" << targ_netconf_file << " <<- NETCONF_EOF"
-                      << std::endl << conf.str() << std::endl
+                      << std::endl << conf << std::endl
                       << "NETCONF_EOF" << std::endl;
         }
 #ifdef HAS_INSTALL_ENV
@@ -375,14 +458,7 @@ bool Script::execute() const {
                                  "configuration directory", ec.message());
                 }
             }
-            std::ofstream conf_file(targ_netconf_file);
-            if(!conf_file) {
-                output_error("internal", "cannot save network configuration "
-                             "to target");
-                EXECUTE_FAILURE("net-internal");
-            } else {
-                conf_file << conf.str();
-            }
+            internal->files->replace(netconf_file) << conf;
         }
 #endif /* HAS_INSTALL_ENV */
     }
@@ -404,14 +480,8 @@ bool Script::execute() const {
             }
 #ifdef HAS_INSTALL_ENV
             else {
-                std::ofstream resolvconf(targ_etc + "/resolv.conf",
-                                         std::ios_base::app);
-                if(!resolvconf) {
-                    output_error("internal", "failed to open resolv.conf");
-                    EXECUTE_FAILURE("nameserver");
-                    return false;
-                }
-                resolvconf << "domain " << domain << std::endl;
+                internal->files->append("/etc/resolv.conf")
+                        << "domain " << domain << std::endl;
             }
 #endif /* HAS_INSTALL_ENV */
         }
@@ -423,17 +493,8 @@ bool Script::execute() const {
             }
 #ifdef HAS_INSTALL_ENV
             else {
-                if(fs::exists(targ_etc + "/resolv.conf", ec)) {
-                    fs::rename(targ_etc + "/resolv.conf",
-                               targ_etc + "/resolv.conf.head", ec);
-                    if(ec) {
-                        output_error("internal",
-                                     "cannot save nameserver configuration",
-                                     ec.message());
-                        EXECUTE_FAILURE("nameserver");
-                        return false;
-                    }
-                }
+                internal->files->rename("/etc/resolv.conf",
+                                        "/etc/resolv.conf.head");
             }
 #endif /* HAS_INSTALL_ENV */
         }
@@ -463,6 +524,11 @@ bool Script::execute() const {
             /* Don't do anything with the network configuration if we are
              * only creating an image. */
         } else {
+            /* The configuration is used from the target. */
+            if(!internal->files->commit()) {
+                EXECUTE_FAILURE("network");
+                return false;
+            }
             if(do_wpa) {
                 fs::copy_file(targ_etc + "/wpa_supplicant/wpa_supplicant.conf",
                           "/etc/wpa_supplicant/wpa_supplicant.conf",
@@ -498,15 +564,18 @@ bool Script::execute() const {
                             char state;
                             statefs.read(&state, 1);
                             if(state != 'u')
-                                run_command("service", {"net." + iface, "start"});
+                                run_command("service", {"net." + iface, "start"},
+                                            NETWORK_START_DEADLINE);
                         } else {
-                            run_command("service", {"net." + iface, "start"});
+                            run_command("service", {"net." + iface, "start"},
+                                        NETWORK_START_DEADLINE);
                         }
                     }
                 }
                 break;
             case NetConfigType::ENI:
-                run_command("/etc/init.d/networking", {"restart"});
+                run_command("/etc/init.d/networking", {"restart"},
+                            NETWORK_START_DEADLINE);
                 break;
             }
 
@@ -534,153 +603,262 @@ bool Script::execute() const {
     /**************** PKGDB ****************/
     output_step_start("pkgdb");
 
-    /* REQ: Runner.Execute.signingkey */
-    for(auto &key : internal->repo_keys) {
-        EXECUTE_OR_FAIL("signingkey", key)
+    /* A resumed execution only installs the packages again if any of them
+     * are missing. */
+    bool installed = false;
+#ifdef HAS_INSTALL_ENV
+    if(resume && journal.completed("pkgdb", internal->step_digest("pkgdb"))) {
+        installed = packages_installed(packages, targetDirectory());
+        if(installed) {
+            output_info("journal", "packages are already installed");
+        }
     }
 
-    /* REQ: Runner.Execute.pkginstall.arch */
-    if(internal->arch) {
-        EXECUTE_OR_FAIL("arch", internal->arch)
-    }
+    /* Only what the packages install is kept in the layer.  The files
+     * written by earlier steps, and anything else already in the target,
+     * such as an emulator for the target's architecture, may differ from
+     * one image to the next. */
+    std::set<std::string> configured_files;
+    if(layers) {
+        configured_files = LayerCache::files(targetDirectory());
+        const std::set<std::string> written = internal->files->paths();
+        configured_files.insert(written.begin(), written.end());
+        /* The files of this image replace any in the layer. */
+        if(layered) {
+            if(!layers->restore(targetDirectory()) ||
+               !internal->files->commit()) {
+                EXECUTE_FAILURE("pkgdb");
+                return false;
+            }
 
-    /* REQ: Runner.Execute.pkginstall.APKDB */
-    output_info("internal", "initialising APK");
-    if(opts.test(Simulate)) {
-        std::cout << "/sbin/apk --root " << targetDirectory() << " --initdb "
-                  << "--keys-dir " << "etc/apk/keys add" << std::endl;
-    }
-#ifdef HAS_INSTALL_ENV
-    else {
-        if(run_command("/sbin/apk",
-                       {"--root", targetDirectory(), "--initdb", "--keys-dir",
-                        "etc/apk/keys", "add"}) != 0) {
-            EXECUTE_FAILURE("pkginstall");
-            return false;
+            /* Packages published since the layer was saved, such as
+             * security fixes, are installed over it. */
+            std::vector<std::string> params{"--root", targetDirectory(),
+                                            "--update-cache",
+                                            "--keys-dir", "etc/apk/keys"};
+            if(pkg_cache) {
+                params.push_back("--cache-dir");
+                params.push_back(pkg_cache->dir());
+            }
+            params.push_back("upgrade");
+            if(run_command("/sbin/apk", params) != 0) {
+                EXECUTE_FAILURE("pkginstall");
+                return false;
+            }
+            installed = true;
         }
     }
 #endif  /* HAS_INSTALL_ENV */
 
-    /* REQ: Runner.Execute.pkginstall */
-    output_info("internal", "installing packages to target");
-    if(opts.test(Simulate)) {
-        std::ostringstream pkg_list;
-        for(auto &pkg : this->internal->packages) {
-            pkg_list << pkg << " ";
+    if(!installed) {
+        /* REQ: Runner.Execute.signingkey */
+        for(auto &key : internal->repo_keys) {
+            EXECUTE_OR_FAIL("signingkey", key)
         }
 
-        std::cout << "apk --root " << targetDirectory() << " --keys-dir "
-                  << "etc/apk/keys" << " update" << std::endl;
-        std::cout << "apk --root " << targetDirectory() << " --keys-dir "
-                  << "etc/apk/keys" << " add " << pkg_list.str() << std::endl;
-    }
-#ifdef HAS_INSTALL_ENV
-    else {
-        if(run_command("/sbin/apk", {"--root", targetDirectory(), "--keys-dir",
-                                     "etc/apk/keys", "update"}) != 0) {
-            EXECUTE_FAILURE("pkginstall");
-            return false;
+        /* REQ: Runner.Execute.pkginstall.arch */
+        if(internal->arch) {
+            EXECUTE_OR_FAIL("arch", internal->arch)
+        }
+
+        /* REQ: Runner.Execute.pkginstall.APKDB */
+        /* REQ: Runner.Execute.pkginstall */
+        /* The database is initialised, the indexes fetched, and every package
+         * installed in a single transaction. */
+        output_info("internal", "installing packages to target");
+        if(opts.test(Simulate)) {
+            std::cout << "apk --root " << targetDirectory() << " --initdb "
+                      << "--update-cache --keys-dir etc/apk/keys add";
+            for(auto &pkg : packages) std::cout << " " << pkg;
+            std::cout << std::endl;
         }
+#ifdef HAS_INSTALL_ENV
+        else {
+            /* APK keeps configuration files already on the target. */
+            if(!internal->files->commit()) {
+                EXECUTE_FAILURE("pkgdb");
+                return false;
+            }
 
-        std::vector<std::string> params(this->internal->packages.size() + 5);
-        params[0] = "--root";
-        params[1] = targetDirectory();
-        params[2] = "--keys-dir";
-        params[3] = "etc/apk/keys";
-        params[4] = "add";
-        std::copy(this->internal->packages.begin(),
-                  this->internal->packages.end(),
-                  params.begin() + 5);
+            std::vector<std::string> params{"--root", targetDirectory(),
+                                            "--initdb", "--update-cache",
+                                            "--keys-dir", "etc/apk/keys"};
+            /* Install from the prefetched packages, if they were downloaded.
+             * A persistent cache is used even if the prefetch failed. */
+            if(prefetch.wait() || pkg_cache) {
+                params.push_back("--cache-dir");
+                params.push_back(prefetch.cache_dir());
+            }
+            params.push_back("add");
+            params.insert(params.end(), packages.begin(), packages.end());
 
-        if(run_command("/sbin/apk", params) != 0) {
-            EXECUTE_FAILURE("pkginstall");
-            return false;
+            if(run_command("/sbin/apk", params) != 0) {
+                EXECUTE_FAILURE("pkginstall");
+                return false;
+            }
+
+            if(pkg_cache) {
+                pkg_cache->touch(targetDirectory());
+                pkg_cache->evict();
+            }
+
+            /* APK does not flush what it installs. */
+            if(journalled && (!internal->files->sync() ||
+               !journal.record("pkgdb", internal->step_digest("pkgdb")))) {
+                EXECUTE_FAILURE("pkgdb");
+                return false;
+            }
+
+            /* A layer that cannot be saved only makes the next image take
+             * longer. */
+            if(layers) layers->save(targetDirectory(), configured_files);
         }
-    }
 #endif  /* HAS_INSTALL_ENV */
+    }
 
     output_step_end("pkgdb");
 
     /**************** POST PACKAGE METADATA ****************/
     output_step_start("post-metadata");
 
-    if(internal->packages.find("netifrc") != internal->packages.end() &&
-       !internal->addresses.empty()) {
-        /* REQ: Runner.Execute.netaddress.OpenRC */
-        if(opts.test(Simulate)) {
-            for(auto &iface : ifaces) {
-                std::cout << "ln -s /etc/init.d/net.lo " << targ_etc
-                          << "/init.d/net." << iface << std::endl;
-                std::cout << "ln -s /etc/init.d/net." << iface
-                          << " " << targ_etc << "/runlevels/default/net."
-                          << iface << std::endl;
+    /* The configuration of the target is only on disk once its files are
+     * committed below, so it is either all done or not at all. */
+    bool configured = false;
+#ifdef HAS_INSTALL_ENV
+    configured = resume && journal.completed("post-metadata",
+                        internal->step_digest("post-metadata"));
+    if(configured) output_info("journal", "the system is already configured");
+#endif  /* HAS_INSTALL_ENV */
+
+    if(!configured) {
+        if(packages.find("netifrc") != packages.end() &&
+           !internal->addresses.empty()) {
+            /* REQ: Runner.Execute.netaddress.OpenRC */
+            if(opts.test(Simulate)) {
+                for(auto &iface : ifaces) {
+                    std::cout << "ln -s /etc/init.d/net.lo " << targ_etc
+                              << "/init.d/net." << iface << std::endl;
+                    std::cout << "ln -s /etc/init.d/net." << iface
+                              << " " << targ_etc << "/runlevels/default/net."
+                              << iface << std::endl;
+                }
             }
-        }
 #ifdef HAS_INSTALL_ENV
-        else {
-            for(auto &iface : ifaces) {
-                fs::create_symlink("/etc/init.d/net.lo",
-                                   targ_etc + "/init.d/net." + iface, ec);
-                if(ec) {
-                    output_error("internal", "could not set up networking on "
-                                 + iface, ec.message());
-                } else {
-                    fs::create_symlink("/etc/init.d/net." + iface,
-                                       targ_etc + "/runlevels/default/net." +
-                                       iface, ec);
+            else {
+                for(auto &iface : ifaces) {
+                    fs::create_symlink("/etc/init.d/net.lo",
+                                       targ_etc + "/init.d/net." + iface, ec);
                     if(ec) {
-                        output_error("internal", "could not auto-start "
+                        output_error("internal", "could not set up "
                                      "networking on " + iface, ec.message());
+                    } else {
+                        fs::create_symlink("/etc/init.d/net." + iface,
+                                           targ_etc +
+                                           "/runlevels/default/net." + iface,
+                                           ec);
+                        if(ec) {
+                            output_error("internal", "could not auto-start "
+                                         "networking on " + iface,
+                                         ec.message());
+                        }
                     }
                 }
             }
+#endif  /* HAS_INSTALL_ENV */
+        }
+
+        /* Every account is set up in memory, and the account database of the
+         * target is written once all of them are. */
+#ifdef HAS_INSTALL_ENV
+        if(!opts.test(Simulate)) {
+            internal->users = std::make_unique<UserDatabase>(
+                        targetDirectory());
+            if(!internal->users->load()) {
+                EXECUTE_FAILURE("rootpw");
+                return false;
+            }
         }
 #endif  /* HAS_INSTALL_ENV */
-    }
 
-    EXECUTE_OR_FAIL("rootpw", internal->rootpw)
+        EXECUTE_OR_FAIL("rootpw", internal->rootpw)
 
-    if(internal->lang) {
-        EXECUTE_OR_FAIL("language", internal->lang)
-    }
+        if(internal->lang) {
+            EXECUTE_OR_FAIL("language", internal->lang)
+        }
 
-    if(internal->keymap) {
-        EXECUTE_OR_FAIL("keymap", internal->keymap)
-        fs::create_symlink("/etc/init.d/keymaps",
-                           targ_etc + "/runlevels/default/keymaps", ec);
-    }
+        if(internal->keymap) {
+            EXECUTE_OR_FAIL("keymap", internal->keymap)
+            fs::create_symlink("/etc/init.d/keymaps",
+                               targ_etc + "/runlevels/default/keymaps", ec);
+        }
 
-    for(auto &acct : internal->accounts) {
-        output_info("internal", "setting up user account " + acct.first);
+        for(auto &acct : internal->accounts) {
+            output_info("internal", "setting up user account " +
+                        std::string(acct.first));
 
-        EXECUTE_OR_FAIL("username", acct.second->name)
-        if(acct.second->alias) {
-            EXECUTE_OR_FAIL("useralias", acct.second->alias)
-        }
-        if(acct.second->passphrase) {
-            EXECUTE_OR_FAIL("userpw", acct.second->passphrase)
-        }
-        if(!acct.second->groups.empty()) {
-            for(auto &grp : acct.second->groups) {
-                EXECUTE_OR_FAIL("usergroups", grp)
+            EXECUTE_OR_FAIL("username", acct.second.name)
+            if(acct.second.alias) {
+                EXECUTE_OR_FAIL("useralias", acct.second.alias)
+            }
+            if(acct.second.passphrase) {
+                EXECUTE_OR_FAIL("userpw", acct.second.passphrase)
+            }
+            if(!acct.second.groups.empty()) {
+                for(auto &grp : acct.second.groups) {
+                    EXECUTE_OR_FAIL("usergroups", grp)
+                }
+            }
+            if(acct.second.icon) {
+                maybe_create_icon_dir(opts, targetDirectory());
+                EXECUTE_OR_FAIL("usericon", acct.second.icon)
             }
         }
-        if(acct.second->icon) {
-            maybe_create_icon_dir(opts, targetDirectory());
-            EXECUTE_OR_FAIL("usericon", acct.second->icon)
+
+        if(internal->users) {
+            internal->users->save(*internal->files);
+            internal->users.reset();
         }
-    }
 
-    EXECUTE_OR_FAIL("timezone", internal->tzone)
+        EXECUTE_OR_FAIL("timezone", internal->tzone)
 
-    for(const auto &svc : internal->svcs_enable) {
-        EXECUTE_OR_FAIL("svcenable", svc)
+        for(const auto &svc : internal->svcs_enable) {
+            EXECUTE_OR_FAIL("svcenable", svc)
+        }
     }
 
+    /* The bootloader is configured from the files of the target. */
+#ifdef HAS_INSTALL_ENV
+    if(internal->files) {
+        const bool committed = internal->files->commit() &&
+                               internal->files->sync();
+        internal->files.reset();
+        if(!committed || (journalled && !journal.record("post-metadata",
+                                internal->step_digest("post-metadata")))) {
+            EXECUTE_FAILURE("post-metadata");
+            return false;
+        }
+    }
+#endif  /* HAS_INSTALL_ENV */
+
     if(internal->boot) {
-        EXECUTE_OR_FAIL("bootloader", internal->boot)
+#ifdef HAS_INSTALL_ENV
+        if(!opts.test(Simulate)) {
+            internal->agent = std::make_unique<ChrootAgent>(
+                        targetDirectory());
+        }
+#endif  /* HAS_INSTALL_ENV */
+        const bool installed = execute_key(internal->boot, "bootloader");
+        /* Nothing may keep the target busy once the script is done. */
+        internal->agent.reset();
+        if(!installed) {
+            EXECUTE_FAILURE("bootloader");
+            return false;
+        }
     }
 
+    /* Nothing is left to resume. */
+    if(journalled) journal.remove();
+
     output_step_end("post-metadata");
     return true;
 }
@@ -14,112 +14,335 @@
 #define HSCRIPT_SCRIPT_INTERNAL_HH_
 
 #include <assert.h>
+#include <cstddef>
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <set>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
+#include <sys/stat.h>
 
+#include "script_c.hh"
 #include "script_l.hh"
+#include "script_k.hh"
 
+#include "chroot.hh"
 #include "disk.hh"
 #include "meta.hh"
+#include "netconf.hh"
 #include "network.hh"
+#include "targetfiles.hh"
 #include "user.hh"
+#include "userdb.hh"
+#include "util/profile.hh"
 
 using namespace Horizon::Keys;
 
+/*! Parses the value of a key into a Key object. */
+typedef Key *(*key_parse_fn)(std::string_view, const Horizon::ScriptLocation &,
+                             int*, int*, const Horizon::Script*);
+/*! Loads a Key object from an entry of the parse cache. */
+typedef Key *(*key_load_fn)(Horizon::CacheReader &,
+                            const Horizon::ScriptLocation &,
+                            const Horizon::Script*);
+
 namespace Horizon {
 
+/*! The size of the arena embedded in each Script.
+ * This is enough to hold a typical installfile without further allocation;
+ * the arena will grow as needed for larger scripts. */
+#define SCRIPT_ARENA_SIZE 16384
+
+/*! Execute +key+, timing it as +phase+ in the active profile, if any. */
+inline bool execute_key(const Key *key, const std::string &phase) {
+    const ScriptLocation where = key->where();
+    LocationScope location(where.name + ":" + std::to_string(where.line));
+    ProfileSpan span("key", phase, output_location);
+    return key->execute();
+}
+
 /*! Describes a user account. */
 struct UserDetail {
-    std::unique_ptr<Username> name;
-    std::unique_ptr<UserAlias> alias;
-    std::unique_ptr<UserPassphrase> passphrase;
-    std::unique_ptr<UserIcon> icon;
-    std::vector< std::unique_ptr<UserGroups> > groups;
+    Username *name = nullptr;
+    UserAlias *alias = nullptr;
+    UserPassphrase *passphrase = nullptr;
+    UserIcon *icon = nullptr;
+    std::pmr::vector<UserGroups *> groups;
+
+    explicit UserDetail(std::pmr::memory_resource *arena) : groups{arena} {}
+};
+
+/*! A script parsed once by a ScriptLoader, and shared by every Script
+ * loaded by it that inherits the script.
+ * Only the Keys are parsed; they are stored by each inheriting Script, so
+ * that duplicates are diagnosed as if the script had been parsed again.
+ */
+struct InheritedScript {
+    /*! A key of the script, in the order they appear. */
+    struct Event {
+        /*! The key. */
+        KeyId key;
+        /*! The line on which the key appears. */
+        int line;
+        /*! The Key object, owned by +owner+; nullptr if the value depends on
+         * the inheriting Script, and must be parsed by it. */
+        Key *obj;
+        /*! The value of the key, if +obj+ is nullptr. */
+        std::string value;
+    };
+
+    /*! The Script owning the Keys. */
+    std::unique_ptr<Script> owner;
+    /*! The file, as saved to the parse cache. */
+    CacheFile file;
+    /*! The device, inode, and modification time of the file when parsed. */
+    struct stat st;
+    /*! The keys of the script, up to its 'inherit' key if it has one. */
+    std::vector<Event> keys;
+    /*! The value of the script's 'inherit' key, or empty. */
+    std::string inherit;
+    /*! The line on which the script's 'inherit' key appears. */
+    int inherit_line = 0;
+    /*! Whether the script parsed without diagnostics, and may be shared.
+     * Any other script is parsed by each Script inheriting it instead. */
+    bool shareable = false;
 };
 
 struct Script::ScriptPrivate {
+    /*! The initial buffer of the arena. */
+    alignas(std::max_align_t) char arena_buffer[SCRIPT_ARENA_SIZE];
+    /*! Holds every Key of the script, and everything owned by the Keys.
+     * It is released all at once when the Script is destroyed. */
+    std::pmr::monotonic_buffer_resource arena{arena_buffer,
+                                              sizeof(arena_buffer)};
+    /*! The script name most recently copied into the arena. */
+    std::string_view last_name;
+    /*! Whether the script may be saved to the parse cache. */
+    bool cacheable = true;
+    /*! The inherited scripts whose Keys are shared with this script. */
+    std::vector<std::shared_ptr<const InheritedScript>> bases;
+
     /*! Determines the target directory (usually /target) */
     std::string target;
+    /*! The files written to the target, while the script executes. */
+    std::unique_ptr<TargetFiles> files;
+    /*! The agent running commands inside the target, while the bootloader
+     * is configured. */
+    std::unique_ptr<ChrootAgent> agent;
+    /*! The number of disk Keys that may execute at once; 0 for automatic. */
+    unsigned int disk_jobs = 0;
+    /*! The host directory in which to cache packages, or empty. */
+    std::string pkg_cache;
+    /*! The most bytes to keep in +pkg_cache+, or 0 for no limit. */
+    std::uint64_t pkg_cache_limit = 0;
+    /*! The host directory in which to cache installed image targets, or
+     * empty. */
+    std::string layer_cache;
 
     /*! Determines whether or not to enable networking. */
-    std::unique_ptr<Network> network;
+    Network *network = nullptr;
     /*! Determines the network configuration system to use. */
-    std::unique_ptr<NetConfigType> netconfig;
+    NetConfigType *netconfig = nullptr;
     /*! The target system's hostname. */
-    std::unique_ptr<Hostname> hostname;
+    Hostname *hostname = nullptr;
     /*! The packages to install to the target system. */
-    std::set<std::string> packages;
+    std::pmr::set<std::pmr::string> packages{&arena};
     /*! The root shadow line. */
-    std::unique_ptr<RootPassphrase> rootpw;
+    RootPassphrase *rootpw = nullptr;
     /*! The system CPU architecture. */
-    std::unique_ptr<Arch> arch;
+    Arch *arch = nullptr;
     /*! The system language. */
-    std::unique_ptr<Language> lang;
+    Language *lang = nullptr;
     /*! The system keymap. */
-    std::unique_ptr<Keymap> keymap;
+    Keymap *keymap = nullptr;
     /*! The system timezone. */
-    std::unique_ptr<Timezone> tzone;
+    Timezone *tzone = nullptr;
     /*! The version of Adélie to install. */
-    std::unique_ptr<Version> version;
+    Version *version = nullptr;
     /*! The desired bootloader configuration. */
-    std::unique_ptr<Bootloader> boot;
+    Bootloader *boot = nullptr;
 
     /*! Network addressing configuration */
-    std::vector< std::unique_ptr<NetAddress> > addresses;
+    std::pmr::vector<NetAddress *> addresses{&arena};
     /*! Network nameserver resolver addresses */
-    std::vector< std::unique_ptr<Nameserver> > nses;
+    std::pmr::vector<Nameserver *> nses{&arena};
     /*! Wireless networking configuration */
-    std::vector< std::unique_ptr<NetSSID> > ssids;
+    std::pmr::vector<NetSSID *> ssids{&arena};
     /*! PPPoE configuration */
-    std::vector< std::unique_ptr<PPPoE> > pppoes;
+    std::pmr::vector<PPPoE *> pppoes{&arena};
+    /*! The network configuration built by the network Keys. */
+    NetConfig network_config;
 
     /*! APK repositories */
-    std::vector< std::unique_ptr<Repository> > repos;
+    std::pmr::vector<Repository *> repos{&arena};
     /*! APK repository keys */
-    std::vector< std::unique_ptr<SigningKey> > repo_keys;
+    std::pmr::vector<SigningKey *> repo_keys{&arena};
 
     /*! Services to enable */
-    std::vector< std::unique_ptr<SvcEnable> > svcs_enable;
+    std::pmr::vector<SvcEnable *> svcs_enable{&arena};
 
     /*! User account information */
-    std::map< std::string, std::unique_ptr<UserDetail> > accounts;
+    std::pmr::map<std::pmr::string, UserDetail, std::less<>> accounts{&arena};
+    /*! The account database of the target, while accounts are set up. */
+    std::unique_ptr<UserDatabase> users;
 
     /*! Disk identification keys */
-    std::vector< std::unique_ptr<DiskId> > diskids;
+    std::pmr::vector<DiskId *> diskids{&arena};
     /*! Disklabel configuration keys */
-    std::vector< std::unique_ptr<DiskLabel> > disklabels;
+    std::pmr::vector<DiskLabel *> disklabels{&arena};
     /*! Partition creation keys */
-    std::vector< std::unique_ptr<Partition> > partitions;
+    std::pmr::vector<Partition *> partitions{&arena};
     /*! LVM physical volume keys */
-    std::vector< std::unique_ptr<LVMPhysical> > lvm_pvs;
+    std::pmr::vector<LVMPhysical *> lvm_pvs{&arena};
     /*! LVM volume group keys */
-    std::vector< std::unique_ptr<LVMGroup> > lvm_vgs;
+    std::pmr::vector<LVMGroup *> lvm_vgs{&arena};
     /*! LVM logical volume keys */
-    std::vector< std::unique_ptr<LVMVolume> > lvm_lvs;
+    std::pmr::vector<LVMVolume *> lvm_lvs{&arena};
     /*! LUKS creation keys */
-    std::vector< std::unique_ptr<Encrypt> > luks;
+    std::pmr::vector<Encrypt *> luks{&arena};
     /*! Filesystem creation keys */
-    std::vector< std::unique_ptr<Filesystem> > fses;
+    std::pmr::vector<Filesystem *> fses{&arena};
     /*! Target system's mountpoints. */
-    std::vector< std::unique_ptr<Mount> > mounts;
+    std::pmr::vector<Mount *> mounts{&arena};
 
-#ifdef NON_LIBRE_FIRMWARE
-    std::unique_ptr<Firmware> firmware;
-#endif
+    /*! Whether to install non-libre firmware.
+     * This is always empty unless NON_LIBRE_FIRMWARE is defined. */
+    Firmware *firmware = nullptr;
 
-    /*! Store +key_obj+ representing the key +key_name+.
-     * @param key_name      The name of the key that is being stored.
+    /*! Retrieve a copy of +name+ that is owned by the arena.
+     * Keys from the same script share the same copy of its name.
+     */
+    std::string_view intern(std::string_view name) {
+        if(name != last_name) {
+            char *copy = static_cast<char *>(arena.allocate(name.size(), 1));
+            name.copy(copy, name.size());
+            last_name = std::string_view(copy, name.size());
+        }
+        return last_name;
+    }
+
+    /*! The typed handlers for a key. */
+    struct KeyHandler {
+        /*! Parses the value of the key into a Key object. */
+        key_parse_fn parse;
+        /*! Loads a Key object of this key from the parse cache. */
+        key_load_fn load;
+        /*! Stores a Key object of this key. */
+        bool (ScriptPrivate::*store)(Key *, const ScriptLocation &, int *,
+                                     int *, const ScriptOptions &);
+        /*! Retrieves the value of a One key. */
+        const Key *(ScriptPrivate::*one)() const;
+        /*! Retrieves the values of a List key. */
+        void (ScriptPrivate::*all)(std::vector<Key *> &) const;
+    };
+
+    /*! The handlers for each key, indexed by KeyId. */
+    static const KeyHandler handlers[];
+
+    /*! Replace +obj+ with a copy owned by +self+, if it is shared. */
+    template<typename T>
+    void own(KeyId key, T *&obj, const Script *self) {
+        if(obj == nullptr || obj->script == self) return;
+        CacheWriter out;
+        obj->saveToCache(out);
+        CacheReader in(out.data());
+        obj = static_cast<T *>(handlers[static_cast<std::size_t>(key)].load(
+                                   in, obj->where(), self));
+        assert(obj != nullptr);
+    }
+
+    /*! Copy every shared Key into the arena of +self+.
+     * This must be done before any Key is executed, since Keys consult the
+     * Script that owns them for its target directory and other keys.
+     */
+    void unshare(const Script *self);
+
+    /*! Execute the disk Keys, running independent Keys at once.
+     * Each Key runs only after the Keys that create the devices it uses.
+     * @param jobs      The most Keys to execute at once.
+     * @param describe  Whether to print the Keys each Key waits for.
+     * @returns true if every disk Key executed successfully.
+     */
+    bool execute_disks(unsigned int jobs, bool describe);
+
+    /*! Determine every package to install to the target.
+     * The packages requested with 'pkginstall' are joined by those needed
+     * by other keys, so that they can all be installed at once.
+     */
+    std::set<std::string> plan_packages() const;
+
+    /*! Compute the digest of the inputs of an execution step that is
+     * recorded in the journal: "disk", "pkgdb", or "post-metadata".  The
+     * digest of "pkgdb" also names the layer of an image in the layer cache.
+     */
+    std::uint64_t step_digest(const std::string &step) const;
+
+    /*! Load a script from the parse cache.
+     * The entry is only used if the script, and every file it inherits,
+     * is unchanged since the entry was saved.
+     * @param cache     The directory holding the parse cache.
+     * @param name      The name of the script.
+     * @param data      The contents of the script.
+     * @param opts      Script parsing options.
+     * @returns The Script, or nullptr if there is no usable entry.
+     */
+    static Script *load_cache(const std::string &cache,
+                              const std::string &name, std::string_view data,
+                              const ScriptOptions &opts);
+
+    /*! Save a parsed script to the parse cache.
+     * @param cache     The directory holding the parse cache.
+     * @param files     Every file read, starting with the script itself.
+     * @param keys      Every Key stored, in the order they were stored.
+     * @param opts      Script parsing options.
+     */
+    static void save_cache(const std::string &cache,
+                           const std::vector<CacheFile> &files,
+                           const std::vector<std::pair<KeyId, const Key *>>
+                           &keys, const ScriptOptions &opts);
+
+    /*! Store +key_obj+ representing the key +key+.
+     * @param key           The key that is being stored.
      * @param obj           The Key object associated with the key.
      * @param pos           The on-disk script position of the key.
      * @param errors        Output parameter: if given, incremented on error.
      * @param warnings      Output parameter: if given, incremented on warning.
      * @param opts          Script parsing options.
      */
-    bool store_key(const std::string &key_name, Key *obj,
-                   const ScriptLocation &pos, int *errors, int *warnings,
-                   const ScriptOptions &opts);
+    bool store_key(KeyId key, Key *obj, const ScriptLocation &pos,
+                   int *errors, int *warnings, const ScriptOptions &opts) {
+        return (this->*handlers[static_cast<std::size_t>(key)].store)(
+                    obj, pos, errors, warnings, opts);
+    }
+
+    /*! Store a key that may be specified any number of times. */
+    template<typename T, std::pmr::vector<T *> ScriptPrivate::*list>
+    bool store_list(Key *obj, const ScriptLocation &, int *, int *,
+                    const ScriptOptions &) {
+        (this->*list).push_back(static_cast<T *>(obj));
+        return true;
+    }
+
+    /*! Retrieve the value of a key that may be specified once. */
+    template<typename T, T *ScriptPrivate::*one>
+    const Key *get_one() const {
+        return this->*one;
+    }
+
+    /*! Retrieve the values of a key that may be specified many times. */
+    template<typename T, std::pmr::vector<T *> ScriptPrivate::*list>
+    void get_all(std::vector<Key *> &values) const {
+        for(auto &value : this->*list) values.push_back(value);
+    }
+
+    /*! Retrieve the values of a key that is not stored as Key objects. */
+    void get_opaque(std::vector<Key *> &) const {
+        /* XXX */
+    }
 
 #define DUPLICATE_ERROR(OBJ, KEY, OLD_VAL) \
     if(pos.inherited) return true;\
@@ -138,8 +361,7 @@ struct Script::ScriptPrivate {
                             network->test() ? "true" : "false")
             return false;
         }
-        std::unique_ptr<Network> net(dynamic_cast<Network *>(obj));
-        network = std::move(net);
+        network = dynamic_cast<Network *>(obj);
         return true;
     }
 
@@ -150,8 +372,7 @@ struct Script::ScriptPrivate {
                             netconfig->type());
             return false;
         }
-        std::unique_ptr<NetConfigType> nc(dynamic_cast<NetConfigType *>(obj));
-        netconfig = std::move(nc);
+        netconfig = dynamic_cast<NetConfigType *>(obj);
         return true;
     }
 
@@ -165,8 +386,7 @@ struct Script::ScriptPrivate {
             }
         }
 
-        std::unique_ptr<PPPoE> uppp(ppp);
-        pppoes.push_back(std::move(uppp));
+        pppoes.push_back(ppp);
         return true;
     }
 
@@ -176,8 +396,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(hostname, "hostname", hostname->value())
             return false;
         }
-        std::unique_ptr<Hostname> name(dynamic_cast<Hostname *>(obj));
-        hostname = std::move(name);
+        hostname = dynamic_cast<Hostname *>(obj);
         return true;
     }
 
@@ -187,13 +406,13 @@ struct Script::ScriptPrivate {
         for(auto &pkg : install->packages()) {
             if(opts.test(StrictMode) && packages.find(pkg) != packages.end()) {
                 if(warnings) *warnings += 1;
-                output_warning(pos, "pkginstall: package '" + pkg +
+                output_warning(pos, "pkginstall: package '" +
+                               std::string(pkg) +
                                "' has already been specified");
                 continue;
             }
             packages.insert(pkg);
         }
-        delete install;
         return true;
     }
 
@@ -203,8 +422,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(arch, "arch", arch->value())
             return false;
         }
-        std::unique_ptr<Arch> a(dynamic_cast<Arch *>(obj));
-        arch = std::move(a);
+        arch = dynamic_cast<Arch *>(obj);
         return true;
     }
 
@@ -214,24 +432,22 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(rootpw, "rootpw", "an encrypted passphrase")
             return false;
         }
-        std::unique_ptr<RootPassphrase> r(dynamic_cast<RootPassphrase *>(obj));
-        rootpw = std::move(r);
+        rootpw = dynamic_cast<RootPassphrase *>(obj);
         return true;
     }
 
     bool store_firmware(Key *obj, const ScriptLocation &pos, int *errors, int *,
                         const ScriptOptions &) {
-        std::unique_ptr<Firmware> f(dynamic_cast<Firmware *>(obj));
 #ifdef NON_LIBRE_FIRMWARE
         if(firmware) {
             DUPLICATE_ERROR(firmware, "firmware",
                             (firmware->test()) ? "true" : "false")
             return false;
         }
-        firmware = std::move(f);
+        firmware = dynamic_cast<Firmware *>(obj);
         return true;
 #else
-        assert(!f->test());
+        assert(!dynamic_cast<Firmware *>(obj)->test());
         return true;
 #endif
     }
@@ -242,8 +458,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(lang, "language", lang->value())
             return false;
         }
-        std::unique_ptr<Language> l(dynamic_cast<Language *>(obj));
-        lang = std::move(l);
+        lang = dynamic_cast<Language *>(obj);
         return true;
     }
 
@@ -253,8 +468,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(keymap, "keymap", keymap->value())
             return false;
         }
-        std::unique_ptr<Keymap> k(dynamic_cast<Keymap *>(obj));
-        keymap = std::move(k);
+        keymap = dynamic_cast<Keymap *>(obj);
         packages.insert("kbd-keymaps");
         return true;
     }
@@ -265,14 +479,13 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(tzone, "timezone", tzone->value())
             return false;
         }
-        std::unique_ptr<Timezone> t(dynamic_cast<Timezone *>(obj));
-        tzone = std::move(t);
+        tzone = dynamic_cast<Timezone *>(obj);
         return true;
     }
 
     bool store_svcenable(Key *obj, const ScriptLocation &pos, int *, int *warn,
                          const ScriptOptions &) {
-        std::unique_ptr<SvcEnable> svc(dynamic_cast<SvcEnable *>(obj));
+        SvcEnable *svc = dynamic_cast<SvcEnable *>(obj);
         for(const auto &s : svcs_enable) {
             if(s->service() == svc->service()) {
                 if(warn) *warn += 1;
@@ -282,7 +495,7 @@ struct Script::ScriptPrivate {
             }
         }
 
-        svcs_enable.push_back(std::move(svc));
+        svcs_enable.push_back(svc);
         return true;
     }
 
@@ -292,8 +505,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(version, "version", version->value())
             return false;
         }
-        std::unique_ptr<Version> v(dynamic_cast<Version *>(obj));
-        version = std::move(v);
+        version = dynamic_cast<Version *>(obj);
         return true;
     }
 
@@ -303,8 +515,7 @@ struct Script::ScriptPrivate {
             DUPLICATE_ERROR(boot, "bootloader", boot->bootloader())
             return false;
         }
-        std::unique_ptr<Bootloader> b(dynamic_cast<Bootloader *>(obj));
-        boot = std::move(b);
+        boot = dynamic_cast<Bootloader *>(obj);
         return true;
     }
 
@@ -316,44 +527,45 @@ struct Script::ScriptPrivate {
                          "you may only specify 255 users");
             return false;
         }
-        std::unique_ptr<Username> name(dynamic_cast<Username *>(obj));
-        if(accounts.find(name->value()) != accounts.end()) {
-            DUPLICATE_ERROR((*accounts.find(name->value())).second->name,
+        Username *name = dynamic_cast<Username *>(obj);
+        const std::string username = name->value();
+        const std::string_view key(username);
+        if(accounts.find(key) != accounts.end()) {
+            DUPLICATE_ERROR((*accounts.find(key)).second.name,
                             "username", "assigned")
             return false;
         }
-        std::unique_ptr<UserDetail> detail(new UserDetail);
-        detail->name = std::move(name);
-        accounts.insert(std::make_pair(detail->name->value(),
-                                       std::move(detail)));
+        UserDetail &detail = accounts.emplace(key, &arena).first->second;
+        detail.name = name;
         return true;
     }
 
 #define GET_USER_DETAIL(OBJ, KEY) \
-    if(accounts.find(OBJ->username()) == accounts.end()) {\
+    const std::string username = OBJ->username();\
+    if(accounts.find(std::string_view(username)) == accounts.end()) {\
         if(errors) *errors += 1;\
         output_error(pos, std::string(KEY) + ": account name " +\
                      OBJ->username() + " is unknown");\
         return false;\
     }\
-    UserDetail *detail = (*accounts.find(OBJ->username())).second.get();
+    UserDetail *detail = &(*accounts.find(std::string_view(username))).second;
 
     bool store_useralias(Key* obj, const ScriptLocation &pos, int *errors,
                          int *, const ScriptOptions &) {
-        std::unique_ptr<UserAlias> alias(dynamic_cast<UserAlias *>(obj));
+        UserAlias *alias = dynamic_cast<UserAlias *>(obj);
         GET_USER_DETAIL(alias, "useralias")
         /* REQ: Runner.Validate.useralias.Unique */
         if(detail->alias) {
             DUPLICATE_ERROR(detail->alias, "useralias", detail->alias->alias())
             return false;
         }
-        detail->alias = std::move(alias);
+        detail->alias = alias;
         return true;
     }
 
     bool store_userpw(Key *obj, const ScriptLocation &pos, int *errors, int *,
                       const ScriptOptions &) {
-        std::unique_ptr<UserPassphrase> pw(dynamic_cast<UserPassphrase *>(obj));
+        UserPassphrase *pw = dynamic_cast<UserPassphrase *>(obj);
         GET_USER_DETAIL(pw, "userpw")
         /* REQ: Runner.Validate.userpw.Unique */
         if(detail->passphrase) {
@@ -361,28 +573,28 @@ struct Script::ScriptPrivate {
                             "an encrypted passphrase")
             return false;
         }
-        detail->passphrase = std::move(pw);
+        detail->passphrase = pw;
         return true;
     }
 
     bool store_usericon(Key *obj, const ScriptLocation &pos, int *errors, int *,
                         const ScriptOptions &) {
-        std::unique_ptr<UserIcon> icon(dynamic_cast<UserIcon *>(obj));
+        UserIcon *icon = dynamic_cast<UserIcon *>(obj);
         GET_USER_DETAIL(icon, "usericon")
         /* REQ: Runner.Validate.usericon.Unique */
         if(detail->icon) {
             DUPLICATE_ERROR(detail->icon, "usericon", detail->icon->icon())
             return false;
         }
-        detail->icon = std::move(icon);
+        detail->icon = icon;
         return true;
     }
 
     bool store_usergroups(Key* obj, const ScriptLocation &pos, int *errors,
                           int *, const ScriptOptions &) {
-        std::unique_ptr<UserGroups> grp(dynamic_cast<UserGroups *>(obj));
+        UserGroups *grp = dynamic_cast<UserGroups *>(obj);
         GET_USER_DETAIL(grp, "usergroups")
-        detail->groups.push_back(std::move(grp));
+        detail->groups.push_back(grp);
         return true;
     }
 #undef GET_USER_DETAIL
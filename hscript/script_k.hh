@@ -0,0 +1,199 @@
+/*
+ * script_k.hh - Definition of the HorizonScript key registry
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_SCRIPT_KEYS_HH_
+#define HSCRIPT_SCRIPT_KEYS_HH_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/*! Every key known to HorizonScript.
+ *
+ * Adding a key to HorizonScript requires only a new entry in this table.
+ * Each entry is: X(Id, name, Class, Kind, member, store), where:
+ *
+ * - Id is the KeyId of the key;
+ * - name is the key as written in a script, in lower-case;
+ * - Class is the Key class that parses the value;
+ * - Kind describes how the key is stored in Script::ScriptPrivate:
+ *     - One: a single value, retrievable with Script::getOneValue;
+ *     - List: many values, retrievable with Script::getValues;
+ *     - Vector: a List that needs no special handling when stored;
+ *     - Opaque: stored in a form that cannot be retrieved as Key objects;
+ * - member is the member of Script::ScriptPrivate holding the values;
+ * - store is the member function of Script::ScriptPrivate used to store
+ *   a value, or store_list for a Vector.
+ */
+#define HSCRIPT_KEYS(X) \
+    X(Network,       "network",       Network,       One,    network,     store_network)\
+    X(Hostname,      "hostname",      Hostname,      One,    hostname,    store_hostname)\
+    X(PkgInstall,    "pkginstall",    PkgInstall,    Opaque, packages,    store_pkginstall)\
+    X(RootPassphrase,"rootpw",        RootPassphrase,One,    rootpw,      store_rootpw)\
+    \
+    X(Arch,          "arch",          Arch,          One,    arch,        store_arch)\
+    X(Language,      "language",      Language,      One,    lang,        store_lang)\
+    X(Keymap,        "keymap",        Keymap,        One,    keymap,      store_keymap)\
+    X(Firmware,      "firmware",      Firmware,      One,    firmware,    store_firmware)\
+    X(Timezone,      "timezone",      Timezone,      One,    tzone,       store_timezone)\
+    X(Repository,    "repository",    Repository,    Vector, repos,       store_list)\
+    X(SigningKey,    "signingkey",    SigningKey,    Vector, repo_keys,   store_list)\
+    X(SvcEnable,     "svcenable",     SvcEnable,     List,   svcs_enable, store_svcenable)\
+    X(Version,       "version",       Version,       One,    version,     store_version)\
+    X(Bootloader,    "bootloader",    Bootloader,    One,    boot,        store_bootloader)\
+    \
+    X(NetConfigType, "netconfigtype", NetConfigType, One,    netconfig,   store_netconfig)\
+    X(NetAddress,    "netaddress",    NetAddress,    Vector, addresses,   store_list)\
+    X(Nameserver,    "nameserver",    Nameserver,    Vector, nses,        store_list)\
+    X(NetSSID,       "netssid",       NetSSID,       Vector, ssids,       store_list)\
+    X(PPPoE,         "pppoe",         PPPoE,         List,   pppoes,      store_pppoe)\
+    \
+    X(Username,      "username",      Username,      Opaque, accounts,    store_username)\
+    X(UserAlias,     "useralias",     UserAlias,     Opaque, accounts,    store_useralias)\
+    X(UserPassphrase,"userpw",        UserPassphrase,Opaque, accounts,    store_userpw)\
+    X(UserIcon,      "usericon",      UserIcon,      Opaque, accounts,    store_usericon)\
+    X(UserGroups,    "usergroups",    UserGroups,    Opaque, accounts,    store_usergroups)\
+    \
+    X(DiskId,        "diskid",        DiskId,        Vector, diskids,     store_list)\
+    X(DiskLabel,     "disklabel",     DiskLabel,     Vector, disklabels,  store_list)\
+    X(Partition,     "partition",     Partition,     Vector, partitions,  store_list)\
+    X(LVMPhysical,   "lvm_pv",        LVMPhysical,   Vector, lvm_pvs,     store_list)\
+    X(LVMGroup,      "lvm_vg",        LVMGroup,      Vector, lvm_vgs,     store_list)\
+    X(LVMVolume,     "lvm_lv",        LVMVolume,     Vector, lvm_lvs,     store_list)\
+    X(Encrypt,       "encrypt",       Encrypt,       Vector, luks,        store_list)\
+    X(Filesystem,    "fs",            Filesystem,    Vector, fses,        store_list)\
+    X(Mount,         "mount",         Mount,         Vector, mounts,      store_list)
+
+namespace Horizon {
+namespace Keys {
+
+/*! Identifies a key in a HorizonScript. */
+enum class KeyId : unsigned char {
+#define X(id, ...) id,
+    HSCRIPT_KEYS(X)
+#undef X
+    /*! The 'inherit' directive, which is handled by the parser itself. */
+    Inherit,
+    /*! Not a HorizonScript key. */
+    Invalid
+};
+
+/*! The number of names in key_names. */
+constexpr std::size_t KEY_COUNT = static_cast<std::size_t>(KeyId::Invalid);
+
+/*! The name of each key, indexed by KeyId. */
+inline constexpr std::string_view key_names[KEY_COUNT] = {
+#define X(id, name, ...) name,
+    HSCRIPT_KEYS(X)
+#undef X
+    "inherit"
+};
+
+/*! The number of slots in the key hash table.  Must be a power of two. */
+constexpr std::size_t KEY_SLOTS = 128;
+
+/*! Marks an unused slot in the key hash table. */
+constexpr unsigned char KEY_SLOT_EMPTY = 0xFF;
+
+/*! Lower-case an ASCII character. */
+constexpr char key_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+/*! Hash a key name, ignoring case (FNV-1a, perturbed by +seed+).
+ * The low bits of FNV-1a depend only on the low bits of the seed, so the
+ * high bits are folded in before the hash is reduced to a slot.
+ */
+constexpr std::uint32_t key_hash(std::string_view name, std::uint32_t seed) {
+    std::uint32_t hash = 2166136261u ^ seed;
+    for(char c : name) {
+        hash ^= static_cast<unsigned char>(key_lower(c));
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+/*! Find a seed for which key_hash maps every key name to a unique slot. */
+constexpr std::uint32_t find_key_seed() {
+    for(std::uint32_t seed = 0; seed < 65536; seed++) {
+        bool used[KEY_SLOTS] = {};
+        bool perfect = true;
+        for(std::size_t key = 0; key < KEY_COUNT && perfect; key++) {
+            std::size_t slot = key_hash(key_names[key], seed) % KEY_SLOTS;
+            perfect = !used[slot];
+            used[slot] = true;
+        }
+        if(perfect) return seed;
+    }
+    return UINT32_MAX;
+}
+
+/*! The seed for the key hash table. */
+constexpr std::uint32_t key_seed = find_key_seed();
+static_assert(key_seed != UINT32_MAX, "the key table has no perfect hash");
+
+/*! The key hash table: the KeyId held in each slot. */
+struct KeySlots {
+    unsigned char slot[KEY_SLOTS];
+};
+
+/*! Build the key hash table, mapping each slot to a KeyId. */
+constexpr KeySlots build_key_slots() {
+    KeySlots slots{};
+    for(std::size_t slot = 0; slot < KEY_SLOTS; slot++) {
+        slots.slot[slot] = KEY_SLOT_EMPTY;
+    }
+    for(std::size_t key = 0; key < KEY_COUNT; key++) {
+        slots.slot[key_hash(key_names[key], key_seed) % KEY_SLOTS] =
+                static_cast<unsigned char>(key);
+    }
+    return slots;
+}
+
+/*! The key hash table. */
+inline constexpr KeySlots key_slots = build_key_slots();
+
+/*! Look up a key by name, ignoring case.
+ * @param name      The name of the key.
+ * @returns The KeyId of the key, or KeyId::Invalid if it is not a key.
+ */
+constexpr KeyId key_id(std::string_view name) {
+    const unsigned char key =
+            key_slots.slot[key_hash(name, key_seed) % KEY_SLOTS];
+    if(key == KEY_SLOT_EMPTY) return KeyId::Invalid;
+
+    const std::string_view candidate = key_names[key];
+    if(candidate.size() != name.size()) return KeyId::Invalid;
+    for(std::size_t pos = 0; pos < name.size(); pos++) {
+        if(key_lower(name[pos]) != candidate[pos]) return KeyId::Invalid;
+    }
+    return static_cast<KeyId>(key);
+}
+
+/*! Retrieve the name of a key.
+ * @param id        The KeyId of the key.
+ * @returns The name of the key, as written in a script.
+ */
+constexpr std::string_view key_name(KeyId id) {
+    return key_names[static_cast<std::size_t>(id)];
+}
+
+static_assert(key_id("network") == KeyId::Network, "key registry mismatch");
+static_assert(key_id("MOUNT") == KeyId::Mount, "key registry mismatch");
+static_assert(key_id("inherit") == KeyId::Inherit, "key registry mismatch");
+static_assert(key_id("nonexistent") == KeyId::Invalid,
+              "key registry mismatch");
+
+}
+}
+
+#endif /* !HSCRIPT_SCRIPT_KEYS_HH_ */
@@ -0,0 +1,162 @@
+/*
+ * script_t.cc - Implementation of the HorizonScript tokeniser
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script_t.hh"
+
+/*! The size of each read when the script cannot be mapped. */
+#define SCRIPT_BLOCK_SIZE 65536
+
+namespace Horizon {
+
+ScriptTokeniser::ScriptTokeniser() : _data{nullptr}, _size{0}, _offset{0},
+    _line{0}, _map{nullptr} {}
+
+ScriptTokeniser::~ScriptTokeniser() {
+    reset();
+}
+
+void ScriptTokeniser::reset() {
+    if(_map != nullptr) munmap(_map, _size);
+    _map = nullptr;
+    _buffer.clear();
+    _data = nullptr;
+    _size = _offset = 0;
+    _line = 0;
+}
+
+bool ScriptTokeniser::open(const std::string &path, bool *io_error) {
+    reset();
+    *io_error = false;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        ::close(fd);
+        return false;
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    if(S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(nullptr, static_cast<std::size_t>(st.st_size),
+                         PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            ::close(fd);
+            madvise(map, static_cast<std::size_t>(st.st_size),
+                    MADV_SEQUENTIAL);
+            _map = map;
+            _data = static_cast<const char *>(map);
+            _size = static_cast<std::size_t>(st.st_size);
+            return true;
+        }
+    }
+
+    /* Pipes, character devices, and file systems that do not support
+     * mapping are read in large blocks instead. */
+    std::size_t used = 0;
+    while(true) {
+        _buffer.resize(used + SCRIPT_BLOCK_SIZE);
+        ssize_t got = ::read(fd, &_buffer[used], SCRIPT_BLOCK_SIZE);
+        if(got == -1) {
+            if(errno == EINTR) continue;
+            *io_error = true;
+            break;
+        }
+        if(got == 0) break;
+        used += static_cast<std::size_t>(got);
+    }
+    ::close(fd);
+
+    _buffer.resize(used);
+    _data = _buffer.data();
+    _size = used;
+    return true;
+}
+
+bool ScriptTokeniser::read(std::istream &stream) {
+    reset();
+
+    std::size_t used = 0;
+    while(stream) {
+        _buffer.resize(used + SCRIPT_BLOCK_SIZE);
+        stream.read(&_buffer[used], SCRIPT_BLOCK_SIZE);
+        used += static_cast<std::size_t>(stream.gcount());
+    }
+
+    _buffer.resize(used);
+    _data = _buffer.data();
+    _size = used;
+    return !stream.bad();
+}
+
+bool ScriptTokeniser::next(ScriptToken &token) {
+    const std::string_view delim(" \t");
+
+    while(_offset < _size) {
+        const char *begin = _data + _offset;
+        const char *end = static_cast<const char *>(
+                    memchr(begin, '\n', _size - _offset));
+        std::size_t length;
+        if(end == nullptr) {
+            length = _size - _offset;
+            _offset = _size;
+        } else {
+            length = static_cast<std::size_t>(end - begin);
+            _offset += length + 1;
+        }
+        _line++;
+
+        const std::string_view line(begin, length);
+        if(line.empty() || line[0] == '#') {
+            /* This is a comment line; ignore it. */
+            continue;
+        }
+
+        std::string_view::size_type start, key_end, value_begin;
+        start = line.find_first_not_of(delim);
+        if(start == std::string_view::npos) {
+            /* This is a blank line; ignore it. */
+            continue;
+        }
+
+        key_end = line.find_first_of(delim, start);
+        token.line = _line;
+        token.key = line.substr(start, key_end - start);
+        if(key_end == std::string_view::npos) {
+            token.value = std::string_view();
+        } else {
+            value_begin = line.find_first_not_of(delim, key_end);
+            if(value_begin == std::string_view::npos) {
+                token.value = std::string_view();
+            } else {
+                token.value = line.substr(value_begin);
+            }
+        }
+        return true;
+    }
+
+    return false;
+}
+
+}
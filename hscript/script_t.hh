@@ -0,0 +1,96 @@
+/*
+ * script_t.hh - Definition of the HorizonScript tokeniser
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_SCRIPT_TOKENISER_HH_
+#define HSCRIPT_SCRIPT_TOKENISER_HH_
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <string_view>
+
+namespace Horizon {
+
+/*! A single key/value line of a HorizonScript.
+ * The views point into the buffer of the ScriptTokeniser that produced the
+ * token, and are only valid as long as that tokeniser is alive.
+ */
+struct ScriptToken {
+    /*! The line number on which the token appears. */
+    int line;
+    /*! The key, exactly as written in the script. */
+    std::string_view key;
+    /*! The value associated with the key, or empty if there is none. */
+    std::string_view value;
+};
+
+/*! Splits a HorizonScript into tokens.
+ * The entire script is mapped (or read, if it cannot be mapped) into memory
+ * once, and tokens are handed out as views into that memory.  There is no
+ * limit on line length, and no allocation is done per line.
+ */
+class ScriptTokeniser {
+private:
+    /*! The script data. */
+    const char *_data;
+    /*! The length of the script data. */
+    std::size_t _size;
+    /*! The offset of the next line to examine. */
+    std::size_t _offset;
+    /*! The line number of the last line examined. */
+    int _line;
+    /*! The address of the mapping, if the script is mapped. */
+    void *_map;
+    /*! The buffer holding the script, if the script is not mapped. */
+    std::string _buffer;
+
+    void reset();
+public:
+    ScriptTokeniser();
+    ~ScriptTokeniser();
+    ScriptTokeniser(const ScriptTokeniser &) = delete;
+    ScriptTokeniser &operator=(const ScriptTokeniser &) = delete;
+
+    /*! Load the script at the specified path.
+     * Regular files are mapped; anything else is read in large blocks.
+     * @param path      The path to the script.
+     * @param io_error  Output variable: set to true if an I/O error occurred
+     *                  after the file was opened.
+     * @returns true if the script was loaded, false otherwise.
+     */
+    bool open(const std::string &path, bool *io_error);
+
+    /*! Load the script from the specified stream, in large blocks.
+     * @param stream    The stream to read.
+     * @returns true if the stream was read entirely, false on I/O error.
+     */
+    bool read(std::istream &stream);
+
+    /*! Retrieve the next token from the script.
+     * Comment lines and blank lines are skipped.
+     * @param token     Output variable: the next token.
+     * @returns true if a token was found, false at the end of the script.
+     */
+    bool next(ScriptToken &token);
+
+    /*! Retrieve the line number of the last line examined. */
+    int line() const { return this->_line; }
+
+    /*! Retrieve the entire script. */
+    std::string_view data() const {
+        return std::string_view(this->_data, this->_size);
+    }
+};
+
+}
+
+#endif /* !HSCRIPT_SCRIPT_TOKENISER_HH_ */
@@ -25,12 +25,14 @@
 #include "script.hh"
 #include "script_i.hh"
 #include "disk.hh"
+#include "inventory.hh"
 #include "meta.hh"
 #include "network.hh"
 #include "user.hh"
 
 #include "util/filesystem.hh"
 #include "util/output.hh"
+#include "util/profile.hh"
 
 using namespace Horizon::Keys;
 using Horizon::ScriptOptions;
@@ -68,15 +70,15 @@ int validate_one_account(const std::string &name, UserDetail *detail) {
     if(detail->icon && !detail->icon->validate()) failures++;
 
     if(detail->groups.size() > 0) {
-        std::set<std::string> seen_groups;
+        std::set<std::string_view> seen_groups;
         for(auto &group : detail->groups) {
             /* REQ: Runner.Validate.usergroups */
             if(!group->validate()) failures++;
 
             /* REQ: Runner.Validate.usergroups.Unique */
-            const std::set<std::string> these = group->groups();
+            const auto &these = group->groups();
             if(!std::all_of(these.begin(), these.end(),
-                [&seen_groups](std::string elem) {
+                [&seen_groups](std::string_view elem) {
                     return seen_groups.find(elem) == seen_groups.end();
                 })
             ) {
@@ -105,7 +107,7 @@ int validate_one_account(const std::string &name, UserDetail *detail) {
  * The list +repos+ will be modified with the default repositories for
  * Adélie Linux.  Both system/ and user/ will be added.
  */
-bool add_default_repos(std::vector<std::unique_ptr<Repository>> &repos,
+bool add_default_repos(std::pmr::vector<Repository *> &repos,
                        const Script *s, bool firmware = false) {
     std::string base_url = "https://distfiles.adelielinux.org/adelie/";
     const ScriptLocation p{"internal", 0};
@@ -124,8 +126,7 @@ bool add_default_repos(std::vector<std::unique_ptr<Repository>> &repos,
         return false;
         /* LCOV_EXCL_STOP */
     }
-    std::unique_ptr<Repository> sys_repo(sys_key);
-    repos.push_back(std::move(sys_repo));
+    repos.push_back(sys_key);
     Repository *user_key = static_cast<Repository *>(
         Repository::parseFromData(base_url + "user", p, nullptr, nullptr, s)
     );
@@ -135,8 +136,7 @@ bool add_default_repos(std::vector<std::unique_ptr<Repository>> &repos,
         return false;
         /* LCOV_EXCL_STOP */
     }
-    std::unique_ptr<Repository> user_repo(user_key);
-    repos.push_back(std::move(user_repo));
+    repos.push_back(user_key);
 
 #ifdef NON_LIBRE_FIRMWARE
     /* REQ: Runner.Execute.firmware.Repository */
@@ -152,8 +152,7 @@ bool add_default_repos(std::vector<std::unique_ptr<Repository>> &repos,
                          "failed to create firmware repository");
             return false;
         }
-        std::unique_ptr<Repository> fw_repo(fw_key);
-        repos.push_back(std::move(fw_repo));
+        repos.push_back(fw_key);
     }
 #endif  /* NON_LIBRE_FIRMWARE */
     return true;
@@ -165,7 +164,7 @@ bool add_default_repos(std::vector<std::unique_ptr<Repository>> &repos,
  * The list +keys+ will be modified with the default repository signing keys
  * for Adélie Linux.
  */
-bool add_default_repo_keys(std::vector<std::unique_ptr<SigningKey>> &keys,
+bool add_default_repo_keys(std::pmr::vector<SigningKey *> &keys,
                            const Script *s, bool firmware = false) {
     SigningKey *key = static_cast<SigningKey *>(
         SigningKey::parseFromData(
@@ -178,8 +177,7 @@ bool add_default_repo_keys(std::vector<std::unique_ptr<SigningKey>> &keys,
         return false;
         /* LCOV_EXCL_STOP */
     }
-    std::unique_ptr<SigningKey> repo_key(key);
-    keys.push_back(std::move(repo_key));
+    keys.push_back(key);
 
 #ifdef NON_LIBRE_FIRMWARE
     /* REQ: Runner.Execute.signingkey.Firmware */
@@ -192,14 +190,12 @@ bool add_default_repo_keys(std::vector<std::unique_ptr<SigningKey>> &keys,
             output_error("internal", "failed to create firmware signing key");
             return false;
         }
-        std::unique_ptr<SigningKey> fw_key(fkey);
-        keys.push_back(std::move(fw_key));
+        keys.push_back(fkey);
         fkey = dynamic_cast<SigningKey *>(SigningKey::parseFromData(
             "/etc/apk/keys/packages@pleroma.apkfission.net-5ac04808.rsa.pub",
                                               {"", 0}, nullptr, nullptr, s));
         if(fkey) {
-            std::unique_ptr<SigningKey> fw_key2(fkey);
-            keys.push_back(std::move(fw_key2));
+            keys.push_back(fkey);
         }
     }
 #endif  /* NON_LIBRE_FIRMWARE */
@@ -208,6 +204,7 @@ bool add_default_repo_keys(std::vector<std::unique_ptr<SigningKey>> &keys,
 
 
 bool Horizon::Script::validate() const {
+    ProfileSpan span("script", "validate");
     int failures = 0;
     std::set<std::string> seen_diskids, seen_labels, seen_parts, seen_pvs,
             seen_vg_names, seen_vg_pvs, seen_lvs, seen_fses, seen_mounts,
@@ -294,8 +291,7 @@ bool Horizon::Script::validate() const {
             return false;
             /* LCOV_EXCL_STOP */
         }
-        std::unique_ptr<Timezone> zone(utc);
-        internal->tzone = std::move(zone);
+        internal->tzone = utc;
     }
 
     /* REQ: Runner.Validate.timezone */
@@ -346,12 +342,18 @@ bool Horizon::Script::validate() const {
     }
 
     for(auto &acct : internal->accounts) {
-        UserDetail *detail = acct.second.get();
-        failures += validate_one_account(acct.first, detail);
+        UserDetail *detail = &acct.second;
+        failures += validate_one_account(std::string(acct.first), detail);
     }
 
     if(internal->boot && !internal->boot->validate()) failures++;
 
+    /* Block devices are checked against a single snapshot of the system,
+     * rather than each key probing the devices it names. */
+    std::unique_ptr<BlockInventory> inventory;
+    if(opts.test(InstallEnvironment)) inventory = BlockInventory::scan();
+    BlockInventory::Scope inventory_scope(inventory.get());
+
 #define VALIDATE_OR_SKIP(obj) \
     if(!obj->validate()) {\
         failures++;\
@@ -419,7 +421,7 @@ bool Horizon::Script::validate() const {
         /* REQ: Runner.Validate.lvm_pv.Block */
         if(opts.test(InstallEnvironment)) {
 #ifdef HAS_INSTALL_ENV
-            if(!fs::exists(pv->value(), ec) &&
+            if(!BlockInventory::exists(pv->value()) &&
                seen_parts.find(pv->value()) == seen_parts.end()) {
                 failures++;
                 output_error(pv->where(), "lvm_pv: device " + pv->value() +
@@ -489,7 +491,8 @@ bool Horizon::Script::validate() const {
             /* Let's make sure it still exists, if we are running in the IE */
             if(opts.test(InstallEnvironment)) {
 #ifdef HAS_INSTALL_ENV
-                if(!fs::exists("/dev/" + lv->vg())) {
+                if((!inventory || !inventory->has_vg(lv->vg())) &&
+                   !fs::exists("/dev/" + lv->vg(), ec)) {
                     failures++;
                     output_error(lv->where(), "lvm_lv: volume group " +
                                  lv->vg() + " does not exist");
@@ -500,7 +503,7 @@ bool Horizon::Script::validate() const {
     }
 
 #define CHECK_EXIST_PART_LV(device, key, where) \
-    if(!fs::exists(device, ec) &&\
+    if(!BlockInventory::exists(device) &&\
        seen_parts.find(device) == seen_parts.end() &&\
        seen_lvs.find(device.substr(5)) == seen_lvs.end()) {\
         failures++;\
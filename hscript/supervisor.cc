@@ -0,0 +1,467 @@
+/*
+ * supervisor.cc - Implementation of the child process supervisor
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>          /* strerror */
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* O_CLOEXEC, O_NONBLOCK */
+#   include <signal.h>         /* kill, SIG* */
+#   include <spawn.h>          /* posix_spawnp */
+#   include <sys/epoll.h>      /* epoll_* */
+#   include <sys/eventfd.h>    /* eventfd */
+#   include <sys/syscall.h>    /* SYS_pidfd_open */
+#   include <sys/wait.h>       /* wait4, W* */
+#   include <unistd.h>         /* close, pipe2, read, syscall */
+#endif /* HAS_INSTALL_ENV */
+#include "supervisor.hh"
+#include "util/output.hh"
+
+extern "C" char **environ;
+
+using namespace Horizon;
+
+/*! How long a child has to exit after SIGTERM before it is sent SIGKILL. */
+#define SUPERVISOR_KILL_GRACE std::chrono::seconds(10)
+/*! How often children are checked when the kernel has no pidfds. */
+#define SUPERVISOR_POLL_MS 100
+/*! The longest line that is held before it is logged anyway. */
+#define SUPERVISOR_MAX_LINE 65536
+
+/* Each file descriptor watched by epoll is identified by the handle of its
+ * child, shifted left, and which of the child's descriptors it is.  The
+ * eventfd is 0, which no child can be. */
+enum WatchKind {
+    WatchExit = 1,
+    WatchOut = 2,
+    WatchErr = 3
+};
+
+ProcessSupervisor::ProcessSupervisor() {}
+
+ProcessSupervisor::~ProcessSupervisor() {
+#ifdef HAS_INSTALL_ENV
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    if(_thread.joinable()) {
+        wake();
+        _thread.join();
+    }
+
+    /* Nothing is left to wait for the children, so they must not outlive
+     * the supervisor. */
+    for(auto &entry : _children) {
+        Child &child = entry.second;
+        if(!child.exited) {
+            kill(child.pid, SIGKILL);
+            while(waitpid(child.pid, nullptr, 0) == -1 && errno == EINTR);
+        }
+        for(int fd : {child.pidfd, child.out, child.err}) {
+            if(fd != -1) close(fd);
+        }
+    }
+    if(_epoll != -1) close(_epoll);
+    if(_wake != -1) close(_wake);
+#endif /* HAS_INSTALL_ENV */
+}
+
+ProcessSupervisor &ProcessSupervisor::instance() {
+    static ProcessSupervisor supervisor;
+    return supervisor;
+}
+
+bool ProcessSupervisor::start_locked() {
+#ifdef HAS_INSTALL_ENV
+    if(_thread.joinable()) return true;
+
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    _wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;
+    if(_epoll == -1 || _wake == -1 ||
+       epoll_ctl(_epoll, EPOLL_CTL_ADD, _wake, &event) != 0) {
+        output_error("supervisor", "cannot watch child processes",
+                     strerror(errno));
+        if(_epoll != -1) close(_epoll);
+        if(_wake != -1) close(_wake);
+        _epoll = _wake = -1;
+        return false;
+    }
+
+    _thread = std::thread(&ProcessSupervisor::run, this);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+void ProcessSupervisor::wake() {
+#ifdef HAS_INSTALL_ENV
+    const uint64_t one = 1;
+    if(::write(_wake, &one, sizeof one) < 0) {
+        /* The counter is already set; the thread will wake anyway. */
+    }
+#endif /* HAS_INSTALL_ENV */
+}
+
+ProcessSupervisor::Handle ProcessSupervisor::spawn(
+        const std::string &cmd, const std::vector<std::string> &args,
+        Deadline deadline, const std::string &where) {
+#ifdef HAS_INSTALL_ENV
+    std::vector<char *> argv{const_cast<char *>(cmd.c_str())};
+    for(const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    bool watched;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        watched = start_locked();
+    }
+
+    /* If the children cannot be watched, they write to our own output. */
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    if(watched && pipe2(out, O_CLOEXEC | O_NONBLOCK) != 0) {
+        output_error(cmd, "cannot fork", strerror(errno));
+        return 0;
+    }
+    if(watched && pipe2(err, O_CLOEXEC | O_NONBLOCK) != 0) {
+        output_error(cmd, "cannot fork", strerror(errno));
+        close(out[0]);
+        close(out[1]);
+        return 0;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if(watched) {
+        /* Only the end the supervisor reads from is non-blocking. */
+        fcntl(out[1], F_SETFL, 0);
+        fcntl(err[1], F_SETFL, 0);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+    }
+
+    pid_t pid;
+    const int ret = posix_spawnp(&pid, cmd.c_str(), &actions, nullptr,
+                                 argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if(watched) {
+        close(out[1]);
+        close(err[1]);
+    }
+    if(ret != 0) {
+        /* extremely unlikely failure case */
+        output_error(cmd, "cannot fork", strerror(ret));
+        if(watched) {
+            close(out[0]);
+            close(err[0]);
+        }
+        return 0;
+    }
+
+    Child child;
+    child.pid = pid;
+#ifdef SYS_pidfd_open
+    if(watched) {
+        child.pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    }
+#endif
+    child.out = out[0];
+    child.err = err[0];
+    child.cmd = cmd;
+    child.where = !where.empty() ? where :
+                  !output_location.empty() ? output_location : cmd;
+    child.sink = &output_sink();
+    child.deadline = deadline;
+    child.signal_at = (deadline > Deadline::zero()) ?
+                Clock::now() + deadline : Clock::time_point::max();
+
+    std::lock_guard<std::mutex> guard(_lock);
+    const Handle handle = _next++;
+    if(watched) {
+        const std::pair<int, int> watches[] = {
+            {child.pidfd, WatchExit}, {child.out, WatchOut},
+            {child.err, WatchErr}
+        };
+        for(const auto &watch : watches) {
+            if(watch.first == -1) continue;
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.u64 = (handle << 2) | watch.second;
+            epoll_ctl(_epoll, EPOLL_CTL_ADD, watch.first, &event);
+        }
+    }
+    _children.emplace(handle, std::move(child));
+    wake();
+    return handle;
+#else /* !HAS_INSTALL_ENV */
+    output_error(cmd, "can't spawn processes in runtine environment");
+    return 0;
+#endif /* HAS_INSTALL_ENV */
+}
+
+int ProcessSupervisor::wait(Handle handle, struct rusage *usage) {
+#ifdef HAS_INSTALL_ENV
+    std::unique_lock<std::mutex> guard(_lock);
+    auto it = _children.find(handle);
+    if(it == _children.end() || it->second.waited) return -1;
+
+    /* Without a watching thread, the child is collected here instead. */
+    while(!it->second.exited) {
+        if(_thread.joinable()) {
+            _exited.wait(guard);
+            continue;
+        }
+        const pid_t pid = it->second.pid;
+        int status = 0;
+        struct rusage used = {};
+        guard.unlock();
+        const pid_t ret = wait4(pid, &status, 0, &used);
+        const int saved_errno = errno;
+        guard.lock();
+        if(ret != -1 || saved_errno != EINTR) {
+            it->second.exited = true;
+            it->second.status = status;
+            it->second.usage = used;
+        }
+    }
+
+    Child child;
+    child.cmd = it->second.cmd;
+    child.deadline = it->second.deadline;
+    child.timed_out = it->second.timed_out;
+    child.cancelled = it->second.cancelled;
+    child.status = it->second.status;
+    child.usage = it->second.usage;
+    /* A process the child started may still be writing to its pipes.  What
+     * it writes is read, so that it never blocks, but not logged: the sink
+     * belongs to the caller, which may destroy it once this returns. */
+    it->second.waited = true;
+    it->second.sink = nullptr;
+    if(it->second.out == -1 && it->second.err == -1) _children.erase(it);
+    guard.unlock();
+
+    if(usage != nullptr) *usage = child.usage;
+    if(child.timed_out) {
+        output_error(child.cmd, "did not finish within " +
+                     std::to_string(child.deadline.count() / 1000) +
+                     " seconds, and was stopped");
+        return -1;
+    }
+    if(child.cancelled) {
+        output_error(child.cmd, "was cancelled");
+        return -1;
+    }
+    if(!WIFEXITED(child.status)) {
+        output_error(child.cmd, "received fatal signal " +
+                     std::to_string(WTERMSIG(child.status)));
+        return -1;
+    }
+    if(WEXITSTATUS(child.status) != 0) {
+        output_error(child.cmd, "exited abnormally with status " +
+                     std::to_string(WEXITSTATUS(child.status)));
+    }
+    return WEXITSTATUS(child.status);
+#else /* !HAS_INSTALL_ENV */
+    return -1;
+#endif /* HAS_INSTALL_ENV */
+}
+
+void ProcessSupervisor::cancel(Handle handle) {
+    std::lock_guard<std::mutex> guard(_lock);
+    auto it = _children.find(handle);
+    if(it == _children.end() || it->second.exited) return;
+    it->second.cancelled = true;
+    terminate(it->second);
+    wake();
+}
+
+void ProcessSupervisor::cancel_all() {
+    std::lock_guard<std::mutex> guard(_lock);
+    for(auto &entry : _children) {
+        if(entry.second.exited || entry.second.signals > 0) continue;
+        entry.second.cancelled = true;
+        terminate(entry.second);
+    }
+    wake();
+}
+
+void ProcessSupervisor::terminate(Child &child) {
+#ifdef HAS_INSTALL_ENV
+    if(child.signals == 0) {
+        kill(child.pid, SIGTERM);
+        child.signal_at = Clock::now() + SUPERVISOR_KILL_GRACE;
+    } else {
+        kill(child.pid, SIGKILL);
+        child.signal_at = Clock::time_point::max();
+    }
+    child.signals++;
+#endif /* HAS_INSTALL_ENV */
+}
+
+/*! Log +line+, written by a child to standard output or +err+, unless the
+ * child has been waited for and so has no +sink+. */
+static void log_line(OutputSink *sink, const std::string &where,
+                     std::string line, bool err) {
+    if(sink == nullptr) return;
+    if(!line.empty() && line.back() == '\r') line.pop_back();
+    OutputScope scope(*sink);
+    output_log(err ? "stderr" : "stdout", "0", where, line);
+}
+
+void ProcessSupervisor::read_output(Child &child, int &fd, bool err) {
+#ifdef HAS_INSTALL_ENV
+    std::string &pending = err ? child.err_line : child.out_line;
+    char buf[4096];
+    bool eof = false;
+
+    while(true) {
+        const ssize_t len = read(fd, buf, sizeof buf);
+        if(len == 0) {
+            eof = true;
+            break;
+        }
+        if(len < 0) {
+            if(errno == EINTR) continue;
+            eof = (errno != EAGAIN);
+            break;
+        }
+        pending.append(buf, static_cast<std::size_t>(len));
+
+        std::string::size_type start = 0, end;
+        while((end = pending.find('\n', start)) != std::string::npos) {
+            log_line(child.sink, child.where,
+                     pending.substr(start, end - start), err);
+            start = end + 1;
+        }
+        pending.erase(0, start);
+        if(pending.size() >= SUPERVISOR_MAX_LINE) {
+            log_line(child.sink, child.where, pending, err);
+            pending.clear();
+        }
+    }
+
+    if(eof) {
+        if(!pending.empty()) log_line(child.sink, child.where, pending, err);
+        pending.clear();
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        fd = -1;
+    }
+#endif /* HAS_INSTALL_ENV */
+}
+
+void ProcessSupervisor::reap(Child &child) {
+#ifdef HAS_INSTALL_ENV
+    const pid_t ret = wait4(child.pid, &child.status, WNOHANG, &child.usage);
+    if(ret == 0 || (ret == -1 && errno == EINTR)) return;
+
+    /* Whatever the child wrote before exiting is logged now.  A daemon it
+     * started may keep its pipes open; they are watched until it closes
+     * them, rather than closed under it. */
+    for(int *fd : {&child.out, &child.err}) {
+        if(*fd == -1) continue;
+        const bool err = (fd == &child.err);
+        read_output(child, *fd, err);
+        std::string &pending = err ? child.err_line : child.out_line;
+        if(!pending.empty()) {
+            log_line(child.sink, child.where, pending, err);
+            pending.clear();
+        }
+    }
+    if(child.pidfd != -1) {
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, child.pidfd, nullptr);
+        close(child.pidfd);
+        child.pidfd = -1;
+    }
+    child.exited = true;
+    _exited.notify_all();
+#endif /* HAS_INSTALL_ENV */
+}
+
+void ProcessSupervisor::run() {
+#ifdef HAS_INSTALL_ENV
+    struct epoll_event events[16];
+    std::unique_lock<std::mutex> guard(_lock);
+
+    while(!_stop) {
+        /* Sleep until the next child must be signalled, or until the next
+         * check for children that have no pidfd. */
+        int timeout = -1;
+        const Clock::time_point now = Clock::now();
+        for(const auto &entry : _children) {
+            const Child &child = entry.second;
+            if(child.exited) continue;
+            if(child.pidfd == -1) {
+                timeout = (timeout == -1) ? SUPERVISOR_POLL_MS :
+                          std::min(timeout, SUPERVISOR_POLL_MS);
+            }
+            if(child.signal_at != Clock::time_point::max()) {
+                using namespace std::chrono;
+                const auto left = duration_cast<milliseconds>(
+                            child.signal_at - now).count() + 1;
+                const int delay = static_cast<int>(std::max<long long>(
+                            0, std::min<long long>(left, 60000)));
+                timeout = (timeout == -1) ? delay : std::min(timeout, delay);
+            }
+        }
+
+        guard.unlock();
+        const int count = epoll_wait(_epoll, events, 16, timeout);
+        guard.lock();
+
+        for(int index = 0; index < count; index++) {
+            const uint64_t data = events[index].data.u64;
+            if(data == 0) {
+                uint64_t value;
+                if(read(_wake, &value, sizeof value) < 0) {
+                    /* Already drained. */
+                }
+                continue;
+            }
+            auto it = _children.find(data >> 2);
+            if(it == _children.end()) continue;
+            Child &child = it->second;
+            switch(data & 3) {
+            case WatchExit:
+                reap(child);
+                break;
+            case WatchOut:
+                if(child.out != -1) read_output(child, child.out, false);
+                break;
+            case WatchErr:
+                if(child.err != -1) read_output(child, child.err, true);
+                break;
+            }
+        }
+
+        const Clock::time_point after = Clock::now();
+        for(auto it = _children.begin(); it != _children.end();) {
+            Child &child = it->second;
+            if(child.waited && child.out == -1 && child.err == -1) {
+                it = _children.erase(it);
+                continue;
+            }
+            ++it;
+            if(child.exited) continue;
+            if(child.pidfd == -1) reap(child);
+            if(child.exited || after < child.signal_at) continue;
+            if(child.signals == 0 && !child.cancelled) child.timed_out = true;
+            terminate(child);
+        }
+    }
+#endif /* HAS_INSTALL_ENV */
+}
@@ -0,0 +1,153 @@
+/*
+ * supervisor.hh - Definition of the child process supervisor
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_SUPERVISOR_HH_
+#define HSCRIPT_SUPERVISOR_HH_
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+class OutputSink;
+
+namespace Horizon {
+
+/*! Runs child processes, and logs what they write.
+ *
+ * Each child writes its standard output and error to pipes, which one
+ * thread watches for every child at once.  Each line a child writes is
+ * logged, as a "stdout" or "stderr" message from the location of the Key
+ * that started it, to the sink of the thread that started it.  The same
+ * thread notices when a child exits, even if a daemon it started still
+ * holds its pipes open, and ends children that pass their deadline.  What
+ * such a daemon writes once the child has been waited for is discarded.
+ */
+class ProcessSupervisor {
+public:
+    /*! Identifies a child process; 0 is never a valid handle. */
+    typedef unsigned long Handle;
+    /*! A deadline of zero means that a child may run for as long as it
+     * needs. */
+    typedef std::chrono::milliseconds Deadline;
+
+    ProcessSupervisor();
+    /*! End any children still running, and wait for them to exit. */
+    ~ProcessSupervisor();
+    ProcessSupervisor(const ProcessSupervisor &) = delete;
+    ProcessSupervisor &operator=(const ProcessSupervisor &) = delete;
+
+    /*! Retrieve the supervisor shared by the whole program. */
+    static ProcessSupervisor &instance();
+
+    /*! Start a child process.
+     * @param cmd       The command to run, searched for in PATH.
+     * @param args      The arguments to pass to the command.
+     * @param deadline  How long the child may run before it is ended.
+     * @param where     The location to log output from; by default, the Key
+     *                  the calling thread is executing, or the command.
+     * @returns The handle of the child, or 0 if it could not be started.
+     */
+    Handle spawn(const std::string &cmd, const std::vector<std::string> &args,
+                 Deadline deadline = Deadline::zero(),
+                 const std::string &where = "");
+
+    /*! Wait for a child to exit, and log how it ended like run_command.
+     * @param child     The handle of the child.
+     * @param usage     If not nullptr, receives the resources the child used.
+     * @returns The exit status of the child, or -1 if it was signalled, ended
+     * by its deadline, or cancelled.
+     */
+    int wait(Handle child, struct rusage *usage = nullptr);
+
+    /*! End a child: it is sent SIGTERM, and SIGKILL if it has not exited a
+     * few seconds later.  wait() must still be called for the child. */
+    void cancel(Handle child);
+    /*! End every child that is running. */
+    void cancel_all();
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /*! A child that has not been waited for, or whose pipes are still held
+     * open by a process it started. */
+    struct Child {
+        /*! The process ID of the child. */
+        int pid = -1;
+        /*! A pidfd for the child, or -1 if the kernel has none. */
+        int pidfd = -1;
+        /*! The pipes carrying the standard output and error of the child,
+         * or -1 once they are closed. */
+        int out = -1, err = -1;
+        /*! The command the child is running. */
+        std::string cmd;
+        /*! The location its output is logged from. */
+        std::string where;
+        /*! The sink its output is logged to, or nullptr once the child has
+         * been waited for. */
+        OutputSink *sink = nullptr;
+        /*! Output that does not yet end with a newline. */
+        std::string out_line, err_line;
+        /*! How long the child may run, or zero. */
+        Deadline deadline{0};
+        /*! When the child must be signalled next, if +deadline+ is set or
+         * it is being ended. */
+        Clock::time_point signal_at;
+        /*! The number of signals sent to end the child. */
+        int signals = 0;
+        /*! Whether the child passed its deadline, or was cancelled. */
+        bool timed_out = false, cancelled = false;
+        /*! Whether the child has exited, and how. */
+        bool exited = false;
+        /*! Whether wait() has returned for the child. */
+        bool waited = false;
+        int status = 0;
+        struct rusage usage = {};
+    };
+
+    /*! Start the thread that watches the children. */
+    bool start_locked();
+    /*! Watch the children until the supervisor is destroyed. */
+    void run();
+    /*! Wake the watching thread, to notice a change to the children. */
+    void wake();
+    /*! Read what +child+ has written to +fd+, logging each full line. */
+    void read_output(Child &child, int &fd, bool err);
+    /*! Collect +child+ if it has exited. */
+    void reap(Child &child);
+    /*! Send +child+ the next signal to end it. */
+    void terminate(Child &child);
+
+    /*! Protects every member below. */
+    std::mutex _lock;
+    /*! Signalled whenever a child exits. */
+    std::condition_variable _exited;
+    /*! The children being watched, by handle. */
+    std::map<Handle, Child> _children;
+    /*! The next handle to assign. */
+    Handle _next = 1;
+    /*! The epoll instance watching the children. */
+    int _epoll = -1;
+    /*! The eventfd used to wake the watching thread. */
+    int _wake = -1;
+    /*! Set to stop the watching thread. */
+    bool _stop = false;
+    /*! The thread watching the children. */
+    std::thread _thread;
+};
+
+}
+
+#endif /* !HSCRIPT_SUPERVISOR_HH_ */
@@ -0,0 +1,189 @@
+/*
+ * targetfiles.cc - Implementation of the transactional target file writer
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstring>          /* strerror */
+#include <fstream>
+#include <utility>
+#include <vector>
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* open */
+#   include <sys/stat.h>       /* stat, fchmod */
+#   include <unistd.h>         /* close, fchown, syncfs, unlink, write */
+#endif /* HAS_INSTALL_ENV */
+#include "targetfiles.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+#include "util/profile.hh"
+
+using namespace Horizon;
+
+TargetFiles::TargetFiles(const std::string &root) : _root(root) {}
+
+TargetFiles::File &TargetFiles::get(const std::string &path, bool load) {
+    auto it = _files.find(path);
+    if(it != _files.end()) {
+        if(it->second.removed) {
+            /* The file was renamed away; it starts over empty. */
+            it->second.removed = false;
+            it->second.mode = 0;
+        }
+        return it->second;
+    }
+
+    File &file = _files[path];
+    const bool discarded = (_discarded.erase(path) != 0);
+    if(load && !discarded) {
+        std::ifstream existing(_root + path);
+        if(existing && existing.peek() != std::ifstream::traits_type::eof()) {
+            file.data << existing.rdbuf();
+        }
+    }
+    return file;
+}
+
+std::ostream &TargetFiles::replace(const std::string &path,
+                                   unsigned int mode) {
+    File &file = get(path, false);
+    file.data.str("");
+    file.data.clear();
+    file.mode = mode;
+    return file.data;
+}
+
+std::ostream &TargetFiles::append(const std::string &path) {
+    return get(path, true).data;
+}
+
+void TargetFiles::discard(const std::string &path) {
+    if(_files.find(path) == _files.end()) _discarded.insert(path);
+}
+
+void TargetFiles::rename(const std::string &from, const std::string &to) {
+    const auto it = _files.find(from);
+    if(it == _files.end() || it->second.removed) {
+        error_code ec;
+        if(!fs::exists(_root + from, ec)) return;
+    }
+
+    File &source = get(from, true);
+    std::string data = source.data.str();
+    unsigned int mode = source.mode;
+#ifdef HAS_INSTALL_ENV
+    struct stat st;
+    if(mode == 0 && stat((_root + from).c_str(), &st) == 0) {
+        mode = st.st_mode & 07777;
+    }
+#endif /* HAS_INSTALL_ENV */
+
+    std::ostream &dest = replace(to, mode);
+    dest << data;
+
+    File &old = _files[from];
+    old.data.str("");
+    old.removed = true;
+}
+
+bool TargetFiles::commit() {
+#ifdef HAS_INSTALL_ENV
+    ProfileSpan span("target", "commit");
+    std::vector<std::string> written;
+    bool ok = true;
+
+    for(auto &entry : _files) {
+        if(entry.second.removed) continue;
+        const std::string path(_root + entry.first);
+        const std::string temp(path + "+");
+        const std::string data = entry.second.data.str();
+        error_code ec;
+
+        fs::create_directories(fs::path(path).parent_path(), ec);
+
+        /* Keep the owner and permissions of the file being replaced. */
+        struct stat st;
+        const bool exists = (stat(path.c_str(), &st) == 0);
+        unsigned int mode = entry.second.mode;
+        if(mode == 0) mode = exists ? (st.st_mode & 07777) : 0644;
+
+        const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC |
+                            O_NOFOLLOW | O_CLOEXEC, 0600);
+        ok = (fd != -1 && fchmod(fd, mode) == 0 &&
+              (!exists || fchown(fd, st.st_uid, st.st_gid) == 0));
+        for(std::size_t done = 0; ok && done < data.size();) {
+            const ssize_t ret = ::write(fd, data.data() + done,
+                                        data.size() - done);
+            if(ret < 0) {
+                if(errno != EINTR) ok = false;
+            } else {
+                done += static_cast<std::size_t>(ret);
+            }
+        }
+        const int saved_errno = errno;
+        if(ok) span.add_bytes_written(data.size());
+        if(fd != -1 && close(fd) != 0) ok = false;
+        if(fd != -1) written.push_back(entry.first);
+        if(!ok) {
+            output_error("target", "cannot write " + entry.first,
+                         strerror(saved_errno));
+            break;
+        }
+    }
+
+    /* Every new file must be on disk before any of them replaces an old
+     * one; a single syncfs does that for all of them. */
+    if(ok) ok = sync();
+
+    for(const auto &path : written) {
+        const std::string full(_root + path);
+        if(!ok) {
+            unlink((full + "+").c_str());
+        } else if(::rename((full + "+").c_str(), full.c_str()) != 0) {
+            output_error("target", "cannot replace " + path,
+                         strerror(errno));
+            ok = false;
+        }
+    }
+
+    for(const auto &entry : _files) {
+        if(ok && entry.second.removed) {
+            unlink((_root + entry.first).c_str());
+        }
+        if(ok) _committed.insert(entry.first);
+    }
+
+    _files.clear();
+    return ok;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+std::set<std::string> TargetFiles::paths() const {
+    std::set<std::string> paths(_committed);
+    for(const auto &entry : _files) paths.insert(entry.first);
+    return paths;
+}
+
+bool TargetFiles::sync() {
+#ifdef HAS_INSTALL_ENV
+    const int fd = open(_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1 || syncfs(fd) != 0) {
+        output_error("target", "cannot flush target file system",
+                     strerror(errno));
+        if(fd != -1) close(fd);
+        return false;
+    }
+    close(fd);
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
@@ -0,0 +1,99 @@
+/*
+ * targetfiles.hh - Definition of the transactional target file writer
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_TARGETFILES_HH_
+#define HSCRIPT_TARGETFILES_HH_
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace Horizon {
+
+/*! Collects the files written to a target during execution.
+ *
+ * Keys write configuration files through replace() and append(), which
+ * only change the contents held in memory.  commit() then writes each
+ * changed file beside the original and renames it into place, so that an
+ * interrupted installation leaves either the old or the new contents of a
+ * file, never part of it.  The data of every file is flushed with one
+ * syncfs(2) of the target before any file is renamed.
+ *
+ * A TargetFiles is not thread-safe; it is only used by Keys executing on
+ * the thread running the script.
+ */
+class TargetFiles {
+public:
+    /*! Create a writer for the system rooted at +root+. */
+    explicit TargetFiles(const std::string &root);
+
+    /*! Retrieve a stream to which the new contents of +path+ are written.
+     * @param path      The path of the file, relative to the root.
+     * @param mode      The permissions of the file, or 0 to keep those of
+     *                  the existing file (0644 for a new file).
+     */
+    std::ostream &replace(const std::string &path, unsigned int mode = 0);
+
+    /*! Retrieve a stream to which lines for the end of +path+ are written.
+     * The existing file is read the first time it is appended to.
+     */
+    std::ostream &append(const std::string &path);
+
+    /*! Ignore what +path+ holds on the target, so that the first append()
+     * to it starts an empty file.  A resumed execution uses this to write
+     * the files it appends to again, instead of appending to them twice.
+     */
+    void discard(const std::string &path);
+
+    /*! Rename +from+ to +to+, including any pending changes to +from+. */
+    void rename(const std::string &from, const std::string &to);
+
+    /*! Write every changed file to the target.
+     * @returns true if every file was written, false otherwise.
+     */
+    bool commit();
+
+    /*! Wait for every committed file to reach the disk of the target. */
+    bool sync();
+
+    /*! Retrieve the path of every file changed so far, whether or not the
+     * change has been committed. */
+    std::set<std::string> paths() const;
+private:
+    /*! A file with pending changes. */
+    struct File {
+        /*! The new contents of the file. */
+        std::ostringstream data;
+        /*! The permissions of the file, or 0 to keep the existing ones. */
+        unsigned int mode = 0;
+        /*! Whether the file is to be removed instead. */
+        bool removed = false;
+    };
+
+    /*! Retrieve the pending file for +path+, reading its existing contents
+     * if +load+ is set and it has none yet. */
+    File &get(const std::string &path, bool load);
+
+    /*! The root directory of the target. */
+    const std::string _root;
+    /*! The files with pending changes, by path. */
+    std::map<std::string, File> _files;
+    /*! The files whose contents on the target are ignored. */
+    std::set<std::string> _discarded;
+    /*! The files changed by earlier commits. */
+    std::set<std::string> _committed;
+};
+
+}
+
+#endif /* !HSCRIPT_TARGETFILES_HH_ */
@@ -10,13 +10,12 @@
  * SPDX-License-Identifier: AGPL-3.0-only
  */
 
-#include <assert.h>
-#include <cstring>
-#include <fstream>
 #include <set>
 #include <sstream>
 #include <time.h>
 #include "user.hh"
+#include "userdb.hh"
+#include "script_c.hh"
 #include "util.hh"
 #include "util/filesystem.hh"
 #include "util/net.hh"
@@ -24,7 +23,7 @@
 
 using namespace Horizon::Keys;
 
-const static std::set<std::string> system_names = {
+const static std::set<std::string, std::less<>> system_names = {
     "root", "bin", "daemon", "adm", "lp", "sync", "shutdown", "halt", "mail",
     "news", "uucp", "operator", "man", "postmaster", "cron", "ftp", "sshd",
     "at", "squid", "xfs", "games", "postgres", "cyrus", "vpopmail", "utmp",
@@ -32,7 +31,7 @@ const static std::set<std::string> system_names = {
     "qmaill", "ntp", "smmsp", "guest", "nobody"
 };
 
-const static std::set<std::string> system_groups = {
+const static std::set<std::string, std::less<>> system_groups = {
     "root", "bin", "daemon", "sys", "adm", "tty", "disk", "lp", "mem", "kmem",
     "wheel", "floppy", "mail", "news", "uucp", "man", "cron", "console",
     "audio", "cdrom", "dialout", "ftp", "sshd", "input", "at", "tape", "video",
@@ -109,7 +108,7 @@ static bool is_valid_name (const char *name)
  * @param pos       The location where the key occurs.
  * @returns true if +pw+ is a valid crypt passphrase; false otherwise.
  */
-static bool string_is_crypt(const std::string &pw, const std::string &key,
+static bool string_is_crypt(std::string_view pw, const std::string &key,
                             const Horizon::ScriptLocation &pos) {
     if(pw.size() < 5 || pw[0] != '$' || (pw[1] != '2' && pw[1] != '6')
             || pw[2] != '$') {
@@ -121,14 +120,19 @@ static bool string_is_crypt(const std::string &pw, const std::string &key,
 }
 
 
-Key *RootPassphrase::parseFromData(const std::string &data,
+Key *RootPassphrase::parseFromData(std::string_view data,
                                    const ScriptLocation &pos,
                                    int *errors, int *, const Script *script) {
     if(!string_is_crypt(data, "rootpw", pos)) {
         if(errors) *errors += 1;
         return nullptr;
     }
-    return new RootPassphrase(script, pos, data);
+    return new(script) RootPassphrase(script, pos, data);
+}
+
+Key *RootPassphrase::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                                  const Script *script) {
+    return new(script) RootPassphrase(script, pos, in.get_string());
 }
 
 bool RootPassphrase::validate() const {
@@ -136,7 +140,7 @@ bool RootPassphrase::validate() const {
 }
 
 bool RootPassphrase::execute() const {
-    const std::string root_line = "root:" + this->_value + ":" +
+    const std::string root_line = "root:" + value() + ":" +
             std::to_string(time(nullptr) / 86400) + ":0:::::";
 
     output_info(pos, "rootpw: setting root passphrase");
@@ -156,35 +160,11 @@ bool RootPassphrase::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    /* This was tested on gwyn during development. */
-    std::ifstream old_shadow(script->targetDirectory() + "/etc/shadow");
-    if(!old_shadow) {
-        output_error(pos, "rootpw: cannot open existing shadow file");
-        return false;
-    }
-
-    std::stringstream shadow_stream;
-    char shadow_line[200];
-    /* Discard root. */
-    old_shadow.getline(shadow_line, sizeof(shadow_line));
-    assert(strncmp(shadow_line, "root", 4) == 0);
-
-    /* Insert the new root line... */
-    shadow_stream << root_line << std::endl;
-    /* ...and copy the rest of the old shadow file. */
-    while(old_shadow.getline(shadow_line, sizeof(shadow_line))) {
-        shadow_stream << shadow_line << std::endl;
-    }
-
-    old_shadow.close();
-
-    std::ofstream new_shadow(script->targetDirectory() + "/etc/shadow",
-                             std::ios_base::trunc);
-    if(!new_shadow) {
-        output_error(pos, "rootpw: cannot replace target shadow file");
+    UserDatabase *db = users(script);
+    if(db == nullptr || !db->set_passphrase("root", value())) {
+        output_error(pos, "rootpw: cannot set root passphrase");
         return false;
     }
-    new_shadow << shadow_stream.str();
     return true;
 #else
     return false;  /* LCOV_EXCL_LINE */
@@ -192,26 +172,32 @@ bool RootPassphrase::execute() const {
 }
 
 
-Key *Username::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *Username::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
-    if(!is_valid_name(data.c_str())) {
+    const std::string name(data);
+    if(!is_valid_name(name.c_str())) {
         if(errors) *errors += 1;
         output_error(pos, "username: invalid username specified");
         return nullptr;
     }
 
     /* REQ: Runner.Validate.username.System */
-    if(system_names.find(data) != system_names.end()) {
+    if(system_names.find(name) != system_names.end()) {
         if(errors) *errors += 1;
-        output_error(pos, "username: reserved system username", data);
+        output_error(pos, "username: reserved system username", name);
         return nullptr;
     }
 
-    return new Username(script, pos, data);
+    return new(script) Username(script, pos, name);
+}
+
+Key *Username::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    return new(script) Username(script, pos, in.get_string());
 }
 
 bool Username::execute() const {
-    output_info(pos, "username: creating account " + _value);
+    output_info(pos, "username: creating account " + value());
 
     if(script->options().test(Simulate)) {
         std::cout << "useradd -c \"Adélie User\" -m -R "
@@ -221,11 +207,9 @@ bool Username::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    if(run_command("chroot", {script->targetDirectory(), "useradd",
-                              "-c", "Adélie User", "-m",
-                              "-U", _value}) != 0)
-    {
-        output_error(pos, "username: failed to create user account", _value);
+    UserDatabase *db = users(script);
+    if(db == nullptr || !db->add_user(value(), "Adélie User")) {
+        output_error(pos, "username: failed to create user account", value());
         return false;
     }
 #endif  /* HAS_INSTALL_ENV */
@@ -233,7 +217,7 @@ bool Username::execute() const {
 }
 
 
-Key *UserAlias::parseFromData(const std::string &data,
+Key *UserAlias::parseFromData(std::string_view data,
                               const ScriptLocation &pos, int *errors, int *,
                               const Script *script) {
     /* REQ: Runner.Validate.useralias.Validity */
@@ -245,8 +229,20 @@ Key *UserAlias::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new UserAlias(script, pos, data.substr(0, sep),
-                         data.substr(sep + 1));
+    return new(script) UserAlias(script, pos, data.substr(0, sep),
+                                 data.substr(sep + 1));
+}
+
+Key *UserAlias::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                             const Script *script) {
+    const std::string_view name = in.get_string();
+    const std::string_view alias = in.get_string();
+    return new(script) UserAlias(script, pos, name, alias);
+}
+
+void UserAlias::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_username);
+    out.put_string(this->_alias);
 }
 
 bool UserAlias::validate() const {
@@ -254,7 +250,7 @@ bool UserAlias::validate() const {
 }
 
 bool UserAlias::execute() const {
-    output_info(pos, "useralias: setting GECOS name for " + _username);
+    output_info(pos, "useralias: setting GECOS name for " + username());
 
     if(script->options().test(Simulate)) {
         std::cout << "usermod -c \"" << _alias << "\" "
@@ -264,9 +260,10 @@ bool UserAlias::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    if(run_command("chroot", {script->targetDirectory(), "usermod",
-                              "-c", _alias, _username}) != 0) {
-        output_error(pos, "useralias: failed to change GECOS for " + _username);
+    UserDatabase *db = users(script);
+    if(db == nullptr || !db->set_gecos(username(), alias())) {
+        output_error(pos, "useralias: failed to change GECOS for " +
+                     username());
         return false;
     }
 #endif  /* HAS_INSTALL_ENV */
@@ -274,7 +271,7 @@ bool UserAlias::execute() const {
 }
 
 
-Key *UserPassphrase::parseFromData(const std::string &data,
+Key *UserPassphrase::parseFromData(std::string_view data,
                                    const ScriptLocation &pos,
                                    int *errors, int *, const Script *script) {
     /* REQ: Runner.Validate.userpw.Validity */
@@ -286,14 +283,26 @@ Key *UserPassphrase::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    std::string passphrase = data.substr(sep + 1);
+    const std::string_view passphrase = data.substr(sep + 1);
     if(!string_is_crypt(passphrase, "userpw", pos)) {
         if(errors) *errors += 1;
         return nullptr;
     }
 
-    return new UserPassphrase(script, pos, data.substr(0, sep),
-                              data.substr(sep + 1));
+    return new(script) UserPassphrase(script, pos, data.substr(0, sep),
+                                      passphrase);
+}
+
+Key *UserPassphrase::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                                  const Script *script) {
+    const std::string_view name = in.get_string();
+    const std::string_view pw = in.get_string();
+    return new(script) UserPassphrase(script, pos, name, pw);
+}
+
+void UserPassphrase::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_username);
+    out.put_string(this->_passphrase);
 }
 
 bool UserPassphrase::validate() const {
@@ -302,7 +311,7 @@ bool UserPassphrase::validate() const {
 }
 
 bool UserPassphrase::execute() const {
-    output_info(pos, "userpw: setting passphrase for " + _username);
+    output_info(pos, "userpw: setting passphrase for " + username());
 
     if(script->options().test(Simulate)) {
         std::cout << "usermod -p '" << _passphrase << "' "
@@ -312,9 +321,9 @@ bool UserPassphrase::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    if(run_command("chroot", {script->targetDirectory(), "usermod",
-                              "-p", _passphrase, _username}) != 0) {
-        output_error(pos, "userpw: failed to set passphrase for " + _username);
+    UserDatabase *db = users(script);
+    if(db == nullptr || !db->set_passphrase(username(), passphrase())) {
+        output_error(pos, "userpw: failed to set passphrase for " + username());
         return false;
     }
 #endif  /* HAS_INSTALL_ENV */
@@ -322,7 +331,7 @@ bool UserPassphrase::execute() const {
 }
 
 
-Key *UserIcon::parseFromData(const std::string &data, const ScriptLocation &pos,
+Key *UserIcon::parseFromData(std::string_view data, const ScriptLocation &pos,
                              int *errors, int *, const Script *script) {
     /* REQ: Runner.Validate.usericon.Validity */
     const std::string::size_type sep = data.find_first_of(' ');
@@ -333,14 +342,26 @@ Key *UserIcon::parseFromData(const std::string &data, const ScriptLocation &pos,
         return nullptr;
     }
 
-    std::string icon_path = data.substr(sep + 1);
+    const std::string icon_path(data.substr(sep + 1));
     if(icon_path[0] != '/' && !is_valid_url(icon_path)) {
         if(errors) *errors += 1;
         output_error(pos, "usericon: path must be absolute path or valid URL");
         return nullptr;
     }
 
-    return new UserIcon(script, pos, data.substr(0, sep), icon_path);
+    return new(script) UserIcon(script, pos, data.substr(0, sep), icon_path);
+}
+
+Key *UserIcon::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                            const Script *script) {
+    const std::string_view name = in.get_string();
+    const std::string_view icon = in.get_string();
+    return new(script) UserIcon(script, pos, name, icon);
+}
+
+void UserIcon::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_username);
+    out.put_string(this->_icon_path);
 }
 
 bool UserIcon::validate() const {
@@ -350,11 +371,11 @@ bool UserIcon::validate() const {
 
 bool UserIcon::execute() const {
     const std::string as_path(script->targetDirectory() +
-                              "/var/lib/AccountsService/icons/" + _username);
+                              "/var/lib/AccountsService/icons/" + username());
     const std::string face_path(script->targetDirectory() + "/home/" +
-                                _username + "/.face");
+                                username() + "/.face");
 
-    output_info(pos, "usericon: setting avatar for " + _username);
+    output_info(pos, "usericon: setting avatar for " + username());
 
     if(script->options().test(Simulate)) {
         if(_icon_path[0] == '/') {
@@ -381,7 +402,7 @@ bool UserIcon::execute() const {
             return false;
         }
     } else {
-        if(!download_file(_icon_path, as_path)) {
+        if(!download_file(icon(), as_path)) {
             output_error(pos, "usericon: failed to download icon");
             return false;
         }
@@ -402,7 +423,7 @@ bool UserIcon::execute() const {
 }
 
 
-Key *UserGroups::parseFromData(const std::string &data,
+Key *UserGroups::parseFromData(std::string_view data,
                                const ScriptLocation &pos,
                                int *errors, int *, const Script *script) {
     /* REQ: Runner.Validate.usergroups.Validity */
@@ -414,9 +435,9 @@ Key *UserGroups::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    std::set<std::string> group_set;
+    std::pmr::set<std::pmr::string> group_set(arena(script));
     char next_group[17];
-    std::istringstream stream(data.substr(sep + 1));
+    std::istringstream stream(std::string(data.substr(sep + 1)));
     while(stream.getline(next_group, 17, ',')) {
         std::string group(next_group);
         /* REQ: Runner.Validate.usergroups.Group */
@@ -426,7 +447,7 @@ Key *UserGroups::parseFromData(const std::string &data,
                          "group is not a recognised system group");
             return nullptr;
         }
-        group_set.insert(group);
+        group_set.emplace(group);
     }
     /* REQ: Runner.Validate.usergroups.Group */
     if(stream.fail() && !stream.eof()) {
@@ -436,7 +457,24 @@ Key *UserGroups::parseFromData(const std::string &data,
         return nullptr;
     }
 
-    return new UserGroups(script, pos, data.substr(0, sep), group_set);
+    return new(script) UserGroups(script, pos, data.substr(0, sep),
+                                  std::move(group_set));
+}
+
+Key *UserGroups::loadFromCache(CacheReader &in, const ScriptLocation &pos,
+                              const Script *script) {
+    const std::string_view name = in.get_string();
+    std::pmr::set<std::pmr::string> group_set(arena(script));
+    for(std::uint64_t count = in.get_number(); count > 0 && !in.failed();
+        count--) {
+        group_set.emplace(in.get_string());
+    }
+    return new(script) UserGroups(script, pos, name, std::move(group_set));
+}
+
+void UserGroups::saveToCache(CacheWriter &out) const {
+    out.put_string(this->_username);
+    out.put_strings(this->_groups);
 }
 
 bool UserGroups::validate() const {
@@ -445,7 +483,7 @@ bool UserGroups::validate() const {
 }
 
 bool UserGroups::execute() const {
-    output_info(pos, "usergroups: setting group membership for " + _username);
+    output_info(pos, "usergroups: setting group membership for " + username());
 
     std::string groups;
     for(auto &grp : _groups) {
@@ -462,9 +500,11 @@ bool UserGroups::execute() const {
     }
 
 #ifdef HAS_INSTALL_ENV
-    if(run_command("chroot", {script->targetDirectory(), "usermod",
-                              "-a", "-G", groups, _username}) != 0) {
-        output_error(pos, "usergroups: failed to add groups to " + _username);
+    std::set<std::string> group_set;
+    for(auto &grp : _groups) group_set.emplace(grp);
+    UserDatabase *db = users(script);
+    if(db == nullptr || !db->add_groups(username(), group_set)) {
+        output_error(pos, "usergroups: failed to add groups to " + username());
         return false;
     }
 #endif  /* HAS_INSTALL_ENV */
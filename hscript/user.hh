@@ -23,10 +23,12 @@ namespace Keys {
 class RootPassphrase : public StringKey {
 private:
     RootPassphrase(const Script *_s, const ScriptLocation &_p,
-                   const std::string &my_pw) : StringKey(_s, _p, my_pw) {}
+                   std::string_view my_pw) : StringKey(_s, _p, my_pw) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool validate() const override;
     bool execute() const override;
 };
@@ -34,28 +36,34 @@ public:
 class Username : public StringKey {
 private:
     Username(const Script *_s, const ScriptLocation &_p,
-             const std::string &name) : StringKey(_s, _p, name) {}
+             std::string_view name) : StringKey(_s, _p, name) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
     bool execute() const override;
 };
 
 class UserAlias : public Key {
 private:
-    const std::string _username;
-    const std::string _alias;
+    const std::pmr::string _username;
+    const std::pmr::string _alias;
 
-    UserAlias(const Script *_s, const ScriptLocation &_p, const std::string &_n,
-              const std::string &_a) : Key(_s, _p), _username(_n), _alias(_a) {}
+    UserAlias(const Script *_s, const ScriptLocation &_p, std::string_view _n,
+              std::string_view _a) : Key(_s, _p), _username(_n, alloc()),
+        _alias(_a, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the username for this alias. */
-    const std::string &username() const { return this->_username; }
+    const std::string username() const { return std::string(this->_username); }
     /*! Retrieve the alias for the account. */
-    const std::string &alias() const { return this->_alias; }
+    const std::string alias() const { return std::string(this->_alias); }
 
     bool validate() const override;
     bool execute() const override;
@@ -63,20 +71,25 @@ public:
 
 class UserPassphrase : public Key {
 private:
-    const std::string _username;
-    const std::string _passphrase;
+    const std::pmr::string _username;
+    const std::pmr::string _passphrase;
 
     UserPassphrase(const Script *_s, const ScriptLocation &_pos,
-                   const std::string &_n, const std::string &_p) :
-        Key(_s, _pos), _username(_n), _passphrase(_p) {}
+                   std::string_view _n, std::string_view _p) :
+        Key(_s, _pos), _username(_n, alloc()), _passphrase(_p, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the username for this passphrase. */
-    const std::string &username() const { return this->_username; }
+    const std::string username() const { return std::string(this->_username); }
     /*! Retrieve the passphrase for the account. */
-    const std::string &passphrase() const { return this->_passphrase; }
+    const std::string passphrase() const {
+        return std::string(this->_passphrase);
+    }
 
     bool validate() const override;
     bool execute() const override;
@@ -84,20 +97,23 @@ public:
 
 class UserIcon : public Key {
 private:
-    const std::string _username;
-    const std::string _icon_path;
+    const std::pmr::string _username;
+    const std::pmr::string _icon_path;
 
-    UserIcon(const Script *_s, const ScriptLocation &_p, const std::string &_n,
-             const std::string &_i) :
-        Key(_s, _p), _username(_n), _icon_path(_i) {}
+    UserIcon(const Script *_s, const ScriptLocation &_p, std::string_view _n,
+             std::string_view _i) :
+        Key(_s, _p), _username(_n, alloc()), _icon_path(_i, alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the username for this icon. */
-    const std::string &username() const { return this->_username; }
+    const std::string username() const { return std::string(this->_username); }
     /*! Retrieve the icon path for the account. */
-    const std::string &icon() const { return this->_icon_path; }
+    const std::string icon() const { return std::string(this->_icon_path); }
 
     bool validate() const override;
     bool execute() const override;
@@ -105,20 +121,26 @@ public:
 
 class UserGroups : public Key {
 private:
-    const std::string _username;
-    const std::set<std::string> _groups;
+    const std::pmr::string _username;
+    const std::pmr::set<std::pmr::string> _groups;
 
     UserGroups(const Script *_s, const ScriptLocation &_pos,
-               const std::string &_n, const std::set<std::string> &_g) :
-        Key(_s, _pos), _username(_n), _groups(_g) {}
+               std::string_view _n, std::pmr::set<std::pmr::string> &&_g) :
+        Key(_s, _pos), _username(_n, alloc()),
+        _groups(std::move(_g), alloc()) {}
 public:
-    static Key *parseFromData(const std::string &, const ScriptLocation &,
+    static Key *parseFromData(std::string_view, const ScriptLocation &,
                               int*, int*, const Script *);
+    static Key *loadFromCache(CacheReader &, const ScriptLocation &,
+                              const Script *);
+    void saveToCache(CacheWriter &) const override;
 
     /*! Retrieve the username for this group set. */
-    const std::string &username() const { return this->_username; }
+    const std::string username() const { return std::string(this->_username); }
     /*! Retrieve the groups for the account. */
-    const std::set<std::string> &groups() const { return this->_groups; }
+    const std::pmr::set<std::pmr::string> &groups() const {
+        return this->_groups;
+    }
 
     bool validate() const override;
     bool execute() const override;
@@ -0,0 +1,381 @@
+/*
+ * userdb.cc - Implementation of the target user account database editor
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <cstdlib>          /* strtoul */
+#include <cstring>          /* strerror */
+#include <fstream>
+#include <time.h>
+#include <utility>
+#ifdef HAS_INSTALL_ENV
+#   include <fcntl.h>          /* open */
+#   include <sys/stat.h>       /* lstat, mkdir, fchmod */
+#   include <unistd.h>         /* fchown, readlink, symlink */
+#endif /* HAS_INSTALL_ENV */
+#include "targetfiles.hh"
+#include "userdb.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+using namespace Horizon;
+
+/*! Split a line of a database file into its fields. */
+static std::vector<std::string> split_fields(const std::string &line) {
+    std::vector<std::string> fields;
+    std::string::size_type start = 0, end;
+    while((end = line.find(':', start)) != std::string::npos) {
+        fields.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+/*! Read the settings in +path+ into +defs+.
+ * This reads both login.defs(5), which separates keys from values with
+ * whitespace, and useradd's defaults file, which uses '='.
+ */
+static void read_defs(const std::string &path,
+                      std::map<std::string, std::string> &defs) {
+    std::ifstream file(path);
+    std::string line;
+    while(std::getline(file, line)) {
+        const std::string::size_type start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#') continue;
+        const std::string::size_type sep = line.find_first_of(" \t=", start);
+        if(sep == std::string::npos) continue;
+        const std::string::size_type value =
+                line.find_first_not_of(" \t=\"", sep);
+        if(value == std::string::npos) continue;
+        const std::string::size_type end = line.find_last_not_of(" \t\"");
+        defs[line.substr(start, sep - start)] =
+                line.substr(value, end + 1 - value);
+    }
+}
+
+/*! Retrieve the setting +key+ from +defs+, or +fallback+ if it is unset. */
+static std::string get_def(const std::map<std::string, std::string> &defs,
+                           const char *key, const std::string &fallback) {
+    const auto it = defs.find(key);
+    return it == defs.end() ? fallback : it->second;
+}
+
+/*! Retrieve the numeric setting +key+ from +defs+, in +base+. */
+static unsigned long get_num(const std::map<std::string, std::string> &defs,
+                             const char *key, unsigned long fallback,
+                             int base = 10) {
+    const auto it = defs.find(key);
+    if(it == defs.end()) return fallback;
+    char *end;
+    const unsigned long num = strtoul(it->second.c_str(), &end, base);
+    return (*end == '\0' && end != it->second.c_str()) ? num : fallback;
+}
+
+/*! Retrieve an ageing setting for shadow(5), which is empty if disabled. */
+static std::string get_age(const std::map<std::string, std::string> &defs,
+                           const char *key) {
+    const std::string value = get_def(defs, key, "");
+    return value == "-1" ? "" : value;
+}
+
+/*! Retrieve the current date, in days since the epoch, for shadow(5). */
+static std::string today() {
+    return std::to_string(time(nullptr) / 86400);
+}
+
+/*! Determine whether +id+ is the ID of any entry in +table+. */
+template<typename T>
+static bool id_used(const T &rows, unsigned long id) {
+    const std::string str = std::to_string(id);
+    for(const auto &row : rows) {
+        if(row.size() > 2 && row[2] == str) return true;
+    }
+    return false;
+}
+
+
+std::vector<std::string> *UserDatabase::Table::find(const std::string &name) {
+    const auto it = index.find(name);
+    return it == index.end() ? nullptr : &rows[it->second];
+}
+
+void UserDatabase::Table::add(std::vector<std::string> fields) {
+    index[fields[0]] = rows.size();
+    rows.push_back(std::move(fields));
+    dirty = true;
+}
+
+
+UserDatabase::UserDatabase(const std::string &root) : _root(root) {
+    _passwd.path = "/etc/passwd";
+    _shadow.path = "/etc/shadow";
+    _group.path = "/etc/group";
+    _gshadow.path = "/etc/gshadow";
+}
+
+bool UserDatabase::load() {
+    read_defs(_root + "/etc/login.defs", _defs);
+    read_defs(_root + "/etc/default/useradd", _defs);
+
+    return read(_passwd, false) && read(_shadow, false) &&
+           read(_group, false) && read(_gshadow, true);
+}
+
+bool UserDatabase::read(Table &table, bool optional) {
+    std::ifstream file(_root + table.path);
+    if(!file) {
+        if(optional) return true;
+        output_error("userdb", "cannot open " + table.path + " on target");
+        return false;
+    }
+
+    std::string line;
+    while(std::getline(file, line)) {
+        std::vector<std::string> fields = split_fields(line);
+        /* NIS compatibility entries and blank lines are kept as they are,
+         * but cannot be edited. */
+        const std::string &name = fields[0];
+        if(!name.empty() && name[0] != '+' && name[0] != '-' &&
+           name[0] != '#') {
+            table.index.emplace(name, table.rows.size());
+        }
+        table.rows.push_back(std::move(fields));
+    }
+    if(file.bad()) {
+        output_error("userdb", "cannot read " + table.path + " on target");
+        return false;
+    }
+
+    table.present = true;
+    return true;
+}
+
+void UserDatabase::save(TargetFiles &files) const {
+    for(const Table *table : {&_group, &_gshadow, &_passwd, &_shadow}) {
+        if(!table->dirty) continue;
+        std::ostream &out = files.replace(table->path);
+        for(const auto &row : table->rows) {
+            for(std::size_t field = 0; field < row.size(); field++) {
+                if(field > 0) out << ':';
+                out << row[field];
+            }
+            out << '\n';
+        }
+    }
+}
+
+unsigned long UserDatabase::next_id(const Table &table, unsigned long min,
+                                    unsigned long max) {
+    /* Like useradd, use the ID after the highest one in the range, unless
+     * that is past the end of the range. */
+    unsigned long highest = 0;
+    for(const auto &row : table.rows) {
+        if(row.size() <= 2) continue;
+        char *end;
+        const unsigned long id = strtoul(row[2].c_str(), &end, 10);
+        if(*end != '\0' || id < min || id > max) continue;
+        if(id > highest) highest = id;
+    }
+    if(highest == 0) return min;
+    if(highest < max) return highest + 1;
+
+    for(unsigned long id = min; id <= max; id++) {
+        if(!id_used(table.rows, id)) return id;
+    }
+    return 0;
+}
+
+bool UserDatabase::add_user(const std::string &name,
+                            const std::string &gecos) {
+    if(_passwd.find(name) != nullptr) {
+        output_error("userdb", "account already exists", name);
+        return false;
+    }
+    if(_group.find(name) != nullptr) {
+        output_error("userdb", "a group with the same name already exists",
+                     name);
+        return false;
+    }
+
+    const unsigned long uid = next_id(_passwd,
+                                      get_num(_defs, "UID_MIN", 1000),
+                                      get_num(_defs, "UID_MAX", 60000));
+    if(uid == 0) {
+        output_error("userdb", "no user IDs are available", name);
+        return false;
+    }
+
+    /* The group of the account has the same ID, if it is free. */
+    const unsigned long gid_min = get_num(_defs, "GID_MIN", 1000);
+    const unsigned long gid_max = get_num(_defs, "GID_MAX", 60000);
+    unsigned long gid = uid;
+    if(gid < gid_min || gid > gid_max || id_used(_group.rows, gid)) {
+        gid = next_id(_group, gid_min, gid_max);
+    }
+    if(gid == 0) {
+        output_error("userdb", "no group IDs are available", name);
+        return false;
+    }
+
+    const std::string home = get_def(_defs, "HOME", "/home") + "/" + name;
+    const std::string uid_s = std::to_string(uid);
+    const std::string gid_s = std::to_string(gid);
+
+    _passwd.add({name, "x", uid_s, gid_s, gecos, home,
+                 get_def(_defs, "SHELL", "/bin/sh")});
+    _shadow.add({name, "!", today(), get_age(_defs, "PASS_MIN_DAYS"),
+                 get_age(_defs, "PASS_MAX_DAYS"),
+                 get_age(_defs, "PASS_WARN_AGE"),
+                 get_age(_defs, "INACTIVE"), "", ""});
+    _group.add({name, "x", gid_s, ""});
+    if(_gshadow.present) _gshadow.add({name, "!", "", ""});
+
+    return make_home(home, uid, gid);
+}
+
+bool UserDatabase::make_home(const std::string &home, unsigned long uid,
+                             unsigned long gid) {
+#ifdef HAS_INSTALL_ENV
+    const std::string path(_root + home);
+    const mode_t mode = static_cast<mode_t>(
+            get_num(_defs, "HOME_MODE",
+                    0777 & ~get_num(_defs, "UMASK", 022, 8), 8) & 07777);
+    error_code ec;
+
+    if(fs::exists(path, ec)) {
+        output_warning("userdb", "home directory already exists; not "
+                       "copying skeleton files into it", home);
+        return true;
+    }
+
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    if(ec || mkdir(path.c_str(), 0700) != 0 ||
+       chown(path.c_str(), uid, gid) != 0 || chmod(path.c_str(), mode) != 0) {
+        output_error("userdb", "cannot create home directory " + home,
+                     ec ? ec.message() : strerror(errno));
+        return false;
+    }
+
+    const std::string skel(_root + get_def(_defs, "SKEL", "/etc/skel"));
+    for(fs::recursive_directory_iterator entry(skel, ec), end;
+        !ec && entry != end; entry.increment(ec)) {
+        const std::string from(entry->path().string());
+        const std::string to(path + from.substr(skel.size()));
+        struct stat st;
+        if(lstat(from.c_str(), &st) != 0) continue;
+
+        bool copied = true;
+        if(S_ISDIR(st.st_mode)) {
+            copied = mkdir(to.c_str(), st.st_mode & 07777) == 0;
+        } else if(S_ISLNK(st.st_mode)) {
+            char target[4096];
+            const ssize_t len = readlink(from.c_str(), target,
+                                         sizeof(target) - 1);
+            copied = len >= 0;
+            if(copied) {
+                target[len] = '\0';
+                copied = symlink(target, to.c_str()) == 0;
+            }
+        } else if(S_ISREG(st.st_mode)) {
+            error_code copy_ec;
+            fs::copy_file(from, to, copy_ec);
+            copied = !copy_ec;
+        } else {
+            continue;
+        }
+
+        if(!copied || lchown(to.c_str(), uid, gid) != 0) {
+            output_warning("userdb", "cannot copy skeleton file to " + home,
+                           from.substr(skel.size()));
+        }
+    }
+
+    /* Like useradd, create a mail spool if the target asks for one. */
+    if(get_def(_defs, "CREATE_MAIL_SPOOL", "no") == "yes") {
+        const std::string spool(get_def(_defs, "MAIL_DIR", "/var/mail") +
+                                "/" + home.substr(home.rfind('/') + 1));
+        const std::vector<std::string> *mail = _group.find("mail");
+        const int fd = open((_root + spool).c_str(),
+                            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if(fd == -1 ||
+           fchown(fd, uid, mail && mail->size() > 2 ?
+                  strtoul((*mail)[2].c_str(), nullptr, 10) : gid) != 0 ||
+           fchmod(fd, mail ? 0660 : 0600) != 0) {
+            output_warning("userdb", "cannot create mail spool " + spool,
+                           strerror(errno));
+        }
+        if(fd != -1) close(fd);
+    }
+
+    return true;
+#else
+    return false;  /* LCOV_EXCL_LINE */
+#endif /* HAS_INSTALL_ENV */
+}
+
+bool UserDatabase::set_gecos(const std::string &name,
+                             const std::string &gecos) {
+    std::vector<std::string> *row = _passwd.find(name);
+    if(row == nullptr) {
+        output_error("userdb", "account does not exist", name);
+        return false;
+    }
+    if(row->size() < 7) row->resize(7);
+    (*row)[4] = gecos;
+    _passwd.dirty = true;
+    return true;
+}
+
+bool UserDatabase::set_passphrase(const std::string &name,
+                                  const std::string &crypt) {
+    std::vector<std::string> *row = _shadow.find(name);
+    if(row == nullptr) {
+        output_error("userdb", "account has no shadow entry", name);
+        return false;
+    }
+    if(row->size() < 9) row->resize(9);
+    (*row)[1] = crypt;
+    (*row)[2] = today();
+    _shadow.dirty = true;
+    return true;
+}
+
+bool UserDatabase::add_groups(const std::string &name,
+                              const std::set<std::string> &groups) {
+    if(_passwd.find(name) == nullptr) {
+        output_error("userdb", "account does not exist", name);
+        return false;
+    }
+
+    /* Every group is checked before any is changed, like usermod. */
+    for(const auto &group : groups) {
+        if(_group.find(group) == nullptr) {
+            output_error("userdb", "group does not exist", group);
+            return false;
+        }
+    }
+
+    for(Table *table : {&_group, &_gshadow}) {
+        for(const auto &group : groups) {
+            std::vector<std::string> *row = table->find(group);
+            if(row == nullptr) continue;
+            if(row->size() < 4) row->resize(4);
+
+            std::string &members = (*row)[3];
+            const std::string list = "," + members + ",";
+            if(list.find("," + name + ",") != std::string::npos) continue;
+            if(!members.empty()) members += ',';
+            members += name;
+            table->dirty = true;
+        }
+    }
+    return true;
+}
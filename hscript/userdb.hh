@@ -0,0 +1,109 @@
+/*
+ * userdb.hh - Definition of the target user account database editor
+ * libhscript, the HorizonScript library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_USERDB_HH_
+#define HSCRIPT_USERDB_HH_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace Horizon {
+
+class TargetFiles;
+
+/*! The account database of a target: /etc/passwd, /etc/shadow, /etc/group,
+ * and /etc/gshadow if the target has one.
+ *
+ * The files are read once by load(), and every change is made in memory.
+ * save() then hands each changed file to a TargetFiles, so that the target
+ * never has a partially written database.  Changes are made the way
+ * useradd(8) and usermod(8) would make them, using the defaults of the
+ * target's /etc/login.defs and /etc/default/useradd.
+ */
+class UserDatabase {
+public:
+    /*! Create a database editor for the system rooted at +root+. */
+    explicit UserDatabase(const std::string &root);
+
+    /*! Read the database of the target.
+     * @returns true if the database was read, false otherwise.
+     */
+    bool load();
+
+    /*! Write every changed file of the database to +files+, which
+     * replaces each of them at once when it is committed.
+     */
+    void save(TargetFiles &files) const;
+
+    /*! Create an account, with a group of the same name and a home
+     * directory populated from the skeleton directory of the target.
+     * @param name      The name of the account.
+     * @param gecos     The GECOS field of the account.
+     * @returns true if the account was created, false otherwise.
+     */
+    bool add_user(const std::string &name, const std::string &gecos);
+
+    /*! Change the GECOS field of the account +name+. */
+    bool set_gecos(const std::string &name, const std::string &gecos);
+
+    /*! Change the crypted passphrase of the account +name+. */
+    bool set_passphrase(const std::string &name, const std::string &crypt);
+
+    /*! Add the account +name+ to each group in +groups+. */
+    bool add_groups(const std::string &name,
+                    const std::set<std::string> &groups);
+private:
+    /*! One file of the database. */
+    struct Table {
+        /*! The path to the file, relative to the root. */
+        std::string path;
+        /*! Each line of the file, split into fields. */
+        std::vector<std::vector<std::string>> rows;
+        /*! The row of each entry, by name. */
+        std::map<std::string, std::size_t> index;
+        /*! Whether the file exists on the target. */
+        bool present = false;
+        /*! Whether the file has been changed. */
+        bool dirty = false;
+
+        /*! Find the entry named +name+, or nullptr. */
+        std::vector<std::string> *find(const std::string &name);
+        /*! Append an entry, whose name is the first of +fields+. */
+        void add(std::vector<std::string> fields);
+    };
+
+    /*! Read +table+ from the target.  If +optional+ is set, a missing file
+     * is not an error. */
+    bool read(Table &table, bool optional);
+    /*! Find the lowest ID in [min, max] after the highest in use by
+     * +table+, or 0 if there is none. */
+    static unsigned long next_id(const Table &table, unsigned long min,
+                                 unsigned long max);
+    /*! Create the home directory +home+ for an account. */
+    bool make_home(const std::string &home, unsigned long uid,
+                   unsigned long gid);
+
+    /*! The root directory of the target. */
+    const std::string _root;
+    /*! Settings from /etc/login.defs and /etc/default/useradd. */
+    std::map<std::string, std::string> _defs;
+    Table _passwd;
+    Table _shadow;
+    Table _group;
+    Table _gshadow;
+};
+
+}
+
+#endif /* !HSCRIPT_USERDB_HH_ */
@@ -12,21 +12,29 @@
 
 #include <string>
 #include <vector>
+#include <sys/stat.h>               /* stat */
 #ifdef HAVE_LIBCURL
 #    include <cstdio>           /* fopen */
 #    include <cstring>          /* strerror */
 #    include <curl/curl.h>      /* curl_* */
 #    include <errno.h>          /* errno */
+#    include <mutex>            /* call_once */
 #endif /* HAVE_LIBCURL */
 #ifdef HAS_INSTALL_ENV
-#   include <spawn.h>           /* posix_spawnp */
-#   include <sys/wait.h>        /* waitpid, W* */
-#   include <unistd.h>          /* environ */
+#   include <sys/resource.h>    /* struct rusage */
+#   include "supervisor.hh"
 #endif
+#include "util.hh"
 #include "util/output.hh"
+#include "util/profile.hh"
 
 #ifdef HAVE_LIBCURL
 bool download_file(const std::string &url, const std::string &path) {
+    /* curl_easy_init would initialise the library itself, but not safely
+     * if another thread is doing the same. */
+    static std::once_flag curl_once;
+    std::call_once(curl_once, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+
     CURL *curl = curl_easy_init();
     CURLcode result;
     bool return_code = false;
@@ -69,49 +77,39 @@ bool download_file(const std::string &url, const std::string &path) {
 }
 #endif /* HAVE_LIBCURL */
 
-int run_command(const std::string &cmd, const std::vector<std::string> &args) {
+int run_command(const std::string &cmd, const std::vector<std::string> &args,
+                std::chrono::seconds deadline,
+                const std::function<void(Horizon::ProcessSupervisor::Handle)>
+                        &started) {
 #ifdef HAS_INSTALL_ENV
-    const char **argv = new const char*[args.size() + 2];
-    pid_t child;
-    int status;
-
-    argv[0] = cmd.c_str();
-    for(unsigned long index = 0; index < args.size(); index++) {
-        argv[index + 1] = args.at(index).c_str();
-    }
-    argv[args.size() + 1] = nullptr;
-
-    status = posix_spawnp(&child, cmd.c_str(), nullptr, nullptr,
-                          const_cast<char * const *>(argv), environ);
-    if(status != 0) {
-        /* extremely unlikely failure case */
-        output_error(cmd, "cannot fork", strerror(status));
-        delete[] argv;
-        return -1;
-    }
-
-    delete[] argv;
-
-    if(waitpid(child, &status, 0) == -1) {
-        /* unlikely failure case */
-        output_error(cmd, "waitpid", strerror(errno));
-        return -1;
+    ProfileSpan span("process", cmd);
+    if(span.active()) {
+        std::string line(cmd);
+        for(const auto &arg : args) line += " " + arg;
+        span.set_detail(line);
     }
 
-    if(!WIFEXITED(status)) {
-        output_error(cmd, "received fatal signal " +
-                     std::to_string(WTERMSIG(status)));
-        return -1;
-    }
-
-    if(WEXITSTATUS(status) != 0) {
-        output_error(cmd, "exited abnormally with status " +
-                     std::to_string(WEXITSTATUS(status)));
-    }
+    Horizon::ProcessSupervisor &supervisor =
+            Horizon::ProcessSupervisor::instance();
+    const auto child = supervisor.spawn(cmd, args, deadline);
+    if(child == 0) return -1;
+    if(started) started(child);
 
-    return WEXITSTATUS(status);
+    struct rusage usage;
+    const int status = supervisor.wait(child, &usage);
+    span.set_child_usage(usage);
+    return status;
 #else /* !HAS_INSTALL_ENV */
     output_error(cmd, "can't spawn processes in runtine environment");
     return -1;
 #endif /* HAS_INSTALL_ENV */
 }
+
+bool is_mountpoint(const std::string &path) {
+    struct stat st, parent;
+    if(stat(path.c_str(), &st) != 0 ||
+       stat((path + "/..").c_str(), &parent) != 0) {
+        return false;
+    }
+    return st.st_dev != parent.st_dev || st.st_ino == parent.st_ino;
+}
@@ -13,8 +13,11 @@
 #ifndef HSCRIPT_UTIL_HH
 #define HSCRIPT_UTIL_HH
 
+#include <chrono>
+#include <functional>
 #include <string>
 #include <vector>
+#include "supervisor.hh"
 
 /*! Download the contents of a URL to a path.
  * @param url       The URL to download.
@@ -26,11 +29,26 @@ bool download_file(const std::string &url, const std::string &path);
 /*! Run a command.
  * @param cmd       The command to run.
  * @param args      Arguments to pass to the command.
+ * @param deadline  If not zero, how long the command may run before it is
+ *                  stopped.
+ * @param started   If set, called with the supervisor handle of the command
+ *                  once it starts, so that it can be cancelled.
  * @returns 0 if the command exited normally with status 0,
  * the exit code if the command exited abnormally,
- * -1 if the command signalled.
- * @note Status of the command is output using +output_error+.
+ * -1 if the command signalled or was stopped.
+ * @note Status of the command is output using +output_error+, and each line
+ * it writes is logged by the ProcessSupervisor.
  */
-int run_command(const std::string &cmd, const std::vector<std::string> &args);
+int run_command(const std::string &cmd, const std::vector<std::string> &args,
+                std::chrono::seconds deadline = std::chrono::seconds::zero(),
+                const std::function<void(Horizon::ProcessSupervisor::Handle)>
+                        &started = nullptr);
+
+/*! Determine if a file system is mounted on +path+.
+ * @param path      The directory to check.
+ * @returns true if +path+ is the root of a mounted file system, false if it
+ * is not or cannot be examined.
+ */
+bool is_mountpoint(const std::string &path);
 
 #endif /* !HSCRIPT_UTIL_HH */
@@ -64,6 +64,9 @@ struct BackendDescriptor {
     string description;
     std::function<BasicBackend *(const string &, const string &,
                                  const std::map<string, string> &)> creation_fn;
+    /*! Whether the backend changes the target while creating the image.
+     *  Backends that do not may create their images at the same time. */
+    bool modifies_target = false;
 };
 
 class BackendManager {
@@ -18,12 +18,17 @@
 #include <sys/mount.h>
 
 #include "basic.hh"
+#include "hscript/chroot.hh"
 #include "hscript/util.hh"
 #include "util/filesystem.hh"
 #include "util/output.hh"
 
 using namespace boost::algorithm;
 
+/*! How long dracut may run before it is considered stalled; it runs under
+ * an emulator when the image is for another architecture. */
+#define DRACUT_DEADLINE std::chrono::minutes(30)
+
 const std::vector<std::string> data_dirs() {
     std::vector<std::string> dirs;
 
@@ -300,7 +305,9 @@ public:
         output_info("CD backend", "configuring login services");
         run_command("sed", {"-i", "s/pam_unix.so$/pam_unix.so nullok_secure/",
                             target + "/etc/pam.d/base-auth"});
-        run_command("chroot", {target, "/usr/bin/passwd", "-d", "live"});
+        /* Commands inside the live environment share one chroot. */
+        ChrootAgent agent(target);
+        agent.run({"/usr/bin/passwd", "-d", "live"});
 
         /* REQ: ISO.19 */
         output_info("CD backend", "creating live /etc/issue");
@@ -368,12 +375,13 @@ public:
         kverstream >> kver;
 
         const std::string irdname = "initrd-" + my_arch;
-        if(run_command("chroot", {target, "dracut", "--kver", kver, "-N",
-                                  "--force", "-a", "dmsquash-live",
-                                  "/boot/" + irdname}) != 0) {
+        if(agent.run({"dracut", "--kver", kver, "-N", "--force",
+                      "-a", "dmsquash-live", "/boot/" + irdname}, nullptr,
+                     DRACUT_DEADLINE) != 0) {
             output_error("CD backend", "dracut failed to create initramfs");
             return COMMAND_ERROR;
         }
+        agent.stop();
 
         fs::rename(target + "/boot/" + irdname, cdpath + "/" + irdname, ec);
         if(ec) {
@@ -466,7 +474,7 @@ void register_cd_backend() {
         [](const std::string &ir_dir, const std::string &out_path,
            const std::map<std::string, std::string> &opts) {
             return new CDBackend(ir_dir, out_path, opts);
-        }
+        }, true
     });
 }
 
@@ -12,33 +12,617 @@
 
 #include <archive.h>
 #include <archive_entry.h>
-#include <sys/mman.h>
-#include <sys/mount.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "basic.hh"
-#include "hscript/util.hh"
 #include "util/filesystem.hh"
 #include "util/output.hh"
 
 namespace Horizon {
 namespace Image {
 
+/*! Frees an archive_entry owned by a TreeReader::Entry. */
+struct EntryDeleter {
+    void operator()(struct archive_entry *entry) const {
+        archive_entry_free(entry);
+    }
+};
+
+/*! Walks a tree, and reads the files in it ahead of the archive writer.
+ *
+ * One thread walks the tree and builds the header of each file, and a pool
+ * of threads reads the contents of regular files in fixed-size chunks, in
+ * the order of the walk.  The chunks waiting to be written never hold more
+ * than the memory budget, except that the file being written may always
+ * have one chunk, so that the writer cannot wait on readers that are
+ * themselves waiting for memory.  Pages that have been read are dropped from
+ * the page cache, since nothing reads them again.
+ *
+ * Headers carry the extended attributes and ACLs of each file, so that file
+ * capabilities survive.  Further links to a file already walked are headers
+ * for hard links, with no contents.  The holes of sparse files are found
+ * with SEEK_DATA and SEEK_HOLE, and only the regions holding data are read.
+ */
+class TreeReader {
+public:
+    /*! A region of a file, as its offset and length. */
+    typedef std::pair<off_t, off_t> Region;
+
+    /*! Part of the contents of a file. */
+    struct Chunk {
+        /*! The offset in the file of the data. */
+        off_t offset = 0;
+        std::vector<char> data;
+    };
+
+    /*! One file of the tree. */
+    struct Entry {
+        /*! The path of the file on the host. */
+        std::string path;
+        /*! The header of the file in the archive. */
+        std::unique_ptr<struct archive_entry, EntryDeleter> header;
+        /*! The regions of the file that hold data, if it has holes. */
+        std::vector<Region> regions;
+        /*! Whether the file has holes. */
+        bool sparse = false;
+    private:
+        friend class TreeReader;
+        /*! The chunks read, but not yet written. */
+        std::deque<Chunk> chunks;
+        /*! Whether every chunk has been read. */
+        bool done = false;
+    };
+
+    /*! The size of each chunk read from a file. */
+    static constexpr std::size_t chunk_size = 1024 * 1024;
+
+    /*! Create a reader for the tree at +root+.
+     * @param format    The format of the archive, to resolve hard links for.
+     * @param readers   The number of threads reading files.
+     * @param budget    The most memory, in bytes, to hold file data in.
+     */
+    TreeReader(const std::string &root, int format, unsigned int readers,
+               std::size_t budget) : _root{root}, _format{format},
+        _budget{std::max(budget, chunk_size)} {
+        _walker = std::thread(&TreeReader::walk, this);
+        for(unsigned int reader = 0; reader < std::max(readers, 1u);
+            reader++) {
+            _readers.emplace_back(&TreeReader::read_files, this);
+        }
+    }
+
+    /*! Stop walking and reading, and wait for every thread. */
+    ~TreeReader() {
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            _stop = true;
+        }
+        _changed.notify_all();
+        _walker.join();
+        for(auto &reader : _readers) reader.join();
+    }
+
+    TreeReader(const TreeReader &) = delete;
+    TreeReader &operator=(const TreeReader &) = delete;
+
+    /*! Retrieve the next file of the walk, once the previous one is done.
+     * @returns The file, or nullptr at the end of the tree or on failure.
+     */
+    const Entry *next() {
+        std::unique_lock<std::mutex> guard(_lock);
+        release_locked();
+        if(_current) {
+            /* The file may not have been read to the end. */
+            Entry &entry = _entries.front();
+            _changed.wait(guard, [&] { return _failed || entry.done; });
+            if(_failed) return nullptr;
+            for(const auto &chunk : entry.chunks) _used -= chunk.data.size();
+            _entries.pop_front();
+            if(_claimed > 0) _claimed--;
+            _current = false;
+            _changed.notify_all();
+        }
+        _changed.wait(guard, [this] {
+            return _failed || !_entries.empty() || _walked;
+        });
+        if(_failed || _entries.empty()) return nullptr;
+        _current = true;
+        return &_entries.front();
+    }
+
+    /*! Retrieve the next chunk of the contents of the current file.
+     * Chunks are retrieved in order of their offset; the holes of a sparse
+     * file lie between them.  The chunk is valid until the next call to
+     * read() or next().
+     * @param chunk     Receives the chunk, which is empty at the end of the
+     *                  file.
+     * @returns true if a chunk was retrieved, false on failure.
+     */
+    bool read(Chunk &chunk) {
+        std::unique_lock<std::mutex> guard(_lock);
+        release_locked();
+        Entry &entry = _entries.front();
+        _changed.wait(guard, [&] {
+            return _failed || !entry.chunks.empty() || entry.done;
+        });
+        if(_failed) return false;
+        if(entry.chunks.empty()) {
+            chunk.data.clear();
+            return true;
+        }
+        /* The buffer of the previous chunk is read into again. */
+        Chunk &front = entry.chunks.front();
+        chunk.offset = front.offset;
+        chunk.data.swap(front.data);
+        if(front.data.capacity() > 0 && _spare.size() < _readers.size()) {
+            _spare.push_back(std::move(front.data));
+        }
+        entry.chunks.pop_front();
+        _lent = chunk.data.size();
+        return true;
+    }
+
+    /*! Determine if walking or reading the tree failed. */
+    bool failed() {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _failed;
+    }
+private:
+    /*! The most files walked ahead of the writer. */
+    static constexpr std::size_t max_ahead = 4096;
+
+    /*! Return the memory of the chunk last lent to the writer. */
+    void release_locked() {
+        if(_lent == 0) return;
+        _used -= _lent;
+        _lent = 0;
+        _changed.notify_all();
+    }
+
+    /*! Stop every thread, after reporting the failure that stopped them. */
+    void fail_locked() {
+        _failed = true;
+        _changed.notify_all();
+    }
+
+    /*! Walk the tree, adding each file to the entries. */
+    void walk() {
+        /* No user or group names are looked up: those of the host are not
+         * those of the target, so only the numeric IDs are stored. */
+        struct archive *disk = archive_read_disk_new();
+#ifdef ARCHIVE_READDISK_NO_SPARSE
+        /* Holes are found by map_regions, as the file is walked. */
+        archive_read_disk_set_behavior(disk, ARCHIVE_READDISK_NO_SPARSE);
+#endif
+        struct archive_entry_linkresolver *links =
+                archive_entry_linkresolver_new();
+        archive_entry_linkresolver_set_strategy(links, _format);
+
+        const bool ok = walk_tree(disk, links);
+
+        archive_entry_linkresolver_free(links);
+        archive_read_free(disk);
+        std::lock_guard<std::mutex> guard(_lock);
+        if(!ok) {
+            fail_locked();
+            return;
+        }
+        _walked = true;
+        _changed.notify_all();
+    }
+
+    /*! Add each file of the tree to the entries.
+     * @param disk      Reads the metadata of each file.
+     * @param links     Finds the files that are links to one already walked.
+     * @returns false if the walk failed, true otherwise.
+     */
+    bool walk_tree(struct archive *disk,
+                   struct archive_entry_linkresolver *links) {
+        error_code ec;
+        fs::recursive_directory_iterator it(_root, ec), end;
+        for(; !ec && it != end; it.increment(ec)) {
+            Entry entry;
+            entry.path = it->path().string();
+            struct stat st;
+            if(lstat(entry.path.c_str(), &st) == -1) {
+                output_error("tar backend", "failed to stat '" + entry.path +
+                             "'", strerror(errno));
+                return false;
+            }
+
+            struct archive_entry *header = archive_entry_new();
+            entry.header.reset(header);
+            archive_entry_copy_sourcepath(header, entry.path.c_str());
+            const int res = archive_read_disk_entry_from_file(disk, header,
+                                                              -1, &st);
+            if(res < ARCHIVE_WARN) {
+                output_error("tar backend", "failed to read '" + entry.path +
+                             "'", archive_error_string(disk));
+                return false;
+            } else if(res == ARCHIVE_WARN) {
+                output_warning("tar backend", "cannot read all metadata of '" +
+                               entry.path + "'", archive_error_string(disk));
+            }
+            archive_entry_update_pathname_utf8(header,
+                it->path().lexically_relative(_root).u8string().c_str());
+            archive_entry_sparse_clear(header);
+            if(S_ISREG(st.st_mode) && st.st_size > 0 &&
+               !map_regions(entry, st)) {
+                return false;
+            }
+
+            /* The tar strategy never holds an entry back, and turns each
+             * further link to a file into a hard link with no contents. */
+            struct archive_entry *spare = nullptr;
+            archive_entry_linkify(links, &header, &spare);
+            if(archive_entry_hardlink(header) != nullptr) {
+                archive_entry_set_size(header, 0);
+                archive_entry_sparse_clear(header);
+                entry.sparse = false;
+                entry.regions.clear();
+            }
+            entry.done = !S_ISREG(st.st_mode) ||
+                    archive_entry_size(header) == 0 ||
+                    (entry.sparse && entry.regions.empty());
+
+            std::unique_lock<std::mutex> guard(_lock);
+            _changed.wait(guard, [this] {
+                return _stop || _failed || _entries.size() < max_ahead;
+            });
+            if(_stop || _failed) return true;
+            _entries.push_back(std::move(entry));
+            _changed.notify_all();
+        }
+
+        if(ec) {
+            output_error("tar backend", "failed to walk '" + _root + "'",
+                         ec.message());
+            return false;
+        }
+        return true;
+    }
+
+    /*! Find the regions of +entry+ that hold data, if it has holes, and add
+     * them to its header.
+     * @returns false if the file could not be opened, true otherwise.
+     */
+    static bool map_regions(Entry &entry, const struct stat &st) {
+        /* A file with a block for every byte has no holes. */
+        if(static_cast<off_t>(st.st_blocks) * 512 >= st.st_size) return true;
+
+        const int fd = open(entry.path.c_str(),
+                            O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if(fd == -1) {
+            output_error("tar backend", "failed to open '" + entry.path + "'",
+                         strerror(errno));
+            return false;
+        }
+        off_t offset = 0;
+        while(offset < st.st_size) {
+            const off_t data = lseek(fd, offset, SEEK_DATA);
+            if(data == -1 && errno == ENXIO) break;  /* Only a hole is left. */
+            if(data == -1) {
+                /* The file system cannot find holes; read the whole file. */
+                close(fd);
+                entry.regions.clear();
+                return true;
+            }
+            if(data >= st.st_size) break;
+            off_t hole = lseek(fd, data, SEEK_HOLE);
+            if(hole == -1 || hole > st.st_size) hole = st.st_size;
+            entry.regions.emplace_back(data, hole - data);
+            offset = hole;
+        }
+        close(fd);
+
+        if(entry.regions.size() == 1 &&
+           entry.regions.front() == Region{0, st.st_size}) {
+            entry.regions.clear();
+            return true;
+        }
+        entry.sparse = true;
+        struct archive_entry *header = entry.header.get();
+        for(const auto &region : entry.regions) {
+            archive_entry_sparse_add_entry(header, region.first,
+                                           region.second);
+        }
+        /* A file that ends with a hole ends with an empty region, so that
+         * the archive records its size. */
+        if(entry.regions.empty() ||
+           entry.regions.back().first + entry.regions.back().second <
+           st.st_size) {
+            archive_entry_sparse_add_entry(header, st.st_size, 0);
+        }
+        return true;
+    }
+
+    /*! Read files in the order of the walk, until there are none left. */
+    void read_files() {
+        std::unique_lock<std::mutex> guard(_lock);
+        while(true) {
+            /* Find the next file that no reader has claimed. */
+            Entry *entry = nullptr;
+            _changed.wait(guard, [&] {
+                if(_stop || _failed) return true;
+                for(; _claimed < _entries.size(); _claimed++) {
+                    if(!_entries[_claimed].done) {
+                        entry = &_entries[_claimed++];
+                        return true;
+                    }
+                }
+                return _walked;
+            });
+            if(entry == nullptr) return;
+
+            guard.unlock();
+            const bool ok = read_file(*entry);
+            guard.lock();
+            entry->done = true;
+            if(!ok) fail_locked();
+            _changed.notify_all();
+        }
+    }
+
+    /*! Read the data of +entry+ into chunks, as the memory budget allows. */
+    bool read_file(Entry &entry) {
+        const int fd = open(entry.path.c_str(),
+                            O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if(fd == -1) {
+            output_error("tar backend", "failed to open '" + entry.path + "'",
+                         strerror(errno));
+            return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        /* Only the size in the header is read, even if the file grew. */
+        const std::vector<Region> whole{
+            {0, archive_entry_size(entry.header.get())}
+        };
+        bool ok = true;
+        for(const auto &region : entry.sparse ? entry.regions : whole) {
+            ok = read_region(entry, fd, region);
+            if(!ok) break;
+        }
+        close(fd);
+        return ok;
+    }
+
+    /*! Read +region+ of +entry+, open as +fd+, into chunks. */
+    bool read_region(Entry &entry, int fd, const Region &region) {
+        const off_t end = region.first + region.second;
+        for(off_t offset = region.first; offset < end;) {
+            const std::size_t length = static_cast<std::size_t>(
+                        std::min<off_t>(end - offset, chunk_size));
+            Chunk chunk;
+            chunk.offset = offset;
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _changed.wait(guard, [&] {
+                    return _stop || _failed ||
+                            _used + length <= _budget ||
+                            (&entry == &_entries.front() &&
+                             entry.chunks.empty());
+                });
+                if(_stop || _failed) return true;
+                _used += length;
+                if(!_spare.empty()) {
+                    chunk.data = std::move(_spare.back());
+                    _spare.pop_back();
+                }
+            }
+
+            posix_fadvise(fd, offset + length, chunk_size,
+                          POSIX_FADV_WILLNEED);
+            chunk.data.resize(length);
+            std::size_t got = 0;
+            while(got < length) {
+                const ssize_t ret = pread(fd, chunk.data.data() + got,
+                                          length - got, offset + got);
+                if(ret < 0 && errno == EINTR) continue;
+                if(ret <= 0) break;
+                got += static_cast<std::size_t>(ret);
+            }
+            const int saved_errno = errno;
+            posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+
+            std::lock_guard<std::mutex> guard(_lock);
+            if(got < length) {
+                _used -= length;
+                output_error("tar backend", "failed to read '" + entry.path +
+                             "'", got == 0 && saved_errno != 0 ?
+                             strerror(saved_errno) : "file shrank");
+                return false;
+            }
+            entry.chunks.push_back(std::move(chunk));
+            _changed.notify_all();
+            offset += static_cast<off_t>(length);
+        }
+        return true;
+    }
+
+    /*! The root of the tree. */
+    const std::string _root;
+    /*! The format of the archive. */
+    const int _format;
+    /*! The most memory to hold file data in. */
+    const std::size_t _budget;
+
+    /*! Protects every member below. */
+    std::mutex _lock;
+    /*! Signalled whenever the entries, chunks, or memory change. */
+    std::condition_variable _changed;
+    /*! The files walked but not yet written, in the order of the walk. */
+    std::deque<Entry> _entries;
+    /*! The index in _entries of the first file no reader has claimed. */
+    std::size_t _claimed = 0;
+    /*! Whether the front entry has been returned by next(). */
+    bool _current = false;
+    /*! The memory held by chunks that have not been written. */
+    std::size_t _used = 0;
+    /*! The size of the chunk lent to the writer. */
+    std::size_t _lent = 0;
+    /*! Buffers of written chunks, to be read into again. */
+    std::vector<std::vector<char>> _spare;
+    /*! Whether the walk is complete. */
+    bool _walked = false;
+    /*! Whether walking or reading failed. */
+    bool _failed = false;
+    /*! Whether the reader is being destroyed. */
+    bool _stop = false;
+
+    std::thread _walker;
+    std::vector<std::thread> _readers;
+};
+
 class TarBackend : public BasicBackend {
 public:
     enum CompressionType {
         None,
         GZip,
         BZip2,
-        XZ
+        XZ,
+        Zstd
     };
 
 private:
     CompressionType comp;
     struct archive *a;
+    /*! The number of threads reading files, and the most memory, in MiB,
+     * that they may hold file data in. */
+    unsigned long readers = 4, read_buffer = 64;
+
+    /*! Determine if +value+ is a non-negative decimal number. */
+    static bool is_number(const std::string &value) {
+        return !value.empty() &&
+                std::all_of(value.begin(), value.end(),
+                            [](unsigned char c) { return isdigit(c); });
+    }
+
+    /*! Read the backend option +key+ into +value+, if it is given.
+     * @returns false if the option is not a positive number. */
+    bool number_option(const char *key, unsigned long &value) {
+        const auto opt = opts.find(key);
+        if(opt == opts.end()) return true;
+        if(!is_number(opt->second) || std::stoul(opt->second) == 0) {
+            output_error("tar backend", std::string(key) + " must be a "
+                         "positive number", opt->second);
+            return false;
+        }
+        value = std::stoul(opt->second);
+        return true;
+    }
+
+    /*! Set the option +key+ of the compression filter to +value+.
+     * @returns ARCHIVE_OK if the option was set, ARCHIVE_WARN if libarchive
+     * does not support it, or ARCHIVE_FAILED if +value+ is invalid. */
+    int set_filter_option(const char *key, const std::string &value) {
+        const int res = archive_write_set_filter_option(a, nullptr, key,
+                                                        value.c_str());
+        if(res < ARCHIVE_WARN) {
+            output_error("tar backend", "invalid compression option " +
+                         std::string(key) + "=" + value,
+                         archive_error_string(a));
+        }
+        return res;
+    }
+
+    /*! Apply the level and threads backend options to the compression
+     * filter.  XZ and Zstandard use one thread per processor unless told
+     * otherwise, which the other compressors do not support.
+     * @returns true if the filter was configured, false otherwise. */
+    bool configure_filter() {
+        const bool threaded = (comp == XZ || comp == Zstd);
+
+        const auto level = opts.find("level");
+        if(level != opts.end()) {
+            if(comp == None) {
+                output_warning("tar backend", "level has no effect on an "
+                               "uncompressed archive");
+            } else if(!is_number(level->second)) {
+                output_error("tar backend", "compression level must be a "
+                             "number", level->second);
+                return false;
+            } else {
+                const int res = set_filter_option("compression-level",
+                                                  level->second);
+                if(res == ARCHIVE_WARN) {
+                    output_error("tar backend", "this compressor does not "
+                                 "support compression levels");
+                }
+                if(res != ARCHIVE_OK) return false;
+            }
+        }
+
+        std::string threads;
+        const auto thread_opt = opts.find("threads");
+        if(thread_opt != opts.end()) {
+            threads = thread_opt->second;
+            if(!is_number(threads)) {
+                output_error("tar backend", "thread count must be a number",
+                             threads);
+                return false;
+            }
+            if(!threaded) {
+                output_warning("tar backend", "threads is only supported by "
+                               "XZ and Zstandard compression");
+                return true;
+            }
+        } else if(!threaded) {
+            return true;
+        }
+        if(threads.empty() || threads == "0") {
+            const unsigned int cpus = std::thread::hardware_concurrency();
+            threads = std::to_string(cpus == 0 ? 1 : cpus);
+        }
+
+        switch(set_filter_option("threads", threads)) {
+        case ARCHIVE_OK:
+            return true;
+        case ARCHIVE_WARN:
+            /* Older libarchive compresses with one thread. */
+            if(thread_opt != opts.end()) {
+                output_warning("tar backend", "this version of libarchive "
+                               "cannot compress with several threads");
+            }
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /*! Write +length+ bytes of +data+ to the current entry. */
+    bool write_data(const char *data, std::size_t length) {
+        if(archive_write_data(a, data, length) < 0) {
+            output_error("tar backend", archive_error_string(a));
+            return false;
+        }
+        return true;
+    }
+
+    /*! Write +length+ zeros to the current entry. */
+    bool write_zeros(int64_t length) {
+        static const std::vector<char> zeros(TreeReader::chunk_size);
+        while(length > 0) {
+            const std::size_t part = static_cast<std::size_t>(
+                        std::min<int64_t>(length, zeros.size()));
+            if(!write_data(zeros.data(), part)) return false;
+            length -= static_cast<int64_t>(part);
+        }
+        return true;
+    }
 
 public:
     TarBackend(const std::string &ir, const std::string &out,
@@ -47,7 +631,7 @@ public:
         : BasicBackend{ir, out, opts}, comp{_c} {};
 
     int prepare() override {
-        int res;
+        int res = ARCHIVE_OK;
 
         a = archive_write_new();
         archive_write_set_format_pax_restricted(a);
@@ -56,15 +640,27 @@ public:
         case None:
             break;
         case GZip:
-            archive_write_add_filter_gzip(a);
+            res = archive_write_add_filter_gzip(a);
             break;
         case BZip2:
-            archive_write_add_filter_bzip2(a);
+            res = archive_write_add_filter_bzip2(a);
             break;
         case XZ:
-            archive_write_add_filter_xz(a);
+            res = archive_write_add_filter_xz(a);
+            break;
+        case Zstd:
+            res = archive_write_add_filter_zstd(a);
             break;
         }
+        if(res < ARCHIVE_WARN) {
+            output_error("tar backend", "cannot compress archive",
+                         archive_error_string(a));
+            return res;
+        }
+        if(!configure_filter() || !number_option("readers", readers) ||
+           !number_option("read-buffer", read_buffer)) {
+            return -1;
+        }
 
         res = archive_write_open_filename(a, this->out_path.c_str());
         if(res < ARCHIVE_OK) {
@@ -80,71 +676,49 @@ public:
     }
 
     int create() override {
-        struct archive_entry *entry = archive_entry_new();
-        error_code ec;
-        int fd, r, code = 0;
-        struct stat s;
-        void *buff;
+        int code = 0;
         std::string target = this->ir_dir + "/target";
 
-        run_command("umount", {"-R", (ir_dir + "/target/sys")});
-        umount((ir_dir + "/target/proc").c_str());
-        run_command("umount", {"-R", (ir_dir + "/target/dev")});
-
-        for(const auto& dent : fs::recursive_directory_iterator(target, ec)) {
-            fs::path relpath = dent.path().lexically_relative(target);
-#define OUTPUT_FAILURE(x) \
-    output_error("tar backend", "failed to " x " '" + std::string(dent.path()) + "'",\
-                 strerror(errno));
-            r = lstat(dent.path().c_str(), &s);
-            if(r == -1) {
-                OUTPUT_FAILURE("stat")
-                code = -1;
-                goto ret;
-            }
-            archive_entry_copy_stat(entry, &s);
-            if(dent.is_symlink()) {
-                archive_entry_set_filetype(entry, AE_IFLNK);
-                fs::path resolved = fs::read_symlink(dent.path(), ec);
-                if(ec) {
-                    output_error("tar backend", "failed to read symlink",
-                                 strerror(ec.value()));
-                    code = -1;
-                    goto ret;
-                }
-                const auto r_path = resolved.u8string();
-                archive_entry_update_symlink_utf8(entry, r_path.c_str());
-            }
-            archive_entry_update_pathname_utf8(entry, relpath.u8string().c_str());
-            if(archive_write_header(this->a, entry) != ARCHIVE_OK) {
-                output_error("tar backend", archive_error_string(a));
+        /* Files are read by other threads while this one compresses. */
+        TreeReader reader(target, archive_format(a), readers,
+                          read_buffer * 1024 * 1024);
+        const TreeReader::Entry *file;
+        TreeReader::Chunk chunk;
+        while(code == 0 && (file = reader.next()) != nullptr) {
+            struct archive_entry *entry = file->header.get();
+            const int res = archive_write_header(this->a, entry);
+            if(res < ARCHIVE_WARN) {
+                output_error("tar backend", archive_error_string(a),
+                             archive_entry_pathname(entry));
                 code = -1;
-                goto ret;
+                break;
+            } else if(res == ARCHIVE_WARN) {
+                output_warning("tar backend", archive_error_string(a),
+                               archive_entry_pathname(entry));
             }
-            if(dent.is_regular_file() && dent.file_size() > 0) {
-                fd = open(dent.path().c_str(), O_RDONLY);
-                if(fd == -1) {
-                    OUTPUT_FAILURE("open")
-                    code = -1;
-                    goto ret;
+            if(archive_entry_filetype(entry) == AE_IFREG) {
+                /* The holes of a sparse file are written as zeros, which
+                 * the archive does not store. */
+                const int64_t size = archive_entry_size(entry);
+                int64_t written = 0;
+                while(code == 0 && reader.read(chunk) &&
+                      !chunk.data.empty()) {
+                    if(!write_zeros(chunk.offset - written) ||
+                       !write_data(chunk.data.data(), chunk.data.size())) {
+                        code = -1;
+                    }
+                    written = chunk.offset +
+                            static_cast<int64_t>(chunk.data.size());
                 }
-                buff = mmap(NULL, dent.file_size(), PROT_READ, MAP_SHARED,
-                            fd, 0);
-                if(buff == MAP_FAILED) {
-                    OUTPUT_FAILURE("map")
-                    close(fd);
+                if(code == 0 && !reader.failed() &&
+                   !write_zeros(size - written)) {
                     code = -1;
-                    goto ret;
                 }
-                archive_write_data(this->a, buff, dent.file_size());
-                close(fd);
             }
             archive_write_finish_entry(this->a);
-            archive_entry_clear(entry);
         }
+        if(reader.failed()) code = -1;
 
-ret:
-        archive_entry_free(entry);
         return code;
     }
 
@@ -189,6 +763,14 @@ void register_tar_backend() {
             return new TarBackend(ir_dir, out_path, opts, TarBackend::XZ);
         }
     });
+
+    BackendManager::register_backend(
+    {"tzst", "Create a tarball with Zstandard compression (.tar.zst)",
+        [](const std::string &ir_dir, const std::string &out_path,
+           const std::map<std::string, std::string> &opts) {
+            return new TarBackend(ir_dir, out_path, opts, TarBackend::Zstd);
+        }
+    });
 }
 
 }
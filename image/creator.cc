@@ -10,14 +10,20 @@
  * SPDX-License-Identifier: AGPL-3.0-only
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstdlib>              /* EXIT_* */
+#include <cstring>              /* strerror */
 #include <functional>
 #include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/program_options.hpp>
 #include <sys/mount.h>
+#include <sys/stat.h>
 
 #include "backends/basic.hh"
 #include "hscript/meta.hh"
@@ -25,6 +31,7 @@
 #include "hscript/util.hh"
 #include "util/filesystem.hh"
 #include "util/output.hh"
+#include "util/profile.hh"
 
 bool pretty = true;     /*! Controls ASCII colour output */
 
@@ -36,6 +43,97 @@ const std::string arch_xlate(const std::string &arch) {
 }
 
 
+/*! One image to create from the target. */
+struct Output {
+    /*! The type code of the backend. */
+    std::string type_code;
+    /*! The path to write the image to. */
+    std::string path;
+    /*! The backend creating the image. */
+    Horizon::Image::BasicBackend *backend = nullptr;
+    /*! Whether the backend changes the target while creating the image. */
+    bool modifies_target = false;
+    /*! The intermediate directory of a backend given an overlay of the
+     *  target, or empty if it uses the target itself. */
+    std::string overlay;
+    /*! The result of creating the image. */
+    int result = 0;
+};
+
+
+/*! Mount /dev, /proc, and /sys in +target+ as during execution, for
+ * backends that run commands inside it.  Those still mounted are kept. */
+void mount_system(const std::string &target) {
+    const std::string devpath = target + "/dev", procpath = target + "/proc",
+            syspath = target + "/sys";
+    error_code ec;
+    for(const auto &path : {devpath, procpath, syspath}) {
+        if(!fs::exists(path, ec)) fs::create_directory(path, ec);
+    }
+    if(!is_mountpoint(devpath) &&
+       mount("/dev", devpath.c_str(), nullptr, MS_BIND | MS_REC,
+             nullptr) != 0) {
+        output_warning("internal", "could not bind-mount /dev", target);
+    }
+    if(!is_mountpoint(procpath) &&
+       mount("none", procpath.c_str(), "proc", 0, nullptr) != 0) {
+        output_warning("internal", "target procfs could not be mounted",
+                       target);
+    }
+    if(!is_mountpoint(syspath) &&
+       mount("/sys", syspath.c_str(), nullptr, MS_BIND | MS_REC,
+             nullptr) != 0) {
+        output_warning("internal", "target sysfs could not be mounted",
+                       target);
+    }
+}
+
+
+/*! Unmount /dev, /proc, and /sys from +target+, so that images of it do
+ * not contain the system they were built on. */
+void unmount_system(const std::string &target) {
+    run_command("umount", {"-R", target + "/sys"});
+    umount((target + "/proc").c_str());
+    run_command("umount", {"-R", target + "/dev"});
+}
+
+
+/*! Mount an overlay of the target in +ir_dir+ on the target of +dir+, so
+ * that a backend using +dir+ as its intermediate directory cannot change the
+ * target that other backends read.  Anything the backend wrote to its own
+ * target while preparing is kept in the upper layer of the overlay.
+ */
+bool mount_overlay(const std::string &ir_dir, const std::string &dir) {
+    error_code ec;
+    const std::string lower = ir_dir + "/target", upper = dir + "/upper",
+            work = dir + "/work", merged = dir + "/target";
+
+    fs::remove_all(upper, ec);
+    fs::remove_all(work, ec);
+    if(fs::exists(merged, ec)) {
+        fs::rename(merged, upper, ec);
+    } else {
+        fs::create_directories(upper, ec);
+    }
+    if(!ec) fs::create_directories(work, ec);
+    if(!ec) fs::create_directories(merged, ec);
+    if(ec) {
+        output_error("overlay", "cannot create overlay directories",
+                     ec.message());
+        return false;
+    }
+
+    const std::string data = "lowerdir=" + lower + ",upperdir=" + upper +
+            ",workdir=" + work;
+    if(mount("overlay", merged.c_str(), "overlay", 0, data.c_str()) != 0) {
+        output_error("overlay", "cannot mount overlay of target",
+                     strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+
 #define DESCR_TEXT "Usage: hscript-image [OPTION]... [INSTALLFILE]\n"\
                    "Write an operating system image configured per INSTALLFILE"
 /*! Text used at the top of usage output */
@@ -49,8 +147,10 @@ int main(int argc, char *argv[]) {
     bool needs_help{}, disable_pretty{}, version_only{};
     int exit_code = EXIT_SUCCESS;
     std::string if_path{"/etc/horizon/installfile"}, ir_dir{"/tmp/horizon-image"},
-                output_path{"image.tar"}, type_code{"tar"};
-    BasicBackend *backend = nullptr;
+                output_path{"image.tar"}, pkg_cache, layer_cache,
+                profile_path;
+    std::vector<std::string> type_specs{"tar"};
+    std::vector<Output> outputs;
     std::map<std::string, std::string> backend_opts;
     Horizon::ScriptOptions opts;
     Horizon::Script *my_script;
@@ -61,15 +161,19 @@ int main(int argc, char *argv[]) {
             ("help,h", bool_switch(&needs_help), "Display this message.")
             ("no-colour,n", bool_switch(&disable_pretty), "Do not 'prettify' output.")
             ("version,v", bool_switch(&version_only), "Show program version information.")
+            ("profile", value<std::string>(&profile_path), "Write a timing profile of the build to this file, in Chrome trace format.")
             ;
     options_description target{"Target control options"};
     target.add_options()
             ("output,o", value<std::string>()->default_value("image.tar"), "Desired filename for the output file.")
             ("ir-dir,i", value<std::string>()->default_value("/tmp/horizon-image"), "Where to store intermediate files.")
+            ("package-cache,c", value<std::string>(), "Cache downloaded packages in this directory, and reuse them in later builds.")
+            ("package-cache-size", value<std::uint64_t>()->default_value(0), "Evict the least recently used packages once the cache exceeds this many MiB.  0 means no limit.")
+            ("layer-cache", value<std::string>(), "Cache the target once its packages are installed in this directory, and start later builds with the same packages from it.")
             ;
     options_description backconfig{"Backend configuration options"};
     backconfig.add_options()
-            ("type,t", value<std::string>()->default_value("tar"), "Type of output file to generate.  Use 'list' for a list of supported types.")
+            ("type,t", value<std::vector<std::string>>()->default_value({"tar"}, "tar"), "Type of output file to generate, optionally followed by a colon and the file name.  You may specify this multiple times to create multiple images from one build.  Use 'list' for a list of supported types.")
             ("backconfig,b", value<std::vector<std::string>>(), "Set a backend configuration option.  You may specify this multiple times for multiple options.")
             ;
     ui.add(general).add(target).add(backconfig);
@@ -109,10 +213,11 @@ int main(int argc, char *argv[]) {
     }
 
     if(!vm["type"].empty()) {
-        type_code = vm["type"].as<std::string>();
+        type_specs = vm["type"].as<std::vector<std::string>>();
     }
 
-    if(type_code == "list") {
+    if(std::find(type_specs.begin(), type_specs.end(), "list") !=
+       type_specs.end()) {
         std::cout << "Type codes known by this build of Image Creation:"
                   << std::endl << std::endl;
         for(const auto &candidate : BackendManager::available_backends()) {
@@ -134,6 +239,20 @@ int main(int argc, char *argv[]) {
         ir_dir = fs::absolute(ir_dir).string();
     }
 
+    if(!vm["package-cache"].empty()) {
+        pkg_cache = vm["package-cache"].as<std::string>();
+        if(fs::path(pkg_cache).is_relative()) {
+            pkg_cache = fs::absolute(pkg_cache).string();
+        }
+    }
+
+    if(!vm["layer-cache"].empty()) {
+        layer_cache = vm["layer-cache"].as<std::string>();
+        if(fs::path(layer_cache).is_relative()) {
+            layer_cache = fs::absolute(layer_cache).string();
+        }
+    }
+
     if(!vm["output"].empty()) {
         output_path = vm["output"].as<std::string>();
     }
@@ -142,6 +261,31 @@ int main(int argc, char *argv[]) {
         output_path = fs::absolute(output_path).string();
     }
 
+    /* Each type is written to the file named after it, or to -o. */
+    for(const auto &spec : type_specs) {
+        Output output;
+        const std::string::size_type colon = spec.find(':');
+        output.type_code = spec.substr(0, colon);
+        output.path = (colon == std::string::npos) ? output_path :
+                                                     spec.substr(colon + 1);
+        if(output.path.empty()) {
+            output_error("command-line", "no file name given for image",
+                         spec);
+            return EXIT_FAILURE;
+        }
+        if(fs::path(output.path).is_relative()) {
+            output.path = fs::absolute(output.path).string();
+        }
+        for(const auto &other : outputs) {
+            if(other.path == output.path) {
+                output_error("command-line", "two images cannot be written "
+                             "to the same file", output.path);
+                return EXIT_FAILURE;
+            }
+        }
+        outputs.push_back(output);
+    }
+
     if(!vm["backconfig"].empty()) {
         for(const auto &confpart :
                 vm["backconfig"].as<std::vector<std::string>>()) {
@@ -170,17 +314,33 @@ int main(int argc, char *argv[]) {
         return EXIT_SUCCESS;
     }
 
-    /* Load the proper backend. */
-    for(const auto &candidate : BackendManager::available_backends()) {
-        if(candidate.type_code == type_code) {
-            backend = candidate.creation_fn(ir_dir, output_path, backend_opts);
-            break;
+    ProfileSession profile(profile_path);
+
+    /* Load the proper backends.  Backends that change the target each work
+     * in an overlay of it, so that neither what they prepare nor what they
+     * create is in the target that other images, and the layer cache, are
+     * made from. */
+    for(std::size_t index = 0; index < outputs.size(); index++) {
+        Output &output = outputs[index];
+        for(const auto &candidate : BackendManager::available_backends()) {
+            if(candidate.type_code == output.type_code) {
+                output.modifies_target = candidate.modifies_target;
+                if(output.modifies_target) {
+                    output.overlay = ir_dir + "/overlay-" +
+                            std::to_string(index);
+                }
+                output.backend = candidate.creation_fn(
+                            output.overlay.empty() ? ir_dir : output.overlay,
+                            output.path, backend_opts);
+                break;
+            }
+        }
+        if(output.backend == nullptr) {
+            output_error("command-line", "unsupported backend or internal "
+                         "error", output.type_code);
+            exit_code = EXIT_FAILURE;
+            goto early_trouble;
         }
-    }
-    if(backend == nullptr) {
-        output_error("command-line", "unsupported backend or internal error",
-                     type_code);
-        return EXIT_FAILURE;
     }
 
     opts.set(Horizon::InstallEnvironment);
@@ -200,16 +360,34 @@ int main(int argc, char *argv[]) {
     } else {
         int ret;
 
-#define RUN_PHASE_OR_TROUBLE(_PHASE, _FRIENDLY) \
-    ret = backend->_PHASE();\
+#define RUN_PHASE(_OUTPUT, _PHASE) \
+    {\
+        ProfileSpan span("image", #_PHASE);\
+        span.set_detail((_OUTPUT).type_code + ":" + (_OUTPUT).path);\
+        ret = (_OUTPUT).backend->_PHASE();\
+    }
+
+#define RUN_PHASE_OR_TROUBLE(_OUTPUT, _PHASE, _FRIENDLY) \
+    RUN_PHASE(_OUTPUT, _PHASE)\
     if(ret != 0) {\
         output_error("internal", "error during output " _FRIENDLY,\
-                     std::to_string(ret));\
+                     (_OUTPUT).type_code + ": " + std::to_string(ret));\
         exit_code = EXIT_FAILURE;\
         goto trouble;\
     }
 
-        RUN_PHASE_OR_TROUBLE(prepare, "preparation");
+        /* Backends using an overlay keep their intermediate directory in
+         * the shared one, which a backend may clear while preparing. */
+        for(auto &output : outputs) {
+            if(output.overlay.empty()) {
+                RUN_PHASE_OR_TROUBLE(output, prepare, "preparation");
+            }
+        }
+        for(auto &output : outputs) {
+            if(!output.overlay.empty()) {
+                RUN_PHASE_OR_TROUBLE(output, prepare, "preparation");
+            }
+        }
 
         /* Attempt to make images work cross-architecture.
          * This requires binfmt_misc to be configured properly.
@@ -231,6 +409,11 @@ int main(int argc, char *argv[]) {
         }
 
         my_script->setTargetDirectory(ir_dir + "/target");
+        if(!pkg_cache.empty()) {
+            my_script->setPackageCache(pkg_cache,
+                    vm["package-cache-size"].as<std::uint64_t>() << 20);
+        }
+        if(!layer_cache.empty()) my_script->setLayerCache(layer_cache);
 
         if(!my_script->execute()) {
             exit_code = EXIT_FAILURE;
@@ -242,19 +425,61 @@ int main(int argc, char *argv[]) {
             fs::remove(ir_dir + "/target" + qpath, ec);
         }
 
-        RUN_PHASE_OR_TROUBLE(create, "creation");
-        RUN_PHASE_OR_TROUBLE(finalise, "finalisation");
+        /* The target is built once, and every image is created from it.
+         * Backends that leave the target alone read it at the same time,
+         * alongside the backends with overlays; those run one at a time, as
+         * they may change the working directory.  The system mounts are
+         * removed first, once, for every backend reading the target, and
+         * mounted again in each overlay. */
+        unmount_system(ir_dir + "/target");
+        {
+            std::vector<std::thread> creators;
+            for(auto &output : outputs) {
+                if(output.modifies_target) continue;
+                creators.emplace_back([&output] {
+                    int ret;
+                    RUN_PHASE(output, create);
+                    output.result = ret;
+                });
+            }
+            creators.emplace_back([&outputs, &ir_dir] {
+                for(auto &output : outputs) {
+                    if(output.overlay.empty()) continue;
+                    if(!mount_overlay(ir_dir, output.overlay)) {
+                        output.result = -1;
+                        continue;
+                    }
+                    mount_system(output.overlay + "/target");
+                    int ret;
+                    RUN_PHASE(output, create);
+                    output.result = ret;
+                    run_command("umount", {"-R", output.overlay + "/target"});
+                }
+            });
+            for(auto &creator : creators) creator.join();
+        }
+        for(auto &output : outputs) {
+            if(output.result != 0) {
+                output_error("internal", "error during output creation",
+                             output.type_code + ": " +
+                             std::to_string(output.result));
+                exit_code = EXIT_FAILURE;
+            }
+        }
+        if(exit_code != EXIT_SUCCESS) goto trouble;
+
+        for(auto &output : outputs) {
+            RUN_PHASE_OR_TROUBLE(output, finalise, "finalisation");
+        }
     }
 
 trouble:        /* delete the Script and exit */
     /* ensure that our target mounts are unmounted */
-    run_command("umount", {"-R", (ir_dir + "/target/sys")});
-    umount((ir_dir + "/target/proc").c_str());
-    run_command("umount", {"-R", (ir_dir + "/target/dev")});
+    unmount_system(ir_dir + "/target");
 
     delete my_script;
 early_trouble:  /* no script yet */
-    delete backend;
+    for(auto &output : outputs) delete output.backend;
 
     return exit_code;
 }
@@ -53,6 +53,19 @@ RSpec.describe 'HorizonScript Simulator', :type => :aruba do
             expect(last_command_started.stdout).to include("parted -ms /dev/sda mklabel msdos")
         end
     end
+    context "simulating 'partition' execution" do
+        it "creates partitions in numeric order" do
+            use_fixture '0264-partition-order.installfile'
+            run_simulate
+            expect(last_command_started).to have_output(/#9 on \/dev\/sdb.*#10 on \/dev\/sdb.*#11 on \/dev\/sdb/m)
+        end
+        it "orders Keys whose disk cannot be resolved after every earlier Key" do
+            use_fixture '0265-disk-unresolved.installfile'
+            run_simulate
+            expect(last_command_started.stdout).to include("# disk: partition on line 7 waits for lines 5, 6")
+            expect(last_command_started.stdout).to include("# disk: fs on line 8 waits for lines 5, 6, 7")
+        end
+    end
     context "simulating 'lvm_pv' execution" do
         it "creates a physical volume" do
             use_fixture '0163-lvmpv-basic.installfile'
@@ -154,21 +167,21 @@ printf '%s\\t%s\\t%s\\t%s\\t0\\t0\\n' /dev/gwyn/source /usr/src auto noatime >>
         it "installs grub-bios correctly" do
             use_fixture '0251-bootloader-x86bios.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("add grub-bios")
+            expect(last_command_started.stdout).to include("etc/apk/keys add adelie-base grub-bios")
             expect(last_command_started.stdout).to include("grub-install")
             expect(last_command_started.stdout).to include("/usr/sbin/update-boot")
         end
         it "installs grub-efi correctly" do
             use_fixture '0256-bootloader-arm64.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("add grub-efi")
+            expect(last_command_started.stdout).to include("etc/apk/keys add adelie-base grub-efi")
             expect(last_command_started.stdout).to include("grub-install")
             expect(last_command_started.stdout).to include("/usr/sbin/update-boot")
         end
         it "installs grub-ieee1275 correctly" do
             use_fixture '0255-bootloader-devonly.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("add grub-ieee1275")
+            expect(last_command_started.stdout).to include("etc/apk/keys add adelie-base grub-ieee1275")
             expect(last_command_started.stdout).to include("grub-install")
             expect(last_command_started.stdout).to include("/usr/sbin/update-boot")
         end
@@ -336,19 +349,24 @@ mtu 9001
         it "initialises the APK database" do
             use_fixture '0001-basic.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("apk --root /target --initdb --keys-dir etc/apk/keys add")
+            expect(last_command_started.stdout).to include("apk --root /target --initdb ")
         end
         # Runner.Execute.pkginstall
         it "updates the local repository cache" do
             use_fixture '0001-basic.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("apk --root /target --keys-dir etc/apk/keys update")
+            expect(last_command_started.stdout).to include("apk --root /target --initdb --update-cache ")
         end
         # Runner.Execute.pkginstall
         it "installs the requested packages" do
             use_fixture '0001-basic.installfile'
             run_simulate
-            expect(last_command_started.stdout).to include("apk --root /target --keys-dir etc/apk/keys add adelie-base")
+            expect(last_command_started.stdout).to include("--keys-dir etc/apk/keys add adelie-base\n")
+        end
+        it "installs every package in a single transaction" do
+            use_fixture '0251-bootloader-x86bios.installfile'
+            run_simulate
+            expect(last_command_started.stdout.scan("apk ").length).to eq 1
         end
     end
     context "simulating 'language' execution" do
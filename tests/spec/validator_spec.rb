@@ -45,6 +45,65 @@ RSpec.describe 'HorizonScript validation', :type => :aruba do
             expect(last_command_started).to have_output(/error: .*chat.* not defined/)
         end
     end
+    context "with a parse cache" do
+        it "loads an unchanged installfile from the cache" do
+            use_fixture '0001-basic.installfile'
+            run_validate ' -c cache'
+            expect(last_command_started).to_not have_output(/\(cached\)/)
+            run_validate ' -c cache'
+            expect(last_command_started).to have_output(/0 warning\(s\) \(cached\)/)
+            expect(last_command_started).to have_output(VALIDATOR_SUCCESS)
+        end
+        it "parses a changed installfile again" do
+            use_fixture '0001-basic.installfile'
+            run_validate ' -c cache'
+            use_fixture '0002-basic-commented.installfile'
+            run_validate ' -c cache'
+            expect(last_command_started).to have_output(PARSER_SUCCESS)
+            expect(last_command_started).to_not have_output(/\(cached\)/)
+        end
+        it "does not cache an installfile with warnings" do
+            use_fixture '0016-invalid-key.installfile'
+            run_validate ' -c cache'
+            run_validate ' -c cache'
+            expect(last_command_started).to have_output(/warning: .*chat.* not defined/)
+            expect(last_command_started).to_not have_output(/\(cached\)/)
+        end
+    end
+    context "with many installfiles" do
+        before(:each) do
+            copy '%/0001-basic.installfile', 'batch/one.installfile'
+            copy '%/0016-invalid-key.installfile', 'batch/two.installfile'
+        end
+        it "validates each installfile in turn" do
+            run_command 'hscript-validate batch/one.installfile batch/two.installfile'
+            expect(last_command_started).to have_output(/one.installfile: info: Script passed validation/)
+            expect(last_command_started).to have_output(/two.installfile: error: Script failed validation/)
+            expect(last_command_started).to have_output(/2 installfile\(s\): 1 passed, 1 failed/)
+        end
+        it "finds installfiles in a directory" do
+            run_command 'hscript-validate -J 2 batch'
+            expect(last_command_started).to have_output(/2 installfile\(s\): 1 passed, 1 failed/)
+        end
+        it "reads installfiles from a manifest" do
+            write_file 'manifest', "# comment\nbatch/one.installfile\n"
+            run_command 'hscript-validate -m manifest'
+            expect(last_command_started).to have_output(/1 installfile\(s\): 1 passed, 0 failed/)
+        end
+        it "writes a summary" do
+            run_command 'hscript-validate batch --summary -'
+            expect(last_command_started).to have_output(/^\{"files":2,"passed":1,"failed":1,"errors":2,"warnings":1,/)
+            expect(last_command_started).to have_output(/"file":"batch\/two.installfile","result":"validate-failed","errors":2,"warnings":1,/)
+        end
+    end
+    context "with JSON output" do
+        it "logs each message as a JSON object" do
+            use_fixture '0016-invalid-key.installfile'
+            run_validate ' --json'
+            expect(last_command_started).to have_output(/^\{"time":"[0-9T:.-]+Z","event":"log","where":"[^"]*:[0-9]+","type":"warning","message":"key 'chat' is not defined"\}$/)
+            expect(last_command_started).to have_output(/"type":"parser","message":"0 error\(s\), 1 warning\(s\)."/)
+        end
+    end
     context "parsing" do
         # obvious...
         it "successfully reads a basic installfile" do
@@ -73,10 +132,11 @@ RSpec.describe 'HorizonScript validation', :type => :aruba do
             expect(last_command_started).to have_output(/parser: 2 error\(s\)/)
         end
         # XXX: no requirement.
-        it "fails on lines over maximum line length" do
-            use_fixture '0017-line-too-long.installfile'
+        it "accepts lines of any length" do
+            use_fixture '0017-long-line.installfile'
             run_validate
-            expect(last_command_started).to have_output(/error: .*length/)
+            expect(last_command_started).to have_output(PARSER_SUCCESS)
+            expect(last_command_started).to have_output(VALIDATOR_SUCCESS)
         end
         context "required keys" do
             # Runner.Validate.Required.
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include "hscript/script.hh"
 #include "util/output.hh"
+#include "util/profile.hh"
 
 
 bool pretty = false;
@@ -22,7 +23,7 @@ int main(int argc, char *argv[]) {
     const Horizon::Script *my_script;
     Horizon::ScriptOptions opts;
     int result_code = EXIT_SUCCESS;
-    std::string installfile;
+    std::string installfile, profile_path;
     bool strict{}, needs_help{}, disable_pretty{}, version_only{};
     using Horizon::ScriptOptionFlags;
     using namespace boost::program_options;
@@ -42,7 +43,8 @@ int main(int argc, char *argv[]) {
         ("help,h", bool_switch(&needs_help), "Display this message.")
         ("version,v", bool_switch(&version_only), "Show program version information.")
         ("no-colour,n", bool_switch(&disable_pretty), "Do not 'prettify' output.")
-        ("strict,s", bool_switch(&strict), "Use strict parsing mode (enable more warnings/errors).");
+        ("strict,s", bool_switch(&strict), "Use strict parsing mode (enable more warnings/errors).")
+        ("profile", value<std::string>(&profile_path), "Write a timing profile of the simulation to this file, in Chrome trace format.");
     options_description cli;
     cli.add(cli_visible).add(cli_hidden);
     positional_options_description cli_pos;
@@ -75,6 +77,8 @@ int main(int argc, char *argv[]) {
         opts.set(ScriptOptionFlags::StrictMode);
     }
 
+    ProfileSession profile(profile_path);
+
     if(!isatty(1)) {
         std::cout << "#!/bin/sh" << std::endl << std::endl;
     }
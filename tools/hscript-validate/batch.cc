@@ -0,0 +1,284 @@
+/*
+ * batch.cc - Implementation of batch validation for the HorizonScript
+ * validator
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include "batch.hh"
+#include "util/filesystem.hh"
+#include "util/output.hh"
+
+
+/*! Determines if +path+ names an installfile, when searching a directory. */
+static bool is_installfile(const fs::path &path) {
+    const std::string name = path.filename().string();
+    const std::string suffix = ".installfile";
+    return name == "installfile" ||
+           (name.size() > suffix.size() &&
+            name.compare(name.size() - suffix.size(), suffix.size(),
+                         suffix) == 0);
+}
+
+/*! Read the installfiles listed in +stream+, one per line.
+ * Blank lines and lines starting with '#' are ignored. */
+static void read_manifest(std::istream &stream,
+                          std::vector<std::string> &files) {
+    std::string line;
+    while(std::getline(stream, line)) {
+        const std::string::size_type start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#') continue;
+        const std::string::size_type end = line.find_last_not_of(" \t\r");
+        files.push_back(line.substr(start, end - start + 1));
+    }
+}
+
+bool find_installfiles(const std::vector<std::string> &inputs,
+                       const std::string &manifest,
+                       std::vector<std::string> &files) {
+    bool success = true;
+
+    if(manifest == "-") {
+        read_manifest(std::cin, files);
+    } else if(!manifest.empty()) {
+        std::ifstream stream(manifest);
+        if(!stream) {
+            output_error(manifest, "Cannot open manifest");
+            success = false;
+        } else {
+            read_manifest(stream, files);
+        }
+    }
+
+    for(const auto &input : inputs) {
+        error_code ec;
+        if(!fs::is_directory(input, ec)) {
+            files.push_back(input);
+            continue;
+        }
+
+        std::vector<std::string> found;
+        for(fs::recursive_directory_iterator entry(input, ec), end;
+            !ec && entry != end; entry.increment(ec)) {
+            if(fs::is_regular_file(entry->path(), ec) &&
+               is_installfile(entry->path())) {
+                found.push_back(entry->path().string());
+            }
+        }
+        if(ec) {
+            output_error(input, "Cannot search directory", ec.message());
+            success = false;
+        }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    return success;
+}
+
+
+/*! The result of validating a single installfile. */
+struct BatchResult {
+    /*! The outcomes of validation. */
+    enum Outcome {
+        Passed,
+        ParseFailed,
+        ValidateFailed
+    };
+
+    /*! Whether the file has been validated. */
+    bool done = false;
+    /*! The outcome of validation. */
+    Outcome outcome = ParseFailed;
+    /*! The number of errors logged. */
+    unsigned int errors = 0;
+    /*! The number of warnings logged. */
+    unsigned int warnings = 0;
+    /*! The time taken to load the file, in milliseconds. */
+    double parse_ms = 0;
+    /*! The time taken to validate the file, in milliseconds. */
+    double validate_ms = 0;
+    /*! The messages logged, until they are output. */
+    std::vector<OutputMessage> messages;
+};
+
+/*! Retrieve the milliseconds elapsed from +start+ to +end+. */
+static double millis(std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/*! Load and validate +file+, collecting its messages in +result+. */
+static void validate_one(Horizon::ScriptLoader &loader,
+                         const std::string &file, BatchResult &result) {
+    using std::chrono::steady_clock;
+    CollectorSink collector;
+    {
+        OutputScope scope(collector);
+        const auto start = steady_clock::now();
+        const Horizon::Script *script = loader.load(file);
+        const auto loaded = steady_clock::now();
+        result.parse_ms = millis(start, loaded);
+
+        if(script == nullptr) {
+            output_error(file, "Could not load the specified script");
+            result.outcome = BatchResult::ParseFailed;
+        } else {
+            const bool valid = script->validate();
+            result.validate_ms = millis(loaded, steady_clock::now());
+            delete script;
+            if(valid) {
+                output_info(file, "Script passed validation.");
+                result.outcome = BatchResult::Passed;
+            } else {
+                output_error(file, "Script failed validation.");
+                result.outcome = BatchResult::ValidateFailed;
+            }
+        }
+    }
+
+    result.messages = collector.messages();
+    for(const auto &msg : result.messages) {
+        if(msg.kind != OutputMessage::Log) continue;
+        if(msg.type == "error") result.errors++;
+        else if(msg.type == "warning") result.warnings++;
+    }
+}
+
+/*! Retrieve the name of +outcome+, as used in the summary. */
+static const char *outcome_name(BatchResult::Outcome outcome) {
+    switch(outcome) {
+    case BatchResult::Passed:
+        return "passed";
+    case BatchResult::ParseFailed:
+        return "parse-failed";
+    case BatchResult::ValidateFailed:
+    default:
+        return "validate-failed";
+    }
+}
+
+/*! Write the summary of a batch as a JSON object. */
+static void write_summary(std::ostream &out,
+                          const std::vector<std::string> &files,
+                          const std::vector<BatchResult> &results,
+                          unsigned int jobs, double wall_ms) {
+    std::size_t passed = 0, errors = 0, warnings = 0;
+    double parse_ms = 0, validate_ms = 0;
+    std::string entries;
+    char number[32];
+
+    for(std::size_t index = 0; index < files.size(); index++) {
+        const BatchResult &result = results[index];
+        if(result.outcome == BatchResult::Passed) passed++;
+        errors += result.errors;
+        warnings += result.warnings;
+        parse_ms += result.parse_ms;
+        validate_ms += result.validate_ms;
+
+        if(index > 0) entries += ",";
+        entries += "{\"file\":";
+        JSONSink::quote(entries, files[index]);
+        entries += ",\"result\":\"";
+        entries += outcome_name(result.outcome);
+        entries += "\",\"errors\":" + std::to_string(result.errors) +
+                   ",\"warnings\":" + std::to_string(result.warnings);
+        std::snprintf(number, sizeof(number), "%.3f", result.parse_ms);
+        entries += ",\"parse_ms\":" + std::string(number);
+        std::snprintf(number, sizeof(number), "%.3f", result.validate_ms);
+        entries += ",\"validate_ms\":" + std::string(number) + "}";
+    }
+
+    out << "{\"files\":" << files.size()
+        << ",\"passed\":" << passed
+        << ",\"failed\":" << files.size() - passed
+        << ",\"errors\":" << errors
+        << ",\"warnings\":" << warnings
+        << ",\"jobs\":" << jobs;
+    std::snprintf(number, sizeof(number), "%.3f", wall_ms);
+    out << ",\"wall_ms\":" << number;
+    std::snprintf(number, sizeof(number), "%.3f", parse_ms);
+    out << ",\"parse_ms\":" << number;
+    std::snprintf(number, sizeof(number), "%.3f", validate_ms);
+    out << ",\"validate_ms\":" << number
+        << ",\"results\":[" << entries << "]}" << std::endl;
+}
+
+int validate_batch(const std::vector<std::string> &files,
+                   const BatchOptions &options) {
+    using std::chrono::steady_clock;
+    const auto start = steady_clock::now();
+    const unsigned int jobs = std::max(1u, static_cast<unsigned int>(
+            std::min<std::size_t>(options.jobs, files.size())));
+
+    /* Scripts inherited by many installfiles are only parsed once. */
+    Horizon::ScriptLoader loader(options.opts, options.cache);
+    std::vector<BatchResult> results(files.size());
+    std::atomic<std::size_t> next_file{0};
+    std::mutex lock;
+    std::condition_variable finished;
+
+    std::vector<std::thread> workers;
+    for(unsigned int job = 0; job < jobs; job++) {
+        workers.emplace_back([&]() {
+            std::size_t index;
+            while((index = next_file++) < files.size()) {
+                BatchResult result;
+                validate_one(loader, files[index], result);
+                result.done = true;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    results[index] = std::move(result);
+                }
+                finished.notify_one();
+            }
+        });
+    }
+
+    /* Output the messages of each file in order, as soon as they are
+     * available, so that the output does not depend on the job count. */
+    std::size_t failed = 0;
+    for(std::size_t index = 0; index < files.size(); index++) {
+        std::vector<OutputMessage> messages;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&]() { return results[index].done; });
+            messages.swap(results[index].messages);
+            if(results[index].outcome != BatchResult::Passed) failed++;
+        }
+        for(const auto &msg : messages) output_sink().write(msg);
+    }
+    for(auto &worker : workers) worker.join();
+
+    const double wall_ms = millis(start, steady_clock::now());
+    output_info("batch", std::to_string(files.size()) + " installfile(s): " +
+                std::to_string(files.size() - failed) + " passed, " +
+                std::to_string(failed) + " failed.");
+
+    if(options.summary == "-") {
+        write_summary(std::cout, files, results, jobs, wall_ms);
+    } else if(!options.summary.empty()) {
+        std::ofstream out(options.summary, std::ios_base::trunc);
+        write_summary(out, files, results, jobs, wall_ms);
+        if(!out) {
+            output_error(options.summary, "Cannot write summary");
+            return EXIT_FAILURE;
+        }
+    }
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
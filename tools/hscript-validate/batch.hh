@@ -0,0 +1,49 @@
+/*
+ * batch.hh - Definition of batch validation for the HorizonScript validator
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef HSCRIPT_VALIDATE_BATCH_HH_
+#define HSCRIPT_VALIDATE_BATCH_HH_
+
+#include <string>
+#include <vector>
+#include "hscript/script.hh"
+
+/*! Options for validating many installfiles at once. */
+struct BatchOptions {
+    /*! Options to use for parsing and validation. */
+    Horizon::ScriptOptions opts;
+    /*! The directory of the parse cache, or empty. */
+    std::string cache;
+    /*! The number of installfiles to validate at once. */
+    unsigned int jobs;
+    /*! The path to which the summary is written, "-" for standard output,
+     * or empty for no summary. */
+    std::string summary;
+};
+
+/*! Find the installfiles to validate.
+ * @param inputs    Installfiles, and directories to search for installfiles.
+ * @param manifest  A file listing installfiles one per line, "-" to read the
+ *                  list from standard input, or empty.
+ * @param files     Output variable: the installfiles found.
+ * @returns true if every input could be read, false otherwise.
+ */
+bool find_installfiles(const std::vector<std::string> &inputs,
+                       const std::string &manifest,
+                       std::vector<std::string> &files);
+
+/*! Validate +files+, logging the messages of each file in turn.
+ * @returns EXIT_SUCCESS if every file is valid, EXIT_FAILURE otherwise.
+ */
+int validate_batch(const std::vector<std::string> &files,
+                   const BatchOptions &options);
+
+#endif /* !HSCRIPT_VALIDATE_BATCH_HH_ */
@@ -10,9 +10,12 @@
  */
 
 #include <boost/program_options.hpp>
+#include <thread>
 #include <unistd.h>
 #include "hscript/script.hh"
+#include "util/filesystem.hh"
 #include "util/output.hh"
+#include "batch.hh"
 
 
 bool pretty = false;
@@ -22,9 +25,11 @@ int main(int argc, char *argv[]) {
     const Horizon::Script *my_script;
     Horizon::ScriptOptions opts;
     int result_code = EXIT_SUCCESS;
-    std::string installfile;
+    std::string installfile, cache, manifest, summary;
+    std::vector<std::string> installfiles;
+    unsigned int jobs = std::max(1u, std::thread::hardware_concurrency());
     bool install{}, keep_going{}, strict{}, needs_help{}, version_only{},
-         dont_pretty{};
+         dont_pretty{}, json{};
     using Horizon::ScriptOptionFlags;
     using namespace boost::program_options;
 
@@ -35,15 +40,20 @@ int main(int argc, char *argv[]) {
 
     options_description cli_hidden;
     cli_hidden.add_options()
-        ("installfile", "Installfile to load");
+        ("installfile", value<std::vector<std::string>>(&installfiles), "Installfiles to load");
     options_description cli_visible("Allowed options");
     cli_visible.add_options()
         ("help,h", bool_switch(&needs_help), "Display this message.")
+        ("cache,c", value<std::string>(&cache), "Cache parsed scripts in the specified directory.")
         ("version,v", bool_switch(&version_only), "Show program version information.")
         ("install,i", bool_switch(&install), "Set Installation Environment flag. (DANGEROUS!)")
+        ("jobs,J", value<unsigned int>(&jobs), "Validate this many installfiles at once.")
+        ("json,j", bool_switch(&json), "Log messages as JSON objects, one per line.")
         ("keep-going,k", bool_switch(&keep_going), "Continue parsing after errors.")
+        ("manifest,m", value<std::string>(&manifest), "Validate the installfiles listed in the specified file.")
         ("no-colour,n", bool_switch(&dont_pretty), "Do not 'prettify' output.")
-        ("strict,s", bool_switch(&strict), "Use strict parsing mode (enable more warnings/errors).");
+        ("strict,s", bool_switch(&strict), "Use strict parsing mode (enable more warnings/errors).")
+        ("summary", value<std::string>(&summary), "Write a JSON summary of a batch to the specified file.");
     options_description cli;
     cli.add(cli_visible).add(cli_hidden);
     positional_options_description cli_pos;
@@ -80,6 +90,10 @@ int main(int argc, char *argv[]) {
     if(strict) {
         opts.set(ScriptOptionFlags::StrictMode);
     }
+    JSONSink json_sink;
+    if(json) {
+        set_output_sink(&json_sink);
+    }
 
     bold_if_pretty(std::cout);
     std::cout << "HorizonScript Validation Utility version " << VERSTR;
@@ -102,14 +116,32 @@ int main(int argc, char *argv[]) {
         return EXIT_SUCCESS;
     }
 
-    if(args.count("installfile")) {
-        installfile = args["installfile"].as<std::string>();
+    /* Validate many installfiles at once if asked to, or if more than one
+     * is given. */
+    error_code ec;
+    if(!manifest.empty() || installfiles.size() > 1 || args.count("jobs") ||
+       !summary.empty() ||
+       (installfiles.size() == 1 && fs::is_directory(installfiles[0], ec))) {
+        std::vector<std::string> files;
+        if(!find_installfiles(installfiles, manifest, files)) {
+            return EXIT_FAILURE;
+        }
+        if(files.empty()) {
+            output_error("batch", "No installfiles were found");
+            return EXIT_FAILURE;
+        }
+        return validate_batch(files, {opts, cache, std::max(1u, jobs),
+                                      summary});
+    }
+
+    if(installfiles.size() == 1) {
+        installfile = installfiles[0];
     } else {
         output_error("<stdin>", "You must specify an installfile");
         return EXIT_FAILURE;
     }
 
-    my_script = Horizon::Script::load(installfile, opts);
+    my_script = Horizon::Script::load(installfile, opts, cache);
     if(my_script == nullptr) {
         output_error(installfile, "Could not load the specified script");
         return EXIT_FAILURE;
@@ -16,7 +16,7 @@
 #include <set>
 #include <string>
 
-const std::set<std::string> valid_keymaps = {
+const std::set<std::string, std::less<>> valid_keymaps = {
     "us", "ad", "af", "ara", "al", "am", "at", "az", "by", "be", "bd", "in",
     "ba", "br", "bg", "ma", "mm", "ca", "cd", "cn", "hr", "cz", "dk", "nl",
     "bt", "ee", "ir", "iq", "fo", "fi", "fr", "gh", "gn", "ge", "de", "gr",
@@ -18,7 +18,9 @@ extern bool pretty;
 #include <string>
 #include <iostream>
 #include <chrono>
-#include <iomanip>
+#include <ctime>
+#include <mutex>
+#include <vector>
 
 #include <hscript/script_l.hh>
 
@@ -44,31 +46,331 @@ inline void reset_if_pretty(std::ostream &stream) {
     if(pretty) stream << "\033[0m";
 }
 
-/*! Print the ISO 8601 timestamp with millisecond resolution.
+/*! A message logged by the output routines. */
+struct OutputMessage {
+    /*! The kinds of message. */
+    enum Kind {
+        /*! A log message. */
+        Log,
+        /*! A step is beginning execution. */
+        StepStart,
+        /*! A step is finishing execution. */
+        StepEnd
+    };
+
+    /*! The kind of message. */
+    Kind kind;
+    /*! The time at which the message was logged. */
+    std::chrono::system_clock::time_point when;
+    /*! The type of a log message ("error", "warning", ...). */
+    std::string type;
+    /*! The ANSI colour code of the type of a log message. */
+    std::string colour;
+    /*! The location that triggered a log message. */
+    std::string where;
+    /*! The message, or the name of the step. */
+    std::string message;
+    /*! Additional detail for a log message, if available. */
+    std::string detail;
+};
+
+
+/*! Receives the messages logged by the output routines.
+ * Sinks may be shared between threads, and must lock accordingly.
+ */
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+    /*! Receive +msg+. */
+    virtual void write(const OutputMessage &msg) = 0;
+    /*! Write out any messages that have been buffered. */
+    virtual void flush() {}
+};
+
+
+/*! Formats ISO 8601 timestamps with millisecond resolution.
+ * The date and time are only formatted again when the second changes.
  * @note See Agent.MessageFormat.
  */
-inline void output_time() {
-    using namespace std::chrono;
-    auto now = system_clock::now();
-    auto millis = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
-    auto time = system_clock::to_time_t(now);
-    std::tm utc = *std::gmtime(&time);
-    std::cerr << std::put_time(&utc, "%FT%T") << ".";
-    std::cerr << std::setfill('0') << std::setw(3) << millis.count();
+class OutputClock {
+private:
+    std::time_t _last = -1;
+    char _stamp[24];
+public:
+    /*! Append the timestamp for +when+ to +out+. */
+    void format(std::string &out, std::chrono::system_clock::time_point when) {
+        using namespace std::chrono;
+        const auto millis = duration_cast<milliseconds>(
+                    when.time_since_epoch()).count();
+        std::time_t time = static_cast<std::time_t>(millis / 1000);
+        if(millis % 1000 < 0) time--;
+        if(time != _last) {
+            std::tm utc;
+            gmtime_r(&time, &utc);
+            std::strftime(_stamp, sizeof(_stamp), "%FT%T", &utc);
+            _last = time;
+        }
+        const int ms = static_cast<int>((millis % 1000 + 1000) % 1000);
+        out += _stamp;
+        out += '.';
+        out += static_cast<char>('0' + ms / 100);
+        out += static_cast<char>('0' + ms / 10 % 10);
+        out += static_cast<char>('0' + ms % 10);
+    }
+};
+
+
+/*! The amount of output a buffered StreamSink holds before writing it. */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*! Base class for sinks that format messages to a stream.
+ * Each message is formatted completely before it is written, so messages
+ * from different threads are never interleaved.  A buffered sink writes
+ * only when OUTPUT_BUFFER_SIZE is reached, when flushed, or when destroyed.
+ */
+class StreamSink : public OutputSink {
+private:
+    std::mutex _lock;
+    std::ostream &_stream;
+    std::string _buffer;
+    bool _buffered;
+
+    void flush_locked() {
+        if(_buffer.empty()) return;
+        _stream.write(_buffer.data(),
+                      static_cast<std::streamsize>(_buffer.size()));
+        _stream.flush();
+        _buffer.clear();
+    }
+protected:
+    /*! Formats the timestamps of messages. */
+    OutputClock clock;
+    /*! Append +msg+, formatted, to +out+. */
+    virtual void format(std::string &out, const OutputMessage &msg) = 0;
+public:
+    StreamSink(std::ostream &stream, bool buffered) : _stream{stream},
+        _buffered{buffered} {}
+    ~StreamSink() override { flush(); }
+
+    void write(const OutputMessage &msg) override {
+        std::lock_guard<std::mutex> guard(_lock);
+        format(_buffer, msg);
+        if(!_buffered || _buffer.size() >= OUTPUT_BUFFER_SIZE) flush_locked();
+    }
+    void flush() override {
+        std::lock_guard<std::mutex> guard(_lock);
+        flush_locked();
+    }
+};
+
+
+/*! Writes messages in the tab-separated Agent.MessageFormat.
+ * This is the default sink.
+ */
+class TextSink : public StreamSink {
+private:
+    const bool *_colour;
+protected:
+    void format(std::string &out, const OutputMessage &msg) override {
+        clock.format(out, msg.when);
+        switch(msg.kind) {
+        case OutputMessage::StepStart:
+            out += "\tstep-start\t" + msg.message + "\n";
+            return;
+        case OutputMessage::StepEnd:
+            out += "\tstep-end\t" + msg.message + "\n";
+            return;
+        case OutputMessage::Log:
+            break;
+        }
+        const bool colour = _colour != nullptr && *_colour;
+        out += "\tlog\t" + msg.where + ": ";
+        if(colour) out += "\033[" + msg.colour + ";1m";
+        out += msg.type + ": ";
+        if(colour) out += "\033[0;1m";
+        out += msg.message;
+        if(colour) out += "\033[0m";
+        if(!msg.detail.empty()) out += ": " + msg.detail;
+        out += '\n';
+    }
+public:
+    /*! Create a TextSink.
+     * @param stream    The stream to which messages are written.
+     * @param colour    If not nullptr, messages are coloured while it is true.
+     * @param buffered  Whether to buffer messages.
+     */
+    explicit TextSink(std::ostream &stream = std::cerr,
+                      const bool *colour = &pretty, bool buffered = false) :
+        StreamSink{stream, buffered}, _colour{colour} {}
+};
+
+
+/*! Writes messages as JSON objects, one per line. */
+class JSONSink : public StreamSink {
+public:
+    /*! Append +str+ to +out+ as a JSON string. */
+    static void quote(std::string &out, const std::string &str) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for(unsigned char c : str) {
+            switch(c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(c < 0x20) {
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xF];
+                } else {
+                    out += static_cast<char>(c);
+                }
+            }
+        }
+        out += '"';
+    }
+protected:
+    void format(std::string &out, const OutputMessage &msg) override {
+        out += "{\"time\":\"";
+        clock.format(out, msg.when);
+        out += "Z\",\"event\":";
+        switch(msg.kind) {
+        case OutputMessage::StepStart:
+        case OutputMessage::StepEnd:
+            out += msg.kind == OutputMessage::StepStart ? "\"step-start\"" :
+                                                          "\"step-end\"";
+            out += ",\"step\":";
+            quote(out, msg.message);
+            out += "}\n";
+            return;
+        case OutputMessage::Log:
+            break;
+        }
+        out += "\"log\",\"where\":";
+        quote(out, msg.where);
+        out += ",\"type\":";
+        quote(out, msg.type);
+        out += ",\"message\":";
+        quote(out, msg.message);
+        if(!msg.detail.empty()) {
+            out += ",\"detail\":";
+            quote(out, msg.detail);
+        }
+        out += "}\n";
+    }
+public:
+    /*! Create a JSONSink.
+     * @param stream    The stream to which messages are written.
+     * @param buffered  Whether to buffer messages.
+     */
+    explicit JSONSink(std::ostream &stream = std::cerr, bool buffered = false) :
+        StreamSink{stream, buffered} {}
+};
+
+
+/*! Collects messages in memory. */
+class CollectorSink : public OutputSink {
+private:
+    mutable std::mutex _lock;
+    std::vector<OutputMessage> _messages;
+public:
+    void write(const OutputMessage &msg) override {
+        std::lock_guard<std::mutex> guard(_lock);
+        _messages.push_back(msg);
+    }
+
+    /*! Retrieve the messages collected so far. */
+    std::vector<OutputMessage> messages() const {
+        std::lock_guard<std::mutex> guard(_lock);
+        return _messages;
+    }
+    /*! Discard the messages collected so far. */
+    void clear() {
+        std::lock_guard<std::mutex> guard(_lock);
+        _messages.clear();
+    }
+    /*! Write the messages collected so far to +sink+, and discard them. */
+    void replay(OutputSink &sink) {
+        std::lock_guard<std::mutex> guard(_lock);
+        for(const auto &msg : _messages) sink.write(msg);
+        _messages.clear();
+    }
+};
+
+
+/*! The default sink, which writes text to std::cerr. */
+inline TextSink &default_output_sink() {
+    static TextSink text;
+    return text;
+}
+
+/*! The sink used by threads without an OutputScope. */
+inline OutputSink *&process_output_sink() {
+    static OutputSink *sink = &default_output_sink();
+    return sink;
+}
+
+/*! The sink of the current thread's innermost OutputScope, if any. */
+inline thread_local OutputSink *thread_output_sink = nullptr;
+
+/*! Retrieve the sink for messages logged by the current thread. */
+inline OutputSink &output_sink() {
+    if(thread_output_sink != nullptr) return *thread_output_sink;
+    return *process_output_sink();
+}
+
+/*! Set the sink used by threads without an OutputScope.
+ * This must be done before any other thread logs a message.
+ * @param sink      The new sink, or nullptr for the default TextSink.
+ */
+inline void set_output_sink(OutputSink *sink) {
+    process_output_sink()->flush();
+    process_output_sink() = sink != nullptr ? sink : &default_output_sink();
 }
 
+/*! The location of the Key the current thread is executing, if any. */
+inline thread_local std::string output_location;
+
+/*! Sets the location of the Key the current thread is executing, for as
+ * long as the scope exists. */
+class LocationScope {
+private:
+    std::string _previous;
+public:
+    explicit LocationScope(const std::string &where) :
+        _previous{output_location} { output_location = where; }
+    ~LocationScope() { output_location = std::move(_previous); }
+    LocationScope(const LocationScope &) = delete;
+    LocationScope &operator=(const LocationScope &) = delete;
+};
+
+/*! Sends the messages logged by the current thread to a sink, for as long as
+ * the scope exists. */
+class OutputScope {
+private:
+    OutputSink *_previous;
+public:
+    explicit OutputScope(OutputSink &sink) :
+        _previous{thread_output_sink} { thread_output_sink = &sink; }
+    ~OutputScope() { thread_output_sink = _previous; }
+    OutputScope(const OutputScope &) = delete;
+    OutputScope &operator=(const OutputScope &) = delete;
+};
+
+
 /*! Outputs that +step+ is beginning execution. */
 inline void output_step_start(const std::string &step) {
-    output_time();
-    std::cerr << "\tstep-start\t";
-    std::cerr << step << std::endl;
+    output_sink().write({OutputMessage::StepStart,
+                         std::chrono::system_clock::now(), "", "", "", step,
+                         ""});
 }
 
 /*! Outputs that +step+ is finishing execution. */
 inline void output_step_end(const std::string &step) {
-    output_time();
-    std::cerr << "\tstep-end\t";
-    std::cerr << step << std::endl;
+    output_sink().write({OutputMessage::StepEnd,
+                         std::chrono::system_clock::now(), "", "", "", step,
+                         ""});
 }
 
 /*! Outputs a message of the specified +type+ to the log stream.
@@ -81,18 +383,8 @@ inline void output_step_end(const std::string &step) {
 inline void output_log(const std::string &type, const std::string &colour,
                        const std::string &where, const std::string &message,
                        const std::string &detail = "") {
-    output_time();
-    std::cerr << "\tlog\t";
-    std::cerr << where << ": ";
-    colour_if_pretty(std::cerr, colour);
-    std::cerr << type << ": ";
-    bold_if_pretty(std::cerr);
-    std::cerr << message;
-    reset_if_pretty(std::cerr);
-    if(!detail.empty()) {
-        std::cerr << ": " << detail;
-    }
-    std::cerr << std::endl;
+    output_sink().write({OutputMessage::Log, std::chrono::system_clock::now(),
+                         type, colour, where, message, detail});
 }
 
 /*! Outputs an error message.
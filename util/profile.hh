@@ -0,0 +1,308 @@
+/*
+ * profile.hh - Timing profile routines
+ * util, the utility library for
+ * Project Horizon
+ *
+ * Copyright (c) 2020 Adélie Linux and contributors.  All rights reserved.
+ * This code is licensed under the AGPL 3.0 license, as noted in the
+ * LICENSE-code file in the root directory of this repository.
+ *
+ * SPDX-License-Identifier: AGPL-3.0-only
+ */
+
+#ifndef __HORIZON_PROFILE_HH_
+#define __HORIZON_PROFILE_HH_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>   /* getrusage, struct rusage */
+#include <sys/time.h>       /* struct timeval */
+
+#include "output.hh"
+
+/*! One event of a timing profile. */
+struct ProfileEvent {
+    /*! The Chrome trace phase: 'X' for a span, 'B' or 'E' for the beginning
+     * or end of a step. */
+    char phase;
+    /*! The kind of event ("step", "key", "process", ...). */
+    std::string category;
+    /*! The name of the event, such as the key or command. */
+    std::string name;
+    /*! The location in the script that caused the event, if any. */
+    std::string where;
+    /*! Additional detail, such as the arguments of a command. */
+    std::string detail;
+    /*! The time at which the event began. */
+    std::chrono::steady_clock::time_point start;
+    /*! The length of a span. */
+    std::chrono::steady_clock::duration length{};
+    /*! The number of the thread that recorded the event. */
+    unsigned int thread = 0;
+    /*! Whether the resource usage below was measured. */
+    bool has_usage = false;
+    /*! The user and system CPU time used, in microseconds. */
+    std::int64_t user_us = 0, sys_us = 0;
+    /*! The peak resident set size of a child process, in KiB. */
+    std::int64_t max_rss_kb = 0;
+    /*! The bytes written to storage. */
+    std::uint64_t bytes_written = 0;
+};
+
+
+/*! Collects the events of a timing profile, and writes them in the Chrome
+ * trace event format, which chrome://tracing and Perfetto can display.
+ * Events may be recorded from any thread.
+ */
+class Profiler {
+private:
+    mutable std::mutex _lock;
+    std::vector<ProfileEvent> _events;
+    const std::chrono::steady_clock::time_point _origin{
+        std::chrono::steady_clock::now()};
+
+    /*! Append the microseconds in +length+ to +out+. */
+    static void micros(std::string &out,
+                       std::chrono::steady_clock::duration length) {
+        using namespace std::chrono;
+        out += std::to_string(duration_cast<microseconds>(length).count());
+    }
+public:
+    /*! Record +event+. */
+    void record(ProfileEvent event) {
+        std::lock_guard<std::mutex> guard(_lock);
+        _events.push_back(std::move(event));
+    }
+
+    /*! Write the events recorded so far to +out+ as a Chrome trace. */
+    void write(std::ostream &out) const {
+        std::lock_guard<std::mutex> guard(_lock);
+        std::string trace = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for(const auto &event : _events) {
+            trace += first ? "\n" : ",\n";
+            first = false;
+            trace += "{\"ph\":\"";
+            trace += event.phase;
+            trace += "\",\"cat\":";
+            JSONSink::quote(trace, event.category);
+            trace += ",\"name\":";
+            JSONSink::quote(trace, event.name);
+            trace += ",\"pid\":1,\"tid\":" + std::to_string(event.thread);
+            trace += ",\"ts\":";
+            micros(trace, event.start - _origin);
+            if(event.phase == 'X') {
+                trace += ",\"dur\":";
+                micros(trace, event.length);
+            }
+            trace += ",\"args\":{";
+            std::string args;
+            if(!event.where.empty()) {
+                args += ",\"where\":";
+                JSONSink::quote(args, event.where);
+            }
+            if(!event.detail.empty()) {
+                args += ",\"detail\":";
+                JSONSink::quote(args, event.detail);
+            }
+            if(event.has_usage) {
+                args += ",\"user_us\":" + std::to_string(event.user_us) +
+                        ",\"sys_us\":" + std::to_string(event.sys_us);
+                if(event.max_rss_kb != 0) {
+                    args += ",\"max_rss_kb\":" +
+                            std::to_string(event.max_rss_kb);
+                }
+            }
+            if(event.has_usage || event.bytes_written != 0) {
+                args += ",\"bytes_written\":" +
+                        std::to_string(event.bytes_written);
+            }
+            if(!args.empty()) trace.append(args, 1, std::string::npos);
+            trace += "}}";
+        }
+        trace += "\n]}\n";
+        out << trace;
+    }
+
+    /*! Write the events recorded so far to the file at +path+.
+     * @returns true if the profile was written, false otherwise.
+     */
+    bool save(const std::string &path) const {
+        std::ofstream out(path);
+        write(out);
+        out.close();
+        if(!out) {
+            output_error(path, "cannot write profile");
+            return false;
+        }
+        return true;
+    }
+};
+
+
+/*! The profile that events are recorded to, or nullptr. */
+inline std::atomic<Profiler *> &active_profiler() {
+    static std::atomic<Profiler *> profiler{nullptr};
+    return profiler;
+}
+
+/*! Record events to +profiler+, or stop recording if it is nullptr.
+ * This must be done before any other thread records an event.
+ */
+inline void set_profiler(Profiler *profiler) {
+    active_profiler() = profiler;
+}
+
+/*! The number of the current thread in a profile, starting from 1. */
+inline unsigned int profile_thread() {
+    static std::atomic<unsigned int> next{1};
+    thread_local const unsigned int number = next++;
+    return number;
+}
+
+/*! Times an operation, from its construction until its destruction.
+ * Nothing is measured unless a profile is active.  Spans created without a
+ * location, such as for the commands that a Key runs, take the location of
+ * the Key the thread is executing.
+ */
+class ProfileSpan {
+private:
+    Profiler *_profiler;
+    ProfileEvent _event;
+    bool _own_usage = false;
+    struct rusage _usage;
+
+    static std::int64_t micros(const struct timeval &time) {
+        return static_cast<std::int64_t>(time.tv_sec) * 1000000 +
+                time.tv_usec;
+    }
+public:
+    /*! Begin timing.
+     * @param category  The kind of operation.
+     * @param name      The name of the operation.
+     * @param where     The location in the script that caused it, if any.
+     */
+    ProfileSpan(const std::string &category, const std::string &name,
+                const std::string &where = "") :
+            _profiler{active_profiler()} {
+        if(_profiler == nullptr) return;
+        _event.phase = 'X';
+        _event.category = category;
+        _event.name = name;
+        _event.where = where.empty() ? output_location : where;
+        _event.thread = profile_thread();
+#ifdef RUSAGE_THREAD
+        _own_usage = (getrusage(RUSAGE_THREAD, &_usage) == 0);
+#endif
+        _event.start = std::chrono::steady_clock::now();
+    }
+
+    /*! Finish timing, and record the operation. */
+    ~ProfileSpan() {
+        if(_profiler == nullptr) return;
+        _event.length = std::chrono::steady_clock::now() - _event.start;
+#ifdef RUSAGE_THREAD
+        struct rusage usage;
+        if(_own_usage && !_event.has_usage &&
+           getrusage(RUSAGE_THREAD, &usage) == 0) {
+            _event.has_usage = true;
+            _event.user_us = micros(usage.ru_utime) -
+                    micros(_usage.ru_utime);
+            _event.sys_us = micros(usage.ru_stime) - micros(_usage.ru_stime);
+            _event.bytes_written += static_cast<std::uint64_t>(
+                        usage.ru_oublock - _usage.ru_oublock) * 512;
+        }
+#endif
+        _profiler->record(std::move(_event));
+    }
+
+    ProfileSpan(const ProfileSpan &) = delete;
+    ProfileSpan &operator=(const ProfileSpan &) = delete;
+
+    /*! Whether the operation is being timed. */
+    bool active() const { return _profiler != nullptr; }
+
+    /*! Describe the operation further, such as with a command line. */
+    void set_detail(const std::string &detail) {
+        if(_profiler != nullptr) _event.detail = detail;
+    }
+
+    /*! Record the resources used by the child process that performed the
+     * operation, as returned by wait4. */
+    void set_child_usage(const struct rusage &usage) {
+        if(_profiler == nullptr) return;
+        _event.has_usage = true;
+        _event.user_us = micros(usage.ru_utime);
+        _event.sys_us = micros(usage.ru_stime);
+        _event.max_rss_kb = usage.ru_maxrss;
+        _event.bytes_written += static_cast<std::uint64_t>(
+                    usage.ru_oublock) * 512;
+    }
+
+    /*! Record +bytes+ written to storage by the operation. */
+    void add_bytes_written(std::uint64_t bytes) {
+        if(_profiler != nullptr) _event.bytes_written += bytes;
+    }
+};
+
+
+/*! Passes messages on to another sink, recording the beginning and end of
+ * each step in the active profile. */
+class ProfileSink : public OutputSink {
+private:
+    OutputSink &_next;
+public:
+    explicit ProfileSink(OutputSink &next) : _next{next} {}
+
+    void write(const OutputMessage &msg) override {
+        Profiler *profiler = active_profiler();
+        if(profiler != nullptr && msg.kind != OutputMessage::Log) {
+            ProfileEvent event;
+            event.phase = (msg.kind == OutputMessage::StepStart) ? 'B' : 'E';
+            event.category = "step";
+            event.name = msg.message;
+            event.thread = profile_thread();
+            event.start = std::chrono::steady_clock::now();
+            profiler->record(std::move(event));
+        }
+        _next.write(msg);
+    }
+    void flush() override { _next.flush(); }
+};
+
+
+/*! Records a profile of the program for as long as it exists, and then
+ * writes it to a file.  Nothing is recorded if no file is given.
+ */
+class ProfileSession {
+private:
+    const std::string _path;
+    Profiler _profiler;
+    OutputSink &_previous;
+    ProfileSink _sink;
+public:
+    /*! Begin recording a profile to be written to +path+, if not empty. */
+    explicit ProfileSession(const std::string &path) : _path{path},
+            _previous{*process_output_sink()}, _sink{_previous} {
+        if(_path.empty()) return;
+        set_profiler(&_profiler);
+        set_output_sink(&_sink);
+    }
+    /*! Stop recording, and write the profile. */
+    ~ProfileSession() {
+        if(_path.empty()) return;
+        set_output_sink(&_previous);
+        set_profiler(nullptr);
+        _profiler.save(_path);
+    }
+    ProfileSession(const ProfileSession &) = delete;
+    ProfileSession &operator=(const ProfileSession &) = delete;
+};
+
+#endif /* !__HORIZON_PROFILE_HH_ */